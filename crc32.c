@@ -0,0 +1,97 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * CRC-32, table driven ("slicing-by-8") or with the ARMv8 CRC extension
+ **********************************************************************/
+
+#include "portable_endian.h"
+#include "crc32.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+
+/* the ARMv8 CRC32 instructions use the same (reflected) polynomial */
+uint32_t crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t data;
+
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&data, p, 8);
+		crc = __crc32d(crc, le64toh(data));
+	}
+	while (len--)
+		crc = __crc32b(crc, *p++);
+	return ~crc;
+}
+
+#else
+
+#define CRC32_POLY	0xEDB88320	/* bit-reversed 0x04C11DB7 */
+
+/*
+ * table[0] is the classic byte-wise table, table[k] advances the CRC of a
+ * byte by another k zero bytes. That allows processing 8 bytes at a time,
+ * with independent lookups. Built once, at the first use.
+ */
+static uint32_t table[8][256];
+static bool table_ready;
+
+static void crc32_init(void)
+{
+	uint32_t i, k, crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+		table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8)
+				      ^ table[0][table[k - 1][i] & 0xFF];
+	table_ready = true;
+}
+
+uint32_t crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t lo, hi;
+
+	if (!table_ready)
+		crc32_init();
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo = le32toh(lo) ^ crc;
+		hi = le32toh(hi);
+		crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF]
+		    ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24]
+		    ^ table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF]
+		    ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+	}
+	while (len--)
+		crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+#endif /* __ARM_FEATURE_CRC32 */
@@ -17,7 +17,14 @@
 
 #include "common.h"
 #include "portable_endian.h"
+#include "crc32.h"
 #include "fel_lib.h"
+#include "fel_bundle.h"
+#include "fel_dump.h"
+#include "fel_metrics.h"
+#include "fel_sparse.h"
+#include "fel_spiflash.h"
+#include "file_io.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -29,9 +36,14 @@
 #include <time.h>
 #include <sys/stat.h>
 
+#include "script.h"
+#include "script_bin.h"
+#include "script_fex.h"
+
 static bool verbose = false; /* If set, makes the 'fel' tool more talkative */
 static uint32_t uboot_entry = 0; /* entry point (address) of U-Boot */
 static uint32_t uboot_size  = 0; /* size of U-Boot binary */
+static bool sparse_upload = false; /* "write" skips constant data via fill thunk */
 
 /* printf-style output, but only if "verbose" flag is active */
 #define pr_info(...) \
@@ -96,8 +108,7 @@ void aw_fel_print_version(feldev_handle *dev)
  * an already loaded U-Boot binary.
  * The return value represents elapsed time in seconds (needed for execution).
  */
-double aw_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
-		       size_t len, bool progress)
+static void check_uboot_overlap(uint32_t offset, size_t len)
 {
 	/* safeguard against overwriting an already loaded U-Boot binary */
 	if (uboot_size > 0 && offset <= uboot_entry + uboot_size
@@ -106,6 +117,12 @@ double aw_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
 			 "Request 0x%08X-0x%08X overlaps 0x%08X-0x%08X.\n",
 			 offset, (uint32_t)(offset + len),
 			 uboot_entry, uboot_entry + uboot_size);
+}
+
+double aw_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
+		       size_t len, bool progress)
+{
+	check_uboot_overlap(offset, len);
 
 	double start = gettime();
 	aw_fel_write_buffer(dev, buf, offset, len, progress);
@@ -148,51 +165,25 @@ unsigned int file_size(const char *filename)
 	return st.st_size;
 }
 
-int save_file(const char *name, void *data, size_t size)
+/* map or read a whole file ("-" = stdin), exiting on failure */
+static void load_file(file_buffer *buf, const char *name)
 {
-	FILE *out = fopen(name, "wb");
-	int rc;
-	if (!out) {
-		perror("Failed to open output file");
-		exit(1);
-	}
-	rc = fwrite(data, size, 1, out);
-	fclose(out);
-	return rc;
+	if (!file_load(buf, name))
+		pr_fatal("Failed to load \"%s\": %s\n", name, strerror(errno));
 }
 
-void *load_file(const char *name, size_t *size)
+/* open an output file ("-" = stdout), exiting on failure */
+static void open_output(file_stream *out, const char *name)
 {
-	size_t offset = 0, bufsize = 8192;
-	char *buf = malloc(bufsize);
-	FILE *in;
-	if (strcmp(name, "-") == 0)
-		in = stdin;
-	else
-		in = fopen(name, "rb");
-	if (!in) {
-		perror("Failed to open input file");
-		exit(1);
-	}
-	
-	while (true) {
-		size_t len = bufsize - offset;
-		size_t n = fread(buf+offset, 1, len, in);
-		offset += n;
-		if (n < len)
-			break;
-		bufsize *= 2;
-		buf = realloc(buf, bufsize);
-		if (!buf) {
-			perror("Failed to resize load_file() buffer");
-			exit(1);
-		}
-	}
-	if (size) 
-		*size = offset;
-	if (in != stdin)
-		fclose(in);
-	return buf;
+	if (!file_open(out, name, true))
+		pr_fatal("Cannot open \"%s\": %s\n", name, strerror(errno));
+}
+
+static void write_output(file_stream *out, const char *name,
+			 const void *buf, size_t len)
+{
+	if (!file_write(out, buf, len))
+		pr_fatal("Write error on \"%s\": %s\n", name, strerror(errno));
 }
 
 void aw_fel_hexdump(feldev_handle *dev, uint32_t offset, size_t size)
@@ -204,21 +195,299 @@ void aw_fel_hexdump(feldev_handle *dev, uint32_t offset, size_t size)
 	}
 }
 
-void aw_fel_dump(feldev_handle *dev, uint32_t offset, size_t size)
+/* stream device memory to a file, reading it in transfer buffer chunks */
+void aw_fel_read_file(feldev_handle *dev, uint32_t offset, size_t size,
+		      const char *filename)
 {
-	if (size > 0) {
-		unsigned char buf[size];
-		aw_fel_read(dev, offset, buf, size);
-		fwrite(buf, size, 1, stdout);
+	void *buf = feldev_buffer_get(dev);
+	file_stream out;
+	size_t chunk;
+
+	open_output(&out, filename);
+	while (size > 0) {
+		chunk = size < FEL_BUFFER_SIZE ? size : FEL_BUFFER_SIZE;
+		aw_fel_read(dev, offset, buf, chunk);
+		write_output(&out, filename, buf, chunk);
+		offset += chunk;
+		size -= chunk;
 	}
+	if (!file_close(&out))
+		pr_fatal("Write error on \"%s\": %s\n", filename, strerror(errno));
+	feldev_buffer_put(dev, buf);
+}
+
+void aw_fel_dump(feldev_handle *dev, uint32_t offset, size_t size)
+{
+	aw_fel_read_file(dev, offset, size, "-");
 }
+
+/*
+ * Fill memory with a byte value. The word-aligned part of the range gets
+ * filled by ARM code on the device, only unaligned head and tail bytes
+ * need an actual data transfer.
+ */
 void aw_fel_fill(feldev_handle *dev, uint32_t offset, size_t size, unsigned char value)
 {
-	if (size > 0) {
-		unsigned char buf[size];
-		memset(buf, value, size);
-		aw_write_buffer(dev, buf, offset, size, false);
+	if (size == 0)
+		return;
+	check_uboot_overlap(offset, size);
+
+	unsigned char bytes[4];
+	memset(bytes, value, sizeof(bytes));
+	size_t head = (4 - (offset & 3)) & 3;
+	if (head > size)
+		head = size;
+	size_t body = (size - head) & ~3;
+	size_t tail = size - head - body;
+
+	if (head > 0)
+		aw_fel_write(dev, bytes, offset, head);
+	if (body > 0) {
+		fel_fill_extent fill = {
+			.addr = offset + head,
+			.size = body,
+			.value = value * 0x01010101U
+		};
+		fel_fill_extents(dev, &fill, 1);
+	}
+	if (tail > 0)
+		aw_fel_write(dev, bytes, offset + head + body, tail);
+}
+
+/*
+ * Payloads up to this size are candidates for a "staged" upload: several of
+ * them get packed into a single transfer, and then distributed to their
+ * destinations by device-side code. This saves a full FEL request cycle
+ * per payload, which dominates the transfer time for small data.
+ */
+#define STAGING_MAX_PAYLOAD	(64 * 1024)
+
+/* contiguous range of data extents, that gets uploaded in one go */
+typedef struct {
+	uint32_t addr;
+	size_t size;
+	sparse_extent **ext;	/* pointers to extents (sorted by address) */
+	size_t count;
+	bool staged;
+} upload_transfer;
+
+/* sort by address, with original (array) order as secondary criterion */
+static int compare_extent_addr(const void *a, const void *b)
+{
+	const sparse_extent *x = *(sparse_extent * const *)a;
+	const sparse_extent *y = *(sparse_extent * const *)b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
+static bool ranges_overlap(uint32_t addr1, size_t size1,
+			   uint32_t addr2, size_t size2)
+{
+	return (uint64_t)addr1 < (uint64_t)addr2 + size2
+	    && (uint64_t)addr2 < (uint64_t)addr1 + size1;
+}
+
+/*
+ * Return a buffer with the data for a transfer. If its extents aren't
+ * contiguous in host memory, this requires allocating (*allocated = true)
+ * and assembling a new buffer.
+ */
+static uint8_t *transfer_buffer(const upload_transfer *t, bool *allocated)
+{
+	size_t i, pos = 0;
+	uint8_t *buf;
+
+	for (i = 1; i < t->count; i++)
+		if (t->ext[i]->data != t->ext[i - 1]->data + t->ext[i - 1]->size)
+			break;
+	*allocated = i < t->count;
+	if (!*allocated)
+		return (uint8_t *)t->ext[0]->data;
+
+	buf = malloc(t->size);
+	if (!buf)
+		pr_fatal("Failed to allocate transfer buffer\n");
+	for (i = 0; i < t->count; i++) {
+		memcpy(buf + pos, t->ext[i]->data, t->ext[i]->size);
+		pos += t->ext[i]->size;
+	}
+	return buf;
+}
+
+/*
+ * Pick small transfers that can be staged. The staging area is placed at the
+ * destination of the largest transfer, as that memory gets overwritten with
+ * the "real" data later anyway. Neither the staging area nor the staged
+ * payloads may touch the scratch area (where the scatter code resides).
+ * Returns the total size of the staging area, 0 if staging isn't worthwhile.
+ */
+static size_t select_staged(feldev_handle *dev, upload_transfer *t,
+			    size_t count, upload_transfer **host)
+{
+	uint32_t scratch = dev->soc_info->scratch_addr;
+	size_t i, largest = 0, staged = 0, size = 0;
+
+	for (i = 1; i < count; i++)
+		if (t[i].size > t[largest].size)
+			largest = i;
+	*host = &t[largest];
+
+	for (i = 0; i < count; i++) {
+		size_t aligned = (t[i].size + 3) & ~3;
+		if (i == largest || t[i].size > STAGING_MAX_PAYLOAD
+		    || size + aligned > t[largest].size
+		    || ranges_overlap(t[i].addr, t[i].size,
+				      scratch, fel_scratch_size(dev)))
+			continue;
+		t[i].staged = true;
+		size += aligned;
+		staged++;
+	}
+	if (staged < 2
+	    || ranges_overlap(t[largest].addr, size, scratch,
+			      fel_scratch_size(dev))) {
+		for (i = 0; i < count; i++)
+			t[i].staged = false;
+		return 0;
+	}
+	return size;
+}
+
+/* Pack staged transfers, upload them and distribute them on the device. */
+static void upload_staged(feldev_handle *dev, upload_transfer *t, size_t count,
+			  const upload_transfer *host, size_t size, bool progress)
+{
+	uint8_t *staging = calloc(1, size);
+	fel_scatter_entry *list = calloc(count, sizeof(fel_scatter_entry));
+	size_t i, n = 0, pos = 0, payload = 0;
+
+	if (!staging || !list)
+		pr_fatal("Failed to allocate staging buffer\n");
+	for (i = 0; i < count; i++) {
+		bool allocated;
+		uint8_t *buf;
+		if (!t[i].staged)
+			continue;
+		check_uboot_overlap(t[i].addr, t[i].size);
+		buf = transfer_buffer(&t[i], &allocated);
+		memcpy(staging + pos, buf, t[i].size);
+		if (allocated)
+			free(buf);
+		list[n].src = host->addr + pos;
+		list[n].dst = t[i].addr;
+		list[n].size = t[i].size;
+		n++;
+		pos += (t[i].size + 3) & ~3;
+		payload += t[i].size;
+	}
+	pr_info("Staging %zu payloads (%zu bytes) at 0x%08X\n",
+		n, payload, host->addr);
+
+	/* padding isn't part of the payload, so report progress ourselves */
+	aw_write_buffer(dev, staging, host->addr, size, false);
+	fel_scatter(dev, list, n);
+	if (progress)
+		progress_add(feldev_progress(dev), payload);
+	free(list);
+	free(staging);
+}
+
+/*
+ * Transfer a list of (data or fill) extents, e.g. resulting from multiple
+ * files and/or sparse images. Extents get sorted by address, so contiguous
+ * ones can be merged into single transfers, and small payloads get staged.
+ * Fill extents are collected and then handed to the device-side fill code,
+ * which can take care of many of them in a single request.
+ * If any of the extents overlap, we have to preserve the original order
+ * (later data overwriting earlier), so no reordering takes place then.
+ */
+void aw_write_extents(feldev_handle *dev, sparse_extent *extent, size_t count,
+		      bool progress)
+{
+	sparse_extent **sorted = calloc(count, sizeof(sparse_extent *));
+	fel_fill_extent *fill = calloc(count, sizeof(fel_fill_extent));
+	upload_transfer *t = calloc(count, sizeof(upload_transfer));
+	size_t i, fills = 0, fill_bytes = 0, transfers = 0;
+	bool reorder = true;
+
+	if (count == 0)
+		goto done;
+	if (!sorted || !fill || !t)
+		pr_fatal("Failed to allocate extent lists\n");
+
+	for (i = 0; i < count; i++)
+		sorted[i] = &extent[i];
+	qsort(sorted, count, sizeof(sparse_extent *), compare_extent_addr);
+	for (i = 1; i < count; i++)
+		if (ranges_overlap(sorted[i - 1]->addr, sorted[i - 1]->size,
+				   sorted[i]->addr, sorted[i]->size))
+			reorder = false;
+	if (!reorder) {
+		pr_info("Overlapping payloads, uploading in original order\n");
+		for (i = 0; i < count; i++)
+			sorted[i] = &extent[i];
+	}
+
+	for (i = 0; i < count; i++) {
+		sparse_extent *ext = sorted[i];
+		if (!ext->data) {
+			check_uboot_overlap(ext->addr, ext->size);
+			fill[fills].addr = ext->addr;
+			fill[fills].size = ext->size;
+			fill[fills].value = ext->value;
+			fill_bytes += ext->size;
+			fills++;
+			continue;
+		}
+		upload_transfer *last = transfers ? &t[transfers - 1] : NULL;
+		if (reorder && last && last->ext + last->count == &sorted[i]
+		    && (uint64_t)last->addr + last->size == ext->addr) {
+			last->size += ext->size; /* merge contiguous extent */
+			last->count++;
+			continue;
+		}
+		t[transfers].addr = ext->addr;
+		t[transfers].size = ext->size;
+		t[transfers].ext = &sorted[i];
+		t[transfers].count = 1;
+		transfers++;
+	}
+
+	if (transfers < count - fills)
+		pr_info("Coalesced %zu data extents into %zu transfers\n",
+			count - fills, transfers);
+	if (reorder && transfers > 2) {
+		upload_transfer *host;
+		size_t size = select_staged(dev, t, transfers, &host);
+		if (size > 0) {
+			check_uboot_overlap(host->addr, host->size);
+			upload_staged(dev, t, transfers, host, size, progress);
+		}
+	}
+
+	for (i = 0; i < transfers; i++) {
+		bool allocated;
+		uint8_t *buf;
+		if (t[i].staged)
+			continue;
+		buf = transfer_buffer(&t[i], &allocated);
+		aw_write_buffer(dev, buf, t[i].addr, t[i].size, progress);
+		if (allocated)
+			free(buf);
 	}
+	if (fills > 0) {
+		pr_info("Filling %zu extent(s), %zu bytes total\n",
+			fills, fill_bytes);
+		fel_fill_extents(dev, fill, fills);
+		if (progress)
+			progress_add(feldev_progress(dev), fill_bytes);
+	}
+done:
+	free(t);
+	free(fill);
+	free(sorted);
 }
 
 static uint32_t fel_to_spl_thunk[] = {
@@ -228,6 +497,70 @@ static uint32_t fel_to_spl_thunk[] = {
 #define	DRAM_BASE		0x40000000
 #define	DRAM_SIZE		0x80000000
 
+/*
+ * Snapshot of the CPU state that the SPL code path needs to look at. All
+ * values get collected by a single thunk execution and are cached for the
+ * session. Functions that modify CP15 registers either update the cached
+ * copy (if they know the resulting value) or invalidate it.
+ */
+typedef struct {
+	uint32_t sctlr, dacr, ttbcr, ttbr0;
+	uint32_t sp_irq, sp;
+} arm_cpu_state;
+
+static struct {
+	feldev_handle *dev;	/* device the snapshot belongs to, NULL = none */
+	arm_cpu_state regs;
+} cpu_state;
+
+static void aw_invalidate_cpu_state(void)
+{
+	cpu_state.dev = NULL;
+}
+
+static const arm_cpu_state *aw_get_cpu_state(feldev_handle *dev,
+					     soc_info_t *soc_info)
+{
+	uint32_t results[6];
+	uint32_t arm_code[] = {
+		/* switch to IRQ mode to retrieve SP_irq, then back */
+		htole32(0xe10f0000), /* mrs        r0, CPSR                  */
+		htole32(0xe3c0101f), /* bic        r1, r0, #31               */
+		htole32(0xe3811012), /* orr        r1, r1, #18               */
+		htole32(0xe121f001), /* msr        CPSR_c, r1                */
+		htole32(0xe1a0100d), /* mov        r1, sp                    */
+		htole32(0xe121f000), /* msr        CPSR_c, r0                */
+		htole32(0xee110f10), /* mrc        15, 0, r0, cr1, cr0, {0}  */
+		htole32(0xee132f10), /* mrc        15, 0, r2, cr3, cr0, {0}  */
+		htole32(0xee123f50), /* mrc        15, 0, r3, cr2, cr0, {2}  */
+		htole32(0xee12cf10), /* mrc        15, 0, ip, cr2, cr0, {0}  */
+		htole32(0xe58f0014), /* str        r0, [pc, #20]             */
+		htole32(0xe58f2014), /* str        r2, [pc, #20]             */
+		htole32(0xe58f3014), /* str        r3, [pc, #20]             */
+		htole32(0xe58fc014), /* str        ip, [pc, #20]             */
+		htole32(0xe58f1014), /* str        r1, [pc, #20]             */
+		htole32(0xe58fd014), /* str        sp, [pc, #20]             */
+		htole32(0xe12fff1e), /* bx         lr                        */
+	};
+
+	if (cpu_state.dev == dev)
+		return &cpu_state.regs;
+
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_fel_read(dev, soc_info->scratch_addr + sizeof(arm_code),
+		    results, sizeof(results));
+
+	cpu_state.regs.sctlr  = le32toh(results[0]);
+	cpu_state.regs.dacr   = le32toh(results[1]);
+	cpu_state.regs.ttbcr  = le32toh(results[2]);
+	cpu_state.regs.ttbr0  = le32toh(results[3]);
+	cpu_state.regs.sp_irq = le32toh(results[4]);
+	cpu_state.regs.sp     = le32toh(results[5]);
+	cpu_state.dev = dev;
+	return &cpu_state.regs;
+}
+
 uint32_t aw_read_arm_cp_reg(feldev_handle *dev, soc_info_t *soc_info,
 			    uint32_t coproc, uint32_t opc1, uint32_t crn,
 			    uint32_t crm, uint32_t opc2)
@@ -266,6 +599,7 @@ void aw_write_arm_cp_reg(feldev_handle *dev, soc_info_t *soc_info,
 	};
 	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
 	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_invalidate_cpu_state();
 }
 
 /* "readl" of a single value */
@@ -282,6 +616,166 @@ void fel_writel(feldev_handle *dev, uint32_t addr, uint32_t val)
 	fel_writel_n(dev, addr, &val, 1);
 }
 
+/*
+ * "--boost": run the CPU from PLL_CPUX at a higher (but still safe) clock
+ * rate, which speeds up the BROM's FEL data handling. The original clock
+ * setup gets restored before running any code other than our own thunks,
+ * like the SPL or "exe" targets, which may depend on it (or set up their
+ * own). So boosting only lasts until then.
+ */
+static struct {
+	bool active;
+	uint32_t pll, mux;	/* original register values */
+} cpu_boost;
+
+#define CPU_CLK_SRC_MASK	(3 << 16)
+#define CPU_CLK_SRC_OSC24M	(1 << 16)
+#define CPU_CLK_SRC_PLL		(2 << 16)
+
+static void aw_wait_for_pll(feldev_handle *dev, soc_clk_info *clk)
+{
+	struct timespec req = { .tv_nsec = 1000000 }; /* 1ms */
+	int i;
+
+	if (!clk->pll_lock) {
+		nanosleep(&req, NULL);
+		return;
+	}
+	for (i = 0; i < 100; i++) {
+		if (fel_readl(dev, clk->pll_reg) & clk->pll_lock)
+			return;
+		nanosleep(&req, NULL);
+	}
+	pr_fatal("ERROR: PLL_CPUX failed to lock\n");
+}
+
+void aw_cpu_boost(feldev_handle *dev)
+{
+	soc_clk_info *clk = dev->soc_info->clk;
+	uint32_t mux;
+
+	if (!clk) {
+		pr_info("CPU clock boost not supported on your SoC (%s)\n",
+			dev->soc_name);
+		return;
+	}
+	cpu_boost.pll = fel_readl(dev, clk->pll_reg);
+	cpu_boost.mux = fel_readl(dev, clk->mux_reg);
+	cpu_boost.active = true;
+
+	/* run from the oscillator while changing the PLL */
+	mux = (cpu_boost.mux & ~CPU_CLK_SRC_MASK) | CPU_CLK_SRC_OSC24M;
+	fel_writel(dev, clk->mux_reg, mux);
+	fel_writel(dev, clk->pll_reg, clk->pll_boost);
+	aw_wait_for_pll(dev, clk);
+	mux = (mux & ~(clk->mux_mask | CPU_CLK_SRC_MASK))
+	      | clk->mux_boost | CPU_CLK_SRC_PLL;
+	fel_writel(dev, clk->mux_reg, mux);
+	pr_info("CPU clock boosted to %u MHz\n", clk->boost_mhz);
+}
+
+void aw_cpu_boost_restore(feldev_handle *dev)
+{
+	soc_clk_info *clk = dev->soc_info->clk;
+	uint32_t mux;
+
+	if (!cpu_boost.active)
+		return;
+	cpu_boost.active = false;
+
+	mux = fel_readl(dev, clk->mux_reg);
+	mux = (mux & ~CPU_CLK_SRC_MASK) | CPU_CLK_SRC_OSC24M;
+	fel_writel(dev, clk->mux_reg, mux);
+	fel_writel(dev, clk->pll_reg, cpu_boost.pll);
+	if ((cpu_boost.mux & CPU_CLK_SRC_MASK) == CPU_CLK_SRC_PLL
+	    && (cpu_boost.pll & (1U << 31)))
+		aw_wait_for_pll(dev, clk);
+	fel_writel(dev, clk->mux_reg, cpu_boost.mux);
+	pr_info("CPU clock restored\n");
+}
+
+/*
+ * Measure the average round trip time of "readl" and "writel", with and
+ * without chaining the USB transfers of these small requests. The word
+ * used for this is the last one of the scratch area, which the thunk
+ * code involved doesn't occupy.
+ */
+void aw_fel_latency(feldev_handle *dev, unsigned int count)
+{
+	uint32_t addr = dev->soc_info->scratch_addr + fel_scratch_size(dev) - 4;
+	bool chained = feldev_set_chaining(dev, true);
+	double start, result[2][2];
+	unsigned int i;
+	int pass;
+
+	if (count == 0)
+		pr_fatal("ERROR: count must not be zero\n");
+	for (pass = 0; pass < 2; pass++) {
+		feldev_set_chaining(dev, pass == 0);
+		start = gettime();
+		for (i = 0; i < count; i++)
+			fel_readl(dev, addr);
+		result[pass][0] = (gettime() - start) / count;
+		start = gettime();
+		for (i = 0; i < count; i++)
+			fel_writel(dev, addr, i);
+		result[pass][1] = (gettime() - start) / count;
+	}
+	feldev_set_chaining(dev, chained);
+
+	printf("%u iterations, average time per operation:\n", count);
+	for (i = 0; i < 2; i++)
+		printf("%-6s  %8.1f us chained, %8.1f us unchained (%.1fx)\n",
+		       i ? "writel" : "readl", result[0][i] * 1e6,
+		       result[1][i] * 1e6, result[1][i] / result[0][i]);
+}
+
+/*
+ * Call a function on the device, timing it with the CPU's cycle counter
+ * (and the generic timer where available) from thunks/timed_call.S. The
+ * timer runs at a fixed frequency, which allows converting the result to
+ * microseconds and deriving the actual CPU clock. The Cortex-A8 (A10/A13)
+ * lacks the generic timer, so only the cycle count is known there.
+ */
+static const uint32_t fel_timed_call_thunk[] = {
+	#include "thunks/timed_call.h"
+};
+
+#define TIMED_THUNK_WORDS	ARRAY_SIZE(fel_timed_call_thunk)
+/* the sunxi timers are all clocked from the 24 MHz oscillator */
+#define TIMED_DEFAULT_FREQ	24000000
+
+void aw_fel_execute_timed(feldev_handle *dev, uint32_t addr)
+{
+	uint32_t code[TIMED_THUNK_WORDS + 1], result[6];
+	uint32_t cycles, freq;
+	uint64_t ticks;
+	size_t i;
+
+	for (i = 0; i < TIMED_THUNK_WORDS; i++)
+		code[i] = htole32(fel_timed_call_thunk[i]);
+	code[TIMED_THUNK_WORDS] = htole32(addr);
+	fel_run_thunk(dev, code, sizeof(code), result, sizeof(result));
+
+	cycles = le32toh(result[0]);
+	ticks = le32toh(result[2]) | (uint64_t)le32toh(result[3]) << 32;
+	freq = le32toh(result[4]);
+	if (freq == 0) /* CNTFRQ isn't necessarily set up by the BROM */
+		freq = TIMED_DEFAULT_FREQ;
+
+	if (result[1])
+		printf("0x%08X: cycle counter overflowed", addr);
+	else
+		printf("0x%08X: %u cycles", addr, cycles);
+	if (result[5]) {
+		double us = ticks * 1e6 / freq;
+		printf(", %.3f us", us);
+		if (!result[1] && ticks > 0)
+			printf(" (CPU clock %.0f MHz)", cycles / us);
+	}
+	putchar('\n');
+}
+
 void aw_fel_print_sid(feldev_handle *dev, bool force_workaround)
 {
 	uint32_t key[4];
@@ -323,118 +817,192 @@ void aw_enable_l2_cache(feldev_handle *dev, soc_info_t *soc_info)
 void aw_get_stackinfo(feldev_handle *dev, soc_info_t *soc_info,
                       uint32_t *sp_irq, uint32_t *sp)
 {
-	uint32_t results[2] = { 0 };
-#if 0
-	/* Does not work on Cortex-A8 (needs Virtualization Extensions) */
-	uint32_t arm_code[] = {
-		htole32(0xe1010300), /* mrs        r0, SP_irq                */
-		htole32(0xe58f0004), /* str        r0, [pc, #4]              */
-		htole32(0xe58fd004), /* str        sp, [pc, #4]              */
-		htole32(0xe12fff1e), /* bx         lr                        */
-	};
-
-	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(dev, soc_info->scratch_addr);
-	aw_fel_read(dev, soc_info->scratch_addr + 0x10, results, 8);
-#else
-	/* Works everywhere */
-	uint32_t arm_code[] = {
-		htole32(0xe10f0000), /* mrs        r0, CPSR                  */
-		htole32(0xe3c0101f), /* bic        r1, r0, #31               */
-		htole32(0xe3811012), /* orr        r1, r1, #18               */
-		htole32(0xe121f001), /* msr        CPSR_c, r1                */
-		htole32(0xe1a0100d), /* mov        r1, sp                    */
-		htole32(0xe121f000), /* msr        CPSR_c, r0                */
-		htole32(0xe58f1004), /* str        r1, [pc, #4]              */
-		htole32(0xe58fd004), /* str        sp, [pc, #4]              */
-		htole32(0xe12fff1e), /* bx         lr                        */
-	};
+	const arm_cpu_state *state = aw_get_cpu_state(dev, soc_info);
 
-	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(dev, soc_info->scratch_addr);
-	aw_fel_read(dev, soc_info->scratch_addr + 0x24, results, 8);
-#endif
-	*sp_irq = le32toh(results[0]);
-	*sp     = le32toh(results[1]);
+	*sp_irq = state->sp_irq;
+	*sp     = state->sp;
 }
 
 uint32_t aw_get_ttbr0(feldev_handle *dev, soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 0);
+	return aw_get_cpu_state(dev, soc_info)->ttbr0;
 }
 
 uint32_t aw_get_ttbcr(feldev_handle *dev, soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 2);
+	return aw_get_cpu_state(dev, soc_info)->ttbcr;
 }
 
 uint32_t aw_get_dacr(feldev_handle *dev, soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 3, 0, 0);
+	return aw_get_cpu_state(dev, soc_info)->dacr;
 }
 
 uint32_t aw_get_sctlr(feldev_handle *dev, soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 1, 0, 0);
+	return aw_get_cpu_state(dev, soc_info)->sctlr;
+}
+
+/* write a CP15 register, keeping a valid CPU state snapshot up to date */
+static void aw_set_cp15_cached(feldev_handle *dev, soc_info_t *soc_info,
+			       uint32_t crn, uint32_t crm, uint32_t opc2,
+			       uint32_t *cached, uint32_t val)
+{
+	feldev_handle *snapshot = cpu_state.dev;
+
+	aw_write_arm_cp_reg(dev, soc_info, 15, 0, crn, crm, opc2, val);
+	if (snapshot == dev) {
+		*cached = val;
+		cpu_state.dev = dev;
+	}
 }
 
 void aw_set_ttbr0(feldev_handle *dev, soc_info_t *soc_info,
 		  uint32_t ttbr0)
 {
-	return aw_write_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 0, ttbr0);
+	aw_set_cp15_cached(dev, soc_info, 2, 0, 0, &cpu_state.regs.ttbr0, ttbr0);
 }
 
 void aw_set_ttbcr(feldev_handle *dev, soc_info_t *soc_info,
 		  uint32_t ttbcr)
 {
-	return aw_write_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 2, ttbcr);
+	aw_set_cp15_cached(dev, soc_info, 2, 0, 2, &cpu_state.regs.ttbcr, ttbcr);
 }
 
 void aw_set_dacr(feldev_handle *dev, soc_info_t *soc_info,
 		 uint32_t dacr)
 {
-	aw_write_arm_cp_reg(dev, soc_info, 15, 0, 3, 0, 0, dacr);
+	aw_set_cp15_cached(dev, soc_info, 3, 0, 0, &cpu_state.regs.dacr, dacr);
 }
 
 void aw_set_sctlr(feldev_handle *dev, soc_info_t *soc_info,
 		  uint32_t sctlr)
 {
-	aw_write_arm_cp_reg(dev, soc_info, 15, 0, 1, 0, 0, sctlr);
+	aw_set_cp15_cached(dev, soc_info, 1, 0, 0, &cpu_state.regs.sctlr, sctlr);
+}
+
+static const uint32_t fel_mmu_tt_thunk[] = {
+	#include "thunks/mmu_tt.h"
+};
+
+#define MMU_TT_GENERATE		1	/* write a new direct mapping table */
+#define MMU_TT_CHECK		2	/* verify that the table is one */
+#define MMU_TT_MAX_PATCHES	4
+
+/* TEXCB bits of a section descriptor */
+#define MMU_SECTION_TEXCB	((7 << 12) | (1 << 3) | (1 << 2))
+
+typedef struct {
+	uint32_t first, count;	/* range of 1MB sections */
+	uint32_t clear, set;	/* descriptor bits to clear, then set */
+} mmu_tt_patch;
+
+/*
+ * Run the MMU translation table thunk on the table at 'ttbr0', so the
+ * (16 KiB) table itself never has to be transferred via USB. Returns the
+ * thunk's status code, with the index of the failing entry in '*index'.
+ */
+static uint32_t aw_mmu_tt_thunk(feldev_handle *dev, soc_info_t *soc_info,
+				uint32_t ttbr0, uint32_t flags,
+				const mmu_tt_patch *patch, size_t count,
+				uint32_t *index)
+{
+	uint32_t buf[ARRAY_SIZE(fel_mmu_tt_thunk) + 3 + 4 * MMU_TT_MAX_PATCHES];
+	uint32_t *param = buf + ARRAY_SIZE(fel_mmu_tt_thunk);
+	uint32_t result[2];
+	size_t i, words;
+
+	for (i = 0; i < ARRAY_SIZE(fel_mmu_tt_thunk); i++)
+		buf[i] = htole32(fel_mmu_tt_thunk[i]);
+	*param++ = htole32(ttbr0);
+	*param++ = htole32(flags);
+	*param++ = htole32(count);
+	for (i = 0; i < count; i++) {
+		*param++ = htole32(patch[i].first);
+		*param++ = htole32(patch[i].count);
+		*param++ = htole32(patch[i].clear);
+		*param++ = htole32(patch[i].set);
+	}
+	words = param - buf;
+
+	aw_fel_write(dev, buf, soc_info->scratch_addr, words * sizeof(uint32_t));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_fel_read(dev, soc_info->scratch_addr + sizeof(fel_mmu_tt_thunk),
+		    result, sizeof(result));
+	*index = le32toh(result[1]);
+	return le32toh(result[0]);
 }
 
 /*
- * Reconstruct the same MMU translation table as used by the A20 BROM.
- * We are basically reverting the changes, introduced in newer SoC
- * variants. This works fine for the SoC variants with the memory
- * layout similar to A20 (the SRAM is in the first megabyte of the
- * address space and the BROM is in the last megabyte of the address
- * space).
+ * "--cached-dram": map DRAM as write-back cacheable (instead of write
+ * combining) when re-enabling the MMU after the SPL, and turn on the data
+ * cache. The BROM's copy loop then benefits from cached writes for DRAM
+ * uploads. Before running code other than our own thunks, or changing the
+ * MMU setup, the caches get cleaned and the data cache disabled again.
  */
-uint32_t *aw_generate_mmu_translation_table(void)
+static const uint32_t fel_cache_clean_thunk[] = {
+	#include "thunks/cache_clean.h"
+};
+
+#define CACHE_DISABLE		1	/* clear SCTLR.C first */
+#define CACHE_INVALIDATE_ONLY	2	/* discard, don't write back */
+
+static bool dram_cached;	/* --cached-dram */
+static bool dcache_enabled;	/* by us, the BROM leaves it disabled */
+
+static void aw_cache_clean(feldev_handle *dev, uint32_t flags)
 {
-	uint32_t *tt = malloc(4096 * sizeof(uint32_t));
-	uint32_t i;
+	uint32_t code[ARRAY_SIZE(fel_cache_clean_thunk) + 1];
+	size_t i;
 
-	/*
-	 * Direct mapping using 1MB sections with TEXCB=00000 (Strongly
-	 * ordered) for all memory except the first and the last sections,
-	 * which have TEXCB=00100 (Normal). Domain bits are set to 1111
-	 * and AP bits are set to 11, but this is mostly irrelevant.
-	 */
-	for (i = 0; i < 4096; i++)
-		tt[i] = 0x00000DE2 | (i << 20);
-	tt[0x000] |= 0x1000;
-	tt[0xFFF] |= 0x1000;
+	for (i = 0; i < ARRAY_SIZE(fel_cache_clean_thunk); i++)
+		code[i] = htole32(fel_cache_clean_thunk[i]);
+	code[i] = htole32(flags);
+	fel_run_thunk(dev, code, sizeof(code), NULL, 0);
+}
+
+/* write back all cached data, and disable the data cache again */
+static void aw_dcache_disable(feldev_handle *dev)
+{
+	if (!dcache_enabled)
+		return;
+	pr_info("Cleaning and disabling the data cache\n");
+	aw_cache_clean(dev, CACHE_DISABLE);
+	dcache_enabled = false;
+	if (cpu_state.dev == dev)
+		cpu_state.regs.sctlr &= ~(1 << 2);
+}
+
+/*
+ * Undo the performance tweaks of the FEL session ("--boost",
+ * "--cached-dram") before running code other than our own thunks.
+ */
+static void aw_prepare_exec(feldev_handle *dev)
+{
+	aw_dcache_disable(dev);
+	aw_cpu_boost_restore(dev);
+}
+
+/* call (user) code on the device, which may change the CPU state */
+static void aw_exec(feldev_handle *dev, uint32_t addr)
+{
+	double start = metrics_begin();
 
-	return tt;
+	aw_prepare_exec(dev);
+	aw_fel_execute(dev, addr);
+	aw_invalidate_cpu_state();
+	metrics_span("exec", start, 0, "0x%08X", addr);
 }
 
-uint32_t *aw_backup_and_disable_mmu(feldev_handle *dev,
-                                    soc_info_t *soc_info)
+/*
+ * Check the BROM's MMU setup and disable the MMU. Returns true if the MMU
+ * was enabled, and the translation table has been verified to be usable
+ * by aw_restore_and_enable_mmu().
+ */
+bool aw_backup_and_disable_mmu(feldev_handle *dev, soc_info_t *soc_info)
 {
-	uint32_t *tt = NULL;
 	uint32_t sctlr, ttbr0, ttbcr, dacr;
-	uint32_t i;
+	uint32_t status, index;
 
 	uint32_t arm_code[] = {
 		/* Disable I-cache, MMU and branch prediction */
@@ -457,6 +1025,9 @@ uint32_t *aw_backup_and_disable_mmu(feldev_handle *dev,
 	 * checks needs to be relaxed).
 	 */
 
+	/* dirty cache lines mustn't survive, the MMU-less view is uncached */
+	aw_dcache_disable(dev);
+
 	/* Basically, ignore M/Z/I/V/UNK bits and expect no TEX remap */
 	sctlr = aw_get_sctlr(dev, soc_info);
 	if ((sctlr & ~((0x7 << 11) | (1 << 6) | 1)) != 0x00C50038)
@@ -464,7 +1035,7 @@ uint32_t *aw_backup_and_disable_mmu(feldev_handle *dev,
 
 	if (!(sctlr & 1)) {
 		pr_info("MMU is not enabled by BROM\n");
-		return NULL;
+		return false;
 	}
 
 	dacr = aw_get_dacr(dev, soc_info);
@@ -479,34 +1050,42 @@ uint32_t *aw_backup_and_disable_mmu(feldev_handle *dev,
 	if (ttbr0 & 0x3FFF)
 		pr_fatal("Unexpected TTBR0 (%08X)\n", ttbr0);
 
-	tt = malloc(16 * 1024);
-	pr_info("Reading the MMU translation table from 0x%08X\n", ttbr0);
-	aw_fel_read(dev, ttbr0, tt, 16 * 1024);
-	for (i = 0; i < 4096; i++)
-		tt[i] = le32toh(tt[i]);
-
 	/* Basic sanity checks to be sure that this is a valid table */
-	for (i = 0; i < 4096; i++) {
-		if (((tt[i] >> 1) & 1) != 1 || ((tt[i] >> 18) & 1) != 0)
-			pr_fatal("MMU: not a section descriptor\n");
-		if ((tt[i] >> 20) != i)
-			pr_fatal("MMU: not a direct mapping\n");
-	}
+	pr_info("Checking the MMU translation table at 0x%08X\n", ttbr0);
+	status = aw_mmu_tt_thunk(dev, soc_info, ttbr0, MMU_TT_CHECK,
+				 NULL, 0, &index);
+	if (status == 1)
+		pr_fatal("MMU: not a section descriptor (entry %u)\n", index);
+	if (status != 0)
+		pr_fatal("MMU: not a direct mapping (entry %u)\n", index);
 
 	pr_info("Disabling I-cache, MMU and branch prediction...");
 	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
 	aw_fel_execute(dev, soc_info->scratch_addr);
 	pr_info(" done.\n");
+	if (cpu_state.dev == dev)
+		cpu_state.regs.sctlr &= ~(0x1800 | 1);
 
-	return tt;
+	return true;
 }
 
+/*
+ * Adjust the memory attributes in the translation table, and (re)enable
+ * the MMU. If 'generate' is set, a new table gets set up first, which is
+ * the same as the one used by the A20 BROM. We are basically reverting
+ * the changes, introduced in newer SoC variants. This works fine for the
+ * SoC variants with the memory layout similar to A20 (the SRAM is in the
+ * first megabyte of the address space and the BROM is in the last
+ * megabyte of the address space).
+ */
 void aw_restore_and_enable_mmu(feldev_handle *dev,
                                soc_info_t *soc_info,
-                               uint32_t *tt)
+                               bool generate)
 {
-	uint32_t i;
 	uint32_t ttbr0 = aw_get_ttbr0(dev, soc_info);
+	mmu_tt_patch patch[MMU_TT_MAX_PATCHES];
+	size_t count = 0;
+	uint32_t index;
 
 	uint32_t arm_code[] = {
 		/* Invalidate I-cache, TLB and BTB */
@@ -519,39 +1098,74 @@ void aw_restore_and_enable_mmu(feldev_handle *dev,
 		/* Enable I-cache, MMU and branch prediction */
 		htole32(0xee110f10), /* mrc        15, 0, r0, cr1, cr0, {0}  */
 		htole32(0xe3800001), /* orr        r0, r0, #1                */
+		htole32(dram_cached  /* orr        r0, r0, #4 (D-cache)      */
+			? 0xe3800004 : 0xe320f000), /* or nop                */
 		htole32(0xe3800b06), /* orr        r0, r0, #0x1800           */
 		htole32(0xee010f10), /* mcr        15, 0, r0, cr1, cr0, {0}  */
 		/* Return back to FEL */
 		htole32(0xe12fff1e), /* bx         lr                        */
 	};
 
-	pr_info("Setting write-combine mapping for DRAM.\n");
-	for (i = (DRAM_BASE >> 20); i < ((DRAM_BASE + DRAM_SIZE) >> 20); i++) {
-		/* Clear TEXCB bits */
-		tt[i] &= ~((7 << 12) | (1 << 3) | (1 << 2));
+	if (generate) {
+		/*
+		 * The generated table is a direct mapping using 1MB sections
+		 * with TEXCB=00000 (Strongly ordered) for all memory except
+		 * the first and the last sections, which have TEXCB=00100
+		 * (Normal). Domain bits are set to 1111 and AP bits are set
+		 * to 11, but this is mostly irrelevant.
+		 */
+		patch[count++] = (mmu_tt_patch){ 0x000, 1, 0, 1 << 12 };
+		patch[count++] = (mmu_tt_patch){ 0xFFF, 1, 0, 1 << 12 };
+	}
+
+	if (dram_cached) {
+		pr_info("Setting write-back cached mapping for DRAM.\n");
+		/* Set TEXCB to 00111 (Normal write-back cached mapping) */
+		patch[count++] = (mmu_tt_patch){ DRAM_BASE >> 20,
+						 DRAM_SIZE >> 20,
+						 MMU_SECTION_TEXCB,
+						 (1 << 12) | (1 << 3) | (1 << 2) };
+		/*
+		 * With the data cache enabled, the SRAM has to stay uncached:
+		 * the code uploaded there gets executed right away, without
+		 * any cache maintenance. Set TEXCB to 00100, like 'generate'.
+		 */
+		if (!generate)
+			patch[count++] = (mmu_tt_patch){ 0x000, 1,
+							 MMU_SECTION_TEXCB,
+							 1 << 12 };
+	} else {
+		pr_info("Setting write-combine mapping for DRAM.\n");
 		/* Set TEXCB to 00100 (Normal uncached mapping) */
-		tt[i] |= (1 << 12);
+		patch[count++] = (mmu_tt_patch){ DRAM_BASE >> 20,
+						 DRAM_SIZE >> 20,
+						 MMU_SECTION_TEXCB, 1 << 12 };
 	}
 
 	pr_info("Setting cached mapping for BROM.\n");
-	/* Clear TEXCB bits first */
-	tt[0xFFF] &= ~((7 << 12) | (1 << 3) | (1 << 2));
 	/* Set TEXCB to 00111 (Normal write-back cached mapping) */
-	tt[0xFFF] |= (1 << 12) | /* TEX */
-		     (1 << 3)  | /* C */
-		     (1 << 2);   /* B */
-
-	pr_info("Writing back the MMU translation table.\n");
-	for (i = 0; i < 4096; i++)
-		tt[i] = htole32(tt[i]);
-	aw_fel_write(dev, tt, ttbr0, 16 * 1024);
-
-	pr_info("Enabling I-cache, MMU and branch prediction...");
+	patch[count++] = (mmu_tt_patch){ 0xFFF, 1, MMU_SECTION_TEXCB,
+					 (1 << 12) | /* TEX */
+					 (1 << 3)  | /* C */
+					 (1 << 2) }; /* B */
+
+	if (aw_mmu_tt_thunk(dev, soc_info, ttbr0,
+			    generate ? MMU_TT_GENERATE : 0,
+			    patch, count, &index) != 0)
+		pr_fatal("MMU: failed to update the translation table\n");
+
+	/* stale lines from before must not become visible */
+	if (dram_cached)
+		aw_cache_clean(dev, CACHE_INVALIDATE_ONLY);
+
+	pr_info("Enabling %sI-cache, MMU and branch prediction...",
+		dram_cached ? "D-cache, " : "");
 	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
 	aw_fel_execute(dev, soc_info->scratch_addr);
 	pr_info(" done.\n");
-
-	free(tt);
+	dcache_enabled = dram_cached;
+	if (cpu_state.dev == dev)
+		cpu_state.regs.sctlr |= 0x1800 | 1 | (dram_cached ? 1 << 2 : 0);
 }
 
 /*
@@ -560,21 +1174,17 @@ void aw_restore_and_enable_mmu(feldev_handle *dev,
  */
 #define SPL_LEN_LIMIT 0x8000
 
-void aw_fel_write_and_execute_spl(feldev_handle *dev, uint8_t *buf, size_t len)
+/*
+ * Check the eGON header (signature, length and checksum) of an SPL image.
+ * This doesn't require a device, so it can be done in advance. Returns the
+ * SPL length from the header.
+ */
+static uint32_t spl_check_header(const uint8_t *buf, size_t len)
 {
-	soc_info_t *soc_info = dev->soc_info;
-	sram_swap_buffers *swap_buffers;
-	char header_signature[9] = { 0 };
-	size_t i, thunk_size;
-	uint32_t *thunk_buf;
-	uint32_t sp, sp_irq;
-	uint32_t spl_checksum, spl_len, spl_len_limit = SPL_LEN_LIMIT;
-	uint32_t *buf32 = (uint32_t *)buf;
-	uint32_t cur_addr = soc_info->spl_addr;
-	uint32_t *tt = NULL;
+	const uint32_t *buf32 = (const uint32_t *)buf;
+	uint32_t spl_checksum, spl_len;
+	size_t i;
 
-	if (!soc_info || !soc_info->swap_buffers)
-		pr_fatal("SPL: Unsupported SoC type\n");
 	if (len < 32 || memcmp(buf + 4, "eGON.BT0", 8) != 0)
 		pr_fatal("SPL: eGON header is not found\n");
 
@@ -584,23 +1194,50 @@ void aw_fel_write_and_execute_spl(feldev_handle *dev, uint8_t *buf, size_t len)
 	if (spl_len > len || (spl_len % 4) != 0)
 		pr_fatal("SPL: bad length in the eGON header\n");
 
-	len = spl_len;
-	for (i = 0; i < len / 4; i++)
+	for (i = 0; i < spl_len / 4; i++)
 		spl_checksum -= le32toh(buf32[i]);
 
 	if (spl_checksum != 0)
 		pr_fatal("SPL: checksum check failed\n");
 
-	if (soc_info->needs_l2en) {
-		pr_info("Enabling the L2 cache\n");
-		aw_enable_l2_cache(dev, soc_info);
-	}
-
-	aw_get_stackinfo(dev, soc_info, &sp_irq, &sp);
-	pr_info("Stack pointers: sp_irq=0x%08X, sp=0x%08X\n", sp_irq, sp);
+	return spl_len;
+}
 
-	tt = aw_backup_and_disable_mmu(dev, soc_info);
-	if (!tt && soc_info->mmu_tt_addr) {
+void aw_fel_write_and_execute_spl(feldev_handle *dev, uint8_t *buf, size_t len)
+{
+	soc_info_t *soc_info = dev->soc_info;
+	sram_swap_buffers *swap_buffers;
+	char header_signature[9] = { 0 };
+	size_t i, thunk_size;
+	uint32_t *thunk_buf;
+	uint32_t sp, sp_irq;
+	uint32_t spl_len, spl_len_limit = SPL_LEN_LIMIT;
+	uint32_t cur_addr = soc_info->spl_addr;
+	bool mmu_enabled, generate_tt = false;
+	double start = metrics_begin(), mmu_start;
+
+	if (!soc_info || !soc_info->swap_buffers)
+		pr_fatal("SPL: Unsupported SoC type\n");
+
+	len = spl_len = spl_check_header(buf, len);
+
+	if (soc_info->needs_l2en) {
+		pr_info("Enabling the L2 cache\n");
+		aw_enable_l2_cache(dev, soc_info);
+	}
+
+	aw_get_stackinfo(dev, soc_info, &sp_irq, &sp);
+	pr_info("Stack pointers: sp_irq=0x%08X, sp=0x%08X\n", sp_irq, sp);
+
+	mmu_start = metrics_begin();
+	mmu_enabled = aw_backup_and_disable_mmu(dev, soc_info);
+	metrics_span("mmu", mmu_start, 0, "disable");
+	if (soc_info->tuning.mmu_tweak == MMU_TWEAK_OFF) {
+		/* calibrated as not worth it, keep running with the MMU off */
+		if (mmu_enabled)
+			pr_info("MMU stays disabled (tuning)\n");
+		mmu_enabled = false;
+	} else if (!mmu_enabled && soc_info->mmu_tt_addr) {
 		if (soc_info->mmu_tt_addr & 0x3FFF)
 			pr_fatal("SPL: 'mmu_tt_addr' must be 16K aligned\n");
 		pr_info("Generating the new MMU translation table at 0x%08X\n",
@@ -618,7 +1255,7 @@ void aw_fel_write_and_execute_spl(feldev_handle *dev, uint8_t *buf, size_t len)
 		aw_set_dacr(dev, soc_info, 0x55555555);
 		aw_set_ttbcr(dev, soc_info, 0x00000000);
 		aw_set_ttbr0(dev, soc_info, soc_info->mmu_tt_addr);
-		tt = aw_generate_mmu_translation_table();
+		mmu_enabled = generate_tt = true;
 	}
 
 	swap_buffers = soc_info->swap_buffers;
@@ -675,6 +1312,7 @@ void aw_fel_write_and_execute_spl(feldev_handle *dev, uint8_t *buf, size_t len)
 	for (i = 0; i < thunk_size / sizeof(uint32_t); i++)
 		thunk_buf[i] = htole32(thunk_buf[i]);
 
+	aw_prepare_exec(dev);
 	pr_info("=> Executing the SPL...");
 	aw_fel_write(dev, thunk_buf, soc_info->thunk_addr, thunk_size);
 	aw_fel_execute(dev, soc_info->thunk_addr);
@@ -691,23 +1329,32 @@ void aw_fel_write_and_execute_spl(feldev_handle *dev, uint8_t *buf, size_t len)
 	if (strcmp(header_signature, "eGON.FEL") != 0)
 		pr_fatal("SPL: failure code '%s'\n", header_signature);
 
+	/*
+	 * The SPL's return-to-FEL path restores the CPU state it was entered
+	 * with, so the CPU state snapshot remains valid at this point.
+	 */
+
 	/* re-enable the MMU if it was enabled by BROM */
-	if (tt != NULL)
-		aw_restore_and_enable_mmu(dev, soc_info, tt);
+	if (mmu_enabled) {
+		mmu_start = metrics_begin();
+		aw_restore_and_enable_mmu(dev, soc_info, generate_tt);
+		metrics_span("mmu", mmu_start, 0, "enable");
+	}
+	metrics_span("spl", start, spl_len, "0x%08X", soc_info->spl_addr);
 }
 
 /*
  * This function tests a given buffer address and length for a valid U-Boot
- * image. Upon success, the image data gets transferred to the default memory
- * address stored within the image header; and the function preserves the
- * U-Boot entry point (offset) and size values.
+ * image, retrieving load address and data size from the header. It returns
+ * false if there is no actual data, and bails out for invalid images.
  */
-void aw_fel_write_uboot_image(feldev_handle *dev, uint8_t *buf, size_t len)
+static bool uboot_image_check(const uint8_t *buf, size_t len,
+			      uint32_t *load_addr, uint32_t *data_size)
 {
 	if (len <= HEADER_SIZE)
-		return; /* Insufficient size (no actual data), just bail out */
+		return false; /* Insufficient size (no actual data) */
 
-	uint32_t *buf32 = (uint32_t *)buf;
+	const uint32_t *buf32 = (const uint32_t *)buf;
 
 	/* Check for a valid mkimage header */
 	int image_type = get_image_type(buf, len);
@@ -729,49 +1376,82 @@ void aw_fel_write_uboot_image(feldev_handle *dev, uint8_t *buf, size_t len)
 		pr_fatal("U-Boot image type mismatch: "
 			 "expected IH_TYPE_FIRMWARE, got %02X\n", image_type);
 
-	uint32_t data_size = be32toh(buf32[3]); /* Image Data Size */
-	uint32_t load_addr = be32toh(buf32[4]); /* Data Load Address */
-	if (data_size != len - HEADER_SIZE)
+	*data_size = be32toh(buf32[3]); /* Image Data Size */
+	*load_addr = be32toh(buf32[4]); /* Data Load Address */
+	if (*data_size != len - HEADER_SIZE)
 		pr_fatal("U-Boot image data size mismatch: "
-			 "expected %zu, got %u\n", len - HEADER_SIZE, data_size);
-
-	/* TODO: Verify image data integrity using the checksum field ih_dcrc,
-	 * available from be32toh(buf32[6])
-	 *
-	 * However, this requires CRC routines that mimic their U-Boot
-	 * counterparts, namely image_check_dcrc() in ${U-BOOT}/common/image.c
-	 * and crc_wd() in ${U-BOOT}/lib/crc32.c
-	 *
-	 * It should be investigated if existing CRC routines in sunxi-tools
-	 * could be factored out and reused for this purpose - e.g. calc_crc32()
-	 * from nand-part-main.c
-	 */
+			 "expected %zu, got %u\n", len - HEADER_SIZE, *data_size);
 
-	/* If we get here, we're "good to go" (i.e. actually write the data) */
-	pr_info("Writing image \"%.*s\", %u bytes @ 0x%08X.\n",
-		IH_NMLEN, buf + HEADER_NAME_OFFSET, data_size, load_addr);
+	/*
+	 * Verify the header and data integrity, like U-Boot's image_check_hcrc()
+	 * and image_check_dcrc() do. The header CRC (ih_hcrc) is calculated
+	 * with its own field set to zero.
+	 */
+	static const uint8_t zero_hcrc[4];
+	uint32_t hcrc = crc32(0, buf, 4);
+	hcrc = crc32(hcrc, zero_hcrc, sizeof(zero_hcrc));
+	hcrc = crc32(hcrc, buf + 8, HEADER_SIZE - 8);
+	if (hcrc != be32toh(buf32[1]))
+		pr_fatal("U-Boot image header CRC mismatch: "
+			 "expected %08X, got %08X\n", be32toh(buf32[1]), hcrc);
+	uint32_t dcrc = crc32(0, buf + HEADER_SIZE, *data_size);
+	if (dcrc != be32toh(buf32[6]))
+		pr_fatal("U-Boot image data CRC mismatch: "
+			 "expected %08X, got %08X\n", be32toh(buf32[6]), dcrc);
+	return true;
+}
 
-	aw_write_buffer(dev, buf + HEADER_SIZE, load_addr, data_size, false);
+/* transfer (already checked) U-Boot image data, keeping track of its region */
+static void uboot_upload(feldev_handle *dev, const uint8_t *data,
+			 uint32_t load_addr, uint32_t size)
+{
+	double start = metrics_begin();
+	aw_write_buffer(dev, (void *)data, load_addr, size, false);
+	metrics_span("upload", start, size, "uboot @ 0x%08X", load_addr);
 
 	/* keep track of U-Boot memory region in global vars */
 	uboot_entry = load_addr;
-	uboot_size = data_size;
+	uboot_size = size;
+}
+
+/*
+ * Upon success of uboot_image_check(), the image data gets transferred to the
+ * default memory address stored within the image header; and the function
+ * preserves the U-Boot entry point (offset) and size values.
+ */
+void aw_fel_write_uboot_image(feldev_handle *dev, uint8_t *buf, size_t len)
+{
+	uint32_t load_addr, data_size;
+
+	if (!uboot_image_check(buf, len, &load_addr, &data_size))
+		return; /* no actual data, just bail out */
+
+	/* If we get here, we're "good to go" (i.e. actually write the data) */
+	pr_info("Writing image \"%.*s\", %u bytes @ 0x%08X.\n",
+		IH_NMLEN, buf + HEADER_NAME_OFFSET, data_size, load_addr);
+	uboot_upload(dev, buf + HEADER_SIZE, load_addr, data_size);
 }
 
 /*
  * This function handles the common part of both "spl" and "uboot" commands.
  */
-void aw_fel_process_spl_and_uboot(feldev_handle *dev, const char *filename)
+static void spl_and_uboot(feldev_handle *dev, uint8_t *buf, size_t size)
 {
-	/* load file into memory buffer */
-	size_t size;
-	uint8_t *buf = load_file(filename, &size);
 	/* write and execute the SPL from the buffer */
 	aw_fel_write_and_execute_spl(dev, buf, size);
 	/* check for optional main U-Boot binary (and transfer it, if applicable) */
 	if (size > SPL_LEN_LIMIT)
 		aw_fel_write_uboot_image(dev, buf + SPL_LEN_LIMIT, size - SPL_LEN_LIMIT);
-	free(buf);
+}
+
+void aw_fel_process_spl_and_uboot(feldev_handle *dev, const char *filename)
+{
+	/* map file into memory */
+	file_buffer file;
+
+	load_file(&file, filename);
+	spl_and_uboot(dev, file.data, file.size);
+	file_release(&file);
 }
 
 /*
@@ -875,16 +1555,501 @@ void aw_rmr_request(feldev_handle *dev, uint32_t entry_point, bool aarch64)
 		htole32(entry_point),
 		htole32(rmr_mode)
 	};
+	aw_prepare_exec(dev);
 	/* scratch buffer setup: transfers ARM code and parameter values */
 	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
 	/* execute the thunk code (triggering a warm reset on the SoC) */
 	pr_info("Store entry point 0x%08X to RVBAR 0x%08X, "
 		"and request warm reset with RMR mode %u...",
 		entry_point, soc_info->rvbar_reg, rmr_mode);
+	double start = metrics_begin();
 	aw_fel_execute(dev, soc_info->scratch_addr);
+	metrics_span("exec", start, 0, "rmr 0x%08X", entry_point);
 	pr_info(" done.\n");
 }
 
+static uint32_t staging_addr, staging_size; /* --staging */
+
+/*
+ * Find the largest SRAM area that isn't used by the BROM FEL code, i.e.
+ * within the SPL area, but outside of any of the swap buffers (these are
+ * the BROM's stacks and data), the scratch area and the SPL header.
+ */
+static bool sram_free_area(feldev_handle *dev, uint32_t *addr, uint32_t *size)
+{
+	soc_info_t *soc_info = dev->soc_info;
+	uint32_t scratch_end = soc_info->scratch_addr + fel_scratch_size(dev);
+	sram_swap_buffers *swap = soc_info->swap_buffers;
+	uint32_t start = soc_info->spl_addr + 0x40; /* skip SPL header */
+	uint32_t end = soc_info->spl_addr + SPL_LEN_LIMIT;
+	uint32_t pos, best = 0, best_size = 0;
+
+	if (!swap)
+		return false; /* we don't know the BROM's memory usage */
+
+	for (pos = start; pos < end; ) {
+		uint32_t next = end; /* start of the next used area */
+		uint32_t skip = end; /* end of the used area */
+		size_t i;
+
+		for (i = 0; swap[i].size; i++)
+			if (swap[i].buf1 + swap[i].size > pos && swap[i].buf1 < next) {
+				next = swap[i].buf1;
+				skip = swap[i].buf1 + swap[i].size;
+			}
+		if (scratch_end > pos && soc_info->scratch_addr < next) {
+			next = soc_info->scratch_addr;
+			skip = scratch_end;
+		}
+		if (next < pos)
+			next = pos; /* pos is within a used area */
+		if (next - pos > best_size) {
+			best = pos;
+			best_size = next - pos;
+		}
+		pos = skip;
+	}
+	*addr = best;
+	*size = best_size;
+	return best_size > 0;
+}
+
+/*
+ * Memory to stage data in for device-side processing: either the area given
+ * by the user (--staging), or the largest free SRAM area.
+ */
+static void get_staging_area(feldev_handle *dev, const char *cmd,
+			     uint32_t *addr, uint32_t *size)
+{
+	if (staging_size) {
+		*addr = staging_addr;
+		*size = staging_size;
+	} else if (!sram_free_area(dev, addr, size)) {
+		pr_fatal("%s: no free SRAM known for %s, please use --staging\n",
+			 cmd, dev->soc_name);
+	}
+}
+
+/*
+ * Measure the transfer tuning data (see soc_tuning) for the device's SoC,
+ * and save it to a file for use with "--tuning". Uploads get timed within
+ * the staging area, which needs to be a DRAM window (--staging, after the
+ * SPL) for testing the larger USB bulk transfer sizes.
+ */
+#define CALIBRATE_BYTES		(1 << 20)	/* upload amount per test */
+#define CALIBRATE_MIN_CHUNK	(16 * 1024)
+#define CALIBRATE_MAX_CHUNK	SOC_TUNING_MAX_CHUNK
+/* the minimum expected rate gets this safety margin to the measured one */
+#define CALIBRATE_RATE_MARGIN	4
+
+static double calibrate_rate(feldev_handle *dev, void *buf, uint32_t addr,
+			     size_t size)
+{
+	double elapsed = 0;
+	size_t total;
+
+	for (total = 0; total < CALIBRATE_BYTES; total += size)
+		elapsed += aw_write_buffer(dev, buf, addr, size, false);
+	return total / elapsed;
+}
+
+/*
+ * The scratch area may extend up to the next area in use by the BROM, as
+ * documented by the SoC's memory layout (see soc_scratch_limit). A write /
+ * readback test can't show that the BROM leaves an area alone, so it only
+ * shrinks that size - to where the first mismatch occurs.
+ */
+static uint32_t calibrate_scratch_size(feldev_handle *dev)
+{
+	uint32_t start = dev->soc_info->scratch_addr;
+	uint32_t size = soc_scratch_limit(dev->soc_info);
+	uint8_t *pattern, *readback;
+	size_t i;
+
+	if (size <= FEL_SCRATCH_SIZE)
+		return 0;
+
+	pattern = malloc(size);
+	readback = malloc(size);
+	if (!pattern || !readback)
+		pr_fatal("calibrate: out of memory\n");
+	for (i = 0; i < size; i++)
+		pattern[i] = i * 13 + (i >> 8);
+	aw_fel_write(dev, pattern, start, size);
+	aw_fel_read(dev, start, readback, size);
+	for (i = 0; i < size && pattern[i] == readback[i]; i++)
+		;
+	free(pattern);
+	free(readback);
+	size = i & ~0xFF;
+	return size > FEL_SCRATCH_SIZE ? size : 0;
+}
+
+static void aw_fel_calibrate(feldev_handle *dev, const char *filename)
+{
+	soc_info_t *soc_info = dev->soc_info;
+	soc_tuning *tuning = &soc_info->tuning;
+	uint32_t stage, stage_size, chunk, best_chunk = 0;
+	double rate, best_rate = 0, rate_off, rate_on;
+	size_t size;
+	void *buf;
+
+	/* start from the (worst case) defaults */
+	memset(tuning, 0, sizeof(*tuning));
+	get_staging_area(dev, "calibrate", &stage, &stage_size);
+	size = stage_size < CALIBRATE_BYTES ? stage_size & ~3 : CALIBRATE_BYTES;
+	if (size < 4096)
+		pr_fatal("calibrate: staging area too small\n");
+	buf = malloc(size);
+	if (!buf)
+		pr_fatal("calibrate: out of memory\n");
+	memset(buf, 0x55, size);
+
+	printf("Uploads to 0x%08X (%zu bytes):\n", stage, size);
+	for (chunk = CALIBRATE_MIN_CHUNK;
+	     chunk <= CALIBRATE_MAX_CHUNK && chunk <= size; chunk *= 2) {
+		tuning->bulk_chunk = chunk;
+		rate = calibrate_rate(dev, buf, stage, size);
+		printf("  USB bulk transfers of %4u KiB: %8.1f KiB/s\n",
+		       chunk / 1024, rate / 1024);
+		if (rate > best_rate) {
+			best_rate = rate;
+			best_chunk = chunk;
+		}
+	}
+	if (best_chunk == 0) {
+		best_rate = calibrate_rate(dev, buf, stage, size);
+		printf("  staging area too small to compare bulk transfer sizes"
+		       " (use --staging with a DRAM window)\n");
+	}
+	tuning->bulk_chunk = best_chunk;
+	tuning->upload_rate = best_rate / CALIBRATE_RATE_MARGIN;
+
+	/*
+	 * The MMU tweak can only be measured while the MMU is enabled, i.e.
+	 * as set up by the BROM or after the SPL: compare uploads with the
+	 * MMU disabled, and (re-)enabled with the optimized attributes.
+	 */
+	if (aw_get_sctlr(dev, soc_info) & 1) {
+		aw_backup_and_disable_mmu(dev, soc_info);
+		rate_off = calibrate_rate(dev, buf, stage, size);
+		aw_restore_and_enable_mmu(dev, soc_info, false);
+		rate_on = calibrate_rate(dev, buf, stage, size);
+		printf("  MMU off: %.1f KiB/s, tweaked: %.1f KiB/s\n",
+		       rate_off / 1024, rate_on / 1024);
+		tuning->mmu_tweak = rate_on > rate_off * 1.05 ? MMU_TWEAK_ON
+							      : MMU_TWEAK_OFF;
+	} else {
+		printf("  MMU is disabled, can't measure the MMU tweak\n");
+	}
+	free(buf);
+
+	tuning->scratch_size = calibrate_scratch_size(dev);
+
+	printf("Tuning for %s: bulk_chunk %u, mmu_tweak %s, scratch_size 0x%X,"
+	       " upload_rate %u\n", dev->soc_name, tuning->bulk_chunk,
+	       tuning->mmu_tweak == MMU_TWEAK_ON ? "on" :
+	       tuning->mmu_tweak == MMU_TWEAK_OFF ? "off" : "default",
+	       tuning->scratch_size, tuning->upload_rate);
+	if (!soc_tuning_save(filename, soc_info))
+		pr_fatal("calibrate: failed to save %s\n", filename);
+}
+
+/*
+ * Compressed memory dumps, using device-side code (thunks/dump_compress.S)
+ * to reduce the amount of data that has to be transferred. The output of
+ * the compressor gets staged either in a free area of SRAM, or in a "spare"
+ * DRAM window specified by the user (--staging).
+ */
+static const uint32_t fel_dump_compress_thunk[] = {
+	#include "thunks/dump_compress.h"
+};
+
+#define DUMP_THUNK_WORDS	ARRAY_SIZE(fel_dump_compress_thunk)
+#define DUMP_PARAM_WORDS	6
+#define DUMP_MAX_BATCH		(16 << 20) /* input per execution, keeps it short */
+#define DUMP_MIN_OUTPUT		(4096 + 1024 + 16) /* worst case for a chunk */
+/* above this, the thunk's chunk pointers would wrap - read the rest as is */
+#define DUMP_THUNK_LIMIT	0xFFFFF000u
+
+void aw_fel_dump_compressed(feldev_handle *dev, uint32_t offset, size_t size,
+			    const char *filename, progress_cb_t callback)
+{
+	soc_info_t *soc_info = dev->soc_info;
+	progress_t *progress = feldev_progress(dev);
+	uint32_t code[DUMP_THUNK_WORDS + DUMP_PARAM_WORDS];
+	uint32_t stage, stage_size, hash_bits, params;
+	uint64_t pos = offset, end = (uint64_t)offset + size;
+	size_t transferred = 0, i;
+	uint32_t *in, *out;
+	file_stream f;
+
+	if ((offset | size) & 3)
+		pr_fatal("dump-compressed: address and length must be "
+			 "word-aligned\n");
+	if (end > 0x100000000ULL)
+		pr_fatal("dump-compressed: range exceeds the address space\n");
+	get_staging_area(dev, "dump-compressed", &stage, &stage_size);
+	if (ranges_overlap(stage, stage_size, offset, size)
+	    || ranges_overlap(soc_info->scratch_addr, fel_scratch_size(dev),
+			      offset, size)
+	    || ranges_overlap(soc_info->scratch_addr, fel_scratch_size(dev),
+			      stage, stage_size))
+		pr_fatal("dump-compressed: range 0x%08X-0x%08llX conflicts with "
+			 "the staging area 0x%08X-0x%08X or scratch area\n",
+			 offset, (unsigned long long)end, stage,
+			 stage + stage_size);
+
+	/* larger hash tables (better compression) for DRAM windows */
+	hash_bits = stage_size >= 256 * 1024 ? 12 : 8;
+	if (stage & 3 || stage_size < (4u << hash_bits) + DUMP_MIN_OUTPUT)
+		pr_fatal("dump-compressed: bad staging area 0x%08X-0x%08X\n",
+			 stage, stage + stage_size);
+	pr_info("Compressing via staging area at 0x%08X (%u bytes)\n",
+		stage, stage_size);
+
+	in = malloc(stage_size);
+	out = malloc(size < DUMP_MAX_BATCH ? size : DUMP_MAX_BATCH);
+	if (!in || !out)
+		pr_fatal("Failed to allocate dump buffers\n");
+	open_output(&f, filename);
+
+	for (i = 0; i < DUMP_THUNK_WORDS; i++)
+		code[i] = htole32(fel_dump_compress_thunk[i]);
+	params = soc_info->scratch_addr + DUMP_THUNK_WORDS * sizeof(uint32_t);
+	if (callback) {
+		progress_set_callback(progress, callback);
+		progress_begin(progress, size);
+	}
+
+	while (pos < end) {
+		uint64_t limit = end < DUMP_THUNK_LIMIT ? end : DUMP_THUNK_LIMIT;
+		uint32_t batch_end, result[3], reached, out_size;
+
+		if (pos >= limit) {
+			aw_fel_read(dev, pos, out, end - pos);
+			write_output(&f, filename, out, end - pos);
+			transferred += end - pos;
+			if (callback)
+				progress_add(progress, end - pos);
+			break;
+		}
+		batch_end = limit - pos > DUMP_MAX_BATCH ? pos + DUMP_MAX_BATCH
+							 : limit;
+
+		code[DUMP_THUNK_WORDS + 0] = htole32(pos);
+		code[DUMP_THUNK_WORDS + 1] = htole32(batch_end);
+		code[DUMP_THUNK_WORDS + 2] = htole32(stage + (4 << hash_bits));
+		code[DUMP_THUNK_WORDS + 3] = htole32((stage + stage_size) & ~3);
+		code[DUMP_THUNK_WORDS + 4] = htole32(stage);
+		code[DUMP_THUNK_WORDS + 5] = htole32(32 - hash_bits);
+		aw_fel_write(dev, code, soc_info->scratch_addr, sizeof(code));
+		aw_fel_execute(dev, soc_info->scratch_addr);
+		aw_fel_read(dev, params, result, sizeof(result));
+
+		reached = le32toh(result[0]);
+		out_size = le32toh(result[2]) - (stage + (4 << hash_bits));
+		if (reached <= pos || reached > batch_end
+		    || out_size > stage_size)
+			pr_fatal("dump-compressed: unexpected result from device "
+				 "(0x%08X, %u bytes)\n", reached, out_size);
+
+		aw_fel_read(dev, stage + (4 << hash_bits), in, out_size);
+		if (!dump_decompress(in, out_size / 4, out, (reached - pos) / 4))
+			pr_fatal("dump-compressed: corrupt data for "
+				 "0x%08X-0x%08X\n", (uint32_t)pos, reached);
+		write_output(&f, filename, out, reached - pos);
+		transferred += out_size;
+		if (callback)
+			progress_add(progress, reached - pos);
+		pos = reached;
+	}
+
+	if (!file_close(&f))
+		pr_fatal("Write error on \"%s\": %s\n", filename, strerror(errno));
+	free(out);
+	free(in);
+	pr_info("Dumped %zu bytes, transferring %zu (%.1f%%)\n", size,
+		transferred, size ? 100. * transferred / size : 0.);
+}
+
+/*
+ * Search memory for a byte pattern, using device-side code from
+ * thunks/memsearch.S. The range gets scanned in batches, to keep each
+ * execution well below the USB timeout even at low CPU clock rates.
+ */
+static const uint32_t fel_memsearch_thunk[] = {
+	#include "thunks/memsearch.h"
+};
+
+#define FIND_THUNK_WORDS	ARRAY_SIZE(fel_memsearch_thunk)
+#define FIND_PARAM_WORDS	20	/* up to (excluding) the results */
+#define FIND_MAX_PATTERN	32
+#define FIND_MAX_MATCHES	32
+/* byte comparisons per batch (worst case: positions times pattern length) */
+#define FIND_MAX_BATCH		(8 << 20)
+
+/* "0x"-prefixed hex digits, or plain text. Returns the number of bytes */
+static size_t parse_find_pattern(const char *arg, uint8_t *bytes)
+{
+	size_t len = 0;
+
+	if (strncmp(arg, "0x", 2) != 0) {
+		len = strlen(arg);
+		if (len == 0 || len > FIND_MAX_PATTERN)
+			pr_fatal("find: pattern must have 1-%d bytes\n",
+				 FIND_MAX_PATTERN);
+		memcpy(bytes, arg, len);
+		return len;
+	}
+	for (arg += 2; isxdigit(arg[0]) && isxdigit(arg[1]); arg += 2) {
+		if (len >= FIND_MAX_PATTERN)
+			pr_fatal("find: pattern must have 1-%d bytes\n",
+				 FIND_MAX_PATTERN);
+		sscanf(arg, "%2hhx", &bytes[len++]);
+	}
+	if (*arg || len == 0)
+		pr_fatal("find: expected an even number of hex digits\n");
+	return len;
+}
+
+void aw_fel_find(feldev_handle *dev, uint32_t offset, size_t size,
+		 const char *pattern, const char *mask)
+{
+	uint32_t scratch = dev->soc_info->scratch_addr;
+	uint32_t code[FIND_THUNK_WORDS + FIND_PARAM_WORDS];
+	uint32_t result[2 + FIND_MAX_MATCHES];
+	uint8_t *param = (uint8_t *)(code + FIND_THUNK_WORDS);
+	uint8_t pat[FIND_MAX_PATTERN], msk[FIND_MAX_PATTERN];
+	uint64_t pos = offset, end = (uint64_t)offset + size;
+	size_t plen, found = 0, i;
+	uint32_t max_batch;
+
+	plen = parse_find_pattern(pattern, pat);
+	/* a partial match may compare the whole pattern at each position */
+	max_batch = FIND_MAX_BATCH / plen;
+	memset(msk, 0xFF, sizeof(msk));
+	if (mask && parse_find_pattern(mask, msk) != plen)
+		pr_fatal("find: mask and pattern length differ\n");
+	for (i = 0; i < plen; i++)
+		pat[i] &= msk[i];
+	if (end > 0x100000000ULL)
+		pr_fatal("find: range exceeds the address space\n");
+
+	for (i = 0; i < FIND_THUNK_WORDS; i++)
+		code[i] = htole32(fel_memsearch_thunk[i]);
+	memset(param, 0, FIND_PARAM_WORDS * sizeof(uint32_t));
+	memcpy(param + 16, pat, plen);
+	memcpy(param + 48, msk, plen);
+	code[FIND_THUNK_WORDS + 2] = htole32(plen);
+
+	while (end - pos >= plen && found < FIND_MAX_MATCHES) {
+		uint32_t batch = end - pos > max_batch ? max_batch : end - pos;
+		uint32_t count, next;
+
+		code[FIND_THUNK_WORDS + 0] = htole32(pos);
+		code[FIND_THUNK_WORDS + 1] = htole32(batch);
+		code[FIND_THUNK_WORDS + 3] = htole32(FIND_MAX_MATCHES - found);
+		fel_run_thunk(dev, code, sizeof(code), result, sizeof(result));
+
+		count = le32toh(result[0]);
+		next = le32toh(result[1]);
+		if (count > FIND_MAX_MATCHES - found || next <= pos
+		    || next > pos + batch - plen + 1)
+			pr_fatal("find: unexpected result from device "
+				 "(%u, 0x%08X)\n", count, next);
+		for (i = 0; i < count; i++) {
+			uint32_t match = le32toh(result[2 + i]);
+			/* the thunk's own copy of the pattern doesn't count */
+			if (match >= scratch && match < scratch + fel_scratch_size(dev))
+				continue;
+			printf("0x%08X\n", match);
+			found++;
+		}
+		pos = next;
+	}
+	if (found >= FIND_MAX_MATCHES && end - pos >= plen) {
+		pr_info("find: stopped after %d matches\n", FIND_MAX_MATCHES);
+	} else if (found == 0) {
+		pr_info("find: no matches\n");
+	}
+}
+
+/*
+ * SPI NOR flash commands, see fel_spiflash.c. They use the staging area
+ * for the SPI command lists and data.
+ */
+static spiflash_t *spiflash_open_staged(feldev_handle *dev, const char *cmd)
+{
+	uint32_t stage, stage_size;
+	spiflash_t *flash;
+
+	get_staging_area(dev, cmd, &stage, &stage_size);
+	flash = spiflash_open(dev, stage, stage_size);
+	pr_info("SPI flash ID %06X, %u KiB\n", spiflash_id(flash),
+		spiflash_size(flash) >> 10);
+	return flash;
+}
+
+static void spiflash_print_stats(const char *cmd, spiflash_stats stats)
+{
+	pr_info("%s: %zu of %zu sectors/blocks needed erasing, "
+		"%zu pages programmed\n", cmd, stats.erased, stats.units,
+		stats.pages);
+}
+
+void aw_fel_spiflash_info(feldev_handle *dev)
+{
+	spiflash_t *flash = spiflash_open_staged(dev, "spiflash-info");
+
+	printf("Manufacturer: %02X, device: %04X, size: %u bytes\n",
+	       spiflash_id(flash) >> 16, spiflash_id(flash) & 0xFFFF,
+	       spiflash_size(flash));
+	spiflash_close(flash);
+}
+
+void aw_fel_spiflash_read(feldev_handle *dev, uint32_t offset, size_t size,
+			  const char *filename, progress_cb_t callback)
+{
+	spiflash_t *flash = spiflash_open_staged(dev, "spiflash-read");
+	void *buf = malloc(size);
+	file_stream f;
+
+	if (!buf)
+		pr_fatal("Failed to allocate %zu bytes\n", size);
+	spiflash_read(flash, offset, buf, size, callback);
+	spiflash_close(flash);
+
+	open_output(&f, filename);
+	write_output(&f, filename, buf, size);
+	if (!file_close(&f))
+		pr_fatal("Write error on \"%s\": %s\n", filename, strerror(errno));
+	free(buf);
+}
+
+void aw_fel_spiflash_write(feldev_handle *dev, uint32_t offset,
+			   const char *filename, progress_cb_t callback)
+{
+	spiflash_t *flash = spiflash_open_staged(dev, "spiflash-write");
+	file_buffer file;
+
+	load_file(&file, filename);
+	spiflash_print_stats("spiflash-write",
+		spiflash_write(flash, offset, file.data, file.size, callback));
+	spiflash_close(flash);
+	file_release(&file);
+}
+
+void aw_fel_spiflash_erase(feldev_handle *dev, uint32_t offset, size_t size,
+			   progress_cb_t callback)
+{
+	spiflash_t *flash = spiflash_open_staged(dev, "spiflash-erase");
+
+	spiflash_print_stats("spiflash-erase",
+		spiflash_erase(flash, offset, size, callback));
+	spiflash_close(flash);
+}
+
 /* check buffer for magic "#=uEnv", indicating uEnv.txt compatible format */
 static bool is_uEnv(void *buffer, size_t size)
 {
@@ -893,6 +2058,120 @@ static bool is_uEnv(void *buffer, size_t size)
 	return memcmp(buffer, "#=uEnv", 6) == 0;
 }
 
+/*
+ * Prepare a sparse transfer for a file buffer: Android sparse images get
+ * expanded, everything else is scanned for runs of constant data.
+ */
+static void prepare_sparse(sparse_image *img, const char *filename,
+			   const uint8_t *buf, size_t size, uint32_t offset)
+{
+	const char *err;
+
+	if (is_android_sparse(buf, size)) {
+		err = sparse_parse_android(img, buf, size, offset);
+		if (err)
+			pr_fatal("Android sparse image \"%s\": %s\n",
+				 filename, err);
+		pr_info("%s: Android sparse image, %zu bytes of data, "
+			"%zu bytes fill\n", filename,
+			img->data_bytes, img->fill_bytes);
+	} else {
+		err = sparse_scan(img, buf, size, offset);
+		if (err)
+			pr_fatal("Failed to scan \"%s\": %s\n", filename, err);
+		if (img->fill_bytes > 0)
+			pr_info("%s: skipping %zu bytes of constant data\n",
+				filename, img->fill_bytes);
+	}
+}
+
+/* a file to upload, loaded into memory (for "write*", "multi*" and "run") */
+typedef struct {
+	file_buffer file;
+	uint8_t *buf;		/* file.data, for short */
+	size_t size;
+	uint32_t offset;
+	sparse_image img;
+} upload_file;
+
+/* load file for an upload, returns the number of bytes to be transferred */
+static size_t upload_load(upload_file *file, const char *filename,
+			  uint32_t offset)
+{
+	file->offset = offset;
+	load_file(&file->file, filename);
+	file->buf = file->file.data;
+	file->size = file->file.size;
+	/* the whole file gets transferred, have it paged in meanwhile */
+	file_buffer_advise(&file->file, 0, file->size, FILE_WILLNEED);
+	sparse_init(&file->img);
+	if (sparse_upload && file->size > 0) {
+		prepare_sparse(&file->img, filename, file->buf, file->size,
+			       file->offset);
+		return sparse_size(&file->img);
+	}
+	return file->size;
+}
+
+static void upload_free(upload_file *file)
+{
+	sparse_free(&file->img);
+	file_release(&file->file);
+	file->buf = NULL;
+}
+
+/*
+ * Transfer (previously loaded) files, sharing a common progress status.
+ * Extents from all files get collected and uploaded together.
+ */
+static void upload_files(feldev_handle *dev, upload_file *files, size_t count,
+			 bool progress)
+{
+	double start = metrics_begin();
+	size_t i, extents = 0, bytes = 0;
+
+	for (i = 0; i < count; i++)
+		extents += sparse_upload ? files[i].img.count : 1;
+	sparse_extent *extent = calloc(extents ? extents : 1,
+				       sizeof(sparse_extent));
+	if (!extent)
+		pr_fatal("Failed to allocate upload extents\n");
+	extents = 0;
+	for (i = 0; i < count; i++) {
+		if (files[i].size == 0)
+			continue;
+		if (sparse_upload) {
+			memcpy(extent + extents, files[i].img.extent,
+			       files[i].img.count * sizeof(sparse_extent));
+			extents += files[i].img.count;
+		} else {
+			extent[extents].addr = files[i].offset;
+			extent[extents].size = files[i].size;
+			extent[extents].data = files[i].buf;
+			extents++;
+		}
+	}
+	aw_write_extents(dev, extent, extents, progress);
+	free(extent);
+	for (i = 0; i < count; i++)
+		bytes += files[i].size;
+	metrics_span("upload", start, bytes, "%zu file(s) @ 0x%08X",
+		     count, count ? files[0].offset : 0);
+
+	for (i = 0; i < count; i++) {
+		uint8_t *buf = files[i].buf;
+		size_t size = files[i].size;
+		uint32_t offset = files[i].offset;
+		if (size > 0) {
+			/* If we transferred a script, try to inform U-Boot about its address. */
+			if (get_image_type(buf, size) == IH_TYPE_SCRIPT)
+				pass_fel_information(dev, offset, 0);
+			if (is_uEnv(buf, size)) /* uEnv-style data */
+				pass_fel_information(dev, offset, size);
+		}
+	}
+}
+
 /* private helper function, gets used for "write*" and "multi*" transfers */
 static unsigned int file_upload(feldev_handle *dev, size_t count,
 				size_t argc, char **argv, progress_cb_t callback)
@@ -901,33 +2180,672 @@ static unsigned int file_upload(feldev_handle *dev, size_t count,
 		pr_fatal("error: too few arguments for uploading %zu files\n",
 			 count);
 
-	/* get all file sizes, keeping track of total bytes */
-	size_t size = 0;
+	/* make sure all files exist (and are regular files) */
 	unsigned int i;
 	for (i = 0; i < count; i++)
-		size += file_size(argv[i * 2 + 1]);
+		file_size(argv[i * 2 + 1]);
 
-	progress_start(callback, size); /* set total size and progress callback */
+	/* load all files, keeping track of total bytes */
+	upload_file *files = calloc(count, sizeof(upload_file));
+	size_t total = 0;
 
-	/* now transfer each file in turn */
-	for (i = 0; i < count; i++) {
-		void *buf = load_file(argv[i * 2 + 1], &size);
-		if (size > 0) {
-			uint32_t offset = strtoul(argv[i * 2], NULL, 0);
-			aw_write_buffer(dev, buf, offset, size, callback != NULL);
+	if (!files)
+		pr_fatal("Failed to allocate upload list\n");
+	for (i = 0; i < count; i++)
+		total += upload_load(&files[i], argv[i * 2 + 1],
+				     strtoul(argv[i * 2], NULL, 0));
 
-			/* If we transferred a script, try to inform U-Boot about its address. */
-			if (get_image_type(buf, size) == IH_TYPE_SCRIPT)
-				pass_fel_information(dev, offset, 0);
-			if (is_uEnv(buf, size)) /* uEnv-style data */
-				pass_fel_information(dev, offset, size);
-		}
-		free(buf);
+	if (callback) { /* set progress callback and total size */
+		progress_t *progress = feldev_progress(dev);
+		progress_set_callback(progress, callback);
+		progress_begin(progress, total);
 	}
 
+	/* now transfer the files */
+	upload_files(dev, files, count, callback != NULL);
+
+	for (i = 0; i < count; i++)
+		upload_free(&files[i]);
+	free(files);
+
 	return i; /* return number of files that were processed */
 }
 
+/*
+ * Compile a .fex file into its binary form (like "fex2bin" does) and
+ * upload the result directly, without going through a temporary file.
+ */
+static void aw_fel_write_fex(feldev_handle *dev, uint32_t offset,
+			     const char *filename)
+{
+	struct script *script = script_new();
+	size_t sections, entries, size;
+	void *bin;
+	FILE *in;
+
+	if (!script)
+		pr_fatal("Failed to allocate script\n");
+	in = fopen(filename, "r");
+	if (!in)
+		pr_fatal("%s: %s\n", filename, strerror(errno));
+	if (!script_parse_fex(in, filename, script))
+		pr_fatal("%s: failed to parse .fex file\n", filename);
+	fclose(in);
+
+	size = script_bin_size(script, &sections, &entries);
+	bin = calloc(1, size);
+	if (!bin)
+		pr_fatal("Failed to allocate %zu bytes for script.bin\n", size);
+	if (!script_generate_bin(bin, size, script, sections, entries))
+		pr_fatal("%s: failed to generate script.bin\n", filename);
+	script_delete(script);
+
+	pr_info("%s: %zu bytes of script.bin data\n", filename, size);
+	double start = metrics_begin();
+	aw_write_buffer(dev, bin, offset, size, false);
+	metrics_span("upload", start, size, "fex @ 0x%08X", offset);
+	free(bin);
+}
+
+/*
+ * Session manifests ("recipes") for the "run" command
+ *
+ * A recipe is a text file listing one action per line, e.g.
+ *
+ *	# boot a kernel via U-Boot's boot script
+ *	spl	u-boot-sunxi-with-spl.bin
+ *	write	0x42000000 zImage
+ *	write	0x43000000 sun7i-a20-cubietruck.dtb
+ *	write	0x43100000 boot.scr
+ *	exec	0x4a000000
+ *
+ * Actions are: spl file, uboot file, write addr file, writel addr value,
+ * fill addr length value, clear addr length, exec addr and reset64 addr.
+ * Everything following '#' is a comment; file names may be put in double
+ * quotes, and relative ones are taken relative to the recipe's directory.
+ *
+ * All files get loaded and checked before the device is accessed. Runs of
+ * consecutive "write" actions are transferred as a single batch (see
+ * aw_write_extents), so the order of these may change.
+ */
+typedef enum {
+	RECIPE_SPL,		/* file, SPL plus optional U-Boot image */
+	RECIPE_UBOOT,		/* like RECIPE_SPL, with U-Boot autostart */
+	RECIPE_WRITE,		/* addr, file */
+	RECIPE_WRITEL,		/* addr, value */
+	RECIPE_FILL,		/* addr, length, value */
+	RECIPE_EXEC,		/* addr */
+	RECIPE_RESET64,		/* addr */
+} recipe_action;
+
+typedef struct {
+	recipe_action action;
+	unsigned int line;
+	uint32_t addr, length, value;
+	upload_file file;
+} recipe_step;
+
+typedef struct {
+	const char *filename;
+	recipe_step *step;
+	size_t count;
+	size_t total;		/* total byte count of all "write" steps */
+} recipe;
+
+#define RECIPE_MAX_ARGS		4	/* action name + 3 arguments */
+
+static const struct {
+	const char *name;
+	recipe_action action;
+	int args;		/* number of arguments */
+	bool has_file;		/* (last) argument is a file name */
+} recipe_actions[] = {
+	{ "spl",	RECIPE_SPL,	1, true },
+	{ "uboot",	RECIPE_UBOOT,	1, true },
+	{ "write",	RECIPE_WRITE,	2, true },
+	{ "writel",	RECIPE_WRITEL,	2, false },
+	{ "fill",	RECIPE_FILL,	3, false },
+	{ "clear",	RECIPE_FILL,	2, false },
+	{ "exec",	RECIPE_EXEC,	1, false },
+	{ "exe",	RECIPE_EXEC,	1, false },
+	{ "execute",	RECIPE_EXEC,	1, false },
+	{ "reset64",	RECIPE_RESET64,	1, false },
+};
+
+/* error message prefixed by recipe file name and line number, then exit */
+#define recipe_fatal(r, line, ...) \
+	do { \
+		pr_error("%s:%u: ", (r)->filename, line); \
+		pr_fatal(__VA_ARGS__); \
+	} while (0)
+
+/* split line into (whitespace separated) arguments, modifying it */
+static int recipe_split(char *line, char **argv, int max_args,
+			const recipe *r, unsigned int lineno)
+{
+	int argc = 0;
+	char *p = line;
+
+	for (;;) {
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			break;
+		if (argc >= max_args)
+			recipe_fatal(r, lineno, "too many arguments\n");
+		if (*p == '"') {
+			argv[argc++] = ++p;
+			p = strchr(p, '"');
+			if (!p)
+				recipe_fatal(r, lineno, "missing closing quote\n");
+		} else {
+			argv[argc++] = p;
+			while (*p && !isspace((unsigned char)*p) && *p != '#')
+				p++;
+			if (*p == '#') { /* comment directly after argument */
+				*p = '\0';
+				break;
+			}
+		}
+		if (*p == '\0')
+			break;
+		*p++ = '\0';
+	}
+	return argc;
+}
+
+static uint32_t recipe_number(const recipe *r, unsigned int lineno,
+			      const char *arg)
+{
+	char *end;
+	unsigned long long value;
+
+	errno = 0;
+	value = strtoull(arg, &end, 0);
+	if (errno || end == arg || *end || value > 0xFFFFFFFF)
+		recipe_fatal(r, lineno, "invalid number '%s'\n", arg);
+	return value;
+}
+
+/* load a file referenced by the recipe (relative to the recipe directory) */
+static char *recipe_path(const recipe *r, const char *name)
+{
+	const char *slash = strrchr(r->filename, '/');
+	size_t dirlen = slash && name[0] != '/' ? slash - r->filename + 1 : 0;
+	char *path = malloc(dirlen + strlen(name) + 1);
+
+	if (!path)
+		pr_fatal("Failed to allocate path name\n");
+	memcpy(path, r->filename, dirlen);
+	strcpy(path + dirlen, name);
+	return path;
+}
+
+/*
+ * Check step (with its data already loaded) for validity, keeping track of
+ * the U-Boot memory region - like aw_write_buffer() would, at runtime.
+ */
+static void recipe_check(recipe *r, recipe_step *step,
+			 uint32_t *uboot_addr, uint32_t *uboot_len)
+{
+	uint32_t load_addr, data_size;
+	upload_file *file = &step->file;
+
+	switch (step->action) {
+	case RECIPE_SPL:
+	case RECIPE_UBOOT:
+		spl_check_header(file->buf, file->size);
+		if (file->size > SPL_LEN_LIMIT
+		    && uboot_image_check(file->buf + SPL_LEN_LIMIT,
+					 file->size - SPL_LEN_LIMIT,
+					 &load_addr, &data_size)) {
+			*uboot_addr = load_addr;
+			*uboot_len = data_size;
+		} else if (step->action == RECIPE_UBOOT) {
+			recipe_fatal(r, step->line, "no U-Boot image found\n");
+		}
+		return;
+	case RECIPE_WRITE:
+		step->length = file->size;
+		break;
+	case RECIPE_WRITEL:
+		step->length = sizeof(uint32_t);
+		break;
+	case RECIPE_FILL:
+		if (step->value > 0xFF)
+			recipe_fatal(r, step->line, "fill value must be a byte\n");
+		break;
+	default:
+		return;
+	}
+	if ((uint64_t)step->addr + step->length > 0x100000000ULL)
+		recipe_fatal(r, step->line, "range exceeds the address space\n");
+	if (*uboot_len > 0 && step->addr <= *uboot_addr + *uboot_len
+			   && step->addr + step->length >= *uboot_addr)
+		recipe_fatal(r, step->line, "request 0x%08X-0x%08X overlaps "
+			     "U-Boot at 0x%08X-0x%08X\n", step->addr,
+			     step->addr + step->length,
+			     *uboot_addr, *uboot_addr + *uboot_len);
+}
+
+/* Parse recipe file, and load (and check) all payloads */
+static recipe *recipe_load(const char *filename)
+{
+	recipe *r = calloc(1, sizeof(recipe));
+	uint32_t uboot_addr = 0, uboot_len = 0;
+	unsigned int lineno = 0;
+	size_t alloc = 0;
+	char line[1024];
+	FILE *f;
+
+	if (!r)
+		pr_fatal("Failed to allocate recipe\n");
+	r->filename = filename;
+	f = fopen(filename, "r");
+	if (!f)
+		pr_fatal("Can't open recipe '%s': %s\n",
+			 filename, strerror(errno));
+
+	while (fgets(line, sizeof(line), f)) {
+		char *argv[RECIPE_MAX_ARGS];
+		size_t i;
+		int argc;
+
+		lineno++;
+		if (!strchr(line, '\n') && !feof(f))
+			recipe_fatal(r, lineno, "line too long\n");
+		argc = recipe_split(line, argv, RECIPE_MAX_ARGS, r, lineno);
+		if (argc == 0)
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(recipe_actions); i++)
+			if (strcmp(argv[0], recipe_actions[i].name) == 0)
+				break;
+		if (i >= ARRAY_SIZE(recipe_actions))
+			recipe_fatal(r, lineno, "unknown action '%s'\n", argv[0]);
+		if (argc - 1 != recipe_actions[i].args)
+			recipe_fatal(r, lineno, "'%s' expects %d argument(s)\n",
+				     argv[0], recipe_actions[i].args);
+
+		if (r->count >= alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			r->step = realloc(r->step, alloc * sizeof(recipe_step));
+			if (!r->step)
+				pr_fatal("Failed to allocate recipe steps\n");
+		}
+		recipe_step *step = &r->step[r->count++];
+		memset(step, 0, sizeof(*step));
+		step->action = recipe_actions[i].action;
+		step->line = lineno;
+		if (recipe_actions[i].args > 1 || !recipe_actions[i].has_file)
+			step->addr = recipe_number(r, lineno, argv[1]);
+		if (recipe_actions[i].has_file) {
+			char *path = recipe_path(r, argv[argc - 1]);
+			file_size(path); /* make sure it's a regular file */
+			size_t bytes = upload_load(&step->file, path, step->addr);
+			if (step->action == RECIPE_WRITE)
+				r->total += bytes;
+			free(path);
+		} else if (step->action == RECIPE_FILL) {
+			step->length = recipe_number(r, lineno, argv[2]);
+			if (argc > 3)
+				step->value = recipe_number(r, lineno, argv[3]);
+		} else if (step->action == RECIPE_WRITEL) {
+			step->value = recipe_number(r, lineno, argv[2]);
+		}
+		recipe_check(r, step, &uboot_addr, &uboot_len);
+	}
+	fclose(f);
+	pr_info("%s: %zu steps, %zu bytes to write\n",
+		filename, r->count, r->total);
+	return r;
+}
+
+static void recipe_free(recipe *r)
+{
+	size_t i;
+
+	if (!r)
+		return;
+	for (i = 0; i < r->count; i++)
+		upload_free(&r->step[i].file);
+	free(r->step);
+	free(r);
+}
+
+/*
+ * Execute recipe. Returns true if U-Boot should be started afterwards,
+ * *stop gets set for actions that end processing (reset64).
+ */
+static bool recipe_run(feldev_handle *dev, recipe *r, progress_cb_t callback,
+		       bool *stop)
+{
+	bool autostart = false, progress_started = false;
+	size_t i, j, k;
+
+	for (i = 0; i < r->count; i++) {
+		recipe_step *step = &r->step[i];
+
+		switch (step->action) {
+		case RECIPE_SPL:
+		case RECIPE_UBOOT:
+			spl_and_uboot(dev, step->file.buf, step->file.size);
+			if (step->action == RECIPE_UBOOT)
+				autostart = uboot_entry > 0 && uboot_size > 0;
+			break;
+		case RECIPE_WRITE: {
+			if (callback && !progress_started) {
+				/* common progress status for all "write" steps */
+				progress_t *progress = feldev_progress(dev);
+				progress_set_callback(progress, callback);
+				progress_begin(progress, r->total);
+				progress_started = true;
+			}
+			/* collect consecutive "write" steps into one batch */
+			for (j = i + 1; j < r->count; j++)
+				if (r->step[j].action != RECIPE_WRITE)
+					break;
+			upload_file *files = calloc(j - i, sizeof(upload_file));
+			if (!files)
+				pr_fatal("Failed to allocate upload list\n");
+			for (k = i; k < j; k++)
+				files[k - i] = r->step[k].file;
+			upload_files(dev, files, j - i, callback != NULL);
+			free(files);
+			i = j - 1;
+			break;
+		}
+		case RECIPE_WRITEL:
+			fel_writel(dev, step->addr, step->value);
+			break;
+		case RECIPE_FILL:
+			aw_fel_fill(dev, step->addr, step->length, step->value);
+			break;
+		case RECIPE_EXEC:
+			aw_exec(dev, step->addr);
+			break;
+		case RECIPE_RESET64:
+			aw_rmr_request(dev, step->addr, true);
+			*stop = true;
+			return false; /* cancels U-Boot autostart */
+		}
+	}
+	return autostart;
+}
+
+/*
+ * Payload bundles (see fel_bundle.h) are recipes compiled into a single
+ * file, with variants for different SoCs: "make-bundle" takes pairs of a
+ * SoC ID ("any" for a fallback) and a recipe, and "run" accepts bundles
+ * in place of recipes.
+ */
+static void bundle_add_recipe(bundle_writer *w, recipe *r)
+{
+	uint32_t load_addr, data_size, flags;
+	sparse_extent extent;
+	const char *err;
+	size_t i;
+
+	for (i = 0; i < r->count; i++) {
+		recipe_step *step = &r->step[i];
+		upload_file *file = &step->file;
+
+		switch (step->action) {
+		case RECIPE_SPL:
+		case RECIPE_UBOOT:
+			extent = (sparse_extent){
+				.addr = 0, .data = file->buf,
+				.size = spl_check_header(file->buf, file->size),
+			};
+			bundle_add_step(w, BUNDLE_SPL, 0, 0, 0, 0);
+			bundle_add_extents(w, &extent, 1);
+			/* recipe_load() has checked the U-Boot image already */
+			if (file->size <= SPL_LEN_LIMIT
+			    || !uboot_image_check(file->buf + SPL_LEN_LIMIT,
+						  file->size - SPL_LEN_LIMIT,
+						  &load_addr, &data_size))
+				break;
+			extent = (sparse_extent){
+				.addr = load_addr, .size = data_size,
+				.data = file->buf + SPL_LEN_LIMIT + HEADER_SIZE,
+			};
+			flags = step->action == RECIPE_UBOOT ? BUNDLE_AUTOSTART : 0;
+			bundle_add_step(w, BUNDLE_UBOOT, flags, load_addr,
+					data_size, 0);
+			bundle_add_extents(w, &extent, 1);
+			break;
+		case RECIPE_WRITE:
+			flags = 0;
+			if (get_image_type(file->buf, file->size) == IH_TYPE_SCRIPT)
+				flags |= BUNDLE_SCRIPT;
+			if (is_uEnv(file->buf, file->size))
+				flags |= BUNDLE_UENV;
+			/* precompute the sparse extents, unless --sparse did */
+			if (file->img.count == 0 && file->size > 0) {
+				err = sparse_scan(&file->img, file->buf,
+						  file->size, file->offset);
+				if (err)
+					recipe_fatal(r, step->line, "%s\n", err);
+			}
+			bundle_add_step(w, BUNDLE_WRITE, flags, file->offset,
+					file->size, 0);
+			bundle_add_extents(w, file->img.extent, file->img.count);
+			break;
+		case RECIPE_WRITEL:
+			bundle_add_step(w, BUNDLE_WRITEL, 0, step->addr, 0,
+					step->value);
+			break;
+		case RECIPE_FILL:
+			bundle_add_step(w, BUNDLE_FILL, 0, step->addr,
+					step->length, step->value);
+			break;
+		case RECIPE_EXEC:
+			bundle_add_step(w, BUNDLE_EXEC, 0, step->addr, 0, 0);
+			break;
+		case RECIPE_RESET64:
+			bundle_add_step(w, BUNDLE_RESET64, 0, step->addr, 0, 0);
+			break;
+		}
+	}
+}
+
+static void make_bundle(const char *filename, int argc, char **argv)
+{
+	bundle_writer *w = bundle_writer_new();
+	recipe **r = calloc(argc / 2 + 1, sizeof(recipe *));
+	uint32_t soc_id;
+	int i;
+
+	if (!r)
+		pr_fatal("Failed to allocate recipe list\n");
+	if (argc < 2 || argc % 2)
+		pr_fatal("make-bundle: expecting pairs of SoC ID and recipe\n");
+	for (i = 0; i < argc / 2; i++) {
+		soc_id = strcmp(argv[2 * i], "any") == 0 ? 0
+			 : strtoul(argv[2 * i], NULL, 0);
+		r[i] = recipe_load(argv[2 * i + 1]);
+		bundle_add_variant(w, soc_id);
+		bundle_add_recipe(w, r[i]);
+	}
+	if (!bundle_save(w, filename))
+		pr_fatal("make-bundle: %s: %s\n", filename, strerror(errno));
+	for (i = 0; i < argc / 2; i++)
+		recipe_free(r[i]);
+	free(r);
+	bundle_writer_free(w);
+}
+
+static void load_bundle(bundle_t *b, const char *filename)
+{
+	const char *err = bundle_open(b, filename);
+
+	if (err)
+		pr_fatal("Bundle '%s': %s\n", filename, err);
+}
+
+static const char *bundle_action_names[] = {
+	[BUNDLE_SPL] = "spl", [BUNDLE_UBOOT] = "uboot",
+	[BUNDLE_WRITE] = "write", [BUNDLE_WRITEL] = "writel",
+	[BUNDLE_FILL] = "fill", [BUNDLE_EXEC] = "exec",
+	[BUNDLE_RESET64] = "reset64",
+};
+
+/* list the bundle's contents, and verify the payload hashes */
+static void bundle_info(const char *filename)
+{
+	bundle_t b;
+	soc_name_t soc_name;
+	uint32_t i, j, k;
+	long bad;
+
+	load_bundle(&b, filename);
+	printf("%s: %u variant(s), %zu bytes\n", filename,
+	       le32toh(b.header->variants), b.size);
+	for (i = 0; i < le32toh(b.header->variants); i++) {
+		const bundle_variant *v = &b.variant[i];
+		const bundle_step *step = b.step + le32toh(v->first_step);
+
+		if (v->soc_id)
+			get_soc_name_from_id(soc_name, le32toh(v->soc_id));
+		else
+			strcpy(soc_name, "any");
+		printf("%s:\n", soc_name);
+		for (j = 0; j < le32toh(v->step_count); j++) {
+			uint32_t first = le32toh(step[j].first_extent);
+			size_t data = 0, fill = 0;
+
+			for (k = 0; k < le32toh(step[j].extent_count); k++) {
+				sparse_extent e = bundle_get_extent(&b,
+							&b.extent[first + k]);
+				if (e.data)
+					data += e.size;
+				else
+					fill += e.size;
+			}
+			printf("  %-8s", bundle_action_names[
+			       le32toh(step[j].action)]);
+			if (le32toh(step[j].action) != BUNDLE_SPL)
+				printf(" 0x%08X", le32toh(step[j].addr));
+			if (data || fill)
+				printf(" (%zu bytes data, %zu bytes fill)",
+				       data, fill);
+			putchar('\n');
+		}
+	}
+	bad = bundle_verify(&b);
+	if (bad >= 0)
+		pr_fatal("%s: hash mismatch for payload at 0x%08X\n", filename,
+			 le32toh(b.extent[bad].addr));
+	bundle_close(&b);
+}
+
+/*
+ * Execute the bundle's variant for the device. As for recipes, returns true
+ * if U-Boot should be started afterwards, and *stop gets set by "reset64".
+ */
+static bool bundle_run(feldev_handle *dev, bundle_t *b, progress_cb_t callback,
+		       bool *stop)
+{
+	const bundle_variant *v = bundle_find_variant(b,
+						dev->soc_version.soc_id);
+	bool autostart = false, progress_started = false;
+	const bundle_step *step;
+	uint32_t i, j, k, n, count;
+	size_t total = 0;
+
+	if (!v)
+		pr_fatal("Bundle has no variant for %s\n", dev->soc_name);
+	step = b->step + le32toh(v->first_step);
+	count = le32toh(v->step_count);
+	for (i = 0; i < count; i++)
+		if (le32toh(step[i].action) == BUNDLE_WRITE)
+			total += le32toh(step[i].length);
+
+	for (i = 0; i < count; i++) {
+		const bundle_extent *first = b->extent
+					     + le32toh(step[i].first_extent);
+		uint32_t addr = le32toh(step[i].addr);
+		uint32_t flags = le32toh(step[i].flags);
+		sparse_extent e;
+
+		switch (le32toh(step[i].action)) {
+		case BUNDLE_SPL:
+			e = bundle_get_extent(b, first);
+			aw_fel_write_and_execute_spl(dev, (uint8_t *)e.data,
+						     e.size);
+			break;
+		case BUNDLE_UBOOT:
+			e = bundle_get_extent(b, first);
+			pr_info("Writing U-Boot image, %u bytes @ 0x%08X.\n",
+				e.size, e.addr);
+			uboot_upload(dev, e.data, e.addr, e.size);
+			autostart = flags & BUNDLE_AUTOSTART;
+			break;
+		case BUNDLE_WRITE: {
+			double start = metrics_begin();
+			size_t extents = 0, bytes = 0;
+
+			if (callback && !progress_started) {
+				/* common progress status for all "write" steps */
+				progress_t *progress = feldev_progress(dev);
+				progress_set_callback(progress, callback);
+				progress_begin(progress, total);
+				progress_started = true;
+			}
+			/* upload consecutive "write" steps as one batch */
+			for (j = i; j < count; j++) {
+				if (le32toh(step[j].action) != BUNDLE_WRITE)
+					break;
+				extents += le32toh(step[j].extent_count);
+				bytes += le32toh(step[j].length);
+			}
+			sparse_extent *extent = calloc(extents ? extents : 1,
+						       sizeof(sparse_extent));
+			if (!extent)
+				pr_fatal("Failed to allocate upload extents\n");
+			/* each step's own extents, as checked by bundle_open() */
+			for (extents = 0, k = i; k < j; k++) {
+				first = b->extent + le32toh(step[k].first_extent);
+				for (n = 0; n < le32toh(step[k].extent_count); n++)
+					extent[extents++] =
+						bundle_get_extent(b, first + n);
+			}
+			aw_write_extents(dev, extent, extents, callback != NULL);
+			free(extent);
+			metrics_span("upload", start, bytes, "bundle, %u step(s) "
+				     "@ 0x%08X", j - i, addr);
+
+			for (k = i; k < j; k++) {
+				addr = le32toh(step[k].addr);
+				flags = le32toh(step[k].flags);
+				if (flags & BUNDLE_SCRIPT)
+					pass_fel_information(dev, addr, 0);
+				if (flags & BUNDLE_UENV)
+					pass_fel_information(dev, addr,
+						le32toh(step[k].length));
+			}
+			i = j - 1;
+			break;
+		}
+		case BUNDLE_WRITEL:
+			fel_writel(dev, addr, le32toh(step[i].value));
+			break;
+		case BUNDLE_FILL:
+			aw_fel_fill(dev, addr, le32toh(step[i].length),
+				    le32toh(step[i].value));
+			break;
+		case BUNDLE_EXEC:
+			aw_exec(dev, addr);
+			break;
+		case BUNDLE_RESET64:
+			aw_rmr_request(dev, addr, true);
+			*stop = true;
+			return false; /* cancels U-Boot autostart */
+		}
+	}
+	return autostart;
+}
+
 static void felusb_list_devices(void)
 {
 	size_t devices; /* FEL device count */
@@ -978,6 +2896,9 @@ int main(int argc, char **argv)
 	feldev_handle *handle;
 	int busnum = -1, devnum = -1;
 	char *sid_arg = NULL;
+	bool cache_memory = false; /* --cache, merge/cache small accesses */
+	bool boost = false; /* --boost, raise the CPU clock */
+	const char *tuning_file = NULL; /* --tuning, transfer tuning data */
 
 	if (argc <= 1) {
 		puts("sunxi-fel " VERSION "\n");
@@ -987,6 +2908,19 @@ int main(int argc, char **argv)
 			"	-l, --list			Enumerate all (USB) FEL devices and exit\n"
 			"	-d, --dev bus:devnum		Use specific USB bus and device number\n"
 			"	    --sid SID			Select device by SID key (exact match)\n"
+			"	    --sparse			\"write\" skips constant data (filled by\n"
+			"					  device code), expands Android sparse images\n"
+			"	    --staging addr:size		Memory to stage data in for device-side\n"
+			"					  processing (default: free SRAM)\n"
+			"	    --cache			Merge small writes to memory, cache reads\n"
+			"					  (until code gets executed)\n"
+			"	    --boost			Raise the CPU clock for faster transfers\n"
+			"					  (until code other than FEL's own runs)\n"
+			"	    --cached-dram		Map DRAM cached after the SPL, for faster\n"
+			"					  uploads (until code other than FEL's own runs)\n"
+			"	    --metrics file		Write transfer counters and phase timings\n"
+			"					  at exit (JSON for *.json, else Prometheus)\n"
+			"	    --tuning file		Load transfer tuning (see \"calibrate\")\n"
 			"\n"
 			"	spl file			Load and execute U-Boot SPL\n"
 			"		If file additionally contains a main U-Boot binary\n"
@@ -1000,26 +2934,51 @@ int main(int argc, char **argv)
 			"\n"
 			"	hex[dump] address length	Dumps memory region in hex\n"
 			"	dump address length		Binary memory dump\n"
+			"	dump-compressed addr len file	Dump memory to file (\"-\" = stdout),\n"
+			"					  compressed by device code\n"
+			"	find addr len pattern [mask]	Search memory for a byte pattern, either\n"
+			"					  text or \"0x\" + hex bytes (mask alike)\n"
 			"	exe[cute] address		Call function address\n"
+			"	exe[cute] --timed address	Call function, report cycles / time taken\n"
 			"	reset64 address			RMR request for AArch64 warm boot\n"
 			"	memmove dest source size	Copy <size> bytes within device memory\n"
 			"	readl address			Read 32-bit value from device memory\n"
 			"	writel address value		Write 32-bit value to device memory\n"
+			"	latency count			Measure readl/writel round trip time\n"
+			"	calibrate file			Measure transfer tuning for the SoC,\n"
+			"					  save it for use with --tuning\n"
 			"	read address length file	Write memory contents into file\n"
 			"	write address file		Store file contents into memory\n"
 			"	write-with-progress addr file	\"write\" with progress bar\n"
 			"	write-with-gauge addr file	Output progress for \"dialog --gauge\"\n"
 			"	write-with-xgauge addr file	Extended gauge output (updates prompt)\n"
+			"	write-with-json addr file	Output progress as JSON lines\n"
+			"	write-fex address file.fex	Compile .fex file to script.bin format\n"
+			"					  and store it into memory\n"
 			"	multi[write] # addr file ...	\"write-with-progress\" multiple files,\n"
 			"					sharing a common progress status\n"
 			"	multi[write]-with-gauge ...	like their \"write-with-*\" counterpart,\n"
 			"	multi[write]-with-xgauge ...	  but following the 'multi' syntax:\n"
 			"					  <#> addr file [addr file [...]]\n"
+			"	multi[write]-with-json ...	Same, output progress as JSON lines\n"
+			"					  (named after the device's bus:dev)\n"
 			"	echo-gauge \"some text\"		Update prompt/caption for gauge output\n"
+			"	run recipe			Execute actions listed in a recipe file\n"
+			"					  (all files get checked in advance)\n"
+			"	run file.bundle			Execute the bundle's variant for the SoC\n"
+			"	make-bundle file.bundle soc recipe [soc recipe ...]\n"
+			"					Compile recipes (for SoC IDs, or \"any\")\n"
+			"					  into a bundle, no device needed\n"
+			"	bundle-info file.bundle		List bundle contents, verify hashes\n"
 			"	ver[sion]			Show BROM version\n"
 			"	sid				Retrieve and output 128-bit SID key\n"
 			"	clear address length		Clear memory\n"
 			"	fill address length value	Fill memory\n"
+			"	spiflash-info			Show SPI NOR flash ID and size\n"
+			"	spiflash-read addr length file	Read SPI flash contents into file\n"
+			"	spiflash-write addr file	Store file contents into SPI flash\n"
+			"					  (erasing sectors as needed)\n"
+			"	spiflash-erase addr length	Erase SPI flash (4 KiB sectors)\n"
 			, argv[0]
 		);
 		exit(0);
@@ -1047,10 +3006,47 @@ int main(int argc, char **argv)
 				pr_fatal("ERROR: Expected 'bus:devnum', got '%s'.\n", dev_arg);
 			pr_info("Selecting USB Bus %03d Device %03d\n", busnum, devnum);
 		}
+		else if (strcmp(argv[1], "--sparse") == 0)
+			sparse_upload = true;
+		else if (strcmp(argv[1], "--cache") == 0)
+			cache_memory = true;
+		else if (strcmp(argv[1], "--boost") == 0)
+			boost = true;
+		else if (strcmp(argv[1], "--cached-dram") == 0)
+			dram_cached = true;
+		else if ((strcmp(argv[1], "--staging") == 0
+			  || strcmp(argv[1], "--dump-window") == 0) && argc > 2) {
+			char *colon, *end;
+			unsigned long addr, size = 0;
+
+			errno = 0;
+			addr = strtoul(argv[2], &colon, 0);
+			end = colon;
+			if (colon != argv[2] && *colon == ':')
+				size = strtoul(colon + 1, &end, 0);
+			if (errno || end == colon + 1 || *end || size == 0
+			    || addr > 0xFFFFFFFF || size - 1 > 0xFFFFFFFF - addr)
+				pr_fatal("ERROR: Expected 'addr:size', got '%s'.\n",
+					 argv[2]);
+			staging_addr = addr;
+			staging_size = size;
+			argc -= 1;
+			argv += 1;
+		}
 		else if (strcmp(argv[1], "--sid") == 0 && argc > 2) {
 			sid_arg = argv[2];
 			argc -= 1;
 			argv += 1;
+		}
+		else if (strcmp(argv[1], "--metrics") == 0 && argc > 2) {
+			metrics_enable(argv[2]);
+			argc -= 1;
+			argv += 1;
+		}
+		else if (strcmp(argv[1], "--tuning") == 0 && argc > 2) {
+			tuning_file = argv[2];
+			argc -= 1;
+			argv += 1;
 		} else
 			break; /* no valid (prefix) option detected, exit loop */
 		argc -= 1;
@@ -1066,12 +3062,23 @@ int main(int argc, char **argv)
 	 */
 	int i;
 	for (i = 1; i < argc; i++)
-		if (*argv[i] == '-')
+		if (*argv[i] == '-' && argv[i][1] /* a lone "-" means stdin/stdout */
+		    && !(strcmp(argv[i], "--timed") == 0
+			 && strncmp(argv[i - 1], "exe", 3) == 0))
 			pr_fatal("Invalid option %s\n", argv[i]);
 
 	/* Process options that don't require a FEL device handle */
 	if (device_list)
 		felusb_list_devices(); /* and exit program afterwards */
+	if (argc > 2 && strcmp(argv[1], "make-bundle") == 0) {
+		make_bundle(argv[2], argc - 3, argv + 3);
+		return 0;
+	}
+	if (argc > 2 && strcmp(argv[1], "bundle-info") == 0) {
+		bundle_info(argv[2]);
+		return 0;
+	}
+	double enum_start = metrics_begin();
 	if (sid_arg) {
 		/* try to set busnum and devnum according to "--sid" option */
 		select_by_sid(sid_arg, &busnum, &devnum);
@@ -1081,11 +3088,45 @@ int main(int argc, char **argv)
 		pr_info("Selecting FEL device %03d:%03d by SID\n", busnum, devnum);
 	}
 
+	/*
+	 * If the first command is "run", load the recipe now - so any errors
+	 * get reported before we access the device.
+	 */
+	recipe *preloaded = NULL;
+	bundle_t bundle = { .base = NULL };
+	if (argc > 2 && strcmp(argv[1], "run") == 0) {
+		if (is_bundle_file(argv[2]))
+			load_bundle(&bundle, argv[2]);
+		else
+			preloaded = recipe_load(argv[2]);
+	}
+
 	/*
 	 * Open FEL device - either specified by busnum:devnum, or
 	 * the first one matching the given USB vendor/procduct ID.
 	 */
 	handle = feldev_open(busnum, devnum, AW_USB_VENDOR_ID, AW_USB_PRODUCT_ID);
+	metrics_span("enumeration", enum_start, 0, "%03d:%03d",
+		     handle->busnum, handle->devnum);
+	metrics_set_device(handle);
+	if (tuning_file) {
+		int sections = soc_tuning_load(tuning_file, handle->soc_info);
+		if (sections < 0)
+			pr_fatal("Failed to load tuning data\n");
+		if (sections == 0)
+			pr_info("%s: no tuning data for %s, using defaults\n",
+				tuning_file, handle->soc_name);
+	}
+	if (cache_memory)
+		feldev_set_cache(handle, true);
+	if (boost)
+		aw_cpu_boost(handle);
+
+	/* label progress output with the device's USB address */
+	char progress_name[16];
+	snprintf(progress_name, sizeof(progress_name), "%03d:%03d",
+		 handle->busnum, handle->devnum);
+	progress_set_name(feldev_progress(handle), progress_name);
 
 	/* Handle command-style arguments, in order of appearance */
 	while (argc > 1 ) {
@@ -1094,6 +3135,11 @@ int main(int argc, char **argv)
 		if (strncmp(argv[1], "hex", 3) == 0 && argc > 3) {
 			aw_fel_hexdump(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
 			skip = 3;
+		} else if (strcmp(argv[1], "dump-compressed") == 0 && argc > 4) {
+			aw_fel_dump_compressed(handle, strtoul(argv[2], NULL, 0),
+					       strtoul(argv[3], NULL, 0), argv[4],
+					       pflag_active ? progress_bar : NULL);
+			skip = 4;
 		} else if (strncmp(argv[1], "dump", 4) == 0 && argc > 3) {
 			aw_fel_dump(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
 			skip = 3;
@@ -1108,8 +3154,29 @@ int main(int argc, char **argv)
 		} else if (strcmp(argv[1], "writel") == 0 && argc > 3) {
 			fel_writel(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
 			skip = 3;
+		} else if (strcmp(argv[1], "find") == 0 && argc > 4) {
+			/* the mask is optional, and always hex ("0x...") */
+			bool mask = argc > 5 && strncmp(argv[5], "0x", 2) == 0;
+			aw_fel_find(handle, strtoul(argv[2], NULL, 0),
+				    strtoul(argv[3], NULL, 0), argv[4],
+				    mask ? argv[5] : NULL);
+			skip = mask ? 5 : 4;
+		} else if (strcmp(argv[1], "calibrate") == 0 && argc > 2) {
+			aw_fel_calibrate(handle, argv[2]);
+			skip = 2;
+		} else if (strcmp(argv[1], "latency") == 0 && argc > 2) {
+			aw_fel_latency(handle, strtoul(argv[2], NULL, 0));
+			skip = 2;
+		} else if (strncmp(argv[1], "exe", 3) == 0 && argc > 3
+			   && strcmp(argv[2], "--timed") == 0) {
+			double start = metrics_begin();
+			aw_prepare_exec(handle);
+			aw_fel_execute_timed(handle, strtoul(argv[3], NULL, 0));
+			aw_invalidate_cpu_state();
+			metrics_span("exec", start, 0, "%s (timed)", argv[3]);
+			skip = 3;
 		} else if (strncmp(argv[1], "exe", 3) == 0 && argc > 2) {
-			aw_fel_execute(handle, strtoul(argv[2], NULL, 0));
+			aw_exec(handle, strtoul(argv[2], NULL, 0));
 			skip=3;
 		} else if (strcmp(argv[1], "reset64") == 0 && argc > 2) {
 			aw_rmr_request(handle, strtoul(argv[2], NULL, 0), true);
@@ -1120,6 +3187,23 @@ int main(int argc, char **argv)
 			aw_fel_print_version(handle);
 		} else if (strcmp(argv[1], "sid") == 0) {
 			aw_fel_print_sid(handle, false);
+		} else if (strcmp(argv[1], "spiflash-info") == 0) {
+			aw_fel_spiflash_info(handle);
+		} else if (strcmp(argv[1], "spiflash-read") == 0 && argc > 4) {
+			aw_fel_spiflash_read(handle, strtoul(argv[2], NULL, 0),
+					     strtoul(argv[3], NULL, 0), argv[4],
+					     pflag_active ? progress_bar : NULL);
+			skip = 4;
+		} else if (strcmp(argv[1], "spiflash-write") == 0 && argc > 3) {
+			aw_fel_spiflash_write(handle, strtoul(argv[2], NULL, 0),
+					      argv[3],
+					      pflag_active ? progress_bar : NULL);
+			skip = 3;
+		} else if (strcmp(argv[1], "spiflash-erase") == 0 && argc > 3) {
+			aw_fel_spiflash_erase(handle, strtoul(argv[2], NULL, 0),
+					      strtoul(argv[3], NULL, 0),
+					      pflag_active ? progress_bar : NULL);
+			skip = 3;
 		} else if (strcmp(argv[1], "sid-registers") == 0) {
 			aw_fel_print_sid(handle, true); /* enforce register access */
 		} else if (strcmp(argv[1], "write") == 0 && argc > 3) {
@@ -1134,6 +3218,12 @@ int main(int argc, char **argv)
 		} else if (strcmp(argv[1], "write-with-xgauge") == 0 && argc > 3) {
 			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
 						progress_gauge_xxx);
+		} else if (strcmp(argv[1], "write-with-json") == 0 && argc > 3) {
+			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
+						progress_json);
+		} else if (strcmp(argv[1], "write-fex") == 0 && argc > 3) {
+			aw_fel_write_fex(handle, strtoul(argv[2], NULL, 0), argv[3]);
+			skip = 3;
 		} else if ((strcmp(argv[1], "multiwrite") == 0 ||
 			    strcmp(argv[1], "multi") == 0) && argc > 4) {
 			size_t count = strtoul(argv[2], NULL, 0); /* file count */
@@ -1149,16 +3239,18 @@ int main(int argc, char **argv)
 			size_t count = strtoul(argv[2], NULL, 0); /* file count */
 			skip = 2 + 2 * file_upload(handle, count, argc - 3,
 						   argv + 3, progress_gauge_xxx);
+		} else if ((strcmp(argv[1], "multiwrite-with-json") == 0 ||
+			    strcmp(argv[1], "multi-with-json") == 0) && argc > 4) {
+			size_t count = strtoul(argv[2], NULL, 0); /* file count */
+			skip = 2 + 2 * file_upload(handle, count, argc - 3,
+						   argv + 3, progress_json);
 		} else if ((strcmp(argv[1], "echo-gauge") == 0) && argc > 2) {
 			skip = 2;
 			printf("XXX\n0\n%s\nXXX\n", argv[2]);
 			fflush(stdout);
 		} else if (strcmp(argv[1], "read") == 0 && argc > 4) {
-			size_t size = strtoul(argv[3], NULL, 0);
-			void *buf = malloc(size);
-			aw_fel_read(handle, strtoul(argv[2], NULL, 0), buf, size);
-			save_file(argv[4], buf, size);
-			free(buf);
+			aw_fel_read_file(handle, strtoul(argv[2], NULL, 0),
+					 strtoul(argv[3], NULL, 0), argv[4]);
 			skip=4;
 		} else if (strcmp(argv[1], "clear") == 0 && argc > 2) {
 			aw_fel_fill(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0), 0);
@@ -1166,6 +3258,29 @@ int main(int argc, char **argv)
 		} else if (strcmp(argv[1], "fill") == 0 && argc > 3) {
 			aw_fel_fill(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0), (unsigned char)strtoul(argv[4], NULL, 0));
 			skip=4;
+		} else if (strcmp(argv[1], "run") == 0 && argc > 2) {
+			progress_cb_t callback = pflag_active ? progress_bar : NULL;
+			bool autostart, stop = false;
+			if (bundle.base || is_bundle_file(argv[2])) {
+				if (!bundle.base)
+					load_bundle(&bundle, argv[2]);
+				autostart = bundle_run(handle, &bundle,
+						       callback, &stop);
+				bundle_close(&bundle);
+			} else {
+				recipe *r = preloaded ? preloaded
+						      : recipe_load(argv[2]);
+				preloaded = NULL;
+				autostart = recipe_run(handle, r, callback, &stop);
+				recipe_free(r);
+			}
+			if (autostart)
+				uboot_autostart = true;
+			else if (stop)
+				uboot_autostart = false;
+			if (stop)
+				break; /* stop processing args */
+			skip = 2;
 		} else if (strcmp(argv[1], "spl") == 0 && argc > 2) {
 			aw_fel_process_spl_and_uboot(handle, argv[2]);
 			skip=2;
@@ -1182,13 +3297,16 @@ int main(int argc, char **argv)
 		argv+=skip;
 	}
 
+	aw_prepare_exec(handle);
+
 	/* auto-start U-Boot if requested (by the "uboot" command) */
 	if (uboot_autostart) {
 		pr_info("Starting U-Boot (0x%08X).\n", uboot_entry);
-		aw_fel_execute(handle, uboot_entry);
+		aw_exec(handle, uboot_entry);
 	}
 
 	feldev_done(handle);
+	metrics_success();
 
 	return 0;
 }
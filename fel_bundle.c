@@ -0,0 +1,408 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * FEL payload bundles: writing, mapping and checking bundle files
+ **********************************************************************/
+
+#include "portable_endian.h"
+#include "fel_bundle.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* keep the table counts sane, so no size calculation can overflow */
+#define BUNDLE_MAX_ENTRIES	(1 << 24)
+
+uint64_t bundle_hash(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+struct bundle_writer {
+	bundle_variant *variant;
+	bundle_step *step;
+	bundle_extent *extent;
+	const uint8_t **data;	/* payload for each extent */
+	size_t variants, steps, extents;
+	size_t variant_alloc, step_alloc, extent_alloc;
+};
+
+/* make room for one more table entry */
+static void *bundle_grow(void *table, size_t *alloc, size_t count,
+			 size_t entry_size)
+{
+	if (count < *alloc)
+		return table;
+	*alloc = *alloc ? *alloc * 2 : 16;
+	table = realloc(table, *alloc * entry_size);
+	if (!table) {
+		perror("Failed to allocate bundle tables");
+		exit(1);
+	}
+	return table;
+}
+
+bundle_writer *bundle_writer_new(void)
+{
+	bundle_writer *w = calloc(1, sizeof(bundle_writer));
+
+	if (!w) {
+		perror("Failed to allocate bundle");
+		exit(1);
+	}
+	return w;
+}
+
+void bundle_writer_free(bundle_writer *w)
+{
+	if (!w)
+		return;
+	free(w->variant);
+	free(w->step);
+	free(w->extent);
+	free(w->data);
+	free(w);
+}
+
+void bundle_add_variant(bundle_writer *w, uint32_t soc_id)
+{
+	bundle_variant *v;
+
+	w->variant = bundle_grow(w->variant, &w->variant_alloc, w->variants,
+				 sizeof(bundle_variant));
+	v = &w->variant[w->variants++];
+	memset(v, 0, sizeof(*v));
+	v->soc_id = soc_id;
+	v->first_step = w->steps;
+}
+
+void bundle_add_step(bundle_writer *w, bundle_action action, uint32_t flags,
+		     uint32_t addr, uint32_t length, uint32_t value)
+{
+	bundle_step *s;
+
+	w->step = bundle_grow(w->step, &w->step_alloc, w->steps,
+			      sizeof(bundle_step));
+	s = &w->step[w->steps++];
+	memset(s, 0, sizeof(*s));
+	s->action = action;
+	s->flags = flags;
+	s->addr = addr;
+	s->length = length;
+	s->value = value;
+	s->first_extent = w->extents;
+	w->variant[w->variants - 1].step_count++;
+}
+
+void bundle_add_extents(bundle_writer *w, const sparse_extent *extent,
+			size_t count)
+{
+	size_t alloc;
+
+	for (; count > 0; count--, extent++) {
+		bundle_extent *e;
+
+		alloc = w->extent_alloc;
+		w->extent = bundle_grow(w->extent, &w->extent_alloc,
+					w->extents, sizeof(bundle_extent));
+		if (w->extent_alloc != alloc) {
+			w->data = realloc(w->data,
+					  w->extent_alloc * sizeof(*w->data));
+			if (!w->data) {
+				perror("Failed to allocate bundle tables");
+				exit(1);
+			}
+		}
+		e = &w->extent[w->extents];
+		memset(e, 0, sizeof(*e));
+		e->addr = extent->addr;
+		e->size = extent->size;
+		if (extent->data) {
+			e->hash = bundle_hash(extent->data, extent->size);
+		} else {
+			e->flags = BUNDLE_FILL_EXTENT;
+			e->value = extent->value;
+		}
+		w->data[w->extents++] = extent->data;
+		w->step[w->steps - 1].extent_count++;
+	}
+}
+
+static uint64_t bundle_align(uint64_t offset)
+{
+	return (offset + BUNDLE_ALIGN - 1) & ~(uint64_t)(BUNDLE_ALIGN - 1);
+}
+
+/*
+ * Assign file offsets to the payloads. Identical payloads (e.g. a kernel
+ * shared by the variants for several SoCs) get stored only once.
+ */
+static uint64_t bundle_layout(bundle_writer *w, uint64_t offset)
+{
+	size_t i, j;
+
+	for (i = 0; i < w->extents; i++) {
+		bundle_extent *e = &w->extent[i];
+
+		if (e->flags & BUNDLE_FILL_EXTENT)
+			continue;
+		for (j = 0; j < i; j++)
+			if (!(w->extent[j].flags & BUNDLE_FILL_EXTENT)
+			    && w->extent[j].hash == e->hash
+			    && w->extent[j].size == e->size
+			    && memcmp(w->data[j], w->data[i], e->size) == 0)
+				break;
+		if (j < i) {
+			e->offset = w->extent[j].offset;
+			w->data[i] = NULL; /* no need to write it again */
+		} else {
+			e->offset = offset;
+			offset = bundle_align(offset + e->size);
+		}
+	}
+	return offset;
+}
+
+bool bundle_save(bundle_writer *w, const char *filename)
+{
+	static const uint8_t zero[BUNDLE_ALIGN];
+	size_t table_size = w->variants * sizeof(bundle_variant)
+			  + w->steps * sizeof(bundle_step)
+			  + w->extents * sizeof(bundle_extent);
+	uint8_t *table = malloc(table_size ? table_size : 1);
+	bundle_header header;
+	uint64_t pos, size;
+	size_t i;
+	file_stream f;
+	bool ok;
+
+	if (!table) {
+		errno = ENOMEM;
+		return false;
+	}
+	size = bundle_layout(w, bundle_align(sizeof(header) + table_size));
+
+	/* tables, converted to little-endian */
+	bundle_variant *v = (bundle_variant *)table;
+	for (i = 0; i < w->variants; i++, v++) {
+		v->soc_id = htole32(w->variant[i].soc_id);
+		v->first_step = htole32(w->variant[i].first_step);
+		v->step_count = htole32(w->variant[i].step_count);
+		v->reserved = 0;
+	}
+	bundle_step *s = (bundle_step *)v;
+	for (i = 0; i < w->steps; i++, s++) {
+		s->action = htole32(w->step[i].action);
+		s->flags = htole32(w->step[i].flags);
+		s->addr = htole32(w->step[i].addr);
+		s->length = htole32(w->step[i].length);
+		s->value = htole32(w->step[i].value);
+		s->first_extent = htole32(w->step[i].first_extent);
+		s->extent_count = htole32(w->step[i].extent_count);
+		s->reserved = 0;
+	}
+	bundle_extent *e = (bundle_extent *)s;
+	for (i = 0; i < w->extents; i++, e++) {
+		e->addr = htole32(w->extent[i].addr);
+		e->size = htole32(w->extent[i].size);
+		e->value = htole32(w->extent[i].value);
+		e->flags = htole32(w->extent[i].flags);
+		e->offset = htole64(w->extent[i].offset);
+		e->hash = htole64(w->extent[i].hash);
+	}
+
+	memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+	header.version = htole32(BUNDLE_VERSION);
+	header.variants = htole32(w->variants);
+	header.steps = htole32(w->steps);
+	header.extents = htole32(w->extents);
+	header.size = htole64(size);
+	header.table_hash = htole64(bundle_hash(table, table_size));
+
+	if (!file_open(&f, filename, true)) {
+		free(table);
+		return false;
+	}
+	ok = file_write(&f, &header, sizeof(header))
+	     && file_write(&f, table, table_size);
+	pos = sizeof(header) + table_size;
+	free(table);
+	for (i = 0; ok && i < w->extents; i++) {
+		if (!w->data[i])
+			continue; /* fill extent, or stored already */
+		ok = file_write(&f, zero, w->extent[i].offset - pos)
+		     && file_write(&f, w->data[i], w->extent[i].size);
+		pos = w->extent[i].offset + w->extent[i].size;
+	}
+	ok = ok && file_write(&f, zero, size - pos);
+	if (!ok) {
+		int err = errno;
+		file_close(&f);
+		errno = err;
+		return false;
+	}
+	return file_close(&f);
+}
+
+bool is_bundle_file(const char *filename)
+{
+	char magic[sizeof(BUNDLE_MAGIC) - 1];
+	file_stream f;
+	bool result;
+
+	if (!file_open(&f, filename, false))
+		return false;
+	result = file_read(&f, magic, sizeof(magic)) == sizeof(magic)
+		 && memcmp(magic, BUNDLE_MAGIC, sizeof(magic)) == 0;
+	file_close(&f);
+	return result;
+}
+
+static const char *bundle_check(bundle_t *b)
+{
+	const bundle_header *h = (const bundle_header *)b->base;
+	uint64_t variants, steps, extents, table_size, i;
+
+	if (memcmp(h->magic, BUNDLE_MAGIC, sizeof(h->magic)) != 0)
+		return "not a bundle (bad magic)";
+	if (le32toh(h->version) != BUNDLE_VERSION)
+		return "unsupported bundle version";
+	if (le64toh(h->size) != b->size)
+		return "file size mismatch (truncated?)";
+	variants = le32toh(h->variants);
+	steps = le32toh(h->steps);
+	extents = le32toh(h->extents);
+	if (variants > BUNDLE_MAX_ENTRIES || steps > BUNDLE_MAX_ENTRIES
+	    || extents > BUNDLE_MAX_ENTRIES)
+		return "bad table size";
+	table_size = variants * sizeof(bundle_variant)
+		   + steps * sizeof(bundle_step)
+		   + extents * sizeof(bundle_extent);
+	if (sizeof(*h) + table_size > b->size)
+		return "bad table size";
+	b->header = h;
+	b->variant = (const bundle_variant *)(h + 1);
+	b->step = (const bundle_step *)(b->variant + variants);
+	b->extent = (const bundle_extent *)(b->step + steps);
+	if (bundle_hash(b->variant, table_size) != le64toh(h->table_hash))
+		return "table hash mismatch";
+
+	for (i = 0; i < variants; i++)
+		if ((uint64_t)le32toh(b->variant[i].first_step)
+		    + le32toh(b->variant[i].step_count) > steps)
+			return "bad step reference";
+	for (i = 0; i < steps; i++) {
+		const bundle_step *s = &b->step[i];
+		uint32_t count = le32toh(s->extent_count);
+		uint64_t first = le32toh(s->first_extent);
+
+		if (le32toh(s->action) > BUNDLE_RESET64)
+			return "unknown action";
+		if (first + count > extents)
+			return "bad extent reference";
+		if ((le32toh(s->action) == BUNDLE_SPL
+		     || le32toh(s->action) == BUNDLE_UBOOT)
+		    && (count != 1 || le32toh(b->extent[first].flags)
+				      & BUNDLE_FILL_EXTENT))
+			return "bad SPL / U-Boot step";
+	}
+	for (i = 0; i < extents; i++) {
+		const bundle_extent *e = &b->extent[i];
+
+		if (!(le32toh(e->flags) & BUNDLE_FILL_EXTENT)
+		    && (le64toh(e->offset) > b->size
+			|| le32toh(e->size) > b->size - le64toh(e->offset)))
+			return "bad payload reference";
+	}
+	return NULL;
+}
+
+const char *bundle_open(bundle_t *b, const char *filename)
+{
+	const char *err;
+
+	memset(b, 0, sizeof(*b));
+	if (!file_load(&b->file, filename))
+		return strerror(errno);
+	b->base = b->file.data;
+	b->size = b->file.size;
+	if (b->size < sizeof(bundle_header))
+		err = "not a bundle (bad file size)";
+	else
+		err = bundle_check(b);
+	if (err)
+		bundle_close(b);
+	return err;
+}
+
+void bundle_close(bundle_t *b)
+{
+	file_release(&b->file);
+	memset(b, 0, sizeof(*b));
+}
+
+const bundle_variant *bundle_find_variant(const bundle_t *b, uint32_t soc_id)
+{
+	const bundle_variant *any = NULL;
+	uint32_t i;
+
+	for (i = 0; i < le32toh(b->header->variants); i++) {
+		uint32_t id = le32toh(b->variant[i].soc_id);
+		if (id == soc_id)
+			return &b->variant[i];
+		if (id == 0 && !any)
+			any = &b->variant[i];
+	}
+	return any;
+}
+
+sparse_extent bundle_get_extent(const bundle_t *b, const bundle_extent *e)
+{
+	sparse_extent result = {
+		.addr = le32toh(e->addr),
+		.size = le32toh(e->size),
+	};
+
+	if (le32toh(e->flags) & BUNDLE_FILL_EXTENT)
+		result.value = le32toh(e->value);
+	else
+		result.data = b->base + le64toh(e->offset);
+	return result;
+}
+
+long bundle_verify(const bundle_t *b)
+{
+	uint32_t i;
+
+	for (i = 0; i < le32toh(b->header->extents); i++) {
+		const bundle_extent *e = &b->extent[i];
+
+		if (!(le32toh(e->flags) & BUNDLE_FILL_EXTENT)
+		    && bundle_hash(b->base + le64toh(e->offset),
+				   le32toh(e->size)) != le64toh(e->hash))
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,154 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FEL_BUNDLE_H
+#define _SUNXI_TOOLS_FEL_BUNDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fel_sparse.h"
+#include "file_io.h"
+
+/*
+ * FEL payload bundles: a precompiled form of "run" recipes, in one file
+ *
+ * A bundle holds one or more variants of a recipe, each for a specific SoC
+ * (or any SoC, with soc_id 0). Everything that would otherwise be checked
+ * or computed on each run is done when building the bundle: the SPL and
+ * U-Boot image headers get validated, payloads are split into data and
+ * fill extents (like --sparse does), and scripts / uEnv data are flagged.
+ * Running a bundle then only needs to map the file and walk the tables.
+ *
+ * File layout (all values little-endian, tables 8-byte aligned):
+ *
+ *	bundle_header
+ *	bundle_variant[variants]
+ *	bundle_step[steps]
+ *	bundle_extent[extents]
+ *	payload data, each data extent starting at a BUNDLE_ALIGN boundary
+ *
+ * The header's table_hash covers the three tables, each data extent has
+ * its own hash for verification (see bundle_verify).
+ *
+ * Payloads are stored uncompressed. Constant data already turns into fill
+ * extents, and kernels / initramfs images usually come compressed anyway.
+ * Compressing the rest would only pay off with decompression on the device,
+ * which needs DRAM (so not for the SPL) and a staging area of its own.
+ */
+#define BUNDLE_MAGIC		"FELBNDL\0"
+#define BUNDLE_VERSION		1
+#define BUNDLE_ALIGN		64
+
+typedef enum {
+	BUNDLE_SPL,		/* SPL, one data extent (no U-Boot image) */
+	BUNDLE_UBOOT,		/* U-Boot image data, one data extent */
+	BUNDLE_WRITE,		/* data and fill extents */
+	BUNDLE_WRITEL,		/* addr, value */
+	BUNDLE_FILL,		/* addr, length, value */
+	BUNDLE_EXEC,		/* addr */
+	BUNDLE_RESET64,		/* addr */
+} bundle_action;
+
+/* step flags */
+#define BUNDLE_AUTOSTART	(1 << 0) /* BUNDLE_UBOOT: start U-Boot at exit */
+#define BUNDLE_SCRIPT		(1 << 1) /* BUNDLE_WRITE: U-Boot boot script */
+#define BUNDLE_UENV		(1 << 2) /* BUNDLE_WRITE: uEnv.txt style data */
+
+/* extent flags */
+#define BUNDLE_FILL_EXTENT	(1 << 0) /* fill with 'value', no payload */
+
+typedef struct {
+	char     magic[8];	/* BUNDLE_MAGIC */
+	uint32_t version;	/* BUNDLE_VERSION */
+	uint32_t variants;	/* number of table entries... */
+	uint32_t steps;
+	uint32_t extents;
+	uint64_t size;		/* file size */
+	uint64_t table_hash;
+} bundle_header;
+
+typedef struct {
+	uint32_t soc_id;	/* 0 = any SoC */
+	uint32_t first_step;
+	uint32_t step_count;
+	uint32_t reserved;
+} bundle_variant;
+
+typedef struct {
+	uint32_t action;	/* bundle_action */
+	uint32_t flags;
+	uint32_t addr, length, value;
+	uint32_t first_extent;
+	uint32_t extent_count;
+	uint32_t reserved;
+} bundle_step;
+
+typedef struct {
+	uint32_t addr, size;
+	uint32_t value;		/* fill pattern */
+	uint32_t flags;
+	uint64_t offset;	/* of the payload data within the file */
+	uint64_t hash;		/* of the payload data */
+} bundle_extent;
+
+/* hash for bundle tables and payloads (64-bit FNV-1a) */
+uint64_t bundle_hash(const void *data, size_t len);
+
+/*
+ * Building a bundle: steps get added to the current variant, extents to
+ * the current step. Data extents refer to the caller's buffers, which have
+ * to remain valid until the bundle got saved.
+ */
+typedef struct bundle_writer bundle_writer;
+
+bundle_writer *bundle_writer_new(void);
+void bundle_writer_free(bundle_writer *w);
+void bundle_add_variant(bundle_writer *w, uint32_t soc_id);
+void bundle_add_step(bundle_writer *w, bundle_action action, uint32_t flags,
+		     uint32_t addr, uint32_t length, uint32_t value);
+void bundle_add_extents(bundle_writer *w, const sparse_extent *extent,
+			size_t count);
+/* write the bundle file, returns false on errors (with errno set) */
+bool bundle_save(bundle_writer *w, const char *filename);
+
+/* A bundle mapped into memory, with pointers to its tables */
+typedef struct {
+	file_buffer file;
+	const uint8_t *base;	/* file.data */
+	size_t size;
+	const bundle_header *header;
+	const bundle_variant *variant;
+	const bundle_step *step;
+	const bundle_extent *extent;
+} bundle_t;
+
+/* check a file for the bundle magic */
+bool is_bundle_file(const char *filename);
+/*
+ * Map a bundle file, and check its tables for consistency - so references
+ * to steps, extents and payloads can be used without further checks.
+ * Returns NULL on success, or a string describing the problem otherwise.
+ */
+const char *bundle_open(bundle_t *b, const char *filename);
+void bundle_close(bundle_t *b);
+
+/* variant for the SoC, falling back to the "any SoC" one (or NULL) */
+const bundle_variant *bundle_find_variant(const bundle_t *b, uint32_t soc_id);
+/* convert a bundle extent, the payload data pointing into the mapping */
+sparse_extent bundle_get_extent(const bundle_t *b, const bundle_extent *e);
+/* check the payload hashes, returns the first bad extent (or -1 if OK) */
+long bundle_verify(const bundle_t *b);
+
+#endif /* _SUNXI_TOOLS_FEL_BUNDLE_H */
@@ -0,0 +1,66 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * Compressed memory dumps: host side of thunks/dump_compress.S
+ **********************************************************************/
+
+#include "portable_endian.h"
+#include "fel_dump.h"
+
+#include <string.h>
+
+bool dump_decompress(const uint32_t *in, size_t in_words,
+		     uint32_t *out, size_t out_words)
+{
+	size_t pos = 0, done = 0;
+
+	while (pos < in_words) {
+		uint32_t token = le32toh(in[pos++]);
+		uint32_t count = token & 0x3FFFFFFF;
+		uint32_t value, i;
+
+		if (count > out_words - done)
+			return false;
+		switch (token >> 30) {
+		case DUMP_TOKEN_LITERAL:
+			if (count > in_words - pos)
+				return false;
+			memcpy(out + done, in + pos, count * sizeof(uint32_t));
+			pos += count;
+			break;
+		case DUMP_TOKEN_RUN:
+			if (pos >= in_words)
+				return false;
+			value = in[pos++]; /* (keeping byte order) */
+			for (i = 0; i < count; i++)
+				out[done + i] = value;
+			break;
+		case DUMP_TOKEN_MATCH:
+			if (pos >= in_words)
+				return false;
+			value = le32toh(in[pos++]); /* distance */
+			if (value == 0 || value > done)
+				return false;
+			for (i = 0; i < count; i++) /* may overlap, copy forward */
+				out[done + i] = out[done + i - value];
+			break;
+		default:
+			return false;
+		}
+		done += count;
+	}
+	return done == out_words;
+}
@@ -0,0 +1,37 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FEL_DUMP_H
+#define _SUNXI_TOOLS_FEL_DUMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Output format of the dump compressor (thunks/dump_compress.S): a stream
+ * of little-endian 32-bit tokens, each with a type in the upper two bits
+ * and a word count in the others. Literal words follow their token, a run
+ * is followed by the word to repeat, and a match by the distance (in words)
+ * back to the data to copy.
+ */
+#define DUMP_TOKEN_LITERAL	0
+#define DUMP_TOKEN_RUN		1
+#define DUMP_TOKEN_MATCH	2
+
+/* decompress a batch of dump_compress output, false for invalid data */
+bool dump_decompress(const uint32_t *in, size_t in_words,
+		     uint32_t *out, size_t out_words);
+
+#endif /* _SUNXI_TOOLS_FEL_DUMP_H */
@@ -27,36 +27,146 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define USB_TIMEOUT	10000 /* 10 seconds */
 
-static bool fel_lib_initialized = false;
+/*
+ * Failed bulk transfers get retried a few times before we give up, with
+ * the delay between attempts doubling each time (but limited to the maximum
+ * given here). Any successful data transfer resets the attempt counter.
+ */
+#define USB_RETRIES		5
+#define USB_RETRY_DELAY		50	/* ms, initial delay */
+#define USB_RETRY_MAX_DELAY	1000	/* ms */
+
+/*
+ * Errors get passed up as return values, a negative FEL_ERROR_* (or libusb)
+ * code. fel_fail() records the description (and the exit code sunxi-fel
+ * always used for it) in the context, see fel_end() for what happens then.
+ */
+struct fel_context {
+	libusb_context *usb;	/* NULL for the default context */
+	bool initialized;	/* libusb_init() done */
+	int calls;		/* nesting depth of fel_call() */
+	int error;		/* last error code (first one within fel_call) */
+	int exitcode;
+	char message[256];	/* description of the last error */
+	fel_log_cb log;		/* diagnostics, NULL = discard them */
+	void *log_data;
+	fel_stats stats;	/* see fel_get_stats() */
+};
+
+static void fel_log_stderr(const char *message, void *user_data)
+{
+	(void)user_data;
+	fprintf(stderr, "%s\n", message);
+}
+
+static fel_context default_context = { .log = fel_log_stderr };
+
+/* number of transfer buffers per device, kept for reuse */
+#define FEL_BUFFERS	4
 
 /* This is out 'private' data type that will be part of a "FEL device" handle */
 struct _felusb_handle {
 	libusb_device_handle *handle;
 	int endpoint_out, endpoint_in;
 	bool iface_detached;
+	struct fel_async_op *queue;	/* pending asynchronous requests */
+	struct {
+		unsigned char *data;	/* FEL_BUFFER_SIZE bytes, or NULL */
+		bool dma;		/* allocated from usbfs device memory */
+		bool busy;
+	} buffer[FEL_BUFFERS];
+	bool no_dma;			/* device memory is unavailable */
+	bool no_chain;			/* disable chained small requests */
+	struct fel_cache *cache;	/* memory access cache, or NULL */
+	struct libusb_transfer **chain_xfer; /* FEL_CHAIN_MAX_STEPS */
+	fel_context *ctx;
 };
 
-/* a helper function to report libusb errors */
-void usb_error(int rc, const char *caption, int exitcode)
+static fel_context *fel_ctx(fel_context *ctx)
 {
-	if (caption)
-		fprintf(stderr, "%s ", caption);
+	return ctx ? ctx : &default_context;
+}
 
-#if defined(LIBUSBX_API_VERSION) && (LIBUSBX_API_VERSION >= 0x01000102)
-	fprintf(stderr, "ERROR %d: %s\n", rc, libusb_strerror(rc));
-#else
-	/* assume that libusb_strerror() is missing in the libusb API */
-	fprintf(stderr, "ERROR %d\n", rc);
-#endif
+/* pass a diagnostic message to the context's callback */
+static void fel_log(fel_context *ctx, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void fel_log(fel_context *ctx, const char *fmt, ...)
+{
+	char message[256];
+	va_list args;
+
+	if (!ctx->log)
+		return;
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	ctx->log(message, ctx->log_data);
+}
+
+static int fel_fail(fel_context *ctx, int error, int exitcode,
+		    const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+/* record an error, returns its code */
+static int fel_fail(fel_context *ctx, int error, int exitcode,
+		    const char *fmt, ...)
+{
+	va_list args;
+
+	/* within fel_call(), the first error is the one to report */
+	if (ctx->calls > 0 && ctx->error != FEL_SUCCESS)
+		return error;
+	va_start(args, fmt);
+	vsnprintf(ctx->message, sizeof(ctx->message), fmt, args);
+	va_end(args);
+	ctx->error = error;
+	ctx->exitcode = exitcode;
+	return error;
+}
+
+/* record a libusb error */
+static int usb_error(fel_context *ctx, int rc, const char *caption,
+		     int exitcode)
+{
+	return fel_fail(ctx, rc, exitcode, "%s ERROR %d: %s",
+			caption, rc, fel_strerror(rc));
+}
+
+/*
+ * The public functions that send requests start with fel_begin(), and
+ * return through fel_end(). Within fel_call(), an error sticks: everything
+ * after it fails right away, since the protocol state is unknown. Outside,
+ * the default context reports the error and exits - which is what the
+ * sunxi-fel tool wants - while others just return it.
+ */
+static int fel_begin(feldev_handle *dev)
+{
+	fel_context *ctx = dev->usb->ctx;
+
+	if (ctx->calls > 0 && ctx->error != FEL_SUCCESS)
+		return ctx->error;
+	if (dev->usb->queue)
+		return fel_fail(ctx, FEL_ERROR_BUSY, 1,
+				"ERROR: Blocking FEL request while asynchronous ones are pending");
+	return FEL_SUCCESS;
+}
 
-	if (exitcode != 0)
-		exit(exitcode);
+static int fel_end(fel_context *ctx, int rc)
+{
+	if (rc < 0 && ctx == &default_context && ctx->calls == 0) {
+		fel_log(ctx, "%s", ctx->message);
+		exit(ctx->exitcode);
+	}
+	return rc;
 }
 
 /*
@@ -67,11 +177,69 @@ void usb_error(int rc, const char *caption, int exitcode)
  * The 512 KiB here are chosen based on the assumption that we want a 10 seconds
  * timeout, and "slow" transfers take place at approx. 64 KiB/sec - so we can
  * expect the maximum chunk being transmitted within 8 seconds or less.
+ *
+ * SoCs with calibrated tuning data (see soc_tuning) may use a different chunk
+ * size and rate, in which case the timeout gets derived from these - see
+ * soc_tuning_transfer().
+ */
+static const size_t AW_USB_MAX_BULK_SEND = SOC_TUNING_MAX_CHUNK; /* 512 KiB per bulk request */
+
+/*
+ * Bulk transfer chunk size and timeout (in ms) for payload data of a device.
+ * Protocol messages keep USB_TIMEOUT: reading the status of an AW_FEL_1_EXEC
+ * request waits for the code on the device, however long it may take.
  */
-static const int AW_USB_MAX_BULK_SEND = 512 * 1024; /* 512 KiB per bulk request */
+static void usb_bulk_tuning(feldev_handle *dev, size_t *chunk,
+			    unsigned int *timeout)
+{
+	uint32_t size, ms;
+
+	/* the SoC isn't known yet while the device gets opened */
+	soc_tuning_transfer(dev->soc_info, &size, &ms);
+	*chunk = size;
+	*timeout = ms;
+}
+
+/*
+ * Decide whether a failed bulk transfer should be retried, and prepare for
+ * that: report the error (so it shows up in the output / log), clear a
+ * possible halt condition of the endpoint and wait for the backoff delay.
+ * Returns false if the error is fatal, or we're out of attempts.
+ */
+static bool usb_retry(felusb_handle *usb, int ep, int rc,
+		      const char *caption, int attempt, progress_t *progress)
+{
+	int delay = USB_RETRY_DELAY << (attempt - 1);
+	struct timespec req;
+
+	if (rc == LIBUSB_ERROR_NO_DEVICE || attempt > USB_RETRIES)
+		return false;
+	if (delay > USB_RETRY_MAX_DELAY)
+		delay = USB_RETRY_MAX_DELAY;
+
+	usb->ctx->stats.usb_retries++;
+	fel_log(usb->ctx, "%s ERROR %d: %s", caption, rc, fel_strerror(rc));
+	fel_log(usb->ctx, "Retrying (attempt %d of %d) in %d ms",
+		attempt, USB_RETRIES, delay);
+	if (progress)
+		progress_retry(progress);
+
+	/* a stalled endpoint won't accept anything until the halt is cleared */
+	if (rc == LIBUSB_ERROR_PIPE) {
+		rc = libusb_clear_halt(usb->handle, ep);
+		if (rc != 0)
+			fel_log(usb->ctx, "libusb_clear_halt() ERROR %d: %s",
+				rc, fel_strerror(rc));
+	}
+	req.tv_sec = delay / 1000;
+	req.tv_nsec = (delay % 1000) * 1000000L;
+	nanosleep(&req, NULL);
+	return true;
+}
 
-void usb_bulk_send(libusb_device_handle *usb, int ep, const void *data,
-		   size_t length, bool progress)
+static int usb_bulk_xfer(felusb_handle *usb, int ep, const void *data,
+			 size_t length, progress_t *progress,
+			 size_t max_chunk, unsigned int timeout)
 {
 	/*
 	 * With no progress notifications, we'll use the maximum chunk size.
@@ -79,35 +247,61 @@ void usb_bulk_send(libusb_device_handle *usb, int ep, const void *data,
 	 * more frequent status updates. 128 KiB per request seem suitable.
 	 * (Worst case of "slow" transfers -> one update every two seconds.)
 	 */
-	size_t max_chunk = progress ? 128 * 1024 : AW_USB_MAX_BULK_SEND;
+	if (progress && max_chunk > 128 * 1024)
+		max_chunk = 128 * 1024;
 
+	fel_stats *stats = &usb->ctx->stats;
 	size_t chunk;
-	int rc, sent;
+	int rc, sent, attempt = 0;
 	while (length > 0) {
 		chunk = length < max_chunk ? length : max_chunk;
-		rc = libusb_bulk_transfer(usb, ep, (void *)data, chunk,
-					  &sent, USB_TIMEOUT);
-		if (rc != 0)
-			usb_error(rc, "usb_bulk_send()", 2);
+		rc = libusb_bulk_transfer(usb->handle, ep, (void *)data, chunk,
+					  &sent, timeout);
+		stats->usb_transfers++;
+		if (ep & LIBUSB_ENDPOINT_IN)
+			stats->usb_bytes_in += sent;
+		else
+			stats->usb_bytes_out += sent;
+		/* account for partial data, so a retry resumes from there */
 		length -= sent;
 		data += sent;
 
 		if (progress)
-			progress_update(sent); /* notification after each chunk */
+			progress_add(progress, sent); /* update after each chunk */
+		if (sent > 0)
+			attempt = 0;
+		if (rc != 0 && !usb_retry(usb, ep, rc, "usb_bulk_send()",
+					  ++attempt, progress))
+			return usb_error(usb->ctx, rc, "usb_bulk_send()", 2);
 	}
+	return FEL_SUCCESS;
+}
+
+static int usb_bulk_send(felusb_handle *usb, int ep, const void *data,
+			 size_t length, progress_t *progress)
+{
+	return usb_bulk_xfer(usb, ep, data, length, progress,
+			     AW_USB_MAX_BULK_SEND, USB_TIMEOUT);
 }
 
-void usb_bulk_recv(libusb_device_handle *usb, int ep, void *data, int length)
+static int usb_bulk_recv(felusb_handle *usb, int ep, void *data, int length)
 {
-	int rc, recv;
+	int rc, recv, attempt = 0;
 	while (length > 0) {
-		rc = libusb_bulk_transfer(usb, ep, data, length,
+		rc = libusb_bulk_transfer(usb->handle, ep, data, length,
 					  &recv, USB_TIMEOUT);
-		if (rc != 0)
-			usb_error(rc, "usb_bulk_recv()", 2);
+		usb->ctx->stats.usb_transfers++;
+		usb->ctx->stats.usb_bytes_in += recv;
 		length -= recv;
 		data += recv;
+
+		if (recv > 0)
+			attempt = 0;
+		if (rc != 0 && !usb_retry(usb, ep, rc, "usb_bulk_recv()",
+					  ++attempt, NULL))
+			return usb_error(usb->ctx, rc, "usb_bulk_recv()", 2);
 	}
+	return FEL_SUCCESS;
 }
 
 struct aw_usb_request {
@@ -135,7 +329,7 @@ struct aw_fel_request {
 #define AW_FEL_1_EXEC	0x102
 #define AW_FEL_1_READ	0x103
 
-static void aw_send_usb_request(feldev_handle *dev, int type, int length)
+static int aw_send_usb_request(feldev_handle *dev, int type, int length)
 {
 	struct aw_usb_request req = {
 		.signature = "AWUC",
@@ -144,58 +338,280 @@ static void aw_send_usb_request(feldev_handle *dev, int type, int length)
 		.unknown1 = htole32(0x0c000000)
 	};
 	req.length2 = req.length;
-	usb_bulk_send(dev->usb->handle, dev->usb->endpoint_out,
-		      &req, sizeof(req), false);
+	return usb_bulk_send(dev->usb, dev->usb->endpoint_out,
+			     &req, sizeof(req), NULL);
 }
 
-static void aw_read_usb_response(feldev_handle *dev)
+static int aw_check_usb_response(felusb_handle *usb, const void *buf)
+{
+	if (memcmp(buf, "AWUS", 4) != 0)
+		return fel_fail(usb->ctx, FEL_ERROR_PROTOCOL, 2,
+				"ERROR: Unexpected response from FEL device");
+	return FEL_SUCCESS;
+}
+
+static int aw_read_usb_response(feldev_handle *dev)
 {
 	char buf[13];
-	usb_bulk_recv(dev->usb->handle, dev->usb->endpoint_in,
-		      buf, sizeof(buf));
-	assert(strcmp(buf, "AWUS") == 0);
+	int rc = usb_bulk_recv(dev->usb, dev->usb->endpoint_in,
+			       buf, sizeof(buf));
+	return rc ? rc : aw_check_usb_response(dev->usb, buf);
+}
+
+/* progress state to account a device's transfers to */
+progress_t *feldev_progress(feldev_handle *dev)
+{
+	return dev->progress ? dev->progress : progress_default();
+}
+
+/*
+ * Transfer buffers
+ *
+ * On Linux, libusb can hand out memory that usbfs maps directly for DMA.
+ * Transfers from/to such memory avoid the kernel allocating a buffer of its
+ * own and copying the data for each bulk request. We keep a few of these
+ * per device, falling back to regular heap memory where that isn't
+ * supported (other OSes, old kernels or libusb versions).
+ */
+static unsigned char *fel_dev_mem_alloc(felusb_handle *usb)
+{
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+	unsigned char *mem;
+
+	if (usb->no_dma)
+		return NULL;
+	mem = libusb_dev_mem_alloc(usb->handle, FEL_BUFFER_SIZE);
+	if (!mem)
+		usb->no_dma = true; /* don't bother trying again */
+	return mem;
+#else
+	(void)usb;
+	return NULL;
+#endif
+}
+
+static void fel_dev_mem_free(felusb_handle *usb, unsigned char *mem)
+{
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+	libusb_dev_mem_free(usb->handle, mem, FEL_BUFFER_SIZE);
+#else
+	(void)usb;
+	(void)mem;
+#endif
+}
+
+/* get a buffer, set "dma" to request device memory (return NULL if none) */
+static unsigned char *fel_buffer_get(felusb_handle *usb, bool dma)
+{
+	unsigned char *result;
+	int i;
+
+	for (i = 0; i < FEL_BUFFERS; i++) {
+		if (usb->buffer[i].busy || (dma && usb->buffer[i].data
+					    && !usb->buffer[i].dma))
+			continue;
+		if (!usb->buffer[i].data) {
+			usb->buffer[i].data = fel_dev_mem_alloc(usb);
+			usb->buffer[i].dma = usb->buffer[i].data != NULL;
+			if (!usb->buffer[i].data) {
+				if (dma)
+					return NULL;
+				usb->buffer[i].data = malloc(FEL_BUFFER_SIZE);
+			}
+		}
+		if (usb->buffer[i].data) {
+			usb->buffer[i].busy = true;
+			return usb->buffer[i].data;
+		}
+	}
+	if (dma)
+		return NULL;
+	/* all of them in use, hand out an extra one */
+	result = malloc(FEL_BUFFER_SIZE);
+	if (!result)
+		fel_fail(usb->ctx, FEL_ERROR_NO_MEM, 1,
+			 "FAILED to allocate transfer buffer.");
+	return result;
+}
+
+static void fel_buffer_put(felusb_handle *usb, void *buf)
+{
+	int i;
+
+	for (i = 0; i < FEL_BUFFERS; i++)
+		if (usb->buffer[i].data == buf) {
+			usb->buffer[i].busy = false;
+			return;
+		}
+	free(buf);
+}
+
+/* check if the given range lies within a (busy) device memory buffer */
+static bool fel_buffer_is_dma(felusb_handle *usb, const void *data,
+			      size_t len)
+{
+	const unsigned char *p = data;
+	int i;
+
+	for (i = 0; i < FEL_BUFFERS; i++)
+		if (usb->buffer[i].dma && usb->buffer[i].busy
+		    && p >= usb->buffer[i].data
+		    && p + len <= usb->buffer[i].data + FEL_BUFFER_SIZE)
+			return true;
+	return false;
 }
 
-static void aw_usb_write(feldev_handle *dev, const void *data, size_t len,
-			 bool progress)
+static void fel_buffers_free(felusb_handle *usb)
 {
-	aw_send_usb_request(dev, AW_USB_WRITE, len);
-	usb_bulk_send(dev->usb->handle, dev->usb->endpoint_out,
-		      data, len, progress);
-	aw_read_usb_response(dev);
+	int i;
+
+	for (i = 0; i < FEL_BUFFERS; i++) {
+		if (usb->buffer[i].dma)
+			fel_dev_mem_free(usb, usb->buffer[i].data);
+		else
+			free(usb->buffer[i].data);
+		usb->buffer[i].data = NULL;
+	}
+}
+
+void *feldev_buffer_get(feldev_handle *dev)
+{
+	void *result = fel_buffer_get(dev->usb, false);
+
+	if (!result)
+		fel_end(dev->usb->ctx, FEL_ERROR_NO_MEM);
+	return result;
+}
+
+void feldev_buffer_put(feldev_handle *dev, void *buf)
+{
+	fel_buffer_put(dev->usb, buf);
+}
+
+/*
+ * AW_USB_* request for a protocol message (FEL request, status or version),
+ * using the default chunk size and timeout
+ */
+static int aw_usb_message(feldev_handle *dev, int type, void *buf,
+			  size_t len)
+{
+	int rc = aw_send_usb_request(dev, type, len);
+
+	if (rc == 0 && type == AW_USB_WRITE)
+		rc = usb_bulk_send(dev->usb, dev->usb->endpoint_out,
+				   buf, len, NULL);
+	else if (rc == 0)
+		rc = usb_bulk_recv(dev->usb, dev->usb->endpoint_in, buf, len);
+	return rc ? rc : aw_read_usb_response(dev);
+}
+
+/*
+ * Bulk transfer of payload data. If it's not in device memory already,
+ * larger amounts get passed through a DMA buffer (when available) in
+ * FEL_BUFFER_SIZE chunks. That copy replaces the one the kernel would
+ * otherwise do, along with its per-request buffer allocation.
+ */
+static int aw_usb_data(feldev_handle *dev, int ep, void *data, size_t len,
+		       progress_t *progress)
+{
+	felusb_handle *usb = dev->usb;
+	unsigned char *bounce = NULL;
+	bool out = ep == usb->endpoint_out;
+	size_t chunk, max_chunk;
+	unsigned int timeout;
+	int rc = FEL_SUCCESS;
+
+	usb_bulk_tuning(dev, &max_chunk, &timeout);
+	if (len >= FEL_BUFFER_MIN_DMA && !fel_buffer_is_dma(usb, data, len))
+		bounce = fel_buffer_get(usb, true);
+	if (!bounce)
+		return usb_bulk_xfer(usb, ep, data, len, progress,
+				     max_chunk, timeout);
+	while (len > 0 && rc == 0) {
+		chunk = len < FEL_BUFFER_SIZE ? len : FEL_BUFFER_SIZE;
+		if (out)
+			memcpy(bounce, data, chunk);
+		rc = usb_bulk_xfer(usb, ep, bounce, chunk, progress,
+				   max_chunk, timeout);
+		if (!out)
+			memcpy(data, bounce, chunk);
+		data += chunk;
+		len -= chunk;
+	}
+	fel_buffer_put(usb, bounce);
+	return rc;
 }
 
-static void aw_usb_read(feldev_handle *dev, const void *data, size_t len)
+static int aw_usb_write(feldev_handle *dev, const void *data, size_t len,
+			bool progress)
 {
-	aw_send_usb_request(dev, AW_USB_READ, len);
-	usb_bulk_send(dev->usb->handle, dev->usb->endpoint_in,
-		      data, len, false);
-	aw_read_usb_response(dev);
+	int rc = aw_send_usb_request(dev, AW_USB_WRITE, len);
+
+	if (rc == 0)
+		rc = aw_usb_data(dev, dev->usb->endpoint_out, (void *)data,
+				 len, progress ? feldev_progress(dev) : NULL);
+	return rc ? rc : aw_read_usb_response(dev);
 }
 
-void aw_send_fel_request(feldev_handle *dev, int type,
-			 uint32_t addr, uint32_t length)
+static int aw_usb_read(feldev_handle *dev, const void *data, size_t len)
+{
+	int rc = aw_send_usb_request(dev, AW_USB_READ, len);
+
+	if (rc == 0)
+		rc = aw_usb_data(dev, dev->usb->endpoint_in, (void *)data,
+				 len, NULL);
+	return rc ? rc : aw_read_usb_response(dev);
+}
+
+/* account a FEL request (and its payload) in the statistics */
+static void fel_count_request(feldev_handle *dev, int type, size_t length)
+{
+	fel_stats *stats = &dev->usb->ctx->stats;
+
+	switch (type) {
+	case AW_FEL_1_READ:
+		stats->read_requests++;
+		stats->bytes_read += length;
+		break;
+	case AW_FEL_1_WRITE:
+		stats->write_requests++;
+		stats->bytes_written += length;
+		break;
+	case AW_FEL_1_EXEC:
+		stats->exec_requests++;
+		break;
+	}
+}
+
+static int aw_send_fel_request(feldev_handle *dev, int type,
+			       uint32_t addr, uint32_t length)
 {
 	struct aw_fel_request req = {
 		.request = htole32(type),
 		.address = htole32(addr),
 		.length = htole32(length)
 	};
-	aw_usb_write(dev, &req, sizeof(req), false);
+	fel_count_request(dev, type, length);
+	return aw_usb_message(dev, AW_USB_WRITE, &req, sizeof(req));
 }
 
-void aw_read_fel_status(feldev_handle *dev)
+static int aw_read_fel_status(feldev_handle *dev)
 {
 	char buf[8];
-	aw_usb_read(dev, buf, sizeof(buf));
+	return aw_usb_message(dev, AW_USB_READ, buf, sizeof(buf));
 }
 
 /* AW_FEL_VERSION request */
-static void aw_fel_get_version(feldev_handle *dev, struct aw_fel_version *buf)
+static int aw_fel_get_version(feldev_handle *dev, struct aw_fel_version *buf)
 {
-	aw_send_fel_request(dev, AW_FEL_VERSION, 0, 0);
-	aw_usb_read(dev, buf, sizeof(*buf));
-	aw_read_fel_status(dev);
+	int rc = aw_send_fel_request(dev, AW_FEL_VERSION, 0, 0);
+
+	if (rc == 0)
+		rc = aw_usb_message(dev, AW_USB_READ, buf, sizeof(*buf));
+	if (rc == 0)
+		rc = aw_read_fel_status(dev);
+	if (rc != 0)
+		return rc;
 
 	buf->soc_id = (le32toh(buf->soc_id) >> 8) & 0xFFFF;
 	buf->unknown_0a = le32toh(buf->unknown_0a);
@@ -203,377 +619,951 @@ static void aw_fel_get_version(feldev_handle *dev, struct aw_fel_version *buf)
 	buf->scratchpad = le16toh(buf->scratchpad);
 	buf->pad[0] = le32toh(buf->pad[0]);
 	buf->pad[1] = le32toh(buf->pad[1]);
+	return FEL_SUCCESS;
 }
 
+static bool fel_chain_small(feldev_handle *dev, size_t len);
+static int fel_chain_request(feldev_handle *dev, int type, uint32_t addr,
+			     void *buf, size_t len);
+
 /* AW_FEL_1_READ request */
-void aw_fel_read(feldev_handle *dev, uint32_t offset, void *buf, size_t len)
+static int fel_request_read(feldev_handle *dev, uint32_t offset, void *buf,
+			    size_t len)
 {
-	aw_send_fel_request(dev, AW_FEL_1_READ, offset, len);
-	aw_usb_read(dev, buf, len);
-	aw_read_fel_status(dev);
+	int rc;
+
+	if (fel_chain_small(dev, len))
+		return fel_chain_request(dev, AW_FEL_1_READ, offset, buf, len);
+	rc = aw_send_fel_request(dev, AW_FEL_1_READ, offset, len);
+	if (rc == 0)
+		rc = aw_usb_read(dev, buf, len);
+	return rc ? rc : aw_read_fel_status(dev);
 }
 
 /* AW_FEL_1_WRITE request */
-void aw_fel_write(feldev_handle *dev, void *buf, uint32_t offset, size_t len)
+static int fel_request_write(feldev_handle *dev, void *buf, uint32_t offset,
+			     size_t len)
 {
-	aw_send_fel_request(dev, AW_FEL_1_WRITE, offset, len);
-	aw_usb_write(dev, buf, len, false);
-	aw_read_fel_status(dev);
+	int rc;
+
+	if (fel_chain_small(dev, len))
+		return fel_chain_request(dev, AW_FEL_1_WRITE, offset, buf, len);
+	rc = aw_send_fel_request(dev, AW_FEL_1_WRITE, offset, len);
+	if (rc == 0)
+		rc = aw_usb_write(dev, buf, len, false);
+	return rc ? rc : aw_read_fel_status(dev);
 }
 
 /* AW_FEL_1_EXEC request */
-void aw_fel_execute(feldev_handle *dev, uint32_t offset)
+static int fel_request_execute(feldev_handle *dev, uint32_t offset)
 {
-	aw_send_fel_request(dev, AW_FEL_1_EXEC, offset, 0);
-	aw_read_fel_status(dev);
+	int rc;
+
+	if (fel_chain_small(dev, 0))
+		return fel_chain_request(dev, AW_FEL_1_EXEC, offset, NULL, 0);
+	rc = aw_send_fel_request(dev, AW_FEL_1_EXEC, offset, 0);
+	return rc ? rc : aw_read_fel_status(dev);
 }
 
+/**********************************************************************
+ * Memory access cache (opt-in)
+ *
+ * Small writes to memory (SRAM and DRAM, never MMIO) get collected, with
+ * adjacent ones merged into a single transfer. Small reads of memory are
+ * kept, so repeating them doesn't need another round trip. Since only
+ * code running on the device changes its memory behind our back, pending
+ * writes get flushed and all cached data invalidated before executing
+ * anything. MMIO accesses, large transfers and asynchronous requests flush
+ * the pending writes first, which keeps the order of device-visible
+ * effects intact.
+ **********************************************************************/
+
+#define FEL_CACHE_ITEM		FEL_SMALL_REQUEST /* max. size of a cached access */
+#define FEL_CACHE_PENDING	8	/* number of pending write extents */
+#define FEL_CACHE_LINES		16	/* number of cached read extents */
+
+typedef struct {
+	uint32_t addr;
+	size_t len;
+	unsigned char *data;
+} fel_cache_extent;
+
+struct fel_cache {
+	fel_cache_extent pending[FEL_CACHE_PENDING];
+	int pending_count;
+	size_t pending_bytes;
+	fel_cache_extent line[FEL_CACHE_LINES];
+	int next_line;		/* round-robin replacement */
+};
+
 /*
- * This function is a higher-level wrapper for the FEL write functionality.
- * Unlike aw_fel_write() above - which is reserved for internal use - this
- * routine optionally allows progress callbacks.
+ * Memory that we may cache: SRAM (below 1 MiB on all SoCs) and everything
+ * from 0x40000000 up, which is DRAM and the BROM. The MMIO ranges lie in
+ * between.
  */
-void aw_fel_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
-			 size_t len, bool progress)
+static bool fel_is_memory(uint32_t addr, size_t len)
+{
+	return addr + len <= 0x100000 || addr >= 0x40000000;
+}
+
+static bool fel_overlaps(fel_cache_extent *e, uint32_t addr, size_t len)
 {
-	aw_send_fel_request(dev, AW_FEL_1_WRITE, offset, len);
-	aw_usb_write(dev, buf, len, progress);
-	aw_read_fel_status(dev);
+	return e->len > 0 && addr < e->addr + e->len && e->addr < addr + len;
+}
+
+static void fel_cache_invalidate(struct fel_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < FEL_CACHE_LINES; i++) {
+		free(cache->line[i].data);
+		cache->line[i].data = NULL;
+		cache->line[i].len = 0;
+	}
 }
 
 /*
- * We don't want the scratch code/buffer to exceed a maximum size of 0x400 bytes
- * (256 32-bit words) on readl_n/writel_n transfers. To guarantee this, we have
- * to account for the amount of space the ARM code uses.
+ * Write pending data to the device. After an error, the rest of it gets
+ * dropped along with the failed extent - and as the cached data may then
+ * differ from the device's memory, it's forgotten about as well.
  */
-#define LCODE_ARM_WORDS  12 /* word count of the [read/write]l_n scratch code */
-#define LCODE_ARM_SIZE   (LCODE_ARM_WORDS << 2) /* code size in bytes */
-#define LCODE_MAX_TOTAL  0x100 /* max. words in buffer */
-#define LCODE_MAX_WORDS  (LCODE_MAX_TOTAL - LCODE_ARM_WORDS) /* data words */
-
-/* multiple "readl" from sequential addresses to a destination buffer */
-static void aw_fel_readl_n(feldev_handle *dev, uint32_t addr,
-			   uint32_t *dst, size_t count)
-{
-	if (count == 0) return;
-	if (count > LCODE_MAX_WORDS) {
-		fprintf(stderr,
-			"ERROR: Max. word count exceeded, truncating aw_fel_readl_n() transfer\n");
-		count = LCODE_MAX_WORDS;
-	}
-
-	assert(LCODE_MAX_WORDS < 256); /* protect against corruption of ARM code */
-	uint32_t arm_code[] = {
-		htole32(0xe59f0020), /* ldr  r0, [pc, #32] ; ldr r0,[read_addr]  */
-		htole32(0xe28f1024), /* add  r1, pc, #36   ; adr r1, read_data   */
-		htole32(0xe59f201c), /* ldr  r2, [pc, #28] ; ldr r2,[read_count] */
-		htole32(0xe3520000 + LCODE_MAX_WORDS), /* cmp	r2, #LCODE_MAX_WORDS */
-		htole32(0xc3a02000 + LCODE_MAX_WORDS), /* movgt	r2, #LCODE_MAX_WORDS */
-		/* read_loop: */
-		htole32(0xe2522001), /* subs r2, r2, #1    ; r2 -= 1             */
-		htole32(0x412fff1e), /* bxmi lr            ; return if (r2 < 0)  */
-		htole32(0xe4903004), /* ldr  r3, [r0], #4  ; load and post-inc   */
-		htole32(0xe4813004), /* str  r3, [r1], #4  ; store and post-inc  */
-		htole32(0xeafffffa), /* b    read_loop                           */
-		htole32(addr),       /* read_addr */
-		htole32(count)       /* read_count */
-		/* read_data (buffer) follows, i.e. values go here */
-	};
-	assert(sizeof(arm_code) == LCODE_ARM_SIZE);
+static int fel_cache_flush(feldev_handle *dev)
+{
+	struct fel_cache *cache = dev->usb->cache;
+	int i, rc = FEL_SUCCESS;
+
+	if (!cache)
+		return FEL_SUCCESS;
+	for (i = 0; i < cache->pending_count; i++) {
+		fel_cache_extent *e = &cache->pending[i];
+		if (rc == 0)
+			rc = fel_request_write(dev, e->data, e->addr, e->len);
+		free(e->data);
+		e->data = NULL;
+		e->len = 0;
+	}
+	cache->pending_count = 0;
+	cache->pending_bytes = 0;
+	if (rc != 0)
+		fel_cache_invalidate(cache);
+	return rc;
+}
+
+int feldev_flush(feldev_handle *dev)
+{
+	int rc = fel_begin(dev);
+
+	if (rc == 0)
+		rc = fel_cache_flush(dev);
+	return fel_end(dev->usb->ctx, rc);
+}
+
+/* copy the (overlapping part of) data written to matching extents */
+static void fel_cache_update(fel_cache_extent *e, int count,
+			     uint32_t addr, const void *buf, size_t len)
+{
+	uint32_t start, end;
+	int i;
+
+	for (i = 0; i < count; i++, e++) {
+		if (!fel_overlaps(e, addr, len))
+			continue;
+		start = addr > e->addr ? addr : e->addr;
+		end = addr + len < e->addr + e->len ? addr + len
+						     : e->addr + e->len;
+		memcpy(e->data + (start - e->addr),
+		       (const unsigned char *)buf + (start - addr), end - start);
+	}
+}
+
+/* flush pending writes, if any of them overlaps the given range */
+static int fel_cache_sync(feldev_handle *dev, uint32_t addr, size_t len)
+{
+	struct fel_cache *cache = dev->usb->cache;
+	int i;
 
-	/* scratch buffer setup: transfers ARM code, including addr and count */
-	aw_fel_write(dev, arm_code, dev->soc_info->scratch_addr, sizeof(arm_code));
-	/* execute code, read back the result */
-	aw_fel_execute(dev, dev->soc_info->scratch_addr);
-	uint32_t buffer[count];
-	aw_fel_read(dev, dev->soc_info->scratch_addr + LCODE_ARM_SIZE,
-		    buffer, sizeof(buffer));
-	/* extract values to destination buffer */
-	uint32_t *val = buffer;
-	while (count-- > 0)
-		*dst++ = le32toh(*val++);
+	for (i = 0; i < cache->pending_count; i++)
+		if (fel_overlaps(&cache->pending[i], addr, len))
+			return fel_cache_flush(dev);
+	return FEL_SUCCESS;
 }
 
 /*
- * aw_fel_readl_n() wrapper that can handle large transfers. If necessary,
- * those will be done in separate 'chunks' of no more than LCODE_MAX_WORDS.
+ * Prepare for an access that doesn't use the cache. Memory only needs
+ * pending writes to the same location done first, while MMIO requires
+ * all of them (in case they affect the device state).
  */
-void fel_readl_n(feldev_handle *dev, uint32_t addr, uint32_t *dst, size_t count)
+static int fel_cache_bypass(feldev_handle *dev, uint32_t addr, size_t len)
 {
-	while (count > 0) {
-		size_t n = count > LCODE_MAX_WORDS ? LCODE_MAX_WORDS : count;
-		aw_fel_readl_n(dev, addr, dst, n);
-		addr += n * sizeof(uint32_t);
-		dst += n;
-		count -= n;
-	}
+	if (fel_is_memory(addr, len))
+		return fel_cache_sync(dev, addr, len);
+	return fel_cache_flush(dev);
 }
 
-/* multiple "writel" from a source buffer to sequential addresses */
-static void aw_fel_writel_n(feldev_handle *dev, uint32_t addr,
-			    uint32_t *src, size_t count)
+static int fel_cache_read(feldev_handle *dev, uint32_t addr, void *buf,
+			  size_t len)
 {
-	if (count == 0) return;
-	if (count > LCODE_MAX_WORDS) {
-		fprintf(stderr,
-			"ERROR: Max. word count exceeded, truncating aw_fel_writel_n() transfer\n");
-		count = LCODE_MAX_WORDS;
+	struct fel_cache *cache = dev->usb->cache;
+	fel_cache_extent *e;
+	int i, rc;
+
+	rc = fel_cache_bypass(dev, addr, len);
+	if (rc != 0)
+		return rc;
+	if (len > FEL_CACHE_ITEM || !fel_is_memory(addr, len))
+		return fel_request_read(dev, addr, buf, len);
+	for (i = 0; i < FEL_CACHE_LINES; i++) {
+		e = &cache->line[i];
+		if (e->len > 0 && addr >= e->addr
+		    && addr + len <= e->addr + e->len) {
+			memcpy(buf, e->data + (addr - e->addr), len);
+			return FEL_SUCCESS;
+		}
 	}
+	rc = fel_request_read(dev, addr, buf, len);
+	if (rc != 0)
+		return rc;
+
+	e = &cache->line[cache->next_line];
+	cache->next_line = (cache->next_line + 1) % FEL_CACHE_LINES;
+	free(e->data);
+	e->data = malloc(len);
+	e->len = e->data ? len : 0;
+	e->addr = addr;
+	if (e->data)
+		memcpy(e->data, buf, len);
+	return FEL_SUCCESS;
+}
 
-	assert(LCODE_MAX_WORDS < 256); /* protect against corruption of ARM code */
+static int fel_cache_write(feldev_handle *dev, const void *buf,
+			   uint32_t addr, size_t len)
+{
+	struct fel_cache *cache = dev->usb->cache;
+	fel_cache_extent *e;
+	unsigned char *data;
+	int i, rc;
+
+	fel_cache_update(cache->line, FEL_CACHE_LINES, addr, buf, len);
+	if (len > FEL_CACHE_ITEM || !fel_is_memory(addr, len)) {
+		rc = fel_cache_bypass(dev, addr, len);
+		return rc ? rc : fel_request_write(dev, (void *)buf, addr, len);
+	}
 	/*
-	 * We need a fixed array size to allow for (partial) initialization,
-	 * so we'll claim the maximum total number of words (0x100) here.
+	 * Completely within a pending extent? Then just update that, along
+	 * with any other pending data it overlaps - so the order of flushing
+	 * them doesn't matter.
 	 */
-	uint32_t arm_code[LCODE_MAX_TOTAL] = {
-		htole32(0xe59f0020), /* ldr  r0, [pc, #32] ; ldr r0,[write_addr] */
-		htole32(0xe28f1024), /* add  r1, pc, #36   ; adr r1, write_data  */
-		htole32(0xe59f201c), /* ldr  r2, [pc, #28] ; ldr r2,[write_count]*/
-		htole32(0xe3520000 + LCODE_MAX_WORDS), /* cmp	r2, #LCODE_MAX_WORDS */
-		htole32(0xc3a02000 + LCODE_MAX_WORDS), /* movgt	r2, #LCODE_MAX_WORDS */
-		/* write_loop: */
-		htole32(0xe2522001), /* subs r2, r2, #1    ; r2 -= 1             */
-		htole32(0x412fff1e), /* bxmi lr            ; return if (r2 < 0)  */
-		htole32(0xe4913004), /* ldr  r3, [r1], #4  ; load and post-inc   */
-		htole32(0xe4803004), /* str  r3, [r0], #4  ; store and post-inc  */
-		htole32(0xeafffffa), /* b    write_loop                          */
-		htole32(addr),       /* write_addr */
-		htole32(count)       /* write_count */
-		/* write_data (buffer) follows, i.e. values taken from here */
-	};
+	for (i = 0; i < cache->pending_count; i++) {
+		e = &cache->pending[i];
+		if (addr >= e->addr && addr + len <= e->addr + e->len) {
+			fel_cache_update(cache->pending, cache->pending_count,
+					 addr, buf, len);
+			return FEL_SUCCESS;
+		}
+	}
+	/* merge with the last extent if adjacent, otherwise add a new one */
+	e = cache->pending_count > 0 ? &cache->pending[cache->pending_count - 1]
+				     : NULL;
+	if (e && addr == e->addr + e->len
+	    && e->len + len <= FEL_SMALL_REQUEST) {
+		data = realloc(e->data, e->len + len);
+		if (!data)
+			return fel_fail(dev->usb->ctx, FEL_ERROR_NO_MEM, 1,
+					"FAILED to allocate cache memory.");
+		e->data = data;
+		memcpy(e->data + e->len, buf, len);
+		e->len += len;
+	} else {
+		/* keep the order of overlaps */
+		rc = fel_cache_sync(dev, addr, len);
+		if (rc == 0 && cache->pending_count >= FEL_CACHE_PENDING)
+			rc = fel_cache_flush(dev);
+		if (rc != 0)
+			return rc;
+		e = &cache->pending[cache->pending_count];
+		e->data = malloc(len);
+		if (!e->data)
+			return fel_fail(dev->usb->ctx, FEL_ERROR_NO_MEM, 1,
+					"FAILED to allocate cache memory.");
+		memcpy(e->data, buf, len);
+		e->addr = addr;
+		e->len = len;
+		cache->pending_count++;
+	}
+	cache->pending_bytes += len;
+	if (cache->pending_bytes >= FEL_SMALL_REQUEST)
+		return fel_cache_flush(dev);
+	return FEL_SUCCESS;
+}
+
+/* flush, and forget about cached data (as device code might change it) */
+static int fel_cache_barrier(feldev_handle *dev)
+{
+	int rc = FEL_SUCCESS;
+
+	if (dev->usb->cache) {
+		rc = fel_cache_flush(dev);
+		fel_cache_invalidate(dev->usb->cache);
+	}
+	return rc;
+}
+
+/* flush and free the cache, if any */
+static int fel_cache_free(feldev_handle *dev)
+{
+	int rc = fel_cache_barrier(dev);
+
+	free(dev->usb->cache);
+	dev->usb->cache = NULL;
+	return rc;
+}
+
+bool feldev_set_cache(feldev_handle *dev, bool enable)
+{
+	struct fel_cache *cache = dev->usb->cache;
+	fel_context *ctx = dev->usb->ctx;
+
+	if (enable && !cache) {
+		dev->usb->cache = calloc(1, sizeof(struct fel_cache));
+		if (!dev->usb->cache)
+			fel_end(ctx, fel_fail(ctx, FEL_ERROR_NO_MEM, 1,
+					"FAILED to allocate cache memory."));
+	} else if (!enable && cache) {
+		fel_end(ctx, fel_cache_free(dev));
+	}
+	return cache != NULL;
+}
+
+int aw_fel_read(feldev_handle *dev, uint32_t offset, void *buf, size_t len)
+{
+	int rc = fel_begin(dev);
 
-	/* copy values from source buffer */
-	size_t i;
-	for (i = 0; i < count; i++)
-		arm_code[LCODE_ARM_WORDS + i] = htole32(*src++);
-	/* scratch buffer setup: transfers ARM code and data */
-	aw_fel_write(dev, arm_code, dev->soc_info->scratch_addr,
-	             (LCODE_ARM_WORDS + count) * sizeof(uint32_t));
-	/* execute, and we're done */
-	aw_fel_execute(dev, dev->soc_info->scratch_addr);
+	if (rc == 0 && dev->usb->cache)
+		rc = fel_cache_read(dev, offset, buf, len);
+	else if (rc == 0)
+		rc = fel_request_read(dev, offset, buf, len);
+	return fel_end(dev->usb->ctx, rc);
+}
+
+int aw_fel_write(feldev_handle *dev, void *buf, uint32_t offset, size_t len)
+{
+	int rc = fel_begin(dev);
+
+	if (rc == 0 && dev->usb->cache)
+		rc = fel_cache_write(dev, buf, offset, len);
+	else if (rc == 0)
+		rc = fel_request_write(dev, buf, offset, len);
+	return fel_end(dev->usb->ctx, rc);
+}
+
+int aw_fel_execute(feldev_handle *dev, uint32_t offset)
+{
+	int rc = fel_begin(dev);
+
+	if (rc == 0)
+		rc = fel_cache_barrier(dev);
+	if (rc == 0)
+		rc = fel_request_execute(dev, offset);
+	return fel_end(dev->usb->ctx, rc);
 }
 
 /*
- * aw_fel_writel_n() wrapper that can handle large transfers. If necessary,
- * those will be done in separate 'chunks' of no more than LCODE_MAX_WORDS.
+ * This function is a higher-level wrapper for the FEL write functionality.
+ * Unlike aw_fel_write() above - which is reserved for internal use - this
+ * routine optionally allows progress callbacks.
  */
-void fel_writel_n(feldev_handle *dev, uint32_t addr, uint32_t *src, size_t count)
+int aw_fel_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
+			size_t len, bool progress)
 {
-	while (count > 0) {
-		size_t n = count > LCODE_MAX_WORDS ? LCODE_MAX_WORDS : count;
-		aw_fel_writel_n(dev, addr, src, n);
-		addr += n * sizeof(uint32_t);
-		src += n;
-		count -= n;
+	int rc = fel_begin(dev);
+
+	if (rc == 0 && dev->usb->cache) {
+		fel_cache_update(dev->usb->cache->line, FEL_CACHE_LINES,
+				 offset, buf, len);
+		rc = fel_cache_bypass(dev, offset, len);
 	}
+	if (rc == 0)
+		rc = aw_send_fel_request(dev, AW_FEL_1_WRITE, offset, len);
+	if (rc == 0)
+		rc = aw_usb_write(dev, buf, len, progress);
+	if (rc == 0)
+		rc = aw_read_fel_status(dev);
+	return fel_end(dev->usb->ctx, rc);
 }
 
-/*
- * move (arbitrary byte count) data between addresses within SoC memory
- *
- * These functions try to copy as many bytes as possible using 32-bit word
- * transfers, and handle any unaligned bytes ('head' and 'tail') separately.
- *
- * This is useful for the same reasons that "readl"/"writel" were introduced:
- * Byte-oriented transfers ("string" copy) might not give the expected results
- * when accessing hardware registers, like e.g. the (G)PIO config/state.
+/**********************************************************************
+ * Asynchronous (non-blocking) FEL requests
  *
- * We have two different low-level functions, where the copy operation moves
- * upwards or downwards respectively. This allows a non-destructive "memmove"
- * wrapper to select the suitable one in case of memory overlap.
+ * Each FEL request is a fixed sequence of USB bulk transfers ("steps"),
+ * three for every AW_USB_* request: the AWUC header, the actual data and
+ * the AWUS response. We keep a queue of requests per device, and walk
+ * through the steps from the libusb completion callbacks. Nothing here
+ * terminates the program; errors are passed to the user's callback.
+ **********************************************************************/
+
+#define FEL_ASYNC_MAX_STEPS	9	/* 3 AW_USB_* requests, 3 steps each */
+
+typedef struct {
+	unsigned char endpoint;
+	unsigned char *buf;
+	size_t length;
+	bool check_awus;	/* response to be checked for "AWUS" */
+	bool payload;		/* data phase of a read / write request */
+} fel_async_step;
+
+struct fel_async_op {
+	struct fel_async_op *next;
+	feldev_handle *dev;
+	fel_async_cb callback;
+	void *user_data;
+	struct libusb_transfer *transfer;
+	fel_async_step step[FEL_ASYNC_MAX_STEPS];
+	int steps, current;
+	size_t done;		/* bytes transferred within current step */
+	/* buffers for the protocol overhead */
+	struct aw_usb_request usb_req[3];
+	struct aw_fel_request fel_req;
+	char usb_resp[3][13];
+	char fel_status[8];
+};
+
+/* add an AW_USB_* request (with data) as three steps to the operation */
+static void fel_async_add_usb(struct fel_async_op *op, int type,
+			      void *data, size_t len, bool payload)
+{
+	felusb_handle *usb = op->dev->usb;
+	int n = op->steps / 3;
+	struct aw_usb_request *req = &op->usb_req[n];
+
+	memcpy(req->signature, "AWUC", 4);
+	req->request = htole16(type);
+	req->length = htole32(len);
+	req->unknown1 = htole32(0x0c000000);
+	req->length2 = req->length;
+
+	op->step[op->steps++] = (fel_async_step) {
+		usb->endpoint_out, (unsigned char *)req, sizeof(*req),
+		false, false };
+	op->step[op->steps++] = (fel_async_step) {
+		type == AW_USB_WRITE ? usb->endpoint_out : usb->endpoint_in,
+		data, len, false, payload };
+	op->step[op->steps++] = (fel_async_step) {
+		usb->endpoint_in, (unsigned char *)op->usb_resp[n],
+		sizeof(op->usb_resp[n]), true, false };
+}
+
+static int fel_transfer_status_to_error(enum libusb_transfer_status status)
+{
+	switch (status) {
+	case LIBUSB_TRANSFER_COMPLETED:	return 0;
+	case LIBUSB_TRANSFER_TIMED_OUT:	return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_CANCELLED:	return LIBUSB_ERROR_INTERRUPTED;
+	case LIBUSB_TRANSFER_STALL:	return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE:	return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:	return LIBUSB_ERROR_OVERFLOW;
+	default:			return LIBUSB_ERROR_IO;
+	}
+}
+
+static void LIBUSB_CALL fel_async_transfer_cb(struct libusb_transfer *transfer);
+
+/* submit the (remaining part of the) current step */
+static int fel_async_submit(struct fel_async_op *op)
+{
+	fel_async_step *step = &op->step[op->current];
+	size_t len = step->length - op->done, max_chunk = AW_USB_MAX_BULK_SEND;
+	unsigned int timeout = USB_TIMEOUT;
+
+	if (step->payload)
+		usb_bulk_tuning(op->dev, &max_chunk, &timeout);
+	if (len > max_chunk)
+		len = max_chunk;
+	libusb_fill_bulk_transfer(op->transfer, op->dev->usb->handle,
+				  step->endpoint, step->buf + op->done, len,
+				  fel_async_transfer_cb, op, timeout);
+	return libusb_submit_transfer(op->transfer);
+}
+
+static void fel_async_start(felusb_handle *usb);
+
+/*
+ * Complete the first request in the device's queue. Since the protocol
+ * state is unknown after an error, this also fails all requests queued
+ * behind it.
  */
+static void fel_async_finish(struct fel_async_op *op, int status)
+{
+	felusb_handle *usb = op->dev->usb;
+	struct fel_async_op *failed = NULL;
+
+	usb->queue = op->next;
+	if (status != 0) {
+		failed = usb->queue;
+		usb->queue = NULL;
+	}
+	libusb_free_transfer(op->transfer);
+	if (op->callback)
+		op->callback(op->dev, status, op->user_data);
+	free(op);
+
+	while (failed) {
+		op = failed;
+		failed = op->next;
+		libusb_free_transfer(op->transfer);
+		if (op->callback)
+			op->callback(op->dev, status, op->user_data);
+		free(op);
+	}
+	fel_async_start(usb);
+}
 
-static void fel_memcpy_up(feldev_handle *dev,
-			  uint32_t dst_addr, uint32_t src_addr, size_t size)
+static void LIBUSB_CALL fel_async_transfer_cb(struct libusb_transfer *transfer)
 {
-	if (size == 0) return;
-	/*
-	 * copy "upwards", increasing destination and source addresses
-	 */
-	uint32_t arm_code[] = {
-		htole32(0xe59f0054), /* ldr   r0, [pc, #84] ; ldr r0, [dst_addr] */
-		htole32(0xe59f1054), /* ldr   r1, [pc, #84] ; ldr r1, [src_addr] */
-		htole32(0xe59f2054), /* ldr   r2, [pc, #84] ; ldr r2, [size]     */
-		htole32(0xe0413000), /* sub   r3, r1, r0    ; r3 = r1 - r0       */
-		htole32(0xe3130003), /* tst   r3, #3        ; test lower bits    */
-		htole32(0x1a00000b), /* bne   copyup_tail   ; unaligned copying  */
-		/* copyup_head: */
-		htole32(0xe3110003), /* tst   r1, #3        ; word-aligned?      */
-		htole32(0x0a000004), /* beq   copyup_loop                        */
-		htole32(0xe4d13001), /* ldrb  r3, [r1], #1  ; load and post-inc  */
-		htole32(0xe4c03001), /* strb  r3, [r0], #1  ; store and post-inc */
-		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
-		htole32(0x5afffff9), /* bpl   copyup_head   ; while (r2 >= 0)    */
-		htole32(0xe12fff1e), /* bx    lr            ; early return       */
-		/* copyup_loop: */
-		htole32(0xe2522004), /* subs  r2, r2, #4    ; r2 -= 4            */
-		htole32(0x54913004), /* ldrpl r3, [r1], #4  ; load and post-inc  */
-		htole32(0x54803004), /* strpl r3, [r0], #4  ; store and post-inc */
-		htole32(0x5afffffb), /* bpl   copyup_loop   ; while (r2 >= 0)    */
-		htole32(0xe2822004), /* add   r2, r2, #4    ; remaining bytes    */
-		/* copyup_tail: */
-		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
-		htole32(0x412fff1e), /* bxmi  lr            ; return if (r2 < 0) */
-		htole32(0xe4d13001), /* ldrb  r3, [r1], #1  ; load and post-inc  */
-		htole32(0xe4c03001), /* strb  r3, [r0], #1  ; store and post-inc */
-		htole32(0xeafffffa), /* b     copyup_tail                        */
-
-		htole32(dst_addr), /* destination address */
-		htole32(src_addr), /* source address */
-		htole32(size),     /* size (= byte count) */
-	};
-	aw_fel_write(dev, arm_code, dev->soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(dev, dev->soc_info->scratch_addr);
+	struct fel_async_op *op = transfer->user_data;
+	fel_async_step *step = &op->step[op->current];
+	fel_stats *stats = &op->dev->usb->ctx->stats;
+	int rc = fel_transfer_status_to_error(transfer->status);
+
+	stats->usb_transfers++;
+	if (transfer->endpoint & LIBUSB_ENDPOINT_IN)
+		stats->usb_bytes_in += transfer->actual_length;
+	else
+		stats->usb_bytes_out += transfer->actual_length;
+	if (rc == 0) {
+		op->done += transfer->actual_length;
+		if (op->done < step->length) {
+			/* continue with next chunk of this step */
+			if (transfer->actual_length == 0)
+				rc = LIBUSB_ERROR_IO;
+			else
+				rc = fel_async_submit(op);
+			if (rc == 0)
+				return;
+		} else if (step->check_awus
+			   && memcmp(step->buf, "AWUS", 4) != 0) {
+			rc = FEL_ERROR_PROTOCOL;
+		} else if (++op->current < op->steps) {
+			op->done = 0;
+			rc = fel_async_submit(op);
+			if (rc == 0)
+				return;
+		}
+	}
+	fel_async_finish(op, rc);
 }
 
-static void fel_memcpy_down(feldev_handle *dev,
-			    uint32_t dst_addr, uint32_t src_addr, size_t size)
+/* start processing the first queued request (if not already active) */
+static void fel_async_start(felusb_handle *usb)
 {
-	if (size == 0) return;
-	/*
-	 * This ARM code makes use of decreasing values in r2
-	 * for memory indexing relative to the base addresses in r0 and r1.
-	 */
-	uint32_t arm_code[] = {
-		htole32(0xe59f0058), /* ldr   r0, [pc, #88] ; ldr r0, [dst_addr] */
-		htole32(0xe59f1058), /* ldr   r1, [pc, #88] ; ldr r1, [src_addr] */
-		htole32(0xe59f2058), /* ldr   r2, [pc, #88] ; ldr r2, [size]     */
-		htole32(0xe0403001), /* sub   r3, r0, r1    ; r3 = r0 - r1       */
-		htole32(0xe3130003), /* tst   r3, #3        ; test lower bits    */
-		htole32(0x1a00000c), /* bne   copydn_tail   ; unaligned copying  */
-		/* copydn_head: */
-		htole32(0xe0813002), /* add   r3, r1, r2    ; r3 = r1 + r2       */
-		htole32(0xe3130003), /* tst   r3, #3        ; word-aligned?      */
-		htole32(0x0a000004), /* beq   copydn_loop                        */
-		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
-		htole32(0x412fff1e), /* bxmi  lr            ; early return       */
-		htole32(0xe7d13002), /* ldrb  r3, [r1, r2]  ; load byte          */
-		htole32(0xe7c03002), /* strb  r3, [r0, r2]  ; store byte         */
-		htole32(0xeafffff7), /* b     copydn_head                        */
-		/* copydn_loop: */
-		htole32(0xe2522004), /* subs  r2, r2, #4    ; r2 -= 4            */
-		htole32(0x57913002), /* ldrpl r3, [r1, r2]  ; load word          */
-		htole32(0x57803002), /* strpl r3, [r0, r2]  ; store word         */
-		htole32(0x5afffffb), /* bpl   copydn_loop   ; while (r2 >= 0)    */
-		htole32(0xe2822004), /* add   r2, r2, #4    ; remaining bytes    */
-		/* copydn_tail: */
-		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
-		htole32(0x412fff1e), /* bxmi  lr            ; return if (r2 < 0) */
-		htole32(0xe7d13002), /* ldrb  r3, [r1, r2]  ; load byte          */
-		htole32(0xe7c03002), /* strb  r3, [r0, r2]  ; store byte         */
-		htole32(0xeafffffa), /* b     copydn_tail                        */
-
-		htole32(dst_addr), /* destination address */
-		htole32(src_addr), /* source address */
-		htole32(size),     /* size (= byte count) */
-	};
-	aw_fel_write(dev, arm_code, dev->soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(dev, dev->soc_info->scratch_addr);
+	struct fel_async_op *op = usb->queue;
+
+	if (!op || op->transfer)
+		return;
+	op->transfer = libusb_alloc_transfer(0);
+	if (!op->transfer) {
+		fel_async_finish(op, LIBUSB_ERROR_NO_MEM);
+		return;
+	}
+	int rc = fel_async_submit(op);
+	if (rc != 0)
+		fel_async_finish(op, rc);
+}
+
+/* set up the steps for a FEL request, including its data phase */
+static void fel_async_setup(struct fel_async_op *op, feldev_handle *dev,
+			    int type, uint32_t addr, void *buf, size_t len)
+{
+	op->dev = dev;
+	fel_count_request(dev, type, len);
+	op->fel_req.request = htole32(type);
+	op->fel_req.address = htole32(addr);
+	op->fel_req.length = htole32(len);
+	fel_async_add_usb(op, AW_USB_WRITE, &op->fel_req, sizeof(op->fel_req),
+			  false);
+	if (type == AW_FEL_1_WRITE)
+		fel_async_add_usb(op, AW_USB_WRITE, buf, len, true);
+	else if (type == AW_FEL_1_READ)
+		fel_async_add_usb(op, AW_USB_READ, buf, len, true);
+	fel_async_add_usb(op, AW_USB_READ, op->fel_status,
+			  sizeof(op->fel_status), false);
 }
 
-void fel_memmove(feldev_handle *dev,
-		 uint32_t dst_addr, uint32_t src_addr, size_t size)
+/* set up a FEL request (plus its data phase), and add it to the queue */
+static int fel_async_request(feldev_handle *dev, int type, uint32_t addr,
+			     void *buf, size_t len,
+			     fel_async_cb callback, void *user_data)
 {
+	struct fel_async_op *op, **tail;
+	int rc;
+
 	/*
-	 * To ensure non-destructive operation, we need to select "downwards"
-	 * copying if the destination overlaps the source region.
+	 * Pending (cached) writes have to reach the device first. That only
+	 * blocks with an idle device: blocking requests are refused while
+	 * others are queued, so there aren't any then.
 	 */
-	if (dst_addr >= src_addr && dst_addr < (src_addr + size))
-		fel_memcpy_down(dev, dst_addr, src_addr, size);
-	else
-		fel_memcpy_up(dev, dst_addr, src_addr, size);
+	rc = fel_cache_barrier(dev);
+	if (rc != 0)
+		return rc;
+	op = calloc(1, sizeof(struct fel_async_op));
+	if (!op)
+		return LIBUSB_ERROR_NO_MEM;
+	fel_async_setup(op, dev, type, addr, buf, len);
+	op->callback = callback;
+	op->user_data = user_data;
+
+	if (!dev->usb->queue) {
+		/* idle device: start now, and return failures to the caller */
+		op->transfer = libusb_alloc_transfer(0);
+		rc = op->transfer ? fel_async_submit(op) : LIBUSB_ERROR_NO_MEM;
+		if (rc != 0) {
+			libusb_free_transfer(op->transfer);
+			free(op);
+			return rc;
+		}
+		dev->usb->queue = op;
+		return 0;
+	}
+	for (tail = &dev->usb->queue; *tail; tail = &(*tail)->next)
+		;
+	*tail = op;
+	return 0;
+}
+
+int aw_fel_read_async(feldev_handle *dev, uint32_t offset, void *buf,
+		      size_t len, fel_async_cb callback, void *user_data)
+{
+	return fel_async_request(dev, AW_FEL_1_READ, offset, buf, len,
+				 callback, user_data);
+}
+
+int aw_fel_write_async(feldev_handle *dev, const void *buf, uint32_t offset,
+		       size_t len, fel_async_cb callback, void *user_data)
+{
+	return fel_async_request(dev, AW_FEL_1_WRITE, offset, (void *)buf, len,
+				 callback, user_data);
+}
+
+int aw_fel_execute_async(feldev_handle *dev, uint32_t offset,
+			 fel_async_cb callback, void *user_data)
+{
+	return fel_async_request(dev, AW_FEL_1_EXEC, offset, NULL, 0,
+				 callback, user_data);
+}
+
+/* number of asynchronous requests that haven't completed yet */
+size_t feldev_pending(feldev_handle *dev)
+{
+	struct fel_async_op *op;
+	size_t count = 0;
+
+	for (op = dev->usb->queue; op; op = op->next)
+		count++;
+	return count;
 }
 
 /*
- * Bitwise manipulation of a 32-bit word at given address, via bit masks that
- * specify which bits to clear and which to set.
+ * Cancel all pending requests of a device, and wait for them to complete
+ * (with LIBUSB_ERROR_INTERRUPTED as status, unless they finished already).
  */
-void fel_clrsetbits_le32(feldev_handle *dev,
-			 uint32_t addr, uint32_t clrbits, uint32_t setbits)
-{
-	uint32_t arm_code[] = {
-		htole32(0xe59f0018), /*    0:  ldr   r0, [addr]              */
-		htole32(0xe5901000), /*    4:  ldr   r1, [r0]                */
-		htole32(0xe59f2014), /*    8:  ldr   r2, [clrbits]           */
-		htole32(0xe1c11002), /*    c:  bic   r1, r1, r2              */
-		htole32(0xe59f2010), /*   10:  ldr   r2, [setbits]           */
-		htole32(0xe1811002), /*   14:  orr   r1, r1, r2              */
-		htole32(0xe5801000), /*   18:  str   r1, [r0]                */
-		htole32(0xe12fff1e), /*   1c:  bx    lr                      */
-
-		htole32(addr),    /* address */
-		htole32(clrbits), /* bits to clear */
-		htole32(setbits), /* bits to set */
-	};
-	aw_fel_write(dev, arm_code, dev->soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(dev, dev->soc_info->scratch_addr);
+void feldev_cancel(feldev_handle *dev)
+{
+	while (dev->usb->queue) {
+		struct fel_async_op *op = dev->usb->queue;
+		if (!op->transfer) {
+			/* never got submitted, fail (whole queue) directly */
+			fel_async_finish(op, LIBUSB_ERROR_INTERRUPTED);
+			continue;
+		}
+		/* this might also find the transfer completed already */
+		libusb_cancel_transfer(op->transfer);
+		while (dev->usb->queue == op)
+			libusb_handle_events(dev->usb->ctx->usb);
+	}
+}
+
+/**********************************************************************
+ * Chained FEL requests
+ *
+ * Done one at a time, the USB transfers of a single FEL request mean nine
+ * (execute: six) round trips, each waiting for the previous completion.
+ * For small requests that latency dominates, so we rather submit all of
+ * the steps at once - the host controller keeps them in order for each
+ * endpoint, and the device simply works through them - then wait a single
+ * time for the whole chain. Several requests (e.g. upload, execute and
+ * read back a thunk) may get chained together this way.
+ **********************************************************************/
+
+#define FEL_CHAIN_MAX_OPS	3
+#define FEL_CHAIN_MAX_STEPS	(FEL_CHAIN_MAX_OPS * FEL_ASYNC_MAX_STEPS)
+
+typedef struct {
+	feldev_handle *dev;
+	struct fel_async_op op[FEL_CHAIN_MAX_OPS];
+	int count;
+	int pending;	/* submitted transfers that haven't completed */
+	int status;	/* first error encountered */
+	int completed;	/* flag for libusb_handle_events_completed() */
+} fel_chain;
+
+static void LIBUSB_CALL fel_chain_transfer_cb(struct libusb_transfer *transfer)
+{
+	fel_chain *chain = transfer->user_data;
+	struct libusb_transfer **xfer = chain->dev->usb->chain_xfer;
+	fel_stats *stats = &chain->dev->usb->ctx->stats;
+	int i, rc = fel_transfer_status_to_error(transfer->status);
+
+	stats->usb_transfers++;
+	if (transfer->endpoint & LIBUSB_ENDPOINT_IN)
+		stats->usb_bytes_in += transfer->actual_length;
+	else
+		stats->usb_bytes_out += transfer->actual_length;
+	if (rc == 0 && transfer->actual_length < transfer->length)
+		rc = LIBUSB_ERROR_IO; /* short transfer, chain got out of sync */
+	if (rc != 0 && chain->status == 0) {
+		/* stop the rest, it gets resumed synchronously later */
+		chain->status = rc;
+		for (i = 0; i < FEL_CHAIN_MAX_STEPS; i++)
+			if (xfer[i] && xfer[i] != transfer)
+				libusb_cancel_transfer(xfer[i]);
+	}
+	if (--chain->pending == 0)
+		chain->completed = 1;
+}
+
+static void fel_chain_add(fel_chain *chain, int type, uint32_t addr,
+			  void *buf, size_t len)
+{
+	assert(chain->count < FEL_CHAIN_MAX_OPS);
+	fel_async_setup(&chain->op[chain->count++], chain->dev,
+			type, addr, buf, len);
+}
+
+/* whether to chain a request with "len" bytes of data */
+static bool fel_chain_small(feldev_handle *dev, size_t len)
+{
+	return !dev->usb->no_chain && !dev->usb->queue
+		&& len <= FEL_SMALL_REQUEST;
+}
+
+static int fel_chain_run(fel_chain *chain)
+{
+	felusb_handle *usb = chain->dev->usb;
+	struct libusb_transfer *xfer;
+	fel_async_step *step;
+	int i, j, n = 0, rc;
+
+	/* allocate all transfers before submitting any of them */
+	if (!usb->chain_xfer)
+		usb->chain_xfer = calloc(FEL_CHAIN_MAX_STEPS,
+					 sizeof(*usb->chain_xfer));
+	for (i = 0; i < chain->count && usb->chain_xfer; i++)
+		for (j = 0; j < chain->op[i].steps; j++, n++)
+			if (!usb->chain_xfer[n]
+			    && !(usb->chain_xfer[n] = libusb_alloc_transfer(0)))
+				return fel_fail(usb->ctx, FEL_ERROR_NO_MEM, 1,
+						"FAILED to allocate transfers.");
+	if (!usb->chain_xfer)
+		return fel_fail(usb->ctx, FEL_ERROR_NO_MEM, 1,
+				"FAILED to allocate transfers.");
+
+	chain->pending = chain->status = chain->completed = 0;
+	for (n = 0, i = 0; i < chain->count; i++)
+		for (j = 0; j < chain->op[i].steps; j++, n++) {
+			step = &chain->op[i].step[j];
+			xfer = usb->chain_xfer[n];
+			libusb_fill_bulk_transfer(xfer, usb->handle,
+					step->endpoint, step->buf, step->length,
+					fel_chain_transfer_cb, chain,
+					USB_TIMEOUT);
+			xfer->actual_length = 0;
+			if (chain->status == 0) {
+				rc = libusb_submit_transfer(xfer);
+				if (rc == 0)
+					chain->pending++;
+				else
+					chain->status = rc;
+			}
+		}
+	while (chain->pending > 0)
+		libusb_handle_events_completed(usb->ctx->usb,
+					       &chain->completed);
+
+	/*
+	 * After an error, redo whatever is missing one transfer at a time.
+	 * The synchronous code retries as needed, and continues right after
+	 * the data that made it through. That requires everything following
+	 * the first incomplete transfer to be untouched, though.
+	 */
+	if (chain->status != 0) {
+		usb->ctx->stats.usb_retries++;
+		fel_log(usb->ctx, "FEL request chain ERROR %d: %s",
+			chain->status, fel_strerror(chain->status));
+		fel_log(usb->ctx, "Resuming transfers individually");
+	}
+	bool incomplete = false;
+	for (n = 0, i = 0; i < chain->count; i++)
+		for (j = 0; j < chain->op[i].steps; j++, n++) {
+			step = &chain->op[i].step[j];
+			size_t done = usb->chain_xfer[n]->actual_length;
+
+			if (chain->status != 0 && done < step->length) {
+				if (incomplete && done > 0)
+					return usb_error(usb->ctx, chain->status,
+							 "FEL request chain out of sync,",
+							 2);
+				incomplete = true;
+				rc = usb_bulk_send(usb, step->endpoint,
+						   step->buf + done,
+						   step->length - done, NULL);
+				if (rc != 0)
+					return rc;
+			}
+			if (step->check_awus) {
+				rc = aw_check_usb_response(usb, step->buf);
+				if (rc != 0)
+					return rc;
+			}
+		}
+	chain->count = 0;
+	return FEL_SUCCESS;
+}
+
+/* do a (small, see fel_chain_small) request as chain */
+static int fel_chain_request(feldev_handle *dev, int type, uint32_t addr,
+			     void *buf, size_t len)
+{
+	fel_chain chain = { .dev = dev };
+
+	fel_chain_add(&chain, type, addr, buf, len);
+	return fel_chain_run(&chain);
+}
+
+static void fel_chain_free(felusb_handle *usb)
+{
+	int i;
+
+	if (usb->chain_xfer)
+		for (i = 0; i < FEL_CHAIN_MAX_STEPS; i++)
+			libusb_free_transfer(usb->chain_xfer[i]);
+	free(usb->chain_xfer);
+	usb->chain_xfer = NULL;
+}
+
+bool feldev_set_chaining(feldev_handle *dev, bool enable)
+{
+	bool result = !dev->usb->no_chain;
+
+	dev->usb->no_chain = !enable;
+	return result;
 }
 
 /*
- * Memory access to the SID (root) keys proved to be unreliable for certain
- * SoCs. This function uses an alternative, register-based approach to retrieve
- * the values.
+ * Upload code (possibly with data appended) to the scratch area, execute it
+ * and read back "result_size" bytes of results, which the code is expected
+ * to leave right after itself. That's three requests, chained if possible.
  */
-static void fel_get_sid_registers(feldev_handle *dev, uint32_t *result)
-{
-	uint32_t arm_code[] = {
-		htole32(0xe59f0040), /*    0:  ldr   r0, [pc, #64]           */
-		htole32(0xe3a01000), /*    4:  mov   r1, #0                  */
-		htole32(0xe28f303c), /*    8:  add   r3, pc, #60             */
-		/* <sid_read_loop>: */
-		htole32(0xe1a02801), /*    c:  lsl   r2, r1, #16             */
-		htole32(0xe3822b2b), /*   10:  orr   r2, r2, #44032          */
-		htole32(0xe3822002), /*   14:  orr   r2, r2, #2              */
-		htole32(0xe5802040), /*   18:  str   r2, [r0, #64]           */
-		/* <sid_read_wait>: */
-		htole32(0xe5902040), /*   1c:  ldr   r2, [r0, #64]           */
-		htole32(0xe3120002), /*   20:  tst   r2, #2                  */
-		htole32(0x1afffffc), /*   24:  bne   1c <sid_read_wait>      */
-		htole32(0xe5902060), /*   28:  ldr   r2, [r0, #96]           */
-		htole32(0xe7832001), /*   2c:  str   r2, [r3, r1]            */
-		htole32(0xe2811004), /*   30:  add   r1, r1, #4              */
-		htole32(0xe3510010), /*   34:  cmp   r1, #16                 */
-		htole32(0x3afffff3), /*   38:  bcc   c <sid_read_loop>       */
-		htole32(0xe3a02000), /*   3c:  mov   r2, #0                  */
-		htole32(0xe5802040), /*   40:  str   r2, [r0, #64]           */
-		htole32(0xe12fff1e), /*   44:  bx    lr                      */
-		htole32(dev->soc_info->sid_base), /* SID base addr */
-		/* retrieved SID values go here */
-	};
-	/* write and execute code */
-	aw_fel_write(dev, arm_code, dev->soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(dev, dev->soc_info->scratch_addr);
-	/* read back the result */
-	aw_fel_read(dev, dev->soc_info->scratch_addr + sizeof(arm_code),
-		    result, 4 * sizeof(uint32_t));
-	for (unsigned i = 0; i < 4; i++)
-		result[i] = le32toh(result[i]);
-}
-
-/* Read the SID "root" key (128 bits). You need to pass the device handle,
- * a pointer to a result array capable of receiving at least four 32-bit words,
- * and a flag specifying if the register-access workaround should be enforced.
- * Return value indicates whether the result is expected to be usable:
- * The function will return `false` (and zero the result) if it cannot access
- * the SID registers.
- */
-bool fel_get_sid_root_key(feldev_handle *dev, uint32_t *result,
-			  bool force_workaround)
+static int fel_thunk(feldev_handle *dev, void *code, size_t code_size,
+		     void *result, size_t result_size)
 {
-	if (!dev->soc_info->sid_base) {
-		/* SID unavailable */
-		for (unsigned i = 0; i < 4; i++) result[i] = 0;
-		return false;
+	uint32_t scratch = dev->soc_info->scratch_addr;
+	fel_chain chain = { .dev = dev };
+	int rc;
+
+	if (!fel_chain_small(dev, code_size + result_size)) {
+		rc = fel_request_write(dev, code, scratch, code_size);
+		if (rc == 0)
+			rc = fel_request_execute(dev, scratch);
+		if (rc == 0 && result_size > 0)
+			rc = fel_request_read(dev, scratch + code_size,
+					      result, result_size);
+		return rc;
 	}
+	fel_chain_add(&chain, AW_FEL_1_WRITE, scratch, code, code_size);
+	fel_chain_add(&chain, AW_FEL_1_EXEC, scratch, NULL, 0);
+	if (result_size > 0)
+		fel_chain_add(&chain, AW_FEL_1_READ, scratch + code_size,
+			      result, result_size);
+	return fel_chain_run(&chain);
+}
 
-	if (dev->soc_info->sid_fix || force_workaround)
-		/* Work around SID issues by using ARM thunk code */
-		fel_get_sid_registers(dev, result);
-	else
-		/* Read SID directly from memory */
-		fel_readl_n(dev, dev->soc_info->sid_base
-			       + dev->soc_info->sid_offset, result, 4);
-	return true;
+int fel_run_thunk(feldev_handle *dev, void *code, size_t code_size,
+		  void *result, size_t result_size)
+{
+	int rc = fel_begin(dev);
+
+	if (rc == 0)
+		rc = fel_cache_barrier(dev);
+	if (rc == 0)
+		rc = fel_thunk(dev, code, code_size, result, result_size);
+	return fel_end(dev->usb->ctx, rc);
+}
+
+const fel_stats *fel_get_stats(fel_context *ctx)
+{
+	return &fel_ctx(ctx)->stats;
+}
+
+void fel_set_log(fel_context *ctx, fel_log_cb log, void *user_data)
+{
+	ctx = fel_ctx(ctx);
+	ctx->log = log;
+	ctx->log_data = user_data;
+}
+
+int fel_handle_events(fel_context *ctx, struct timeval *timeout)
+{
+	struct timeval zero = { 0, 0 };
+
+	return libusb_handle_events_timeout_completed(fel_ctx(ctx)->usb,
+			timeout ? timeout : &zero, NULL);
+}
+
+int fel_get_pollfds(fel_context *ctx, fel_pollfd *fds, int max)
+{
+	const struct libusb_pollfd **list;
+	int i;
+
+	list = libusb_get_pollfds(fel_ctx(ctx)->usb);
+	if (!list)
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	for (i = 0; list[i]; i++)
+		if (i < max) {
+			fds[i].fd = list[i]->fd;
+			fds[i].events = list[i]->events;
+		}
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000104)
+	libusb_free_pollfds(list);
+#else
+	free(list);
+#endif
+	return i;
+}
+
+void fel_set_pollfd_notifiers(fel_context *ctx, fel_pollfd_added_cb added,
+			      fel_pollfd_removed_cb removed, void *user_data)
+{
+	libusb_set_pollfd_notifiers(fel_ctx(ctx)->usb, added, removed,
+				    user_data);
+}
+
+int fel_get_next_timeout(fel_context *ctx, struct timeval *timeout)
+{
+	return libusb_get_next_timeout(fel_ctx(ctx)->usb, timeout);
+}
+
+const char *fel_strerror(int status)
+{
+	if (status == 0)
+		return "Success";
+	if (status == FEL_ERROR_PROTOCOL)
+		return "Unexpected response from FEL device";
+	if (status == FEL_ERROR_BUSY)
+		return "Asynchronous FEL requests pending";
+#if defined(LIBUSBX_API_VERSION) && (LIBUSBX_API_VERSION >= 0x01000102)
+	return libusb_strerror(status);
+#else
+	return "libusb error";
+#endif
 }
 
 /* general functions, "FEL device" management */
@@ -619,7 +1609,7 @@ static int feldev_get_endpoint(feldev_handle *dev)
 }
 
 /* claim USB interface associated with the libusb handle for a FEL device */
-void feldev_claim(feldev_handle *dev)
+static int feldev_claim(feldev_handle *dev)
 {
 	int rc = libusb_claim_interface(dev->usb->handle, 0);
 #if defined(__linux__)
@@ -630,15 +1620,18 @@ void feldev_claim(feldev_handle *dev)
 	}
 #endif
 	if (rc)
-		usb_error(rc, "libusb_claim_interface()", 1);
+		return usb_error(dev->usb->ctx, rc,
+				 "libusb_claim_interface()", 1);
 
 	rc = feldev_get_endpoint(dev);
 	if (rc)
-		usb_error(rc, "FAILED to get FEL mode endpoint addresses!", 1);
+		return usb_error(dev->usb->ctx, rc,
+				 "FAILED to get FEL mode endpoint addresses!", 1);
+	return FEL_SUCCESS;
 }
 
 /* release USB interface associated with the libusb handle for a FEL device */
-void feldev_release(feldev_handle *dev)
+static void feldev_release(feldev_handle *dev)
 {
 	libusb_release_interface(dev->usb->handle, 0);
 #if defined(__linux__)
@@ -647,87 +1640,132 @@ void feldev_release(feldev_handle *dev)
 #endif
 }
 
-/* open handle to desired FEL device */
-feldev_handle *feldev_open(int busnum, int devnum,
-			   uint16_t vendor_id, uint16_t product_id)
+/* open the USB device, claim it and retrieve the SoC information */
+static int fel_open_usb(feldev_handle *result, int busnum, int devnum,
+			uint16_t vendor_id, uint16_t product_id)
 {
-	if (!fel_lib_initialized) /* if not already done: auto-initialize */
-		feldev_init();
-	feldev_handle *result = calloc(1, sizeof(feldev_handle));
-	if (!result) {
-		fprintf(stderr, "FAILED to allocate feldev_handle memory.\n");
-		exit(1);
-	}
-	result->usb = calloc(1, sizeof(felusb_handle));
-	if (!result->usb) {
-		fprintf(stderr, "FAILED to allocate felusb_handle memory.\n");
-		free(result);
-		exit(1);
-	}
+	fel_context *ctx = result->usb->ctx;
+	int rc;
 
 	if (busnum < 0 || devnum < 0) {
 		/* With the default values (busnum -1, devnum -1) we don't care
 		 * for a specific USB device; so let libusb open the first
 		 * device that matches VID/PID.
 		 */
-		result->usb->handle = libusb_open_device_with_vid_pid(NULL, vendor_id, product_id);
+		result->usb->handle = libusb_open_device_with_vid_pid(ctx->usb,
+						vendor_id, product_id);
 		if (!result->usb->handle) {
 			switch (errno) {
 			case EACCES:
-				fprintf(stderr, "ERROR: You don't have permission to access Allwinner USB FEL device\n");
-				break;
+				return fel_fail(ctx, FEL_ERROR_ACCESS, 1, "ERROR: You don't have permission to access Allwinner USB FEL device");
 			default:
-				fprintf(stderr, "ERROR: Allwinner USB FEL device not found!\n");
-				break;
+				return fel_fail(ctx, FEL_ERROR_NOT_FOUND, 1, "ERROR: Allwinner USB FEL device not found!");
 			}
-			exit(1);
 		}
 	} else {
 		/* look for specific bus and device number */
-		bool found = false;
-		ssize_t rc, i;
-		libusb_device **list;
-
-		rc = libusb_get_device_list(NULL, &list);
-		if (rc < 0)
-			usb_error(rc, "libusb_get_device_list()", 1);
-		for (i = 0; i < rc; i++) {
+		struct libusb_device_descriptor desc;
+		libusb_device **list, *match = NULL;
+		ssize_t count, i;
+
+		count = libusb_get_device_list(ctx->usb, &list);
+		if (count < 0)
+			return usb_error(ctx, count,
+					 "libusb_get_device_list()", 1);
+		for (i = 0; i < count && !match; i++)
 			if (libusb_get_bus_number(list[i]) == busnum
-			    && libusb_get_device_address(list[i]) == devnum) {
-				found = true; /* bus:devnum matched */
-				struct libusb_device_descriptor desc;
-				libusb_get_device_descriptor(list[i], &desc);
-				if (desc.idVendor != vendor_id
-				    || desc.idProduct != product_id) {
-					fprintf(stderr, "ERROR: Bus %03d Device %03d not a FEL device "
-						"(expected %04x:%04x, got %04x:%04x)\n", busnum, devnum,
-						vendor_id, product_id, desc.idVendor, desc.idProduct);
-					exit(1);
-				}
-				/* open handle to this specific device (incrementing its refcount) */
-				rc = libusb_open(list[i], &result->usb->handle);
-				if (rc != 0)
-					usb_error(rc, "libusb_open()", 1);
-				break;
-			}
-		}
+			    && libusb_get_device_address(list[i]) == devnum)
+				match = libusb_ref_device(list[i]);
 		libusb_free_device_list(list, true);
 
-		if (!found) {
-			fprintf(stderr, "ERROR: Bus %03d Device %03d not found in libusb device list\n",
-				busnum, devnum);
-			exit(1);
+		if (!match)
+			return fel_fail(ctx, FEL_ERROR_NOT_FOUND, 1, "ERROR: Bus %03d Device %03d not found in libusb device list",
+					busnum, devnum);
+		libusb_get_device_descriptor(match, &desc);
+		if (desc.idVendor != vendor_id || desc.idProduct != product_id) {
+			libusb_unref_device(match);
+			return fel_fail(ctx, FEL_ERROR_INVALID, 1, "ERROR: Bus %03d Device %03d not a FEL device "
+					"(expected %04x:%04x, got %04x:%04x)", busnum, devnum,
+					vendor_id, product_id, desc.idVendor, desc.idProduct);
 		}
+		/* open handle to this specific device (incrementing its refcount) */
+		rc = libusb_open(match, &result->usb->handle);
+		libusb_unref_device(match);
+		if (rc != 0)
+			return usb_error(ctx, rc, "libusb_open()", 1);
 	}
 
-	feldev_claim(result); /* claim interface, detect USB endpoints */
+	rc = feldev_claim(result); /* claim interface, detect USB endpoints */
+	if (rc != 0)
+		return rc;
 
 	/* retrieve BROM version and SoC information */
-	aw_fel_get_version(result, &result->soc_version);
+	rc = aw_fel_get_version(result, &result->soc_version);
+	if (rc != 0)
+		return rc;
 	get_soc_name_from_id(result->soc_name, result->soc_version.soc_id);
 	result->soc_info = get_soc_info_from_version(&result->soc_version);
 
-	return result;
+	libusb_device *usb = libusb_get_device(result->usb->handle);
+	result->busnum = libusb_get_bus_number(usb);
+	result->devnum = libusb_get_device_address(usb);
+	return FEL_SUCCESS;
+}
+
+static int fel_init_default(void)
+{
+	int rc = libusb_init(NULL);
+	if (rc != 0)
+		return usb_error(&default_context, rc, "libusb_init()", 1);
+	default_context.initialized = true;
+	return FEL_SUCCESS;
+}
+
+/* open handle to desired FEL device */
+static int fel_open_device(fel_context *ctx, int busnum, int devnum,
+			   uint16_t vendor_id, uint16_t product_id,
+			   feldev_handle **dev)
+{
+	feldev_handle *result;
+	int rc;
+
+	*dev = NULL;
+	if (!ctx->initialized) { /* if not already done: auto-initialize */
+		rc = fel_init_default();
+		if (rc != 0)
+			return rc;
+	}
+	result = calloc(1, sizeof(feldev_handle));
+	if (!result)
+		return fel_fail(ctx, FEL_ERROR_NO_MEM, 1,
+				"FAILED to allocate feldev_handle memory.");
+	result->usb = calloc(1, sizeof(felusb_handle));
+	if (!result->usb) {
+		free(result);
+		return fel_fail(ctx, FEL_ERROR_NO_MEM, 1,
+				"FAILED to allocate felusb_handle memory.");
+	}
+	result->usb->ctx = ctx;
+
+	rc = fel_open_usb(result, busnum, devnum, vendor_id, product_id);
+	if (rc != 0) {
+		/* don't leak the handle */
+		fel_close(result);
+		return rc;
+	}
+	*dev = result;
+	return FEL_SUCCESS;
+}
+
+feldev_handle *feldev_open(int busnum, int devnum,
+			   uint16_t vendor_id, uint16_t product_id)
+{
+	feldev_handle *dev;
+
+	fel_end(&default_context,
+		fel_open_device(&default_context, busnum, devnum,
+				vendor_id, product_id, &dev));
+	return dev;
 }
 
 /* close FEL device (optional, dev may be NULL) */
@@ -735,6 +1773,10 @@ void feldev_close(feldev_handle *dev)
 {
 	if (dev) {
 		if (dev->usb->handle) {
+			feldev_cancel(dev);
+			fel_cache_free(dev);
+			fel_buffers_free(dev->usb);
+			fel_chain_free(dev->usb);
 			feldev_release(dev);
 			libusb_close(dev->usb->handle);
 		}
@@ -744,64 +1786,51 @@ void feldev_close(feldev_handle *dev)
 
 void feldev_init(void)
 {
-	int rc = libusb_init(NULL);
-	if (rc != 0)
-		usb_error(rc, "libusb_init()", 1);
-	fel_lib_initialized = true;
+	fel_end(&default_context, fel_init_default());
 }
 
 void feldev_done(feldev_handle *dev)
 {
 	feldev_close(dev);
 	free(dev);
-	if (fel_lib_initialized) libusb_exit(NULL);
+	if (default_context.initialized) {
+		libusb_exit(NULL);
+		default_context.initialized = false;
+	}
 }
 
-/*
- * Enumerate (all) FEL devices. Allocates a list (array of feldev_list_entry)
- * and optionally returns the number of elements via "count". You may
- * alternatively detect the end of the list by checking the entry's soc_version
- * for a zero ID.
- * It's your responsibility to call free() on the result later.
- */
-feldev_list_entry *list_fel_devices(size_t *count)
+static void fel_list_sid(feldev_handle *dev, void *arg)
+{
+	feldev_list_entry *entry = arg;
+	fel_get_sid_root_key(dev, entry->SID, false);
+}
+
+/* FEL devices among the USB ones, with their SoC information and SID */
+static int fel_list_fill(fel_context *ctx, libusb_device **usb,
+			 ssize_t usb_count, feldev_list_entry *list,
+			 size_t *count)
 {
-	feldev_list_entry *list, *entry;
-	ssize_t rc, i;
-	libusb_context *ctx;
-	libusb_device **usb;
 	struct libusb_device_descriptor desc;
+	feldev_list_entry *entry;
 	feldev_handle *dev;
-	size_t devices = 0;
-
-	libusb_init(&ctx);
-	rc = libusb_get_device_list(ctx, &usb);
-	if (rc < 0)
-		usb_error(rc, "libusb_get_device_list()", 1);
-
-	/*
-	 * Size our array to hold entries for every USB device,
-	 * plus an empty one at the end (for list termination).
-	 */
-	list = calloc(rc + 1, sizeof(feldev_list_entry));
-	if (!list) {
-		fprintf(stderr, "list_fel_devices() FAILED to allocate list memory.\n");
-		exit(1);
-	}
+	ssize_t i;
+	int rc;
 
-	for (i = 0; i < rc; i++) {
+	for (i = 0; i < usb_count; i++) {
 		libusb_get_device_descriptor(usb[i], &desc);
 		if (desc.idVendor != AW_USB_VENDOR_ID
 		    || desc.idProduct != AW_USB_PRODUCT_ID)
 		continue; /* not an Allwinner FEL device */
 
-		entry = list + devices; /* pointer to current feldev_list_entry */
-		devices += 1;
+		entry = list + *count; /* pointer to current feldev_list_entry */
+		*count += 1;
 
 		entry->busnum = libusb_get_bus_number(usb[i]);
 		entry->devnum = libusb_get_device_address(usb[i]);
-		dev = feldev_open(entry->busnum, entry->devnum,
-				  AW_USB_VENDOR_ID, AW_USB_PRODUCT_ID);
+		rc = fel_open_device(ctx, entry->busnum, entry->devnum,
+				     AW_USB_VENDOR_ID, AW_USB_PRODUCT_ID, &dev);
+		if (rc != 0)
+			return rc;
 
 		/* copy relevant fields */
 		entry->soc_version = dev->soc_version;
@@ -809,14 +1838,178 @@ feldev_list_entry *list_fel_devices(size_t *count)
 		strncpy(entry->soc_name, dev->soc_name, sizeof(soc_name_t));
 
 		/* retrieve SID bits */
-		fel_get_sid_root_key(dev, entry->SID, false);
+		rc = fel_call(dev, fel_list_sid, entry);
 
 		feldev_close(dev);
 		free(dev);
+		if (rc != 0)
+			return rc;
+	}
+	return FEL_SUCCESS;
+}
+
+/*
+ * Enumerate (all) FEL devices. Allocates a list (array of feldev_list_entry)
+ * and optionally returns the number of elements via "count". You may
+ * alternatively detect the end of the list by checking the entry's soc_version
+ * for a zero ID.
+ * It's your responsibility to call free() on the result later.
+ */
+static int fel_list_devices(fel_context *ctx, feldev_list_entry **list,
+			    size_t *count)
+{
+	libusb_device **usb;
+	ssize_t usb_count;
+	size_t found = 0;
+	int rc;
+
+	*list = NULL;
+	if (count)
+		*count = 0;
+	if (!ctx->initialized) {
+		rc = fel_init_default();
+		if (rc != 0)
+			return rc;
 	}
+	usb_count = libusb_get_device_list(ctx->usb, &usb);
+	if (usb_count < 0)
+		return usb_error(ctx, usb_count, "libusb_get_device_list()", 1);
+
+	/*
+	 * Size our array to hold entries for every USB device,
+	 * plus an empty one at the end (for list termination).
+	 */
+	*list = calloc(usb_count + 1, sizeof(feldev_list_entry));
+	if (!*list) {
+		libusb_free_device_list(usb, true);
+		return fel_fail(ctx, FEL_ERROR_NO_MEM, 1,
+				"list_fel_devices() FAILED to allocate list memory.");
+	}
+
+	rc = fel_list_fill(ctx, usb, usb_count, *list, &found);
 	libusb_free_device_list(usb, true);
-	libusb_exit(ctx);
+	if (rc != 0) {
+		free(*list);
+		*list = NULL;
+		return rc;
+	}
 
-	if (count) *count = devices;
+	if (count) *count = found;
+	return FEL_SUCCESS;
+}
+
+feldev_list_entry *list_fel_devices(size_t *count)
+{
+	feldev_list_entry *list;
+
+	fel_end(&default_context,
+		fel_list_devices(&default_context, &list, count));
 	return list;
 }
+
+/* library contexts, and the error code returning functions */
+
+int fel_context_new(fel_context **ctx)
+{
+	fel_context *result = calloc(1, sizeof(fel_context));
+	int rc;
+
+	*ctx = NULL;
+	if (!result)
+		return FEL_ERROR_NO_MEM;
+	rc = libusb_init(&result->usb);
+	if (rc != 0) {
+		free(result);
+		return rc;
+	}
+	result->initialized = true;
+	*ctx = result;
+	return FEL_SUCCESS;
+}
+
+void fel_context_free(fel_context *ctx)
+{
+	if (ctx && ctx != &default_context) {
+		libusb_exit(ctx->usb);
+		free(ctx);
+	}
+}
+
+const char *fel_context_error(fel_context *ctx)
+{
+	return fel_ctx(ctx)->message;
+}
+
+int fel_open(fel_context *ctx, int busnum, int devnum, feldev_handle **dev)
+{
+	return fel_open_device(fel_ctx(ctx), busnum, devnum,
+			       AW_USB_VENDOR_ID, AW_USB_PRODUCT_ID, dev);
+}
+
+int fel_list(fel_context *ctx, feldev_list_entry **list, size_t *count)
+{
+	return fel_list_devices(fel_ctx(ctx), list, count);
+}
+
+void fel_close(feldev_handle *dev)
+{
+	feldev_close(dev);
+	free(dev);
+}
+
+int fel_call(feldev_handle *dev, fel_call_fn fn, void *arg)
+{
+	fel_context *ctx = dev->usb->ctx;
+
+	if (ctx->calls == 0)
+		ctx->error = FEL_SUCCESS;
+	else if (ctx->error != FEL_SUCCESS)
+		return ctx->error;
+	ctx->calls++;
+	fn(dev, arg);
+	ctx->calls--;
+	return ctx->error;
+}
+
+/* arguments of the basic requests run with fel_call() */
+typedef struct {
+	uint32_t addr;
+	void *buf;
+	size_t len;
+} fel_call_args;
+
+static void fel_call_read(feldev_handle *dev, void *arg)
+{
+	fel_call_args *a = arg;
+	aw_fel_read(dev, a->addr, a->buf, a->len);
+}
+
+static void fel_call_write(feldev_handle *dev, void *arg)
+{
+	fel_call_args *a = arg;
+	aw_fel_write(dev, a->buf, a->addr, a->len);
+}
+
+static void fel_call_execute(feldev_handle *dev, void *arg)
+{
+	fel_call_args *a = arg;
+	aw_fel_execute(dev, a->addr);
+}
+
+int fel_read(feldev_handle *dev, uint32_t addr, void *buf, size_t len)
+{
+	fel_call_args a = { .addr = addr, .buf = buf, .len = len };
+	return fel_call(dev, fel_call_read, &a);
+}
+
+int fel_write(feldev_handle *dev, uint32_t addr, const void *buf, size_t len)
+{
+	fel_call_args a = { .addr = addr, .buf = (void *)buf, .len = len };
+	return fel_call(dev, fel_call_write, &a);
+}
+
+int fel_execute(feldev_handle *dev, uint32_t addr)
+{
+	fel_call_args a = { .addr = addr };
+	return fel_call(dev, fel_call_execute, &a);
+}
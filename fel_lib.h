@@ -19,6 +19,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/time.h>
 #include "progress.h"
 #include "soc_info.h"
 
@@ -26,6 +27,9 @@
 #define AW_USB_VENDOR_ID	0x1F3A
 #define AW_USB_PRODUCT_ID	0xEFE8
 
+/* size limit for thunk code and data, placed at soc_info->scratch_addr */
+#define FEL_SCRATCH_SIZE	0x400
+
 typedef struct _felusb_handle felusb_handle; /* opaque data type */
 
 /* More general FEL "device" handle, including version data and SoC info */
@@ -34,6 +38,8 @@ typedef struct {
 	struct aw_fel_version soc_version;
 	soc_name_t soc_name;
 	soc_info_t *soc_info;
+	int busnum, devnum;
+	progress_t *progress;	/* progress tracking, NULL = progress_default() */
 } feldev_handle;
 
 /* list_fel_devices() will return an array of this type */
@@ -45,7 +51,76 @@ typedef struct {
 	uint32_t SID[4];
 } feldev_list_entry;
 
-/* FEL device management */
+/*
+ * The usable size of the scratch area, at least FEL_SCRATCH_SIZE. It may be
+ * larger for SoCs with (calibrated) tuning data, see soc_tuning.
+ */
+static inline uint32_t fel_scratch_size(feldev_handle *dev)
+{
+	uint32_t size = dev->soc_info->tuning.scratch_size;
+	return size > FEL_SCRATCH_SIZE ? size : FEL_SCRATCH_SIZE;
+}
+
+/*
+ * Library context
+ *
+ * A context holds a libusb session, transfer statistics and the description
+ * of the last error. Functions that can fail return an error code: a
+ * negative FEL_ERROR_* value, or a libusb one for USB errors. The exception
+ * is the default context, as used by feldev_open() and list_fel_devices():
+ * outside of fel_call(), it prints the message and exits on errors - which
+ * is what the sunxi-fel tool wants. Contexts are independent of each other;
+ * but a context and its devices may only be used by one thread at a time.
+ * Wherever a context is expected, NULL means the default one.
+ */
+typedef struct fel_context fel_context;
+
+#define FEL_SUCCESS		0
+#define FEL_ERROR_INVALID	(-2)	/* not a FEL device */
+#define FEL_ERROR_ACCESS	(-3)	/* no permission to access device */
+#define FEL_ERROR_NOT_FOUND	(-5)	/* no (matching) FEL device */
+#define FEL_ERROR_BUSY		(-6)	/* asynchronous requests pending */
+#define FEL_ERROR_NO_MEM	(-11)
+#define FEL_ERROR_PROTOCOL	(-100)	/* unexpected response from device */
+
+int fel_context_new(fel_context **ctx);
+/* close all of the context's devices before freeing it */
+void fel_context_free(fel_context *ctx);
+/* description of the context's last error */
+const char *fel_context_error(fel_context *ctx);
+
+/*
+ * Diagnostic messages, e.g. about USB errors that get retried, go to a
+ * callback. The default context prints them to stderr (and so does sunxi-fel
+ * with the message of an error that makes it exit), other ones discard them
+ * unless a callback gets set here. NULL turns them off.
+ */
+typedef void (*fel_log_cb)(const char *message, void *user_data);
+void fel_set_log(fel_context *ctx, fel_log_cb log, void *user_data);
+
+/* open (first matching, with busnum/devnum < 0) FEL device, or list them */
+int fel_open(fel_context *ctx, int busnum, int devnum, feldev_handle **dev);
+int fel_list(fel_context *ctx, feldev_list_entry **list, size_t *count);
+/* close device and free the handle (dev may be NULL) */
+void fel_close(feldev_handle *dev);
+
+/*
+ * Basic FEL requests. After an error, the protocol state of the device is
+ * unknown, so it's best closed and opened again.
+ */
+int fel_read(feldev_handle *dev, uint32_t addr, void *buf, size_t len);
+int fel_write(feldev_handle *dev, uint32_t addr, const void *buf, size_t len);
+int fel_execute(feldev_handle *dev, uint32_t addr);
+/*
+ * Call fn(dev, arg), returning the first error that any of the functions
+ * declared further down run into. After an error, the ones that follow
+ * within fn fail right away (with the same code), so fn doesn't need to
+ * check each of them. This also keeps the default context from exiting.
+ */
+typedef void (*fel_call_fn)(feldev_handle *dev, void *arg);
+int fel_call(feldev_handle *dev, fel_call_fn fn, void *arg);
+
+/* FEL device management, with the default context */
 
 void feldev_init(void);
 void feldev_done(feldev_handle *dev);
@@ -56,28 +131,148 @@ void feldev_close(feldev_handle *dev);
 
 feldev_list_entry *list_fel_devices(size_t *count);
 
-/* FEL functions */
+progress_t *feldev_progress(feldev_handle *dev);
+
+/*
+ * Transfer buffers of FEL_BUFFER_SIZE bytes, in DMA-able (usbfs) memory
+ * where the platform supports it. Reading or writing FEL data directly
+ * from/to these saves copying it. Transfers of at least FEL_BUFFER_MIN_DMA
+ * bytes that use other memory get passed through such a buffer internally.
+ */
+#define FEL_BUFFER_SIZE		(512 * 1024)
+#define FEL_BUFFER_MIN_DMA	(64 * 1024)
+
+void *feldev_buffer_get(feldev_handle *dev);
+void feldev_buffer_put(feldev_handle *dev, void *buf);
 
-void aw_fel_read(feldev_handle *dev, uint32_t offset, void *buf, size_t len);
-void aw_fel_write(feldev_handle *dev, void *buf, uint32_t offset, size_t len);
-void aw_fel_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
-			 size_t len, bool progress);
-void aw_fel_execute(feldev_handle *dev, uint32_t offset);
+/* FEL functions, these and the ones below return 0 or an error code */
 
-void fel_readl_n(feldev_handle *dev, uint32_t addr, uint32_t *dst, size_t count);
-void fel_writel_n(feldev_handle *dev, uint32_t addr, uint32_t *src, size_t count);
+int aw_fel_read(feldev_handle *dev, uint32_t offset, void *buf, size_t len);
+int aw_fel_write(feldev_handle *dev, void *buf, uint32_t offset, size_t len);
+int aw_fel_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
+			size_t len, bool progress);
+int aw_fel_execute(feldev_handle *dev, uint32_t offset);
 
-void fel_memmove(feldev_handle *dev,
-		 uint32_t dst_addr, uint32_t src_addr, size_t size);
+/*
+ * Small requests (up to FEL_SMALL_REQUEST bytes of data) get their USB
+ * transfers submitted all at once, instead of waiting for each in turn.
+ * This can be turned off per device, returns the previous setting.
+ */
+#define FEL_SMALL_REQUEST	(64 * 1024)
+bool feldev_set_chaining(feldev_handle *dev, bool enable);
+
+/*
+ * Opt-in caching of small memory (i.e. non-MMIO) accesses: adjacent writes
+ * get merged and deferred, repeated reads served from the cache. Executing
+ * code on the device flushes and invalidates it, but anything else that
+ * changes memory on the device side is not tracked. Returns the previous
+ * setting; feldev_flush() writes any pending data to the device.
+ */
+bool feldev_set_cache(feldev_handle *dev, bool enable);
+int feldev_flush(feldev_handle *dev);
 
-void fel_clrsetbits_le32(feldev_handle *dev,
-			 uint32_t addr, uint32_t clrbits, uint32_t setbits);
+/*
+ * Asynchronous FEL functions, for integration with event loops
+ *
+ * These queue a request and return immediately, with 0 on success or a
+ * negative error code - in which case the callback won't run. Requests
+ * for a device are processed in order; the callback gets invoked on
+ * completion with a status of 0, or a negative (libusb) error code -
+ * FEL_ERROR_PROTOCOL for an unexpected response. All requests queued
+ * behind a failed one also complete with its status. Buffers have to
+ * remain valid until the callback runs. Progress happens within
+ * fel_handle_events(); the blocking functions fail with FEL_ERROR_BUSY
+ * while requests are pending.
+ */
+typedef void (*fel_async_cb)(feldev_handle *dev, int status, void *user_data);
+
+int aw_fel_read_async(feldev_handle *dev, uint32_t offset, void *buf,
+		      size_t len, fel_async_cb callback, void *user_data);
+int aw_fel_write_async(feldev_handle *dev, const void *buf, uint32_t offset,
+		       size_t len, fel_async_cb callback, void *user_data);
+int aw_fel_execute_async(feldev_handle *dev, uint32_t offset,
+			 fel_async_cb callback, void *user_data);
+
+size_t feldev_pending(feldev_handle *dev);
+void feldev_cancel(feldev_handle *dev);
+
+/*
+ * process USB events of the context's devices, waiting up to "timeout"
+ * (NULL = don't block)
+ */
+int fel_handle_events(fel_context *ctx, struct timeval *timeout);
+
+/* file descriptors to poll() for, with the next timeout to be handled */
+typedef struct {
+	int fd;
+	short events;	/* POLLIN, POLLOUT */
+} fel_pollfd;
+
+typedef void (*fel_pollfd_added_cb)(int fd, short events, void *user_data);
+typedef void (*fel_pollfd_removed_cb)(int fd, void *user_data);
+
+/* store up to max entries, returns the total count (or an error code) */
+int fel_get_pollfds(fel_context *ctx, fel_pollfd *fds, int max);
+void fel_set_pollfd_notifiers(fel_context *ctx, fel_pollfd_added_cb added,
+			      fel_pollfd_removed_cb removed, void *user_data);
+/* returns 1 if timeout was set, 0 if there's none pending, or an error */
+int fel_get_next_timeout(fel_context *ctx, struct timeval *timeout);
+
+const char *fel_strerror(int status);
+
+/*
+ * Cumulative transfer statistics (for all devices of a context): FEL
+ * requests with their payload, and the USB bulk transfers that carry them -
+ * including the protocol overhead, and retries after errors.
+ */
+typedef struct {
+	uint64_t read_requests, write_requests, exec_requests;
+	uint64_t bytes_read, bytes_written;
+	uint64_t usb_transfers;
+	uint64_t usb_bytes_in, usb_bytes_out;
+	uint64_t usb_retries;
+} fel_stats;
+
+const fel_stats *fel_get_stats(fel_context *ctx);
+
+/* upload and execute thunk code, then read back results placed after it */
+int fel_run_thunk(feldev_handle *dev, void *code, size_t code_size,
+		  void *result, size_t result_size);
+
+int fel_readl_n(feldev_handle *dev, uint32_t addr, uint32_t *dst, size_t count);
+int fel_writel_n(feldev_handle *dev, uint32_t addr, uint32_t *src, size_t count);
+
+int fel_memmove(feldev_handle *dev,
+		uint32_t dst_addr, uint32_t src_addr, size_t size);
+
+int fel_clrsetbits_le32(feldev_handle *dev,
+			uint32_t addr, uint32_t clrbits, uint32_t setbits);
 #define fel_clrbits_le32(dev, addr, value) \
 	fel_clrsetbits_le32(dev, addr, value, 0)
 #define fel_setbits_le32(dev, addr, value) \
 	fel_clrsetbits_le32(dev, addr, 0, value)
 
-/* retrieve SID root key */
+/* memory extent to be filled with a 32-bit pattern (word-aligned) */
+typedef struct {
+	uint32_t addr;
+	uint32_t size;	/* byte count, must be > 0 */
+	uint32_t value;
+} fel_fill_extent;
+
+int fel_fill_extents(feldev_handle *dev,
+		     const fel_fill_extent *list, size_t count);
+
+/* data block to be moved from a staging area to its destination */
+typedef struct {
+	uint32_t src;
+	uint32_t dst;
+	uint32_t size;	/* byte count, must be > 0 */
+} fel_scatter_entry;
+
+int fel_scatter(feldev_handle *dev,
+		const fel_scatter_entry *list, size_t count);
+
+/* retrieve SID root key, false if unavailable (or after an error) */
 bool fel_get_sid_root_key(feldev_handle *dev, uint32_t *result,
 			  bool force_workaround);
 
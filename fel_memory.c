@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2012 Henrik Nordstrom <henrik@henriknordstrom.net>
+ * Copyright (C) 2015 Siarhei Siamashka <siarhei.siamashka@gmail.com>
+ * Copyright (C) 2016 Bernhard Nortmann <bernhard.nortmann@web.de>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * Memory access on the FEL device, by running small thunks
+ *
+ * These only build on the basic FEL requests (and fel_run_thunk), not on
+ * libusb directly - which allows testing them on a simulated device.
+ **********************************************************************/
+
+#include "portable_endian.h"
+#include "fel_lib.h"
+
+#include <assert.h>
+
+/*
+ * We don't want the scratch code/buffer to exceed a maximum size of 0x400 bytes
+ * (256 32-bit words) on readl_n/writel_n transfers. To guarantee this, we have
+ * to account for the amount of space the ARM code uses.
+ */
+#define LCODE_ARM_WORDS  12 /* word count of the [read/write]l_n scratch code */
+#define LCODE_ARM_SIZE   (LCODE_ARM_WORDS << 2) /* code size in bytes */
+#define LCODE_MAX_TOTAL  (FEL_SCRATCH_SIZE >> 2) /* max. words in buffer */
+#define LCODE_MAX_WORDS  (LCODE_MAX_TOTAL - LCODE_ARM_WORDS) /* data words */
+
+/* multiple "readl" from sequential addresses to a destination buffer */
+static int aw_fel_readl_n(feldev_handle *dev, uint32_t addr,
+			  uint32_t *dst, size_t count)
+{
+	int rc;
+
+	if (count == 0) return 0;
+	assert(count <= LCODE_MAX_WORDS); /* see fel_readl_n() */
+
+	assert(LCODE_MAX_WORDS < 256); /* protect against corruption of ARM code */
+	uint32_t arm_code[] = {
+		htole32(0xe59f0020), /* ldr  r0, [pc, #32] ; ldr r0,[read_addr]  */
+		htole32(0xe28f1024), /* add  r1, pc, #36   ; adr r1, read_data   */
+		htole32(0xe59f201c), /* ldr  r2, [pc, #28] ; ldr r2,[read_count] */
+		htole32(0xe3520000 + LCODE_MAX_WORDS), /* cmp	r2, #LCODE_MAX_WORDS */
+		htole32(0xc3a02000 + LCODE_MAX_WORDS), /* movgt	r2, #LCODE_MAX_WORDS */
+		/* read_loop: */
+		htole32(0xe2522001), /* subs r2, r2, #1    ; r2 -= 1             */
+		htole32(0x412fff1e), /* bxmi lr            ; return if (r2 < 0)  */
+		htole32(0xe4903004), /* ldr  r3, [r0], #4  ; load and post-inc   */
+		htole32(0xe4813004), /* str  r3, [r1], #4  ; store and post-inc  */
+		htole32(0xeafffffa), /* b    read_loop                           */
+		htole32(addr),       /* read_addr */
+		htole32(count)       /* read_count */
+		/* read_data (buffer) follows, i.e. values go here */
+	};
+	assert(sizeof(arm_code) == LCODE_ARM_SIZE);
+
+	/*
+	 * scratch buffer setup: transfers ARM code, including addr and count,
+	 * then execute it and read back the result
+	 */
+	uint32_t buffer[count];
+	rc = fel_run_thunk(dev, arm_code, sizeof(arm_code),
+			   buffer, sizeof(buffer));
+	if (rc != 0)
+		return rc;
+	/* extract values to destination buffer */
+	uint32_t *val = buffer;
+	while (count-- > 0)
+		*dst++ = le32toh(*val++);
+	return 0;
+}
+
+/*
+ * aw_fel_readl_n() wrapper that can handle large transfers. If necessary,
+ * those will be done in separate 'chunks' of no more than LCODE_MAX_WORDS.
+ */
+int fel_readl_n(feldev_handle *dev, uint32_t addr, uint32_t *dst, size_t count)
+{
+	int rc;
+
+	while (count > 0) {
+		size_t n = count > LCODE_MAX_WORDS ? LCODE_MAX_WORDS : count;
+		rc = aw_fel_readl_n(dev, addr, dst, n);
+		if (rc != 0)
+			return rc;
+		addr += n * sizeof(uint32_t);
+		dst += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/* multiple "writel" from a source buffer to sequential addresses */
+static int aw_fel_writel_n(feldev_handle *dev, uint32_t addr,
+			   uint32_t *src, size_t count)
+{
+	if (count == 0) return 0;
+	assert(count <= LCODE_MAX_WORDS); /* see fel_writel_n() */
+
+	assert(LCODE_MAX_WORDS < 256); /* protect against corruption of ARM code */
+	/*
+	 * We need a fixed array size to allow for (partial) initialization,
+	 * so we'll claim the maximum total number of words (0x100) here.
+	 */
+	uint32_t arm_code[LCODE_MAX_TOTAL] = {
+		htole32(0xe59f0020), /* ldr  r0, [pc, #32] ; ldr r0,[write_addr] */
+		htole32(0xe28f1024), /* add  r1, pc, #36   ; adr r1, write_data  */
+		htole32(0xe59f201c), /* ldr  r2, [pc, #28] ; ldr r2,[write_count]*/
+		htole32(0xe3520000 + LCODE_MAX_WORDS), /* cmp	r2, #LCODE_MAX_WORDS */
+		htole32(0xc3a02000 + LCODE_MAX_WORDS), /* movgt	r2, #LCODE_MAX_WORDS */
+		/* write_loop: */
+		htole32(0xe2522001), /* subs r2, r2, #1    ; r2 -= 1             */
+		htole32(0x412fff1e), /* bxmi lr            ; return if (r2 < 0)  */
+		htole32(0xe4913004), /* ldr  r3, [r1], #4  ; load and post-inc   */
+		htole32(0xe4803004), /* str  r3, [r0], #4  ; store and post-inc  */
+		htole32(0xeafffffa), /* b    write_loop                          */
+		htole32(addr),       /* write_addr */
+		htole32(count)       /* write_count */
+		/* write_data (buffer) follows, i.e. values taken from here */
+	};
+
+	/* copy values from source buffer */
+	size_t i;
+	for (i = 0; i < count; i++)
+		arm_code[LCODE_ARM_WORDS + i] = htole32(*src++);
+	/* scratch buffer setup: transfers ARM code and data, and execute */
+	return fel_run_thunk(dev, arm_code,
+			     (LCODE_ARM_WORDS + count) * sizeof(uint32_t),
+			     NULL, 0);
+}
+
+/*
+ * aw_fel_writel_n() wrapper that can handle large transfers. If necessary,
+ * those will be done in separate 'chunks' of no more than LCODE_MAX_WORDS.
+ */
+int fel_writel_n(feldev_handle *dev, uint32_t addr, uint32_t *src, size_t count)
+{
+	int rc;
+
+	while (count > 0) {
+		size_t n = count > LCODE_MAX_WORDS ? LCODE_MAX_WORDS : count;
+		rc = aw_fel_writel_n(dev, addr, src, n);
+		if (rc != 0)
+			return rc;
+		addr += n * sizeof(uint32_t);
+		src += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/*
+ * move (arbitrary byte count) data between addresses within SoC memory
+ *
+ * These functions try to copy as many bytes as possible using 32-bit word
+ * transfers, and handle any unaligned bytes ('head' and 'tail') separately.
+ *
+ * This is useful for the same reasons that "readl"/"writel" were introduced:
+ * Byte-oriented transfers ("string" copy) might not give the expected results
+ * when accessing hardware registers, like e.g. the (G)PIO config/state.
+ *
+ * We have two different low-level functions, where the copy operation moves
+ * upwards or downwards respectively. This allows a non-destructive "memmove"
+ * wrapper to select the suitable one in case of memory overlap.
+ */
+
+/* upload the thunk code to the scratch area, and execute it */
+static int fel_run_code(feldev_handle *dev, void *code, size_t size)
+{
+	int rc = aw_fel_write(dev, code, dev->soc_info->scratch_addr, size);
+	return rc ? rc : aw_fel_execute(dev, dev->soc_info->scratch_addr);
+}
+
+static int fel_memcpy_up(feldev_handle *dev,
+			 uint32_t dst_addr, uint32_t src_addr, size_t size)
+{
+	if (size == 0) return 0;
+	/*
+	 * copy "upwards", increasing destination and source addresses
+	 */
+	uint32_t arm_code[] = {
+		htole32(0xe59f0054), /* ldr   r0, [pc, #84] ; ldr r0, [dst_addr] */
+		htole32(0xe59f1054), /* ldr   r1, [pc, #84] ; ldr r1, [src_addr] */
+		htole32(0xe59f2054), /* ldr   r2, [pc, #84] ; ldr r2, [size]     */
+		htole32(0xe0413000), /* sub   r3, r1, r0    ; r3 = r1 - r0       */
+		htole32(0xe3130003), /* tst   r3, #3        ; test lower bits    */
+		htole32(0x1a00000b), /* bne   copyup_tail   ; unaligned copying  */
+		/* copyup_head: */
+		htole32(0xe3110003), /* tst   r1, #3        ; word-aligned?      */
+		htole32(0x0a000004), /* beq   copyup_loop                        */
+		htole32(0xe4d13001), /* ldrb  r3, [r1], #1  ; load and post-inc  */
+		htole32(0xe4c03001), /* strb  r3, [r0], #1  ; store and post-inc */
+		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
+		htole32(0x5afffff9), /* bpl   copyup_head   ; while (r2 >= 0)    */
+		htole32(0xe12fff1e), /* bx    lr            ; early return       */
+		/* copyup_loop: */
+		htole32(0xe2522004), /* subs  r2, r2, #4    ; r2 -= 4            */
+		htole32(0x54913004), /* ldrpl r3, [r1], #4  ; load and post-inc  */
+		htole32(0x54803004), /* strpl r3, [r0], #4  ; store and post-inc */
+		htole32(0x5afffffb), /* bpl   copyup_loop   ; while (r2 >= 0)    */
+		htole32(0xe2822004), /* add   r2, r2, #4    ; remaining bytes    */
+		/* copyup_tail: */
+		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
+		htole32(0x412fff1e), /* bxmi  lr            ; return if (r2 < 0) */
+		htole32(0xe4d13001), /* ldrb  r3, [r1], #1  ; load and post-inc  */
+		htole32(0xe4c03001), /* strb  r3, [r0], #1  ; store and post-inc */
+		htole32(0xeafffffa), /* b     copyup_tail                        */
+
+		htole32(dst_addr), /* destination address */
+		htole32(src_addr), /* source address */
+		htole32(size),     /* size (= byte count) */
+	};
+	return fel_run_code(dev, arm_code, sizeof(arm_code));
+}
+
+static int fel_memcpy_down(feldev_handle *dev,
+			   uint32_t dst_addr, uint32_t src_addr, size_t size)
+{
+	if (size == 0) return 0;
+	/*
+	 * This ARM code makes use of decreasing values in r2
+	 * for memory indexing relative to the base addresses in r0 and r1.
+	 */
+	uint32_t arm_code[] = {
+		htole32(0xe59f0058), /* ldr   r0, [pc, #88] ; ldr r0, [dst_addr] */
+		htole32(0xe59f1058), /* ldr   r1, [pc, #88] ; ldr r1, [src_addr] */
+		htole32(0xe59f2058), /* ldr   r2, [pc, #88] ; ldr r2, [size]     */
+		htole32(0xe0403001), /* sub   r3, r0, r1    ; r3 = r0 - r1       */
+		htole32(0xe3130003), /* tst   r3, #3        ; test lower bits    */
+		htole32(0x1a00000c), /* bne   copydn_tail   ; unaligned copying  */
+		/* copydn_head: */
+		htole32(0xe0813002), /* add   r3, r1, r2    ; r3 = r1 + r2       */
+		htole32(0xe3130003), /* tst   r3, #3        ; word-aligned?      */
+		htole32(0x0a000004), /* beq   copydn_loop                        */
+		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
+		htole32(0x412fff1e), /* bxmi  lr            ; early return       */
+		htole32(0xe7d13002), /* ldrb  r3, [r1, r2]  ; load byte          */
+		htole32(0xe7c03002), /* strb  r3, [r0, r2]  ; store byte         */
+		htole32(0xeafffff7), /* b     copydn_head                        */
+		/* copydn_loop: */
+		htole32(0xe2522004), /* subs  r2, r2, #4    ; r2 -= 4            */
+		htole32(0x57913002), /* ldrpl r3, [r1, r2]  ; load word          */
+		htole32(0x57803002), /* strpl r3, [r0, r2]  ; store word         */
+		htole32(0x5afffffb), /* bpl   copydn_loop   ; while (r2 >= 0)    */
+		htole32(0xe2822004), /* add   r2, r2, #4    ; remaining bytes    */
+		/* copydn_tail: */
+		htole32(0xe2522001), /* subs  r2, r2, #1    ; r2 -= 1            */
+		htole32(0x412fff1e), /* bxmi  lr            ; return if (r2 < 0) */
+		htole32(0xe7d13002), /* ldrb  r3, [r1, r2]  ; load byte          */
+		htole32(0xe7c03002), /* strb  r3, [r0, r2]  ; store byte         */
+		htole32(0xeafffffa), /* b     copydn_tail                        */
+
+		htole32(dst_addr), /* destination address */
+		htole32(src_addr), /* source address */
+		htole32(size),     /* size (= byte count) */
+	};
+	return fel_run_code(dev, arm_code, sizeof(arm_code));
+}
+
+int fel_memmove(feldev_handle *dev,
+		uint32_t dst_addr, uint32_t src_addr, size_t size)
+{
+	/*
+	 * To ensure non-destructive operation, we need to select "downwards"
+	 * copying if the destination overlaps the source region.
+	 */
+	if (dst_addr >= src_addr && dst_addr < (src_addr + size))
+		return fel_memcpy_down(dev, dst_addr, src_addr, size);
+	return fel_memcpy_up(dev, dst_addr, src_addr, size);
+}
+
+/*
+ * Bitwise manipulation of a 32-bit word at given address, via bit masks that
+ * specify which bits to clear and which to set.
+ */
+int fel_clrsetbits_le32(feldev_handle *dev,
+			uint32_t addr, uint32_t clrbits, uint32_t setbits)
+{
+	uint32_t arm_code[] = {
+		htole32(0xe59f0018), /*    0:  ldr   r0, [addr]              */
+		htole32(0xe5901000), /*    4:  ldr   r1, [r0]                */
+		htole32(0xe59f2014), /*    8:  ldr   r2, [clrbits]           */
+		htole32(0xe1c11002), /*    c:  bic   r1, r1, r2              */
+		htole32(0xe59f2010), /*   10:  ldr   r2, [setbits]           */
+		htole32(0xe1811002), /*   14:  orr   r1, r1, r2              */
+		htole32(0xe5801000), /*   18:  str   r1, [r0]                */
+		htole32(0xe12fff1e), /*   1c:  bx    lr                      */
+
+		htole32(addr),    /* address */
+		htole32(clrbits), /* bits to clear */
+		htole32(setbits), /* bits to set */
+	};
+	return fel_run_code(dev, arm_code, sizeof(arm_code));
+}
+
+/*
+ * Fill memory extents with 32-bit pattern values. The ARM code gets followed
+ * by a table of (addr, size, value) triplets, terminated by a zero size. To
+ * stay within the scratch area (0x400 bytes, unless tuned), large lists are
+ * split into multiple batches - each of them costing one write plus one execute.
+ */
+static const uint32_t fel_fill_thunk[] = {
+	#include "thunks/fill.h"
+};
+
+#define FILL_THUNK_WORDS	(sizeof(fel_fill_thunk) / sizeof(uint32_t))
+
+int fel_fill_extents(feldev_handle *dev,
+		     const fel_fill_extent *list, size_t count)
+{
+	/* the batch size follows the (possibly tuned) scratch area size */
+	size_t max_words = fel_scratch_size(dev) / sizeof(uint32_t);
+	size_t max_extents = (max_words - FILL_THUNK_WORDS) / 3 - 1;
+	uint32_t arm_code[max_words];
+	size_t i, n, words;
+	int rc;
+
+	while (count > 0) {
+		n = count > max_extents ? max_extents : count;
+		for (i = 0; i < FILL_THUNK_WORDS; i++)
+			arm_code[i] = htole32(fel_fill_thunk[i]);
+		words = FILL_THUNK_WORDS;
+		for (i = 0; i < n; i++) {
+			assert(((list[i].addr | list[i].size) & 3) == 0);
+			arm_code[words++] = htole32(list[i].addr);
+			arm_code[words++] = htole32(list[i].size);
+			arm_code[words++] = htole32(list[i].value);
+		}
+		/* end of table marker (zero size) */
+		arm_code[words++] = 0;
+		arm_code[words++] = 0;
+		arm_code[words++] = 0;
+
+		rc = fel_run_code(dev, arm_code, words * sizeof(uint32_t));
+		if (rc != 0)
+			return rc;
+		list += n;
+		count -= n;
+	}
+	return 0;
+}
+
+static const uint32_t fel_scatter_thunk[] = {
+	#include "thunks/scatter.h"
+};
+
+#define SCATTER_THUNK_WORDS	(sizeof(fel_scatter_thunk) / sizeof(uint32_t))
+
+/*
+ * Copy data blocks (from a previously uploaded staging area) to their final
+ * destinations, using device-side code. Source and destination ranges must
+ * not overlap.
+ */
+int fel_scatter(feldev_handle *dev,
+		const fel_scatter_entry *list, size_t count)
+{
+	size_t max_words = fel_scratch_size(dev) / sizeof(uint32_t);
+	size_t max_entries = (max_words - SCATTER_THUNK_WORDS) / 3 - 1;
+	uint32_t arm_code[max_words];
+	size_t i, n, words;
+	int rc;
+
+	while (count > 0) {
+		n = count > max_entries ? max_entries : count;
+		for (i = 0; i < SCATTER_THUNK_WORDS; i++)
+			arm_code[i] = htole32(fel_scatter_thunk[i]);
+		words = SCATTER_THUNK_WORDS;
+		for (i = 0; i < n; i++) {
+			assert(list[i].size > 0);
+			arm_code[words++] = htole32(list[i].src);
+			arm_code[words++] = htole32(list[i].dst);
+			arm_code[words++] = htole32(list[i].size);
+		}
+		/* end of table marker (zero size) */
+		arm_code[words++] = 0;
+		arm_code[words++] = 0;
+		arm_code[words++] = 0;
+
+		rc = fel_run_code(dev, arm_code, words * sizeof(uint32_t));
+		if (rc != 0)
+			return rc;
+		list += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/*
+ * Memory access to the SID (root) keys proved to be unreliable for certain
+ * SoCs. This function uses an alternative, register-based approach to retrieve
+ * the values.
+ */
+static int fel_get_sid_registers(feldev_handle *dev, uint32_t *result)
+{
+	uint32_t arm_code[] = {
+		htole32(0xe59f0040), /*    0:  ldr   r0, [pc, #64]           */
+		htole32(0xe3a01000), /*    4:  mov   r1, #0                  */
+		htole32(0xe28f303c), /*    8:  add   r3, pc, #60             */
+		/* <sid_read_loop>: */
+		htole32(0xe1a02801), /*    c:  lsl   r2, r1, #16             */
+		htole32(0xe3822b2b), /*   10:  orr   r2, r2, #44032          */
+		htole32(0xe3822002), /*   14:  orr   r2, r2, #2              */
+		htole32(0xe5802040), /*   18:  str   r2, [r0, #64]           */
+		/* <sid_read_wait>: */
+		htole32(0xe5902040), /*   1c:  ldr   r2, [r0, #64]           */
+		htole32(0xe3120002), /*   20:  tst   r2, #2                  */
+		htole32(0x1afffffc), /*   24:  bne   1c <sid_read_wait>      */
+		htole32(0xe5902060), /*   28:  ldr   r2, [r0, #96]           */
+		htole32(0xe7832001), /*   2c:  str   r2, [r3, r1]            */
+		htole32(0xe2811004), /*   30:  add   r1, r1, #4              */
+		htole32(0xe3510010), /*   34:  cmp   r1, #16                 */
+		htole32(0x3afffff3), /*   38:  bcc   c <sid_read_loop>       */
+		htole32(0xe3a02000), /*   3c:  mov   r2, #0                  */
+		htole32(0xe5802040), /*   40:  str   r2, [r0, #64]           */
+		htole32(0xe12fff1e), /*   44:  bx    lr                      */
+		htole32(dev->soc_info->sid_base), /* SID base addr */
+		/* retrieved SID values go here */
+	};
+	/* write and execute code, read back the result */
+	int rc = fel_run_thunk(dev, arm_code, sizeof(arm_code),
+			       result, 4 * sizeof(uint32_t));
+	for (unsigned i = 0; i < 4; i++)
+		result[i] = le32toh(result[i]);
+	return rc;
+}
+
+/* Read the SID "root" key (128 bits). You need to pass the device handle,
+ * a pointer to a result array capable of receiving at least four 32-bit words,
+ * and a flag specifying if the register-access workaround should be enforced.
+ * Return value indicates whether the result is expected to be usable:
+ * The function will return `false` (and zero the result) if it cannot access
+ * the SID registers, or the requests for that fail.
+ */
+bool fel_get_sid_root_key(feldev_handle *dev, uint32_t *result,
+			  bool force_workaround)
+{
+	int rc = FEL_ERROR_NOT_FOUND;
+
+	if (!dev->soc_info->sid_base)
+		; /* SID unavailable */
+	else if (dev->soc_info->sid_fix || force_workaround)
+		/* Work around SID issues by using ARM thunk code */
+		rc = fel_get_sid_registers(dev, result);
+	else
+		/* Read SID directly from memory */
+		rc = fel_readl_n(dev, dev->soc_info->sid_base
+				      + dev->soc_info->sid_offset, result, 4);
+	if (rc != 0) {
+		for (unsigned i = 0; i < 4; i++) result[i] = 0;
+		return false;
+	}
+	return true;
+}
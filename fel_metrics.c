@@ -0,0 +1,315 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * Per-run metrics, written at exit (Prometheus text format or JSON)
+ **********************************************************************/
+
+#include "common.h"
+#include "fel_metrics.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	const char *phase;
+	char detail[64];
+	double start, seconds;	/* start is relative to the run's begin */
+	uint64_t bytes;
+} metrics_span_t;
+
+static struct {
+	const char *filename;	/* NULL = metrics disabled */
+	bool json;
+	bool success;
+	double start;		/* timestamp of metrics_enable() */
+	soc_name_t soc_name;
+	uint32_t soc_id;
+	metrics_span_t *span;
+	size_t count, alloc;
+} metrics;
+
+/* output string with the escaping needed for JSON and Prometheus labels */
+static void put_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", out);
+		else if (c < 0x20)
+			fputc(' ', out);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+/* label set for per-SoC series, optionally with a phase */
+static void put_soc_labels(FILE *out, const char *phase)
+{
+	fputs("{soc=", out);
+	put_string(out, metrics.soc_name);
+	fprintf(out, ",soc_id=\"0x%04X\"", metrics.soc_id);
+	if (phase)
+		fprintf(out, ",phase=\"%s\"", phase);
+	fputc('}', out);
+}
+
+enum phase_total { PHASE_SPANS, PHASE_SECONDS, PHASE_BYTES };
+
+/* output one sample per distinct phase, in order of first appearance */
+static void for_each_phase(FILE *out, const char *name, enum phase_total what)
+{
+	size_t i, j, spans;
+	double seconds;
+	uint64_t bytes;
+
+	for (i = 0; i < metrics.count; i++) {
+		const char *phase = metrics.span[i].phase;
+		for (j = 0; j < i; j++)
+			if (strcmp(metrics.span[j].phase, phase) == 0)
+				break;
+		if (j < i)
+			continue; /* already done */
+
+		spans = 0;
+		seconds = 0;
+		bytes = 0;
+		for (j = i; j < metrics.count; j++) {
+			if (strcmp(metrics.span[j].phase, phase) != 0)
+				continue;
+			spans++;
+			seconds += metrics.span[j].seconds;
+			bytes += metrics.span[j].bytes;
+		}
+		fputs(name, out);
+		put_soc_labels(out, phase);
+		if (what == PHASE_SPANS)
+			fprintf(out, " %zu\n", spans);
+		else if (what == PHASE_SECONDS)
+			fprintf(out, " %.6f\n", seconds);
+		else
+			fprintf(out, " %llu\n", (unsigned long long)bytes);
+	}
+}
+
+static void write_prometheus(FILE *out, const fel_stats *stats, double total)
+{
+	double seconds = 0, bytes = 0;
+	size_t i;
+
+	fprintf(out, "# HELP sunxi_fel_info SoC of the FEL device\n"
+		     "# TYPE sunxi_fel_info gauge\n"
+		     "sunxi_fel_info");
+	put_soc_labels(out, NULL);
+	fputs(" 1\n", out);
+	fprintf(out, "# HELP sunxi_fel_success Whether the run completed without error\n"
+		     "# TYPE sunxi_fel_success gauge\n"
+		     "sunxi_fel_success %d\n", metrics.success);
+	fprintf(out, "# HELP sunxi_fel_run_seconds Wall-clock time of the run\n"
+		     "# TYPE sunxi_fel_run_seconds gauge\n"
+		     "sunxi_fel_run_seconds %.6f\n", total);
+
+	fprintf(out, "# HELP sunxi_fel_requests_total FEL requests by type\n"
+		     "# TYPE sunxi_fel_requests_total counter\n"
+		     "sunxi_fel_requests_total{type=\"read\"} %llu\n"
+		     "sunxi_fel_requests_total{type=\"write\"} %llu\n"
+		     "sunxi_fel_requests_total{type=\"exec\"} %llu\n",
+		(unsigned long long)stats->read_requests,
+		(unsigned long long)stats->write_requests,
+		(unsigned long long)stats->exec_requests);
+	fprintf(out, "# HELP sunxi_fel_bytes_total FEL request payload\n"
+		     "# TYPE sunxi_fel_bytes_total counter\n"
+		     "sunxi_fel_bytes_total{direction=\"read\"} %llu\n"
+		     "sunxi_fel_bytes_total{direction=\"write\"} %llu\n",
+		(unsigned long long)stats->bytes_read,
+		(unsigned long long)stats->bytes_written);
+	fprintf(out, "# HELP sunxi_fel_usb_transfers_total USB bulk transfers\n"
+		     "# TYPE sunxi_fel_usb_transfers_total counter\n"
+		     "sunxi_fel_usb_transfers_total %llu\n",
+		(unsigned long long)stats->usb_transfers);
+	fprintf(out, "# HELP sunxi_fel_usb_bytes_total USB bulk data, including protocol overhead\n"
+		     "# TYPE sunxi_fel_usb_bytes_total counter\n"
+		     "sunxi_fel_usb_bytes_total{direction=\"in\"} %llu\n"
+		     "sunxi_fel_usb_bytes_total{direction=\"out\"} %llu\n",
+		(unsigned long long)stats->usb_bytes_in,
+		(unsigned long long)stats->usb_bytes_out);
+	fprintf(out, "# HELP sunxi_fel_usb_retries_total Retries after USB errors\n"
+		     "# TYPE sunxi_fel_usb_retries_total counter\n"
+		     "sunxi_fel_usb_retries_total %llu\n",
+		(unsigned long long)stats->usb_retries);
+
+	if (metrics.count == 0)
+		return;
+	/*
+	 * Individual spans only go to JSON output. Labelling them for
+	 * Prometheus would create new series with every run, so we export
+	 * totals per phase instead (the set of phases is fixed).
+	 */
+	fprintf(out, "# HELP sunxi_fel_phase_spans_total Number of session phase spans\n"
+		     "# TYPE sunxi_fel_phase_spans_total counter\n");
+	for_each_phase(out, "sunxi_fel_phase_spans_total", PHASE_SPANS);
+	fprintf(out, "# HELP sunxi_fel_phase_seconds_total Wall-clock time of session phases\n"
+		     "# TYPE sunxi_fel_phase_seconds_total counter\n");
+	for_each_phase(out, "sunxi_fel_phase_seconds_total", PHASE_SECONDS);
+	fprintf(out, "# HELP sunxi_fel_phase_bytes_total Bytes transferred in session phases\n"
+		     "# TYPE sunxi_fel_phase_bytes_total counter\n");
+	for_each_phase(out, "sunxi_fel_phase_bytes_total", PHASE_BYTES);
+
+	/* spans with data don't nest, so we can simply add them up */
+	for (i = 0; i < metrics.count; i++) {
+		if (metrics.span[i].bytes == 0)
+			continue;
+		bytes += metrics.span[i].bytes;
+		seconds += metrics.span[i].seconds;
+	}
+	if (seconds > 0) {
+		fprintf(out, "# HELP sunxi_fel_transfer_bytes_per_second Average rate of the data transfer phases\n"
+			     "# TYPE sunxi_fel_transfer_bytes_per_second gauge\n"
+			     "sunxi_fel_transfer_bytes_per_second");
+		put_soc_labels(out, NULL);
+		fprintf(out, " %.0f\n", bytes / seconds);
+	}
+}
+
+static void write_json(FILE *out, const fel_stats *stats, double total)
+{
+	size_t i;
+
+	fprintf(out, "{\"soc\":");
+	put_string(out, metrics.soc_name);
+	fprintf(out, ",\"soc_id\":\"0x%04X\",\"success\":%s,\"run_seconds\":%.6f,\n",
+		metrics.soc_id, metrics.success ? "true" : "false", total);
+	fprintf(out, " \"requests\":{\"read\":%llu,\"write\":%llu,\"exec\":%llu},\n"
+		     " \"bytes\":{\"read\":%llu,\"write\":%llu},\n"
+		     " \"usb\":{\"transfers\":%llu,\"bytes_in\":%llu,"
+		     "\"bytes_out\":%llu,\"retries\":%llu},\n"
+		     " \"phases\":[",
+		(unsigned long long)stats->read_requests,
+		(unsigned long long)stats->write_requests,
+		(unsigned long long)stats->exec_requests,
+		(unsigned long long)stats->bytes_read,
+		(unsigned long long)stats->bytes_written,
+		(unsigned long long)stats->usb_transfers,
+		(unsigned long long)stats->usb_bytes_in,
+		(unsigned long long)stats->usb_bytes_out,
+		(unsigned long long)stats->usb_retries);
+	for (i = 0; i < metrics.count; i++) {
+		fprintf(out, "%s\n  {\"phase\":\"%s\",\"detail\":",
+			i ? "," : "", metrics.span[i].phase);
+		put_string(out, metrics.span[i].detail);
+		fprintf(out, ",\"start\":%.6f,\"seconds\":%.6f,\"bytes\":%llu}",
+			metrics.span[i].start, metrics.span[i].seconds,
+			(unsigned long long)metrics.span[i].bytes);
+	}
+	fprintf(out, "%s]}\n", metrics.count ? "\n " : "");
+}
+
+/* atexit() handler, so that failing runs get their metrics written too */
+static void metrics_write(void)
+{
+	double total = gettime() - metrics.start;
+	size_t len = strlen(metrics.filename);
+	char *tmp = malloc(len + 5);
+	FILE *out;
+
+	/*
+	 * Write a temporary file first and rename it, so a collector never
+	 * sees a partial one (as recommended for the textfile collector).
+	 */
+	if (!tmp) {
+		pr_error("Failed to write metrics: out of memory\n");
+		return;
+	}
+	snprintf(tmp, len + 5, "%s.tmp", metrics.filename);
+	out = fopen(tmp, "w");
+	if (!out) {
+		pr_error("%s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return;
+	}
+	if (metrics.json)
+		write_json(out, fel_get_stats(NULL), total);
+	else
+		write_prometheus(out, fel_get_stats(NULL), total);
+	if (fclose(out) != 0 || rename(tmp, metrics.filename) != 0) {
+		pr_error("%s: %s\n", metrics.filename, strerror(errno));
+		remove(tmp);
+	}
+	free(tmp);
+	free(metrics.span);
+}
+
+void metrics_enable(const char *filename)
+{
+	size_t len = strlen(filename);
+
+	if (!metrics.filename)
+		atexit(metrics_write);
+	metrics.filename = filename;
+	metrics.json = len >= 5 && strcmp(filename + len - 5, ".json") == 0;
+	metrics.start = gettime();
+}
+
+void metrics_set_device(feldev_handle *dev)
+{
+	memcpy(metrics.soc_name, dev->soc_name, sizeof(soc_name_t));
+	metrics.soc_id = dev->soc_version.soc_id;
+}
+
+void metrics_success(void)
+{
+	metrics.success = true;
+}
+
+double metrics_begin(void)
+{
+	return metrics.filename ? gettime() : 0;
+}
+
+void metrics_span(const char *phase, double start, uint64_t bytes,
+		  const char *detail, ...)
+{
+	metrics_span_t *span;
+	va_list args;
+
+	if (!metrics.filename)
+		return;
+	if (metrics.count >= metrics.alloc) {
+		size_t alloc = metrics.alloc ? 2 * metrics.alloc : 16;
+		span = realloc(metrics.span, alloc * sizeof(metrics_span_t));
+		if (!span)
+			pr_fatal("Failed to allocate metrics\n");
+		metrics.span = span;
+		metrics.alloc = alloc;
+	}
+	span = &metrics.span[metrics.count++];
+	span->phase = phase;
+	span->detail[0] = '\0';
+	if (detail) {
+		va_start(args, detail);
+		vsnprintf(span->detail, sizeof(span->detail), detail, args);
+		va_end(args);
+	}
+	span->start = start - metrics.start;
+	span->seconds = gettime() - start;
+	span->bytes = bytes;
+}
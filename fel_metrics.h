@@ -0,0 +1,48 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FEL_METRICS_H
+#define _SUNXI_TOOLS_FEL_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "fel_lib.h"
+
+/*
+ * Per-run metrics ("--metrics file"), for monitoring many FEL sessions
+ *
+ * We record wall-clock spans for the phases of a session (enumeration,
+ * SPL, MMU reconfiguration, uploads and exec requests), which get written
+ * to the file at exit - together with the transfer counters from fel_lib
+ * (see fel_get_stats). Spans may nest, e.g. "mmu" ones within "spl".
+ *
+ * The output format is JSON if the file name ends in ".json", otherwise
+ * the Prometheus text format (as used by the node exporter's "textfile"
+ * collector). JSON lists the individual spans, Prometheus gets totals per
+ * phase and SoC, plus the average transfer rate. Until metrics_enable()
+ * is called, everything is a no-op.
+ */
+void metrics_enable(const char *filename);
+void metrics_set_device(feldev_handle *dev);
+/* mark the run as successful, i.e. it didn't end with an error */
+void metrics_success(void);
+
+/* start a span, returns a timestamp to pass to metrics_span() */
+double metrics_begin(void);
+/* record a span, "detail" is a printf-style description (may be NULL) */
+void metrics_span(const char *phase, double start, uint64_t bytes,
+		  const char *detail, ...)
+	__attribute__((format(printf, 4, 5)));
+
+#endif /* _SUNXI_TOOLS_FEL_METRICS_H */
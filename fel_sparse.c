@@ -0,0 +1,260 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * Sparse uploads: split data into "transfer" and "fill" extents
+ **********************************************************************/
+
+#include "portable_endian.h"
+#include "fel_sparse.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void sparse_init(sparse_image *img)
+{
+	memset(img, 0, sizeof(*img));
+}
+
+void sparse_free(sparse_image *img)
+{
+	free(img->extent);
+	sparse_init(img);
+}
+
+/* returns NULL if out of memory, leaving the image unchanged */
+static sparse_extent *sparse_new_extent(sparse_image *img)
+{
+	if (img->count >= img->alloc) {
+		size_t alloc = img->alloc ? img->alloc * 2 : 16;
+		sparse_extent *extent = realloc(img->extent,
+						alloc * sizeof(sparse_extent));
+		if (!extent)
+			return NULL;
+		img->extent = extent;
+		img->alloc = alloc;
+	}
+	return &img->extent[img->count++];
+}
+
+static const char *sparse_add_data(sparse_image *img, uint32_t addr,
+				   const uint8_t *data, size_t size)
+{
+	if (size == 0)
+		return NULL;
+
+	/* merge with previous extent, if data and addresses are contiguous */
+	if (img->count > 0) {
+		sparse_extent *last = &img->extent[img->count - 1];
+		if (last->data && last->data + last->size == data
+		    && last->addr + last->size == addr) {
+			last->size += size;
+			img->data_bytes += size;
+			return NULL;
+		}
+	}
+	sparse_extent *ext = sparse_new_extent(img);
+	if (!ext)
+		return "out of memory";
+	ext->addr = addr;
+	ext->size = size;
+	ext->data = data;
+	ext->value = 0;
+	img->data_bytes += size;
+	return NULL;
+}
+
+static const char *sparse_add_fill(sparse_image *img, uint32_t addr,
+				   size_t size, uint32_t value)
+{
+	if (size == 0)
+		return NULL;
+
+	if (img->count > 0) {
+		sparse_extent *last = &img->extent[img->count - 1];
+		if (!last->data && last->value == value
+		    && last->addr + last->size == addr) {
+			last->size += size;
+			img->fill_bytes += size;
+			return NULL;
+		}
+	}
+	sparse_extent *ext = sparse_new_extent(img);
+	if (!ext)
+		return "out of memory";
+	ext->addr = addr;
+	ext->size = size;
+	ext->data = NULL;
+	ext->value = value;
+	img->fill_bytes += size;
+	return NULL;
+}
+
+/* test if a block consists of one repeated 32-bit value */
+static inline bool block_is_constant(const uint8_t *block)
+{
+	return memcmp(block, block + 4, SPARSE_BLOCK_SIZE - 4) == 0;
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return le32toh(value);
+}
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+	uint16_t value;
+	memcpy(&value, p, sizeof(value));
+	return le16toh(value);
+}
+
+/*
+ * Scan the buffer in blocks of SPARSE_BLOCK_SIZE. Runs of blocks that all
+ * consist of the same 32-bit pattern become fill extents, if they are at
+ * least SPARSE_MIN_FILL bytes long. Everything else is data. Fill extents
+ * require word alignment, so for unaligned target addresses we'll simply
+ * end up with a single data extent.
+ */
+const char *sparse_scan(sparse_image *img, const uint8_t *buf, size_t len,
+			uint32_t addr)
+{
+	size_t pos = 0, data_start = 0;
+	const char *err;
+
+	if ((addr & 3) == 0 && len >= SPARSE_MIN_FILL) {
+		while (pos + SPARSE_BLOCK_SIZE <= len) {
+			const uint8_t *block = buf + pos;
+			if (!block_is_constant(block)) {
+				pos += SPARSE_BLOCK_SIZE;
+				continue;
+			}
+			/* extend run over all following identical blocks */
+			size_t end = pos + SPARSE_BLOCK_SIZE;
+			while (end + SPARSE_BLOCK_SIZE <= len
+			       && memcmp(buf + end, block, SPARSE_BLOCK_SIZE) == 0)
+				end += SPARSE_BLOCK_SIZE;
+
+			if (end - pos >= SPARSE_MIN_FILL) {
+				err = sparse_add_data(img, addr + data_start,
+						      buf + data_start,
+						      pos - data_start);
+				if (!err)
+					err = sparse_add_fill(img, addr + pos,
+							      end - pos,
+							      get_le32(block));
+				if (err)
+					return err;
+				data_start = end;
+			}
+			pos = end;
+		}
+	}
+	return sparse_add_data(img, addr + data_start, buf + data_start,
+			       len - data_start);
+}
+
+/* Definitions taken from Android's system/core/libsparse/sparse_format.h */
+#define SPARSE_HEADER_MAGIC	0xED26FF3A
+#define SPARSE_HEADER_LEN	28
+#define CHUNK_HEADER_LEN	12
+
+#define CHUNK_TYPE_RAW		0xCAC1
+#define CHUNK_TYPE_FILL		0xCAC2
+#define CHUNK_TYPE_DONT_CARE	0xCAC3
+#define CHUNK_TYPE_CRC32	0xCAC4
+
+bool is_android_sparse(const uint8_t *buf, size_t len)
+{
+	return len >= SPARSE_HEADER_LEN && get_le32(buf) == SPARSE_HEADER_MAGIC;
+}
+
+const char *sparse_parse_android(sparse_image *img, const uint8_t *buf,
+				 size_t len, uint32_t addr)
+{
+	if (!is_android_sparse(buf, len))
+		return "not an Android sparse image";
+	if (get_le16(buf + 4) != 1)
+		return "unsupported major version";
+	if (addr & 3)
+		return "target address must be word-aligned";
+
+	size_t file_hdr_sz = get_le16(buf + 8);
+	size_t chunk_hdr_sz = get_le16(buf + 10);
+	uint32_t blk_sz = get_le32(buf + 12);
+	uint32_t total_blks = get_le32(buf + 16);
+	uint32_t total_chunks = get_le32(buf + 20);
+
+	if (file_hdr_sz < SPARSE_HEADER_LEN || chunk_hdr_sz < CHUNK_HEADER_LEN)
+		return "bad header size";
+	if (file_hdr_sz > len)
+		return "truncated header";
+	if (blk_sz == 0 || (blk_sz & 3))
+		return "bad block size";
+	if ((uint64_t)total_blks * blk_sz > 0x100000000ULL - addr)
+		return "image exceeds the 32-bit address space";
+
+	size_t pos = file_hdr_sz;
+	uint32_t blk = 0; /* current output position, in blocks */
+	uint32_t i;
+	const char *err;
+	for (i = 0; i < total_chunks; i++) {
+		if (pos + chunk_hdr_sz > len)
+			return "truncated chunk header";
+		const uint8_t *chunk = buf + pos;
+		uint16_t type = get_le16(chunk);
+		uint32_t chunk_sz = get_le32(chunk + 4); /* in blocks */
+		uint32_t total_sz = get_le32(chunk + 8); /* in bytes */
+		const uint8_t *data = chunk + chunk_hdr_sz;
+		size_t data_sz = total_sz - chunk_hdr_sz;
+
+		if (total_sz < chunk_hdr_sz || total_sz > len - pos)
+			return "bad chunk size";
+		if (chunk_sz > total_blks - blk)
+			return "chunk exceeds the output size";
+		uint32_t out = addr + blk * blk_sz;
+		size_t out_sz = (size_t)chunk_sz * blk_sz;
+
+		switch (type) {
+		case CHUNK_TYPE_RAW:
+			if (data_sz != out_sz)
+				return "raw chunk size mismatch";
+			/* raw data may itself contain constant runs */
+			err = sparse_scan(img, data, data_sz, out);
+			if (err)
+				return err;
+			break;
+		case CHUNK_TYPE_FILL:
+			if (data_sz < 4)
+				return "fill chunk too short";
+			err = sparse_add_fill(img, out, out_sz, get_le32(data));
+			if (err)
+				return err;
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+		case CHUNK_TYPE_CRC32:
+			/* nothing to write */
+			break;
+		default:
+			return "unknown chunk type";
+		}
+		blk += chunk_sz;
+		pos += total_sz;
+	}
+	if (blk != total_blks)
+		return "chunks don't cover the output size";
+	return NULL;
+}
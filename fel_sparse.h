@@ -0,0 +1,76 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FEL_SPARSE_H
+#define _SUNXI_TOOLS_FEL_SPARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A "sparse" upload is described by a list of extents. Each extent either
+ * refers to data that has to be transferred, or represents a memory range
+ * that can be filled on the device side with a 32-bit pattern value.
+ */
+typedef struct {
+	uint32_t addr;		/* target address */
+	uint32_t size;		/* byte count */
+	const uint8_t *data;	/* data to transfer, NULL for a fill extent */
+	uint32_t value;		/* fill pattern, if data == NULL */
+} sparse_extent;
+
+typedef struct {
+	sparse_extent *extent;
+	size_t count;		/* number of extents in use */
+	size_t alloc;		/* number of extents allocated */
+	size_t data_bytes;	/* sum of all data extent sizes */
+	size_t fill_bytes;	/* sum of all fill extent sizes */
+} sparse_image;
+
+/*
+ * Scanning granularity (block size) and the minimum length of a constant
+ * run that we'll want to turn into a fill extent. A fill costs a few FEL
+ * requests, so shorter runs are cheaper to transfer as plain data.
+ */
+#define SPARSE_BLOCK_SIZE	4096
+#define SPARSE_MIN_FILL		(64 * 1024)
+
+void sparse_init(sparse_image *img);
+void sparse_free(sparse_image *img);
+
+/*
+ * Split buffer into data and fill extents, for a transfer to "addr".
+ * Returns NULL on success, or a string describing the problem otherwise.
+ */
+const char *sparse_scan(sparse_image *img, const uint8_t *buf, size_t len,
+			uint32_t addr);
+
+/* Android sparse image format ("simg"), see libsparse/sparse_format.h */
+bool is_android_sparse(const uint8_t *buf, size_t len);
+/*
+ * Translate an Android sparse image to extents for a transfer to "addr".
+ * Returns NULL on success, or a string describing the problem otherwise.
+ * Data extents will point into buf, so it must remain valid.
+ */
+const char *sparse_parse_android(sparse_image *img, const uint8_t *buf,
+				 size_t len, uint32_t addr);
+
+/* total (expanded) byte count of the image */
+static inline size_t sparse_size(const sparse_image *img)
+{
+	return img->data_bytes + img->fill_bytes;
+}
+
+#endif /* _SUNXI_TOOLS_FEL_SPARSE_H */
@@ -0,0 +1,549 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * SPI NOR flash access via FEL
+ *
+ * The SPI controller gets set up with a few register writes, everything
+ * else is done by thunks/spi_nor.S: it executes lists of SPI commands that
+ * we prepare in the staging area. A single list covers many flash pages,
+ * so the number of FEL round trips stays low. Erasing is preceded by a
+ * (device-side) check if the sector is blank already, and skipped if so.
+ **********************************************************************/
+
+#include "common.h"
+#include "portable_endian.h"
+#include "fel_spiflash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t fel_spi_nor_thunk[] = {
+	#include "thunks/spi_nor.h"
+};
+
+/* clock control and pin controller registers, common to all known SoCs */
+#define CCU_AHB_GATING0		0x01C20060
+#define CCU_SPI0_CLK		0x01C200A0
+#define CCU_BUS_SOFT_RST0	0x01C202C0
+#define CCU_SPI0_BIT		(1 << 20)
+#define CCU_CLK_ENABLE		(1u << 31) /* with OSC24M as source */
+#define PIO_PORT_C_CFG(pin)	(0x01C20800 + 2 * 0x24 + (pin) / 8 * 4)
+
+/* sun4i-style controller (A10/A13/A20) */
+#define SUN4I_SPI_RXD		0x00
+#define SUN4I_SPI_TXD		0x04
+#define SUN4I_SPI_CTL		0x08
+#define SUN4I_SPI_CCTL		0x1C
+#define SUN4I_SPI_BC		0x20
+#define SUN4I_SPI_TC		0x24
+#define SUN4I_SPI_FIFO_STA	0x28
+#define SUN4I_CTL_ENABLE	(1 << 0)
+#define SUN4I_CTL_MASTER	(1 << 1)
+#define SUN4I_CTL_CPHA		(1 << 2)
+#define SUN4I_CTL_CPOL		(1 << 3)
+#define SUN4I_CTL_CS_ACTIVE_LOW	(1 << 4)
+#define SUN4I_CTL_TF_RST	(1 << 8)
+#define SUN4I_CTL_RF_RST	(1 << 9)
+#define SUN4I_CTL_XCH		(1 << 10)
+#define SUN4I_CTL_CS_MASK	(3 << 12)
+#define SUN4I_CTL_DHB		(1 << 15)
+#define SUN4I_CTL_CS_MANUAL	(1 << 16)
+
+/* sun6i-style controller (A31 and later) */
+#define SUN6I_SPI_GCR		0x04
+#define SUN6I_SPI_TCR		0x08
+#define SUN6I_SPI_FCR		0x18
+#define SUN6I_SPI_FIFO_STA	0x1C
+#define SUN6I_SPI_CCTL		0x24
+#define SUN6I_SPI_MBC		0x30
+#define SUN6I_SPI_MTC		0x34
+#define SUN6I_SPI_BCC		0x38
+#define SUN6I_SPI_TXD		0x200
+#define SUN6I_SPI_RXD		0x300
+#define SUN6I_GCR_ENABLE	(1 << 0)
+#define SUN6I_GCR_MASTER	(1 << 1)
+#define SUN6I_GCR_TP_EN		(1 << 7)
+#define SUN6I_GCR_SRST		(1u << 31)
+#define SUN6I_TCR_CPHA		(1 << 0)
+#define SUN6I_TCR_CPOL		(1 << 1)
+#define SUN6I_TCR_SS_MASK	(3 << 4)
+#define SUN6I_TCR_SS_OWNER	(1 << 6)
+#define SUN6I_TCR_DHB		(1 << 8)
+#define SUN6I_TCR_XCH		(1u << 31)
+#define SUN6I_FCR_RX_RST	(1 << 15)
+#define SUN6I_FCR_TX_RST	(1u << 31)
+
+/* SPI clock = 24 MHz / (2 * (CDR2 + 1)) with DRS set, i.e. 12 MHz */
+#define SPI_CCTL_VALUE		(1 << 12)
+
+/* command list format, see thunks/spi_nor.S */
+#define SPI_OP_END		0
+#define SPI_OP_XFER		1
+#define SPI_OP_READ		2
+#define SPI_OP_POLL		3
+#define SPI_OP_BLANK		4
+#define SPI_OP_COND		0x100
+#define SPI_OP_MASK(mask)	((mask) << 16)
+#define SPI_CMD_HEADER		12
+
+#define SPI_PARAM_WORDS		10
+#define SPI_RESULT_WORDS	2
+#define SPI_POLL_LIMIT		(1 << 21) /* a few seconds, below USB timeout */
+#define SPI_RESET_POLLS		1000	/* host-side reads of the SRST bit */
+#define SPI_MAX_LIST		(128 * 1024) /* limits the time per execution */
+#define SPI_MIN_LIST		1024
+/*
+ * The whole list runs within a single FEL execute request, so the time the
+ * flash may stay busy (worst case, as per typical datasheets) must also be
+ * limited - well below the USB timeout of 10 seconds.
+ */
+#define SPI_MAX_BUSY_MS		4000
+#define SPI_SECTOR_ERASE_MS	400
+#define SPI_BLOCK_ERASE_MS	2000
+#define SPI_PAGE_PROGRAM_MS	5
+
+/* SPI NOR flash commands, using 3-byte addresses */
+#define SPI_NOR_PP		0x02
+#define SPI_NOR_READ		0x03
+#define SPI_NOR_RDSR		0x05
+#define SPI_NOR_WREN		0x06
+#define SPI_NOR_SE		0x20	/* 4 KiB sector erase */
+#define SPI_NOR_BE		0xD8	/* 64 KiB block erase */
+#define SPI_NOR_RDID		0x9F
+#define SPI_NOR_SR_WIP		0x01
+
+#define SPI_NOR_PAGE_SIZE	256
+#define SPI_NOR_SECTOR_SIZE	0x1000
+#define SPI_NOR_BLOCK_SIZE	0x10000
+#define SPI_NOR_MAX_SIZE	0x1000000
+
+#define ALIGN4(x)		(((x) + 3) & ~(size_t)3)
+
+struct spiflash {
+	feldev_handle *dev;
+	uint32_t stage;		/* device address of the command list */
+	size_t max_len;		/* size limit for the command list */
+	uint8_t *list;		/* host copy of the command list */
+	size_t len;		/* current length of the command list */
+	size_t pending;		/* progress to report once the list ran */
+	size_t blanks;		/* number of blank checks that passed */
+	unsigned int busy_ms;	/* worst case busy time of the current list */
+	progress_cb_t callback;
+	uint32_t id, size;
+};
+
+static uint32_t spi_readl(feldev_handle *dev, uint32_t addr)
+{
+	uint32_t val;
+	fel_readl_n(dev, addr, &val, 1);
+	return val;
+}
+
+static void spi_writel(feldev_handle *dev, uint32_t addr, uint32_t val)
+{
+	fel_writel_n(dev, addr, &val, 1);
+}
+
+/* enable clock and pins, and set up SPI0 as master with automatic CS */
+static void spi_init(feldev_handle *dev, const soc_spi_info *spi)
+{
+	size_t i, polls = 0;
+
+	fel_setbits_le32(dev, CCU_AHB_GATING0, CCU_SPI0_BIT);
+	if (spi->sun6i)
+		fel_setbits_le32(dev, CCU_BUS_SOFT_RST0, CCU_SPI0_BIT);
+	spi_writel(dev, CCU_SPI0_CLK, CCU_CLK_ENABLE);
+
+	for (i = 0; i < ARRAY_SIZE(spi->pins); i++) {
+		unsigned int shift = spi->pins[i] % 8 * 4;
+		fel_clrsetbits_le32(dev, PIO_PORT_C_CFG(spi->pins[i]),
+				    0xF << shift, spi->pin_func << shift);
+	}
+
+	if (spi->sun6i) {
+		fel_setbits_le32(dev, spi->base + SUN6I_SPI_GCR,
+				 SUN6I_GCR_ENABLE | SUN6I_GCR_MASTER |
+				 SUN6I_GCR_TP_EN | SUN6I_GCR_SRST);
+		/* the reset completes within a few cycles, unless clocks are off */
+		while (spi_readl(dev, spi->base + SUN6I_SPI_GCR) & SUN6I_GCR_SRST)
+			if (++polls >= SPI_RESET_POLLS)
+				pr_fatal("SPI flash: timeout, controller is still in reset\n");
+		fel_clrbits_le32(dev, spi->base + SUN6I_SPI_TCR,
+				 SUN6I_TCR_CPHA | SUN6I_TCR_CPOL |
+				 SUN6I_TCR_SS_MASK | SUN6I_TCR_SS_OWNER |
+				 SUN6I_TCR_DHB);
+		fel_setbits_le32(dev, spi->base + SUN6I_SPI_FCR,
+				 SUN6I_FCR_RX_RST | SUN6I_FCR_TX_RST);
+		spi_writel(dev, spi->base + SUN6I_SPI_CCTL, SPI_CCTL_VALUE);
+	} else {
+		fel_clrsetbits_le32(dev, spi->base + SUN4I_SPI_CTL,
+				    SUN4I_CTL_CPHA | SUN4I_CTL_CPOL |
+				    SUN4I_CTL_CS_MASK | SUN4I_CTL_DHB |
+				    SUN4I_CTL_CS_MANUAL,
+				    SUN4I_CTL_ENABLE | SUN4I_CTL_MASTER |
+				    SUN4I_CTL_CS_ACTIVE_LOW |
+				    SUN4I_CTL_TF_RST | SUN4I_CTL_RF_RST);
+		spi_writel(dev, spi->base + SUN4I_SPI_CCTL, SPI_CCTL_VALUE);
+	}
+}
+
+/* upload the thunk, with the register addresses for the SoC's controller */
+static void spi_upload_thunk(spiflash_t *flash, const soc_spi_info *spi)
+{
+	uint32_t code[ARRAY_SIZE(fel_spi_nor_thunk) + SPI_PARAM_WORDS];
+	uint32_t *param = code + ARRAY_SIZE(fel_spi_nor_thunk);
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(fel_spi_nor_thunk); i++)
+		code[i] = fel_spi_nor_thunk[i];
+	if (spi->sun6i) {
+		param[0] = spi->base + SUN6I_SPI_TXD;
+		param[1] = spi->base + SUN6I_SPI_RXD;
+		param[2] = spi->base + SUN6I_SPI_FIFO_STA;
+		param[3] = spi->base + SUN6I_SPI_TCR;
+		param[4] = SUN6I_TCR_XCH;
+		param[5] = spi->base + SUN6I_SPI_MBC;
+		param[6] = spi->base + SUN6I_SPI_MTC;
+		param[7] = spi->base + SUN6I_SPI_BCC;
+	} else {
+		param[0] = spi->base + SUN4I_SPI_TXD;
+		param[1] = spi->base + SUN4I_SPI_RXD;
+		param[2] = spi->base + SUN4I_SPI_FIFO_STA;
+		param[3] = spi->base + SUN4I_SPI_CTL;
+		param[4] = SUN4I_CTL_XCH;
+		param[5] = spi->base + SUN4I_SPI_BC;
+		param[6] = spi->base + SUN4I_SPI_TC;
+		param[7] = 0; /* no separate "single mode" counter */
+	}
+	param[8] = flash->stage;
+	param[9] = SPI_POLL_LIMIT;
+
+	for (i = 0; i < ARRAY_SIZE(code); i++)
+		code[i] = htole32(code[i]);
+	aw_fel_write(flash->dev, code, flash->dev->soc_info->scratch_addr,
+		     sizeof(code));
+}
+
+/* execute the current command list on the device */
+static void spi_run(spiflash_t *flash)
+{
+	feldev_handle *dev = flash->dev;
+	uint32_t result[SPI_RESULT_WORDS];
+
+	if (flash->len == 0)
+		return;
+	memset(flash->list + flash->len, 0, 4); /* SPI_OP_END */
+	aw_fel_write(dev, flash->list, flash->stage, flash->len + 4);
+	aw_fel_execute(dev, dev->soc_info->scratch_addr);
+	aw_fel_read(dev, dev->soc_info->scratch_addr + sizeof(fel_spi_nor_thunk)
+		    + SPI_PARAM_WORDS * sizeof(uint32_t), result, sizeof(result));
+	if (le32toh(result[0]) != 0)
+		pr_fatal("SPI flash: timeout, flash is still busy\n");
+	flash->blanks += le32toh(result[1]);
+	flash->len = 0;
+	flash->busy_ms = 0;
+
+	if (flash->callback && flash->pending)
+		progress_add(feldev_progress(dev), flash->pending);
+	flash->pending = 0;
+}
+
+/*
+ * make sure that 'size' more bytes fit into the command list, and that
+ * the flash won't be busy for more than SPI_MAX_BUSY_MS with 'busy_ms' added
+ */
+static void spi_reserve(spiflash_t *flash, size_t size, unsigned int busy_ms)
+{
+	if (flash->len + size > flash->max_len
+	    || flash->busy_ms + busy_ms > SPI_MAX_BUSY_MS)
+		spi_run(flash);
+	flash->busy_ms += busy_ms;
+}
+
+/*
+ * Append a command, with tx data consisting of 'cmd' and 'data'. Returns
+ * the offset of the received data within the command list (SPI_OP_READ).
+ */
+static size_t spi_add(spiflash_t *flash, uint32_t op,
+		      const uint8_t *cmd, size_t cmd_len,
+		      const uint8_t *data, size_t data_len, size_t rx_len)
+{
+	size_t tx_len = cmd_len + data_len;
+	size_t size = SPI_CMD_HEADER + ALIGN4(tx_len +
+			((op & 0xFF) == SPI_OP_READ ? rx_len : 0));
+	uint32_t header[3] = { htole32(op), htole32(tx_len), htole32(rx_len) };
+	uint8_t *p;
+
+	spi_reserve(flash, size, 0);
+	p = flash->list + flash->len;
+	memset(p, 0, size);
+	memcpy(p, header, sizeof(header));
+	memcpy(p + SPI_CMD_HEADER, cmd, cmd_len);
+	if (data_len)
+		memcpy(p + SPI_CMD_HEADER + cmd_len, data, data_len);
+	flash->len += size;
+	return flash->len - size + SPI_CMD_HEADER + tx_len;
+}
+
+/* store opcode and 3-byte address in buf, returns the length */
+static size_t spi_nor_cmd(uint8_t *buf, uint8_t opcode, uint32_t addr)
+{
+	buf[0] = opcode;
+	buf[1] = addr >> 16;
+	buf[2] = addr >> 8;
+	buf[3] = addr;
+	return 4;
+}
+
+/* erase a sector or block, unless a blank check shows it's erased already */
+static void spi_erase_unit(spiflash_t *flash, uint32_t addr, uint32_t size)
+{
+	static const uint8_t wren = SPI_NOR_WREN, rdsr = SPI_NOR_RDSR;
+	uint8_t cmd[4];
+
+	/* keep these together, the blank check result is per execution */
+	spi_reserve(flash, 4 * (SPI_CMD_HEADER + sizeof(cmd)),
+		    size == SPI_NOR_BLOCK_SIZE ? SPI_BLOCK_ERASE_MS
+					       : SPI_SECTOR_ERASE_MS);
+	spi_nor_cmd(cmd, SPI_NOR_READ, addr);
+	spi_add(flash, SPI_OP_BLANK, cmd, sizeof(cmd), NULL, 0, size);
+	spi_add(flash, SPI_OP_XFER | SPI_OP_COND, &wren, 1, NULL, 0, 0);
+	spi_nor_cmd(cmd, size == SPI_NOR_BLOCK_SIZE ? SPI_NOR_BE : SPI_NOR_SE,
+		    addr);
+	spi_add(flash, SPI_OP_XFER | SPI_OP_COND, cmd, sizeof(cmd), NULL, 0, 0);
+	spi_add(flash, SPI_OP_POLL | SPI_OP_COND | SPI_OP_MASK(SPI_NOR_SR_WIP),
+		&rdsr, 1, NULL, 0, 1);
+}
+
+static void spi_program_page(spiflash_t *flash, uint32_t addr,
+			     const uint8_t *data, size_t len)
+{
+	static const uint8_t wren = SPI_NOR_WREN, rdsr = SPI_NOR_RDSR;
+	uint8_t cmd[4];
+
+	/* WREN, program and poll, in one list */
+	spi_reserve(flash, 3 * SPI_CMD_HEADER + 2 * ALIGN4(1)
+		    + ALIGN4(sizeof(cmd) + len), SPI_PAGE_PROGRAM_MS);
+	spi_add(flash, SPI_OP_XFER, &wren, 1, NULL, 0, 0);
+	spi_nor_cmd(cmd, SPI_NOR_PP, addr);
+	spi_add(flash, SPI_OP_XFER, cmd, sizeof(cmd), data, len, 0);
+	spi_add(flash, SPI_OP_POLL | SPI_OP_MASK(SPI_NOR_SR_WIP),
+		&rdsr, 1, NULL, 0, 1);
+}
+
+static bool is_blank(const uint8_t *data, size_t len)
+{
+	while (len--)
+		if (*data++ != 0xFF)
+			return false;
+	return true;
+}
+
+/*
+ * Erase the (sector-aligned) range, using 64 KiB block erases where
+ * possible. If 'data' is given, program it afterwards - skipping pages
+ * that are blank.
+ */
+static spiflash_stats spi_erase_range(spiflash_t *flash, uint32_t start,
+				     uint32_t end, const uint8_t *data)
+{
+	spiflash_stats stats = { 0 };
+	uint32_t addr, size, page;
+
+	flash->blanks = 0;
+	for (addr = start; addr < end; addr += size) {
+		size = SPI_NOR_SECTOR_SIZE;
+		if (addr % SPI_NOR_BLOCK_SIZE == 0
+		    && end - addr >= SPI_NOR_BLOCK_SIZE)
+			size = SPI_NOR_BLOCK_SIZE;
+		spi_erase_unit(flash, addr, size);
+		stats.units++;
+
+		for (page = 0; data && page < size; page += SPI_NOR_PAGE_SIZE) {
+			const uint8_t *p = data + addr - start + page;
+			if (is_blank(p, SPI_NOR_PAGE_SIZE))
+				continue;
+			spi_program_page(flash, addr + page, p,
+					 SPI_NOR_PAGE_SIZE);
+			stats.pages++;
+		}
+		flash->pending += size;
+	}
+	spi_run(flash);
+
+	stats.erased = stats.units - flash->blanks;
+	return stats;
+}
+
+static void spi_check_range(spiflash_t *flash, uint32_t offset, size_t len)
+{
+	if (offset > flash->size || len > flash->size - offset)
+		pr_fatal("SPI flash: range 0x%X+0x%zX exceeds the flash size "
+			 "(0x%X)\n", offset, len, flash->size);
+}
+
+spiflash_t *spiflash_open(feldev_handle *dev,
+			  uint32_t stage_addr, uint32_t stage_size)
+{
+	soc_info_t *soc_info = dev->soc_info;
+	spiflash_t *flash;
+	uint8_t id[3];
+	size_t offset;
+
+	if (!soc_info->spi)
+		pr_fatal("SPI flash: no SPI controller info for %s\n",
+			 dev->soc_name);
+	if (stage_addr & 3 || stage_size < SPI_MIN_LIST
+	    || (stage_addr < soc_info->scratch_addr + fel_scratch_size(dev)
+		&& soc_info->scratch_addr < stage_addr + stage_size))
+		pr_fatal("SPI flash: bad staging area 0x%08X-0x%08X\n",
+			 stage_addr, stage_addr + stage_size);
+
+	flash = calloc(1, sizeof(*flash));
+	if (!flash)
+		pr_fatal("Failed to allocate SPI flash state\n");
+	flash->dev = dev;
+	flash->stage = stage_addr;
+	/* leave room for the SPI_OP_END marker */
+	flash->max_len = (stage_size < SPI_MAX_LIST ? stage_size : SPI_MAX_LIST)
+			 - 4;
+	flash->list = malloc(flash->max_len + 4);
+	if (!flash->list)
+		pr_fatal("Failed to allocate SPI command list\n");
+
+	spi_init(dev, soc_info->spi);
+	spi_upload_thunk(flash, soc_info->spi);
+
+	id[0] = SPI_NOR_RDID;
+	offset = spi_add(flash, SPI_OP_READ, id, 1, NULL, 0, sizeof(id));
+	spi_run(flash);
+	aw_fel_read(dev, flash->stage + offset, id, sizeof(id));
+	flash->id = id[0] << 16 | id[1] << 8 | id[2];
+	if (flash->id == 0 || flash->id == 0xFFFFFF)
+		pr_fatal("SPI flash: no flash chip found (ID %06X)\n", flash->id);
+
+	/* most vendors encode the capacity as log2(size) */
+	if (id[2] >= 16 && id[2] < 24) {
+		flash->size = 1 << id[2];
+	} else {
+		flash->size = SPI_NOR_MAX_SIZE;
+		pr_error("Warning: unknown SPI flash capacity, assuming 16 MiB\n");
+	}
+	return flash;
+}
+
+void spiflash_close(spiflash_t *flash)
+{
+	free(flash->list);
+	free(flash);
+}
+
+uint32_t spiflash_id(spiflash_t *flash)
+{
+	return flash->id;
+}
+
+uint32_t spiflash_size(spiflash_t *flash)
+{
+	return flash->size;
+}
+
+/* report the progress of an operation to the device's progress state */
+static void spi_progress_begin(spiflash_t *flash, progress_cb_t callback,
+			       size_t total)
+{
+	progress_t *progress = feldev_progress(flash->dev);
+
+	flash->callback = callback;
+	if (callback) {
+		progress_set_callback(progress, callback);
+		progress_begin(progress, total);
+	}
+}
+
+void spiflash_read(spiflash_t *flash, uint32_t offset, void *buf, size_t len,
+		   progress_cb_t callback)
+{
+	size_t max_chunk = (flash->max_len - SPI_CMD_HEADER - 4) & ~(size_t)3;
+	uint8_t *dst = buf;
+	uint8_t cmd[4];
+
+	spi_check_range(flash, offset, len);
+	spi_progress_begin(flash, callback, len);
+
+	while (len > 0) {
+		size_t n = len < max_chunk ? len : max_chunk;
+		size_t pos;
+
+		spi_nor_cmd(cmd, SPI_NOR_READ, offset);
+		pos = spi_add(flash, SPI_OP_READ, cmd, sizeof(cmd), NULL, 0, n);
+		flash->pending = n;
+		spi_run(flash);
+		aw_fel_read(flash->dev, flash->stage + pos, dst, n);
+		offset += n;
+		dst += n;
+		len -= n;
+	}
+	flash->callback = NULL;
+}
+
+spiflash_stats spiflash_erase(spiflash_t *flash, uint32_t offset, size_t len,
+			      progress_cb_t callback)
+{
+	spiflash_stats stats;
+
+	if ((offset | len) & (SPI_NOR_SECTOR_SIZE - 1))
+		pr_fatal("SPI flash: erase range must be 4 KiB aligned\n");
+	spi_check_range(flash, offset, len);
+
+	spi_progress_begin(flash, callback, len);
+	stats = spi_erase_range(flash, offset, offset + len, NULL);
+	flash->callback = NULL;
+	return stats;
+}
+
+spiflash_stats spiflash_write(spiflash_t *flash, uint32_t offset,
+			      const void *buf, size_t len,
+			      progress_cb_t callback)
+{
+	spiflash_stats stats = { 0 };
+	uint32_t start = offset & ~(SPI_NOR_SECTOR_SIZE - 1);
+	uint32_t end, data_end = offset + len;
+	uint8_t *image;
+
+	spi_check_range(flash, offset, len);
+	if (len == 0)
+		return stats;
+	end = (data_end + SPI_NOR_SECTOR_SIZE - 1) & ~(SPI_NOR_SECTOR_SIZE - 1);
+
+	/* preserve the existing content of partially written sectors */
+	image = malloc(end - start);
+	if (!image)
+		pr_fatal("Failed to allocate SPI flash image\n");
+	if (start < offset)
+		spiflash_read(flash, start, image, offset - start, NULL);
+	if (data_end < end)
+		spiflash_read(flash, data_end, image + (data_end - start),
+			      end - data_end, NULL);
+	memcpy(image + (offset - start), buf, len);
+
+	spi_progress_begin(flash, callback, end - start);
+	stats = spi_erase_range(flash, start, end, image);
+	flash->callback = NULL;
+	free(image);
+	return stats;
+}
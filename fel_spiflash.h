@@ -0,0 +1,57 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FEL_SPIFLASH_H
+#define _SUNXI_TOOLS_FEL_SPIFLASH_H
+
+#include "fel_lib.h"
+
+/*
+ * SPI NOR flash access via the SoC's SPI0 controller (see soc_info_t),
+ * with the actual SPI transfers done by device-side code. The command lists
+ * for that code and the data get staged in the given memory area, which
+ * should be as large as possible. It may be SRAM (FEL only), or DRAM after
+ * it has been initialized (e.g. by running the SPL).
+ */
+typedef struct spiflash spiflash_t; /* opaque data type */
+
+spiflash_t *spiflash_open(feldev_handle *dev,
+			  uint32_t stage_addr, uint32_t stage_size);
+void spiflash_close(spiflash_t *flash);
+
+/* JEDEC ID (manufacturer, memory type, capacity) and flash size in bytes */
+uint32_t spiflash_id(spiflash_t *flash);
+uint32_t spiflash_size(spiflash_t *flash);
+
+void spiflash_read(spiflash_t *flash, uint32_t offset, void *buf, size_t len,
+		   progress_cb_t callback);
+/*
+ * Erasing and writing only erase sectors that aren't blank already. The
+ * erase range has to be sector-aligned (4 KiB), while writes may start and
+ * end anywhere - in that case the remaining data of the sectors involved
+ * gets preserved. Both return some statistics about the work done.
+ */
+typedef struct {
+	size_t units;	/* number of sectors / blocks processed */
+	size_t erased;	/* number of those that actually needed erasing */
+	size_t pages;	/* number of pages programmed */
+} spiflash_stats;
+
+spiflash_stats spiflash_erase(spiflash_t *flash, uint32_t offset, size_t len,
+			      progress_cb_t callback);
+spiflash_stats spiflash_write(spiflash_t *flash, uint32_t offset,
+			      const void *buf, size_t len,
+			      progress_cb_t callback);
+
+#endif /* _SUNXI_TOOLS_FEL_SPIFLASH_H */
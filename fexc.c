@@ -16,17 +16,13 @@
  */
 
 #include "fexc.h"
+#include "file_io.h"
 
 #include <errno.h>
 #include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
-#ifndef NO_MMAP
-  #include <sys/mman.h>
-#endif
-#include <sys/stat.h>
 #include <unistd.h>
-#include <fcntl.h>
 
 #define pr_info(...)	pr_error("fexc: " __VA_ARGS__)
 #define pr_err(...)	pr_error("E: fexc: " __VA_ARGS__)
@@ -37,51 +33,6 @@ enum script_format {
 	UBOOT_HEADER_FORMAT,
 };
 
-/*
- */
-static inline char *read_all(int fd, const char *filename, size_t *size)
-{
-	size_t buf_size = 4096, count = 0;
-	char *p, *buf = malloc(buf_size);
-	if (!buf) {
-		pr_err("%s: %s\n", "malloc", strerror(errno));
-		return NULL;
-	}
-	p = buf;
-	while (1) {
-		ssize_t rc = read(fd, p, buf_size-count);
-		if (rc == 0)
-			break;
-		else if (rc > 0) {
-			count += rc;
-			p += rc;
-
-			if (count == buf_size) {
-				char *new;
-				buf_size *= 2;
-				new = realloc(buf, buf_size);
-				if (!new) {
-					pr_err("%s: %s\n", "realloc",
-					       strerror(errno));
-					free(buf);
-					return NULL;
-				} else if (new != buf) {
-					buf = new;
-					p = buf + count;
-				}
-			}
-		} else if (errno != EAGAIN && errno != EINTR) {
-			pr_err("%s: %s: %s\n", filename,
-			       "read", strerror(errno));
-			free(buf);
-			return NULL;
-		}
-	}
-
-	*size = count;
-	return buf;
-}
-
 /*
  */
 static inline int script_parse(enum script_format format,
@@ -102,54 +53,19 @@ static inline int script_parse(enum script_format format,
 		fclose(in);
 		}; break;
 	case BIN_SCRIPT_FORMAT: {
-		int in = 0; /* stdin */
-		struct stat sb;
-		void *bin = NULL;
-		size_t bin_size;
-		int allocated = 1;
+		/* mapped if it's a regular file, otherwise read it all */
+		file_buffer bin;
 
-		if (!filename)
-			filename = "<stdin>";
-		else if ((in = open(filename, O_RDONLY)) < 0) {
-			pr_err("%s: %s\n", filename, strerror(errno));
+		if (!file_load(&bin, filename ? filename : "-")) {
+			pr_err("%s: %s\n", filename ? filename : "<stdin>",
+			       strerror(errno));
 			break;
 		}
+		if (!filename)
+			filename = "<stdin>";
 
-		if (fstat(in, &sb) == -1) {
-			pr_err("%s: %s: %s\n", filename,
-			       "fstat", strerror(errno));
-			goto bin_close;
-#ifndef NO_MMAP
-		} else if (S_ISREG(sb.st_mode)) {
-			/* regular file, mmap it */
-			bin = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, in, 0);
-			if (bin == MAP_FAILED) {
-				pr_err("%s: %s: %s\n", filename,
-				       "mmap", strerror(errno));
-				goto bin_close;
-			}
-			bin_size = sb.st_size;
-			allocated = 0;
-#endif
-		} else {
-			/* something else... just read it all! */
-			bin = read_all(in, filename, &bin_size);
-			if (bin == NULL)
-				goto bin_close;
-			allocated = 1;
-		}
-
-		ret = script_decompile_bin(bin, bin_size, filename, script);
-		if (allocated)
-			free(bin);
-#ifndef NO_MMAP
-		else if (munmap(bin, bin_size) == -1) {
-			pr_err("%s: %s: %s\n", filename,
-			       "munmap", strerror(errno));
-		}
-#endif
-bin_close:
-		close(in);
+		ret = script_decompile_bin(bin.data, bin.size, filename, script);
+		file_release(&bin);
 		}; break;
 	case UBOOT_HEADER_FORMAT: /* not valid input */
 		;
@@ -179,39 +95,29 @@ static inline int script_generate(enum script_format format,
 		ret = text_gen[format](out, filename, script);
 		fclose(out);
 	} else {
-		int out = 1; /* stdout */
+		file_stream out;
 		size_t sections, entries, bin_size;
 		void *bin;
 
-		if (!filename)
-			filename = "<stdout>";
-		else if ((out = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+		if (!file_open(&out, filename ? filename : "-", true)) {
 			pr_err("%s: %s\n", filename, strerror(errno));
 			goto done;
 		}
+		if (!filename)
+			filename = "<stdout>";
 
 		bin_size = script_bin_size(script, &sections, &entries);
 		bin = calloc(1, bin_size);
 		if (!bin)
 			pr_err("%s: %s\n", "malloc", strerror(errno));
 		else if (script_generate_bin(bin, bin_size, script, sections, entries)) {
-			char *p = bin;
-			while(bin_size) {
-				ssize_t wc = write(out, p, bin_size);
-
-				if (wc>0) {
-					p += wc;
-					bin_size -= wc;
-				} else if (wc < 0 && errno != EINTR) {
-					pr_err("%s: %s: %s\n", filename,
-					       "write", strerror(errno));
-					break;
-				}
-			}
-			ret = (bin_size == 0);
+			ret = file_write(&out, bin, bin_size);
+			if (!ret)
+				pr_err("%s: %s: %s\n", filename,
+				       "write", strerror(errno));
 		}
 		free(bin);
-		close(out);
+		file_close(&out);
 	}
 done:
 	return ret;
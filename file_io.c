@@ -0,0 +1,311 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * File I/O for the host tools: mapped files and chunked streams
+ **********************************************************************/
+
+#include "file_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef NO_MMAP
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+
+/* fail if a 64-bit offset doesn't fit off_t */
+static bool file_offset_ok(uint64_t offset)
+{
+	if ((off_t)offset < 0 || (uint64_t)(off_t)offset != offset) {
+		errno = EOVERFLOW;
+		return false;
+	}
+	return true;
+}
+
+/* read everything into a buffer, "hint" is the expected size (or 0) */
+static bool file_read_all(file_buffer *buf, int fd, size_t hint)
+{
+	size_t alloc = hint ? hint + 1 : FILE_IO_CHUNK, len;
+	uint8_t *data = malloc(alloc), *p;
+	ssize_t n;
+
+	if (!data)
+		return false;
+	for (;;) {
+		if (buf->size == alloc) {
+			p = alloc * 2 > alloc ? realloc(data, alloc * 2) : NULL;
+			if (!p) {
+				free(data);
+				errno = ENOMEM;
+				return false;
+			}
+			data = p;
+			alloc *= 2;
+		}
+		len = alloc - buf->size;
+		n = read(fd, data + buf->size,
+			 len < FILE_IO_CHUNK ? len : FILE_IO_CHUNK);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			free(data);
+			return false;
+		}
+		buf->size += n;
+	}
+	buf->data = data;
+	return true;
+}
+
+bool file_load(file_buffer *buf, const char *name)
+{
+	bool result, is_stdin = strcmp(name, "-") == 0;
+	int fd = is_stdin ? STDIN_FILENO : open(name, O_RDONLY | O_BINARY);
+	struct stat st;
+	size_t hint = 0;
+
+	memset(buf, 0, sizeof(*buf));
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if ((uint64_t)st.st_size >= SIZE_MAX) {
+			if (!is_stdin)
+				close(fd);
+			errno = EFBIG;
+			return false;
+		}
+		hint = st.st_size;
+#ifndef NO_MMAP
+		/* stdin might not be at the start of the file */
+		void *p = is_stdin || hint == 0 ? MAP_FAILED :
+			  mmap(NULL, hint, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			close(fd);
+			buf->data = p;
+			buf->size = hint;
+			buf->mapped = true;
+			file_buffer_advise(buf, 0, hint, FILE_SEQUENTIAL);
+			return true;
+		}
+#endif
+	}
+	result = file_read_all(buf, fd, hint);
+	if (!is_stdin) {
+		int err = errno;
+		close(fd);
+		errno = err;
+	}
+	return result;
+}
+
+void file_release(file_buffer *buf)
+{
+#ifndef NO_MMAP
+	if (buf->mapped)
+		munmap(buf->data, buf->size);
+	else
+#endif
+		free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+}
+
+void file_buffer_advise(file_buffer *buf, size_t offset, size_t len,
+			file_advice advice)
+{
+#if !defined(NO_MMAP) && defined(POSIX_MADV_SEQUENTIAL)
+	static const int map[] = {
+		[FILE_SEQUENTIAL] = POSIX_MADV_SEQUENTIAL,
+		[FILE_WILLNEED] = POSIX_MADV_WILLNEED,
+		[FILE_DONTNEED] = POSIX_MADV_DONTNEED,
+	};
+	uintptr_t page = sysconf(_SC_PAGESIZE), start, end;
+
+	if (!buf->mapped || offset >= buf->size)
+		return;
+	if (len > buf->size - offset)
+		len = buf->size - offset;
+	/* the range has to start at a page boundary */
+	start = (uintptr_t)buf->data + offset;
+	end = start + len;
+	start &= ~(page - 1);
+	posix_madvise((void *)start, end - start, map[advice]);
+#else
+	(void)buf;
+	(void)offset;
+	(void)len;
+	(void)advice;
+#endif
+}
+
+bool file_open(file_stream *f, const char *name, bool write)
+{
+	off_t pos;
+
+	memset(f, 0, sizeof(*f));
+	f->writing = write;
+	if (strcmp(name, "-") == 0) {
+		if (write)
+			fflush(stdout); /* keep the order with stdio output */
+		f->fd = write ? STDOUT_FILENO : STDIN_FILENO;
+	} else if (write) {
+		f->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+			     0666);
+	} else {
+		f->fd = open(name, O_RDONLY | O_BINARY);
+	}
+	if (f->fd < 0)
+		return false;
+
+	pos = lseek(f->fd, 0, SEEK_CUR);
+	f->seekable = pos >= 0;
+	f->offset = f->seekable ? (uint64_t)pos : 0;
+	if (!write)
+		file_advise(f, f->offset, 0, FILE_SEQUENTIAL);
+	return true;
+}
+
+ssize_t file_read(file_stream *f, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = read(f->fd, (uint8_t *)buf + done,
+			 len - done < FILE_IO_CHUNK ? len - done : FILE_IO_CHUNK);
+		if (n == 0) {
+			f->eof = true;
+			break;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+		f->offset += n;
+	}
+	return done;
+}
+
+bool file_write(file_stream *f, const void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = write(f->fd, (const uint8_t *)buf + done,
+			  len - done < FILE_IO_CHUNK ? len - done : FILE_IO_CHUNK);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		done += n;
+		f->offset += n;
+	}
+	return true;
+}
+
+bool file_seek(file_stream *f, uint64_t offset)
+{
+	uint8_t skip[64 * 1024];
+	ssize_t n;
+
+	if (offset == f->offset)
+		return true;
+	if (f->seekable) {
+		if (!file_offset_ok(offset)
+		    || lseek(f->fd, offset, SEEK_SET) < 0)
+			return false;
+		f->offset = offset;
+		f->eof = false;
+		return true;
+	}
+	if (offset < f->offset || f->writing) {
+		errno = ESPIPE;
+		return false;
+	}
+	/* like on regular files, going past the end is no error in itself */
+	while (f->offset < offset && !f->eof) {
+		n = file_read(f, skip, offset - f->offset < sizeof(skip) ?
+				       offset - f->offset : sizeof(skip));
+		if (n < 0)
+			return false;
+	}
+	return true;
+}
+
+bool file_copy(file_stream *dst, file_stream *src, uint64_t len)
+{
+	size_t chunk = len < FILE_IO_CHUNK ? len : FILE_IO_CHUNK;
+	uint8_t *buf = malloc(chunk ? chunk : 1);
+	bool result = buf != NULL;
+	ssize_t n;
+
+	while (result && len > 0) {
+		if (chunk > len)
+			chunk = len;
+		n = file_read(src, buf, chunk);
+		if (n >= 0 && (size_t)n < chunk)
+			errno = EIO; /* premature end of file */
+		result = (size_t)n == chunk && file_write(dst, buf, chunk);
+		len -= chunk;
+	}
+	free(buf);
+	return result;
+}
+
+void file_advise(file_stream *f, uint64_t offset, uint64_t len,
+		 file_advice advice)
+{
+#if defined(POSIX_FADV_SEQUENTIAL)
+	static const int map[] = {
+		[FILE_SEQUENTIAL] = POSIX_FADV_SEQUENTIAL,
+		[FILE_WILLNEED] = POSIX_FADV_WILLNEED,
+		[FILE_DONTNEED] = POSIX_FADV_DONTNEED,
+	};
+
+	if (f->seekable && file_offset_ok(offset) && file_offset_ok(len))
+		posix_fadvise(f->fd, offset, len, map[advice]);
+#else
+	(void)f;
+	(void)offset;
+	(void)len;
+	(void)advice;
+#endif
+}
+
+bool file_close(file_stream *f)
+{
+	int rc = 0;
+
+	if (f->fd > STDERR_FILENO)
+		rc = close(f->fd);
+	f->fd = -1;
+	return rc == 0;
+}
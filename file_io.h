@@ -0,0 +1,81 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FILE_IO_H
+#define _SUNXI_TOOLS_FILE_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * File I/O shared by the host tools
+ *
+ * Whole files get mapped into memory where possible (regular files, on
+ * systems with mmap), so their data is paged in on demand instead of being
+ * copied to the heap - and the kernel can drop it again under pressure.
+ * Other files (pipes, devices, "-" for stdin) are read in FILE_IO_CHUNK
+ * sized pieces. Streams read or write files sequentially, with seeking
+ * forward also working on pipes, so tools can process input of any size
+ * with constant memory. Offsets are 64-bit, even on 32-bit hosts.
+ *
+ * Functions return false (or -1) on errors, with errno set accordingly.
+ */
+#define FILE_IO_CHUNK	(1024 * 1024)
+
+/* access pattern hints for readahead, may be ignored */
+typedef enum {
+	FILE_SEQUENTIAL,	/* read ahead aggressively */
+	FILE_WILLNEED,		/* start reading the range now */
+	FILE_DONTNEED,		/* done with the range, drop it from cache */
+} file_advice;
+
+/* a whole file in memory, writable (changes don't go to the file) */
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	bool mapped;
+} file_buffer;
+
+/* map or load a file ("-" = stdin) */
+bool file_load(file_buffer *buf, const char *name);
+void file_release(file_buffer *buf);
+void file_buffer_advise(file_buffer *buf, size_t offset, size_t len,
+			file_advice advice);
+
+typedef struct {
+	int fd;
+	bool writing;
+	bool seekable;		/* regular file, or a device that allows lseek */
+	bool eof;		/* a read reached the end of the file */
+	uint64_t offset;	/* current position */
+} file_stream;
+
+/* open a file for reading or writing (truncating it), "-" = stdin/stdout */
+bool file_open(file_stream *f, const char *name, bool write);
+/* returns the number of bytes read, less than len only at end of file */
+ssize_t file_read(file_stream *f, void *buf, size_t len);
+bool file_write(file_stream *f, const void *buf, size_t len);
+/* go to an offset; on pipes only forward, by reading and discarding data */
+bool file_seek(file_stream *f, uint64_t offset);
+/* copy len bytes between streams (in chunks), EIO if src is too short */
+bool file_copy(file_stream *dst, file_stream *src, uint64_t len);
+/* hint for a range of the file, len 0 meaning up to its end */
+void file_advise(file_stream *f, uint64_t offset, uint64_t len,
+		 file_advice advice);
+/* close stream (stdin/stdout stay open), false if there was an error */
+bool file_close(file_stream *f);
+
+#endif /* _SUNXI_TOOLS_FILE_IO_H */
@@ -41,6 +41,7 @@
 
 #include "common.h"
 #include "portable_endian.h"
+#include "file_io.h"
 
 #if defined(CONFIG_BCH_CONST_PARAMS)
 #define GF_M(_p)               (CONFIG_BCH_CONST_M)
@@ -752,44 +753,55 @@ static void scramble(const struct image_info *info,
 	}
 }
 
-static int write_page(const struct image_info *info, uint8_t *buffer,
-		      FILE *src, FILE *rnd, FILE *dst,
+/*
+ * Source data is read once, into "data" (a page of usable_page_size bytes,
+ * "avail" of them valid). Each output page gets assembled in "page" and
+ * written in one go, "step" is the work buffer for the ECC steps.
+ */
+struct page_buffers {
+	uint8_t *data;
+	size_t avail;
+	uint8_t *page;
+	uint8_t *step;
+};
+
+static int write_page(const struct image_info *info, struct page_buffers *b,
+		      file_stream *src, file_stream *rnd, file_stream *dst,
 		      struct bch_control *bch, int page)
 {
 	int steps = info->usable_page_size / info->ecc_step_size;
 	int eccbytes = DIV_ROUND_UP(info->ecc_strength * 14, 8);
-	off_t pos = ftell(dst);
-	size_t pad, cnt;
+	uint8_t *buffer = b->step;
+	size_t pad, cnt, used;
+	ssize_t n;
 	int i;
 
 	if (eccbytes % 2)
 		eccbytes++;
 
-	memset(buffer, 0xff, info->page_size + info->oob_size);
-	cnt = fread(buffer, 1, info->usable_page_size, src);
-	if (!cnt) {
-		if (!feof(src)) {
-			fprintf(stderr,
-				"Failed to read data from the source\n");
-			return -1;
-		} else {
-			return 0;
-		}
+	n = file_read(src, b->data + b->avail,
+		      info->usable_page_size - b->avail);
+	if (n < 0) {
+		fprintf(stderr, "Failed to read data from the source\n");
+		return -1;
 	}
+	b->avail += n;
+	if (!b->avail)
+		return 0;
 
-	fwrite(buffer, info->page_size + info->oob_size, 1, dst);
+	memset(b->page, 0xff, info->page_size + info->oob_size);
+	memcpy(b->page, b->data, b->avail);
 
 	for (i = 0; i < info->usable_page_size; i++) {
-		if (buffer[i] !=  0xff)
+		if (b->page[i] !=  0xff)
 			break;
 	}
 
 	/* We leave empty pages at 0xff. */
-	if (i == info->usable_page_size)
-		return 0;
-
-	/* Restore the source pointer to read it again. */
-	fseek(src, -cnt, SEEK_CUR);
+	if (i == info->usable_page_size) {
+		b->avail = 0;
+		goto write;
+	}
 
 	/* Randomize unused space if scrambling is required. */
 	if (info->scramble) {
@@ -798,18 +810,16 @@ static int write_page(const struct image_info *info, uint8_t *buffer,
 		if (info->boot0) {
 			offs = steps * (info->ecc_step_size + eccbytes + 4);
 			cnt = info->page_size + info->oob_size - offs;
-			fread(buffer + offs, 1, cnt, rnd);
+			file_read(rnd, b->page + offs, cnt);
 		} else {
 			offs = info->page_size + (steps * (eccbytes + 4));
 			cnt = info->page_size + info->oob_size - offs;
-			memset(buffer + offs, 0xff, cnt);
-			scramble(info, page, buffer + offs, cnt);
+			memset(b->page + offs, 0xff, cnt);
+			scramble(info, page, b->page + offs, cnt);
 		}
-		fseek(dst, pos + offs, SEEK_SET);
-		fwrite(buffer + offs, cnt, 1, dst);
 	}
 
-	for (i = 0; i < steps; i++) {
+	for (i = 0, used = 0; i < steps; i++) {
 		int ecc_offs, data_offs;
 		uint8_t *ecc;
 
@@ -823,17 +833,16 @@ static int write_page(const struct image_info *info, uint8_t *buffer,
 			ecc_offs = info->page_size + 4 + (i * (eccbytes + 4));
 		}
 
-		cnt = fread(buffer, 1, info->ecc_step_size, src);
-		if (!cnt && !feof(src)) {
-			fprintf(stderr,
-				"Failed to read data from the source\n");
-			return -1;
-		}
+		cnt = b->avail - used;
+		if (cnt > (size_t)info->ecc_step_size)
+			cnt = info->ecc_step_size;
+		memcpy(buffer, b->data + used, cnt);
+		used += cnt;
 
 		pad = info->ecc_step_size - cnt;
 		if (pad) {
 			if (info->scramble && info->boot0)
-				fread(buffer + cnt, 1, pad, rnd);
+				file_read(rnd, buffer + cnt, pad);
 			else
 				memset(buffer + cnt, 0xff, pad);
 		}
@@ -845,19 +854,23 @@ static int write_page(const struct image_info *info, uint8_t *buffer,
 		swap_bits(ecc, eccbytes);
 		scramble(info, page, buffer, info->ecc_step_size + 4 + eccbytes);
 
-		fseek(dst, pos + data_offs, SEEK_SET);
-		fwrite(buffer, info->ecc_step_size, 1, dst);
-		fseek(dst, pos + ecc_offs - 4, SEEK_SET);
-		fwrite(ecc - 4, eccbytes + 4, 1, dst);
+		memcpy(b->page + data_offs, buffer, info->ecc_step_size);
+		memcpy(b->page + ecc_offs - 4, ecc - 4, eccbytes + 4);
 	}
 
+	/* Data beyond the ECC steps goes to the next page. */
+	b->avail -= used;
+	memmove(b->data, b->data + used, b->avail);
+
 	/* Fix BBM. */
-	fseek(dst, pos + info->page_size, SEEK_SET);
-	memset(buffer, 0xff, 2);
-	fwrite(buffer, 2, 1, dst);
+	memset(b->page + info->page_size, 0xff, 2);
 
-	/* Make dst pointer point to the next page. */
-	fseek(dst, pos + info->page_size + info->oob_size, SEEK_SET);
+write:
+	if (!file_write(dst, b->page, info->page_size + info->oob_size)) {
+		fprintf(stderr, "Failed to write the dest file (%s)\n",
+			strerror(errno));
+		return -1;
+	}
 
 	return 0;
 }
@@ -866,8 +879,8 @@ static int create_image(const struct image_info *info)
 {
 	off_t page = info->offset / info->page_size;
 	struct bch_control *bch;
-	FILE *src, *dst, *rnd;
-	uint8_t *buffer;
+	struct page_buffers b = { .avail = 0 };
+	file_stream src, dst, rnd;
 
 	bch = init_bch(14, info->ecc_strength, BCH_PRIMITIVE_POLY);
 	if (!bch) {
@@ -875,41 +888,45 @@ static int create_image(const struct image_info *info)
 		return -1;
 	}
 
-	buffer = malloc(info->page_size + info->oob_size);
-	if (!buffer) {
+	b.data = malloc(info->usable_page_size);
+	b.page = malloc(info->page_size + info->oob_size);
+	/* step data, 4 bytes of 0xff and at most 112 ECC bytes (64 bits) */
+	b.step = malloc(info->ecc_step_size + 4 + DIV_ROUND_UP(64 * 14, 8));
+	if (!b.data || !b.page || !b.step) {
 		fprintf(stderr, "Failed to allocate the NAND page buffer\n");
 		return -1;
 	}
 
-	memset(buffer, 0xff, info->page_size + info->oob_size);
-
-	src = fopen(info->source, "r");
-	if (!src) {
+	if (!file_open(&src, info->source, false)) {
 		fprintf(stderr, "Failed to open source file (%s)\n",
 			info->source);
 		return -1;
 	}
 
-	dst = fopen(info->dest, "w");
-	if (!dst) {
+	if (!file_open(&dst, info->dest, true)) {
 		fprintf(stderr, "Failed to open dest file (%s)\n", info->dest);
 		return -1;
 	}
 
-	rnd = fopen("/dev/urandom", "r");
-	if (!rnd) {
+	if (!file_open(&rnd, "/dev/urandom", false)) {
 		fprintf(stderr, "Failed to open /dev/urandom\n");
 		return -1;
 	}
 
-	while (!feof(src)) {
+	while (!src.eof || b.avail) {
 		int ret;
 
-		ret = write_page(info, buffer, src, rnd, dst, bch, page++);
+		ret = write_page(info, &b, &src, &rnd, &dst, bch, page++);
 		if (ret)
 			return ret;
 	}
 
+	if (!file_close(&dst)) {
+		fprintf(stderr, "Failed to write the dest file (%s)\n",
+			strerror(errno));
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -22,6 +22,7 @@
 
 #include "common.h"
 #include "portable_endian.h"
+#include "file_io.h"
 
 struct phoenix_ptable {
 	char signature[16];		/* "PHOENIX_CARD_IMG" */
@@ -37,42 +38,33 @@ struct phoenix_ptable {
 	} part[62];
 } ptable;
 
-static int save_part(struct phoenix_ptable *ptable, int part, const char *dest, FILE *in)
+/*
+ * Copy a partition to its output file, streaming it in chunks. Input from a
+ * pipe works too, as long as the partitions get saved in ascending order.
+ */
+static int save_part(struct phoenix_ptable *ptable, int part, const char *dest, file_stream *in)
 {
 	int l = strlen(dest) + 16;
 	char outname[l];
-	FILE *out = stdout;
-	char *buf = NULL;
-	int ret = 0;
+	file_stream out;
 	snprintf(outname, l, dest, part);
-	if (part > ptable->parts) {
+	if (part > le16toh(ptable->parts)) {
 		fprintf(stderr, "ERROR: Part index out of range\n");
 		return -1;
 	}
-	buf = malloc(ptable->part[part].size);
-	if (!buf)
-		goto err;
-	if (strcmp(outname, "-") != 0)
-		out = fopen(outname, "wb");
-	if (!out)
+	if (!file_open(&out, outname, true))
 		goto err;
-	if (fseek(in, ptable->part[part].start * 0x200, SEEK_SET) == -1)
+	if (!file_seek(in, (uint64_t)le32toh(ptable->part[part].start) * 0x200)
+	    || !file_copy(&out, in, le32toh(ptable->part[part].size))) {
+		file_close(&out);
 		goto err;
-	if (fread(buf, ptable->part[part].size, 1, in) != 1)
-		goto err;
-	if (fwrite(buf, ptable->part[part].size, 1, out) != 1)
+	}
+	if (!file_close(&out))
 		goto err;
-	ret = 0;
-_exit:
-	if (buf)
-		free(buf);
-	if (out != stdout)
-		fclose(out);
-	return ret;
+	return 0;
 err:
-	perror(NULL);
-	ret = -1;
-	goto _exit;
+	perror(outname);
+	return -1;
 }
 
 static void usage(char **argv)
@@ -91,7 +83,7 @@ static void usage(char **argv)
 int main(int argc, char **argv)
 {
 	int i;
-	FILE *in = stdin;
+	file_stream in;
 	int verbose = 1;
 	int save_parts = 0;
 	int part = -1;
@@ -140,12 +132,13 @@ int main(int argc, char **argv)
 		usage(argv);
 		exit(1);
 	}
-	if (optind < argc ) {
-		in = fopen(argv[optind], "rb");
+	if (!file_open(&in, optind < argc ? argv[optind] : "-", false)) {
+		perror(argv[optind]);
+		exit(1);
 	}
-	fseek(in, 0x1C00, SEEK_CUR);
-	fread(&ptable, 1, 0x400, in);
-	if (strncmp(ptable.signature, "PHOENIX_CARD_IMG", 16) != 0) {
+	if (!file_seek(&in, in.offset + 0x1C00)
+	    || file_read(&in, &ptable, 0x400) != 0x400
+	    || strncmp(ptable.signature, "PHOENIX_CARD_IMG", 16) != 0) {
 		fprintf(stderr, "ERROR: Not a phoenix image\n");
 		exit(1);
 	}
@@ -167,7 +160,8 @@ int main(int argc, char **argv)
 			printf("\n");
 		}
 		if (save_parts && (part == -1 || part == i)) {
-			save_part(&ptable, i, dest, in);
+			save_part(&ptable, i, dest, &in);
 		}
 	}
+	file_close(&in);
 }
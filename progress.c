@@ -16,7 +16,10 @@
  */
 #include "progress.h"
 
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -44,78 +47,331 @@ inline double estimate(size_t remaining, double rate)
 	return 0.;
 }
 
-/* Return ETA (in seconds) as string, formatted to minutes and seconds */
-const char *format_ETA(double remaining)
-{
-	static char result[6] = "";
+/* buffer size for format_ETA(), "mm:ss" */
+#define ETA_LEN		6
 
+/*
+ * Return ETA (in seconds) as string, formatted to minutes and seconds.
+ * The result is either stored to buf, or a string constant.
+ */
+static const char *format_ETA(double remaining, char buf[ETA_LEN])
+{
 	int seconds = remaining + 0.5; /* simplistic round() */
 	if (seconds >= 0 && seconds < 6000) {
-		snprintf(result, sizeof(result),
-			 "%02d:%02d", seconds / 60, seconds % 60);
-		return result;
+		snprintf(buf, ETA_LEN, "%02d:%02d", seconds / 60, seconds % 60);
+		return buf;
 	}
 	return "--:--";
 }
 
-/* Private progress state variable */
+/* Private progress state */
 
-typedef struct {
+/* minimum duration of a rate sample, shorter intervals get accumulated */
+#define PROGRESS_SAMPLE_TIME	0.05
+
+struct progress {
+	pthread_mutex_t lock;
+	progress_t *parent;	/* aggregate to account progress to, or NULL */
+	char *name;
 	progress_cb_t callback;
+	progress_clock_t clock;	/* timestamp source, NULL = gettime() */
+	double interval;	/* minimum time between callbacks */
+
 	size_t total;
 	size_t done;
-	double start; /* start point (timestamp) for rate and ETA calculation */
-} progress_private_t;
+	double start;		/* start point (timestamp) for elapsed time */
+	double last_report;	/* timestamp of last callback invocation */
+	double last_data;	/* timestamp of last actual progress */
+	bool was_stalled;	/* stall state at last callback */
+	unsigned int retries;	/* transfer retries since start */
 
-static progress_private_t progress = {
-	.callback = NULL,
-	.start = 0.
+	/* rate estimation, exponentially weighted moving average */
+	double ewma;		/* smoothed rate (bytes per second) */
+	double sample_start;	/* start of current sample interval */
+	size_t sample_bytes;	/* bytes accumulated within current sample */
 };
 
-/* 'External' API */
+static progress_t default_progress = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.interval = PROGRESS_INTERVAL,
+};
 
-void progress_start(progress_cb_t callback, size_t expected_total)
+progress_t *progress_default(void)
 {
-	progress.callback = callback;
-	progress.total = expected_total;
-	progress.done = 0;
-	progress.start = gettime(); /* reset start time */
+	return &default_progress;
 }
 
-/* Update progress status, passing information to the callback function. */
-void progress_update(size_t bytes_done)
+progress_t *progress_new(const char *name, progress_cb_t callback,
+			 progress_t *parent)
 {
-	progress.done += bytes_done;
-	if (progress.callback)
-		progress.callback(progress.total, progress.done);
+	progress_t *progress = calloc(1, sizeof(progress_t));
+	if (!progress)
+		return NULL;
+	if (name && !(progress->name = strdup(name))) {
+		free(progress);
+		return NULL;
+	}
+	pthread_mutex_init(&progress->lock, NULL);
+	progress->parent = parent;
+	progress->callback = callback;
+	progress->interval = PROGRESS_INTERVAL;
+	return progress;
 }
 
-/* Return relative / "elapsed" time, since progress_start() */
-static inline double progress_elapsed(void)
+void progress_free(progress_t *progress)
 {
-	if (progress.start != 0.)
-		return gettime() - progress.start;
-	return 0.;
+	if (!progress || progress == &default_progress)
+		return;
+	pthread_mutex_destroy(&progress->lock);
+	free(progress->name);
+	free(progress);
+}
+
+void progress_set_callback(progress_t *progress, progress_cb_t callback)
+{
+	pthread_mutex_lock(&progress->lock);
+	progress->callback = callback;
+	pthread_mutex_unlock(&progress->lock);
+}
+
+void progress_set_name(progress_t *progress, const char *name)
+{
+	pthread_mutex_lock(&progress->lock);
+	free(progress->name);
+	progress->name = name ? strdup(name) : NULL;
+	pthread_mutex_unlock(&progress->lock);
+}
+
+void progress_set_interval(progress_t *progress, double interval)
+{
+	pthread_mutex_lock(&progress->lock);
+	progress->interval = interval;
+	pthread_mutex_unlock(&progress->lock);
+}
+
+void progress_set_clock(progress_t *progress, progress_clock_t clock)
+{
+	pthread_mutex_lock(&progress->lock);
+	progress->clock = clock;
+	pthread_mutex_unlock(&progress->lock);
+}
+
+/* current timestamp, parents get passed the one of their child */
+static double progress_now(progress_t *progress)
+{
+	progress_clock_t clock;
+
+	pthread_mutex_lock(&progress->lock);
+	clock = progress->clock;
+	pthread_mutex_unlock(&progress->lock);
+	return clock ? clock() : gettime();
+}
+
+/*
+ * Feed a new rate sample into the moving average. The weight of a sample
+ * depends on its duration (relative to PROGRESS_RATE_TAU), so irregular
+ * chunk timing doesn't skew the result. dt / (tau + dt) is the first-order
+ * approximation of 1 - exp(-dt / tau), and saves us from linking libm.
+ */
+static void progress_sample(progress_t *progress, double now)
+{
+	double dt = now - progress->sample_start;
+	double current = progress->sample_bytes / dt;
+
+	if (progress->ewma == 0.)
+		progress->ewma = current; /* first sample */
+	else
+		progress->ewma += (current - progress->ewma)
+				  * dt / (PROGRESS_RATE_TAU + dt);
+	progress->sample_start = now;
+	progress->sample_bytes = 0;
+}
+
+/* Compute status snapshot, requires progress->lock to be held */
+static void progress_status(progress_t *progress, double now,
+			    progress_status_t *status)
+{
+	double elapsed = progress->start != 0. ? now - progress->start : 0.;
+	double speed = progress->ewma;
+	double idle = now - progress->sample_start;
+
+	if (speed == 0.)
+		/* no complete sample yet, fall back to the overall average */
+		speed = rate(progress->done, elapsed);
+	else if (idle > PROGRESS_SAMPLE_TIME)
+		/* decay estimate while no data is coming in */
+		speed = (progress->ewma * PROGRESS_RATE_TAU
+			 + progress->sample_bytes) / (PROGRESS_RATE_TAU + idle);
+
+	status->name = progress->name;
+	status->total = progress->total;
+	status->done = progress->done;
+	status->elapsed = elapsed;
+	status->rate = speed;
+	status->retries = progress->retries;
+	status->stalled = progress->done < progress->total
+		&& now - progress->last_data >= PROGRESS_STALL_TIME;
+	if (progress->done >= progress->total)
+		status->eta = 0.;
+	else if (status->stalled || speed <= 0.)
+		status->eta = -1.;
+	else
+		status->eta = estimate(progress->total - progress->done, speed);
+}
+
+/*
+ * Invoke the callback, if one is set and it's "time" to do so. Completion
+ * and any change of the stall state always get reported, everything else
+ * is subject to the minimum interval. Requires progress->lock to be held.
+ */
+static void progress_report(progress_t *progress, double now, bool force)
+{
+	progress_status_t status;
+
+	if (!progress->callback)
+		return;
+	progress_status(progress, now, &status);
+
+	if (!force && status.done < status.total
+	    && status.stalled == progress->was_stalled
+	    && now - progress->last_report < progress->interval)
+		return;
+
+	progress->last_report = now;
+	progress->was_stalled = status.stalled;
+	progress->callback(&status);
+}
+
+static void progress_begin_at(progress_t *progress, size_t expected_total,
+			      double now)
+{
+	pthread_mutex_lock(&progress->lock);
+	if (progress->start == 0. || progress->done >= progress->total) {
+		/* (re)start the transfer */
+		progress->total = 0;
+		progress->done = 0;
+		progress->start = now;
+		progress->ewma = 0.;
+		progress->sample_start = now;
+		progress->sample_bytes = 0;
+		progress->last_report = 0.;
+		progress->was_stalled = false;
+		progress->retries = 0;
+	}
+	/* an aggregate may get more transfers added while running */
+	progress->total += expected_total;
+	progress->last_data = now;
+	pthread_mutex_unlock(&progress->lock);
+
+	if (progress->parent)
+		progress_begin_at(progress->parent, expected_total, now);
+}
+
+void progress_begin(progress_t *progress, size_t expected_total)
+{
+	progress_begin_at(progress, expected_total, progress_now(progress));
+}
+
+static void progress_add_at(progress_t *progress, size_t bytes_done,
+			    double now)
+{
+	pthread_mutex_lock(&progress->lock);
+	progress->done += bytes_done;
+	if (bytes_done > 0)
+		progress->last_data = now;
+	progress->sample_bytes += bytes_done;
+	if (now - progress->sample_start >= PROGRESS_SAMPLE_TIME)
+		progress_sample(progress, now);
+	progress_report(progress, now, false);
+	pthread_mutex_unlock(&progress->lock);
+
+	if (progress->parent)
+		progress_add_at(progress->parent, bytes_done, now);
+}
+
+void progress_add(progress_t *progress, size_t bytes_done)
+{
+	progress_add_at(progress, bytes_done, progress_now(progress));
+}
+
+static void progress_retry_at(progress_t *progress, double now)
+{
+	pthread_mutex_lock(&progress->lock);
+	progress->retries++;
+	progress_report(progress, now, true);
+	pthread_mutex_unlock(&progress->lock);
+
+	if (progress->parent)
+		progress_retry_at(progress->parent, now);
+}
+
+void progress_retry(progress_t *progress)
+{
+	progress_retry_at(progress, progress_now(progress));
+}
+
+void progress_poll(progress_t *progress)
+{
+	double now = progress_now(progress);
+
+	pthread_mutex_lock(&progress->lock);
+	progress_report(progress, now, false);
+	pthread_mutex_unlock(&progress->lock);
+}
+
+void progress_get_status(progress_t *progress, progress_status_t *status)
+{
+	double now = progress_now(progress);
+
+	pthread_mutex_lock(&progress->lock);
+	progress_status(progress, now, status);
+	pthread_mutex_unlock(&progress->lock);
+}
+
+/* 'External' API, using the default progress state */
+
+void progress_start(progress_cb_t callback, size_t expected_total)
+{
+	progress_set_callback(&default_progress, callback);
+	/* force restart, even if the previous transfer was incomplete */
+	pthread_mutex_lock(&default_progress.lock);
+	default_progress.start = 0.;
+	pthread_mutex_unlock(&default_progress.lock);
+	progress_begin(&default_progress, expected_total);
+}
+
+/* Update progress status, passing information to the callback function. */
+void progress_update(size_t bytes_done)
+{
+	progress_add(&default_progress, bytes_done);
 }
 
 /* Callback function implementing a simple progress bar written to stdout */
-void progress_bar(size_t total, size_t done)
+void progress_bar(const progress_status_t *status)
 {
 	static const int WIDTH = 48; /* # of characters to use for progress bar */
 
+	size_t total = status->total, done = status->done;
+	char eta[ETA_LEN];
 	float ratio = total > 0 ? (float)done / total : 0;
 	int i, pos = WIDTH * ratio;
-	double speed = rate(done, progress_elapsed());
-	double eta = estimate(total - done, speed);
 
 	printf("\r%3.0f%% [", ratio * 100); /* current percentage */
 	for (i = 0; i < pos; i++) putchar('=');
 	for (i = pos; i < WIDTH; i++) putchar(' ');
 	if (done < total)
-		printf("]%6.1f kB/s, ETA %s ", kilo(speed), format_ETA(eta));
+		printf("]%6.1f kB/s, ETA %s ", kilo(status->rate),
+		       status->stalled ? "stall"
+				       : format_ETA(status->eta, eta));
 	else
-		/* transfer complete, output totals plus a newline */
-		printf("] %5.0f kB, %6.1f kB/s\n", kilo(done), kilo(speed));
+		/* transfer complete, output totals (average rate) */
+		printf("] %5.0f kB, %6.1f kB/s", kilo(done),
+		       kilo(rate(done, status->elapsed)));
+	if (status->retries > 0)
+		printf(done < total ? "(%u retries) " : ", %u retries",
+		       status->retries);
+	if (done >= total)
+		putchar('\n');
 
 	fflush(stdout);
 }
@@ -128,10 +384,10 @@ void progress_bar(size_t total, size_t done)
  *	| dialog --title "FEL upload progress" \
  *		 --gauge "" 5 70
  */
-void progress_gauge(size_t total, size_t done)
+void progress_gauge(const progress_status_t *status)
 {
-	if (total > 0) {
-		printf("%.0f\n", (float)done / total * 100);
+	if (status->total > 0) {
+		printf("%.0f\n", (float)status->done / status->total * 100);
 		fflush(stdout);
 	}
 }
@@ -146,20 +402,68 @@ void progress_gauge(size_t total, size_t done)
  *		 --backtitle "Please wait..." \
  *		 --gauge "" 6 70
  */
-void progress_gauge_xxx(size_t total, size_t done)
+void progress_gauge_xxx(const progress_status_t *status)
 {
+	size_t total = status->total, done = status->done;
+	char eta[ETA_LEN];
+
 	if (total > 0) {
-		double speed = rate(done, progress_elapsed());
-		double eta = estimate(total - done, speed);
 		printf("XXX\n");
 		printf("%.0f\n", (float)done / total * 100);
 		if (done < total)
 			printf("%zu of %zu, %.1f kB/s, ETA %s\n",
-				done, total, kilo(speed), format_ETA(eta));
+				done, total, kilo(status->rate),
+				status->stalled ? "stall"
+						: format_ETA(status->eta, eta));
 		else
 			printf("Done: %.1f kB, at %.1f kB/s\n",
-				kilo(done), kilo(speed));
+				kilo(done), kilo(rate(done, status->elapsed)));
 		printf("XXX\n");
 		fflush(stdout);
 	}
 }
+
+/* output string as JSON, with the necessary escaping */
+static void json_string(FILE *stream, const char *str)
+{
+	fputc('"', stream);
+	for (; *str; str++) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			fprintf(stream, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(stream, "\\u%04x", c);
+		else
+			fputc(c, stream);
+	}
+	fputc('"', stream);
+}
+
+/*
+ * Progress callback that emits one JSON object per line ("JSON Lines"),
+ * meant for consumption by other programs, e.g.
+ *
+ * {"name":"001:005","total":1048576,"done":524288,"elapsed":1.234,
+ *  "rate":425000.0,"eta":1.2,"retries":0,"stalled":false,"complete":false}
+ *
+ * "name" is only present if set, "eta" is null when unknown.
+ */
+void progress_json(const progress_status_t *status)
+{
+	printf("{");
+	if (status->name) {
+		printf("\"name\":");
+		json_string(stdout, status->name);
+		printf(",");
+	}
+	printf("\"total\":%zu,\"done\":%zu,\"elapsed\":%.3f,\"rate\":%.1f,",
+	       status->total, status->done, status->elapsed, status->rate);
+	if (status->eta >= 0.)
+		printf("\"eta\":%.1f,", status->eta);
+	else
+		printf("\"eta\":null,");
+	printf("\"retries\":%u,\"stalled\":%s,\"complete\":%s}\n",
+	       status->retries, status->stalled ? "true" : "false",
+	       status->done >= status->total ? "true" : "false");
+	fflush(stdout);
+}
@@ -17,25 +17,79 @@
 #ifndef _SUNXI_TOOLS_PROGRESS_H
 #define _SUNXI_TOOLS_PROGRESS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+/* progress status snapshot, as passed to the callback functions */
+typedef struct {
+	const char *name;	/* label of the transfer (or device), may be NULL */
+	size_t total;		/* expected total (byte count) */
+	size_t done;		/* bytes transferred so far */
+	double elapsed;		/* seconds since start */
+	double rate;		/* smoothed transfer rate (bytes per second) */
+	double eta;		/* estimated time remaining, negative if unknown */
+	bool stalled;		/* no progress within PROGRESS_STALL_TIME */
+	unsigned int retries;	/* number of (USB) transfer retries */
+} progress_status_t;
+
 /* function pointer type for a progress callback / notification */
-typedef void (*progress_cb_t)(size_t total, size_t done);
+typedef void (*progress_cb_t)(const progress_status_t *status);
+/* timestamp source (in seconds), e.g. to replace gettime() in tests */
+typedef double (*progress_clock_t)(void);
+
+/* opaque progress state, one per transfer (or group of transfers) */
+typedef struct progress progress_t;
 
 /* conversion helper macros */
 #define kilo(value)	((double)(value) / 1000.) /* SI prefix "k" */
 #define kibi(value)	((double)(value) / 1024.) /* binary prefix "Ki", "K" */
 
+/* timing constants (in seconds) */
+#define PROGRESS_INTERVAL	0.1	/* minimum time between callbacks */
+#define PROGRESS_RATE_TAU	2.0	/* time constant for rate smoothing */
+#define PROGRESS_STALL_TIME	3.0	/* no progress for this long = stalled */
+
 double gettime(void);
 double rate(size_t transferred, double elapsed);
 double estimate(size_t remaining, double rate);
 
+/*
+ * Per-transfer progress state. All functions are thread-safe. Passing a
+ * "parent" creates an aggregate view: every child's expected total and
+ * progress also get accounted to the parent, which can then report the
+ * combined status (e.g. for several devices) via its own callback.
+ * Callbacks get invoked with the state locked, so they must not call back
+ * into the progress functions for the same object.
+ * progress_new() returns NULL if it runs out of memory.
+ */
+progress_t *progress_new(const char *name, progress_cb_t callback,
+			 progress_t *parent);
+void progress_free(progress_t *progress);
+void progress_set_callback(progress_t *progress, progress_cb_t callback);
+void progress_set_name(progress_t *progress, const char *name);
+/* change minimum time between callbacks, 0 = report every update */
+void progress_set_interval(progress_t *progress, double interval);
+/* change timestamp source, NULL = gettime() */
+void progress_set_clock(progress_t *progress, progress_clock_t clock);
+
+void progress_begin(progress_t *progress, size_t expected_total);
+void progress_add(progress_t *progress, size_t bytes_done);
+/* note that a transfer had to be retried (after an error) */
+void progress_retry(progress_t *progress);
+/* re-evaluate time-dependent status (e.g. stalls) without new data */
+void progress_poll(progress_t *progress);
+void progress_get_status(progress_t *progress, progress_status_t *status);
+
+/* the default progress state, used by the "global" functions below */
+progress_t *progress_default(void);
+
 void progress_start(progress_cb_t callback, size_t expected_total);
 void progress_update(size_t bytes_done);
 
 /* progress callback implementations for various display styles */
-void progress_bar(size_t total, size_t done);
-void progress_gauge(size_t total, size_t done);
-void progress_gauge_xxx(size_t total, size_t done);
+void progress_bar(const progress_status_t *status);
+void progress_gauge(const progress_status_t *status);
+void progress_gauge_xxx(const progress_status_t *status);
+void progress_json(const progress_status_t *status);
 
 #endif /* _SUNXI_TOOLS_PROGRESS_H */
@@ -326,6 +326,11 @@ int script_decompile_bin(void *bin, size_t bin_size,
 	unsigned int i;
 	struct script_bin_head *head = bin;
 
+	if (bin_size < sizeof(*head)) {
+		pr_err("Malformed data: size %zu.\n", bin_size);
+		return 0;
+	}
+
 	if ((head->version[0] > SCRIPT_BIN_VERSION_LIMIT) ||
 	    (head->version[1] > SCRIPT_BIN_VERSION_LIMIT)) {
 		pr_err("Malformed data: version %u.%u.\n",
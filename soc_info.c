@@ -22,7 +22,9 @@
  **********************************************************************/
 #include "soc_info.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /*
@@ -94,6 +96,47 @@ sram_swap_buffers a80_sram_swap_buffers[] = {
 	{ .size = 0 }  /* End of the table */
 };
 
+/*
+ * SPI0 controller data. The A10 and A20 use PC23 for the chip select, all
+ * others have the SPI0 pins at PC0-PC3.
+ */
+soc_spi_info a10_a20_spi_info = {
+	.base = 0x01C05000, .pins = { 0, 1, 2, 23 }, .pin_func = 3,
+};
+
+soc_spi_info a13_spi_info = {
+	.base = 0x01C05000, .pins = { 0, 1, 2, 3 }, .pin_func = 3,
+};
+
+soc_spi_info h3_spi_info = {
+	.base = 0x01C68000, .sun6i = true,
+	.pins = { 0, 1, 2, 3 }, .pin_func = 3,
+};
+
+soc_spi_info a64_spi_info = {
+	.base = 0x01C68000, .sun6i = true,
+	.pins = { 0, 1, 2, 3 }, .pin_func = 4,
+};
+
+/*
+ * CPU clock control, see "--boost". The sun4i/sun5i/sun7i CCU feeds AXI
+ * and AHB from the CPU clock, so these get 384 MHz with the dividers left
+ * alone (AHB = CPU / 2 after reset). The A31 and later have separate bus
+ * clocks, but need AXI and ATB dividers (/3, /2) for the CPU at 408 MHz.
+ */
+soc_clk_info a10_a13_a20_clk_info = {
+	.pll_reg = 0x01C20000, .pll_boost = 0xA1005000, /* N = 16 */
+	.mux_reg = 0x01C20054,
+	.boost_mhz = 384,
+};
+
+soc_clk_info sun6i_clk_info = {
+	.pll_reg = 0x01C20000, .pll_boost = 0x80001000, /* N = 17 */
+	.pll_lock = 1 << 28,
+	.mux_reg = 0x01C20050, .mux_mask = 0x0303, .mux_boost = 0x0102,
+	.boost_mhz = 408,
+};
+
 soc_info_t soc_info_table[] = {
 	{
 		.soc_id       = 0x1623, /* Allwinner A10 */
@@ -103,6 +146,8 @@ soc_info_t soc_info_table[] = {
 		.swap_buffers = a10_a13_a20_sram_swap_buffers,
 		.needs_l2en   = true,
 		.sid_base     = 0x01C23800,
+		.spi          = &a10_a20_spi_info,
+		.clk          = &a10_a13_a20_clk_info,
 	},{
 		.soc_id       = 0x1625, /* Allwinner A10s, A13, R8 */
 		.name         = "A13",
@@ -111,6 +156,8 @@ soc_info_t soc_info_table[] = {
 		.swap_buffers = a10_a13_a20_sram_swap_buffers,
 		.needs_l2en   = true,
 		.sid_base     = 0x01C23800,
+		.spi          = &a13_spi_info,
+		.clk          = &a10_a13_a20_clk_info,
 	},{
 		.soc_id       = 0x1651, /* Allwinner A20 */
 		.name         = "A20",
@@ -118,6 +165,8 @@ soc_info_t soc_info_table[] = {
 		.thunk_addr   = 0xA200, .thunk_size = 0x200,
 		.swap_buffers = a10_a13_a20_sram_swap_buffers,
 		.sid_base     = 0x01C23800,
+		.spi          = &a10_a20_spi_info,
+		.clk          = &a10_a13_a20_clk_info,
 	},{
 		.soc_id       = 0x1650, /* Allwinner A23 */
 		.name         = "A23",
@@ -125,12 +174,14 @@ soc_info_t soc_info_table[] = {
 		.thunk_addr   = 0x46E00, .thunk_size = 0x200,
 		.swap_buffers = ar100_abusing_sram_swap_buffers,
 		.sid_base     = 0x01C23800,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1633, /* Allwinner A31 */
 		.name         = "A31",
 		.scratch_addr = 0x1000,
 		.thunk_addr   = 0x22E00, .thunk_size = 0x200,
 		.swap_buffers = a31_sram_swap_buffers,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1667, /* Allwinner A33, R16 */
 		.name         = "A33",
@@ -138,6 +189,7 @@ soc_info_t soc_info_table[] = {
 		.thunk_addr   = 0x46E00, .thunk_size = 0x200,
 		.swap_buffers = ar100_abusing_sram_swap_buffers,
 		.sid_base     = 0x01C23800,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1689, /* Allwinner A64 */
 		.name         = "A64",
@@ -148,6 +200,8 @@ soc_info_t soc_info_table[] = {
 		.sid_base     = 0x01C14000,
 		.sid_offset   = 0x200,
 		.rvbar_reg    = 0x017000A0,
+		.spi          = &a64_spi_info,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1639, /* Allwinner A80 */
 		.name         = "A80",
@@ -175,6 +229,8 @@ soc_info_t soc_info_table[] = {
 		.sid_base     = 0x01C14000,
 		.sid_offset   = 0x200,
 		.sid_fix      = true,
+		.spi          = &h3_spi_info,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1681, /* Allwinner V3s */
 		.name         = "V3s",
@@ -183,6 +239,8 @@ soc_info_t soc_info_table[] = {
 		.thunk_addr   = 0xA200, .thunk_size = 0x200,
 		.swap_buffers = a10_a13_a20_sram_swap_buffers,
 		.sid_base     = 0x01C23800,
+		.spi          = &h3_spi_info,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1718, /* Allwinner H5 */
 		.name         = "H5",
@@ -193,6 +251,8 @@ soc_info_t soc_info_table[] = {
 		.sid_base     = 0x01C14000,
 		.sid_offset   = 0x200,
 		.rvbar_reg    = 0x017000A0,
+		.spi          = &a64_spi_info,
+		.clk          = &sun6i_clk_info,
 	},{
 		.soc_id       = 0x1701, /* Allwinner R40 */
 		.name         = "R40",
@@ -201,6 +261,7 @@ soc_info_t soc_info_table[] = {
 		.swap_buffers = a10_a13_a20_sram_swap_buffers,
 		.sid_base     = 0x01C1B000,
 		.sid_offset   = 0x200,
+		.clk          = &sun6i_clk_info,
 	},{
 		.swap_buffers = NULL /* End of the table */
 	}
@@ -264,3 +325,153 @@ void get_soc_name_from_id(soc_name_t buffer, uint32_t soc_id)
 	/* unknown SoC (or name string missing), use the hexadecimal ID */
 	snprintf(buffer, sizeof(soc_name_t) - 1, "0x%04X", soc_id);
 }
+
+/*
+ * Tuning override files
+ *
+ * These are text files with one "key value" pair per line, and comments
+ * starting with '#'. A "soc <id>" line starts the section for the given SoC
+ * ID, the other keys are the names of the soc_tuning fields. Numbers may be
+ * decimal or "0x" hexadecimal, the MMU tweak is "on", "off" or "default".
+ * Files for several SoCs can simply get concatenated.
+ */
+static const char *mmu_tweak_names[] = {
+	[MMU_TWEAK_DEFAULT] = "default",
+	[MMU_TWEAK_ON] = "on",
+	[MMU_TWEAK_OFF] = "off",
+};
+
+static bool tuning_number(const char *value, uint32_t *result)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(value, &end, 0);
+	if (errno || end == value || *end || n > UINT32_MAX)
+		return false;
+	*result = n;
+	return true;
+}
+
+uint32_t soc_scratch_limit(const soc_info_t *soc_info)
+{
+	const sram_swap_buffers *swap = soc_info->swap_buffers;
+	uint32_t start = soc_info->scratch_addr;
+	uint32_t limit[] = { soc_info->thunk_addr, soc_info->mmu_tt_addr,
+			     soc_info->spl_addr };
+	uint32_t end = start + SOC_TUNING_MAX_SCRATCH;
+	size_t i;
+
+	if (!swap)
+		return 0;
+	/* the scratch area ends where the next area in use by the BROM starts */
+	for (i = 0; swap[i].size; i++) {
+		if (swap[i].buf1 > start && swap[i].buf1 < end)
+			end = swap[i].buf1;
+		if (swap[i].buf2 > start && swap[i].buf2 < end)
+			end = swap[i].buf2;
+	}
+	for (i = 0; i < sizeof(limit) / sizeof(limit[0]); i++)
+		if (limit[i] > start && limit[i] < end)
+			end = limit[i];
+	return (end - start) & ~0xFF;
+}
+
+void soc_tuning_transfer(const soc_info_t *soc_info, uint32_t *chunk,
+			 uint32_t *timeout)
+{
+	static const soc_tuning defaults;
+	const soc_tuning *tuning = soc_info ? &soc_info->tuning : &defaults;
+	uint64_t rate = tuning->upload_rate ? tuning->upload_rate
+					    : SOC_TUNING_MIN_RATE;
+
+	*chunk = tuning->bulk_chunk ? tuning->bulk_chunk : SOC_TUNING_MAX_CHUNK;
+	/* time for a chunk at the minimum rate, plus 2 seconds to spare */
+	*timeout = *chunk * 1000ULL / rate + 2000;
+}
+
+int soc_tuning_load(const char *filename, soc_info_t *soc_info)
+{
+	soc_tuning tuning = soc_info->tuning;
+	char line[256], key[32], value[32];
+	bool match = false, ok = true;
+	int lineno = 0, sections = 0;
+	uint32_t n;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	while (ok && fgets(line, sizeof(line), f)) {
+		char *comment = strchr(line, '#');
+		int fields;
+
+		lineno++;
+		if (comment)
+			*comment = '\0';
+		fields = sscanf(line, "%31s %31s", key, value);
+		if (fields <= 0)
+			continue; /* empty line */
+		ok = fields == 2;
+		if (ok && strcmp(key, "soc") == 0) {
+			ok = tuning_number(value, &n);
+			match = n == soc_info->soc_id;
+			if (match)
+				sections++;
+		} else if (!ok || !match) {
+			continue;
+		} else if (strcmp(key, "bulk_chunk") == 0) {
+			ok = tuning_number(value, &tuning.bulk_chunk)
+			     && tuning.bulk_chunk <= SOC_TUNING_MAX_CHUNK;
+		} else if (strcmp(key, "scratch_size") == 0) {
+			/* never beyond what the memory layout allows */
+			ok = tuning_number(value, &tuning.scratch_size)
+			     && tuning.scratch_size % 4 == 0
+			     && tuning.scratch_size <= soc_scratch_limit(soc_info);
+		} else if (strcmp(key, "upload_rate") == 0) {
+			ok = tuning_number(value, &tuning.upload_rate);
+		} else if (strcmp(key, "mmu_tweak") == 0) {
+			for (n = 0; n < 3; n++)
+				if (strcmp(value, mmu_tweak_names[n]) == 0)
+					break;
+			ok = n < 3;
+			tuning.mmu_tweak = n;
+		} else {
+			ok = false;
+		}
+	}
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "%s:%d: invalid tuning entry \"%s\"\n",
+			filename, lineno, key);
+		return -1;
+	}
+	soc_info->tuning = tuning;
+	return sections;
+}
+
+bool soc_tuning_save(const char *filename, const soc_info_t *soc_info)
+{
+	const soc_tuning *tuning = &soc_info->tuning;
+	FILE *f = fopen(filename, "w");
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	fprintf(f, "# sunxi-fel transfer tuning (see \"sunxi-fel calibrate\")\n");
+	fprintf(f, "soc\t\t0x%04X\t# %s\n", soc_info->soc_id,
+		soc_info->name ? soc_info->name : "unknown");
+	fprintf(f, "bulk_chunk\t%u\n", tuning->bulk_chunk);
+	fprintf(f, "mmu_tweak\t%s\n", mmu_tweak_names[tuning->mmu_tweak]);
+	fprintf(f, "scratch_size\t0x%X\n", tuning->scratch_size);
+	fprintf(f, "upload_rate\t%u\n", tuning->upload_rate);
+	if (fclose(f) != 0) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	return true;
+}
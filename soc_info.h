@@ -51,6 +51,64 @@ typedef struct {
 	uint32_t size; /* buffer size */
 } sram_swap_buffers;
 
+/*
+ * Information about the SPI0 controller and its pins, as needed to access
+ * the SPI NOR flash (boot device) via FEL. All supported SoCs use the same
+ * clock control and PIO register layout; 'sun6i' selects the SPI register
+ * layout introduced with the A31, which also needs a reset to be deasserted.
+ */
+typedef struct {
+	uint32_t base;		/* SPI0 controller MMIO base */
+	bool     sun6i;		/* A31-style controller */
+	uint8_t  pins[4];	/* port C pin numbers of MOSI, MISO, CLK, CS0 */
+	uint8_t  pin_func;	/* pinmux function of these pins */
+} soc_spi_info;
+
+/*
+ * CPU clock setup for the optional "--boost" mode. The BROM leaves the CPU
+ * running at a conservative clock rate, often directly from the 24 MHz
+ * oscillator. 'pll_reg' is the PLL_CPUX (PLL1) control register, and
+ * 'pll_boost' its value for a safe higher rate - the one U-Boot uses before
+ * setting up the PMIC voltages. 'mux_reg' holds the CPU clock source
+ * selection in bits 17:16 (1 = OSC24M, 2 = PLL), and the divider bits in
+ * 'mux_mask' get set to 'mux_boost' along with selecting the PLL. A non-zero
+ * 'pll_lock' is the bit indicating that the PLL is stable.
+ */
+typedef struct {
+	uint32_t pll_reg;
+	uint32_t pll_boost;
+	uint32_t pll_lock;
+	uint32_t mux_reg;
+	uint32_t mux_mask;
+	uint32_t mux_boost;
+	uint32_t boost_mhz;	/* resulting CPU clock */
+} soc_clk_info;
+
+/*
+ * Transfer tuning, as measured by "sunxi-fel calibrate". Zero values select
+ * the defaults, which are meant for the worst case: USB bulk transfers of
+ * 512 KiB with a timeout that assumes at least 64 KiB/s, and a scratch area
+ * of FEL_SCRATCH_SIZE bytes. 'mmu_tweak' controls whether the MMU gets
+ * (re-)enabled with optimized section attributes after running the SPL.
+ */
+typedef enum {
+	MMU_TWEAK_DEFAULT = 0,	/* same as "on" */
+	MMU_TWEAK_ON,
+	MMU_TWEAK_OFF,
+} soc_mmu_tweak;
+
+typedef struct {
+	uint32_t      bulk_chunk;   /* preferred USB bulk transfer size */
+	soc_mmu_tweak mmu_tweak;
+	uint32_t      scratch_size; /* usable size of the scratch area */
+	uint32_t      upload_rate;  /* minimum expected upload rate (bytes/s) */
+} soc_tuning;
+
+/* upper limits for the tuning values, and the default transfer rate */
+#define SOC_TUNING_MAX_CHUNK	(512 * 1024)
+#define SOC_TUNING_MAX_SCRATCH	0x4000
+#define SOC_TUNING_MIN_RATE	(64 * 1024)
+
 /*
  * Each SoC variant may have its own list of memory buffers to be exchanged
  * and the information about the placement of the thunk code, which handles
@@ -87,6 +145,9 @@ typedef struct {
 	uint32_t           rvbar_reg;    /* MMIO address of RVBARADDR0_L register */
 	bool               sid_fix;      /* Use SID workaround (read via register) */
 	sram_swap_buffers *swap_buffers;
+	soc_spi_info      *spi;          /* SPI0 (flash) info, NULL = unknown */
+	soc_clk_info      *clk;          /* CPU clock info, NULL = unknown */
+	soc_tuning         tuning;       /* transfer tuning, zero = defaults */
 } soc_info_t;
 
 
@@ -94,4 +155,24 @@ void get_soc_name_from_id(soc_name_t buffer, uint32_t soc_id);
 soc_info_t *get_soc_info_from_id(uint32_t soc_id);
 soc_info_t *get_soc_info_from_version(struct aw_fel_version *buf);
 
+/*
+ * Tuning override files, written by "sunxi-fel calibrate": loading applies
+ * the entries for the given SoC, returning the number of matching sections
+ * found (or -1 on errors). Saving returns false on errors.
+ */
+int soc_tuning_load(const char *filename, soc_info_t *soc_info);
+bool soc_tuning_save(const char *filename, const soc_info_t *soc_info);
+/*
+ * The largest scratch area size that the SoC's documented memory layout
+ * allows (up to SOC_TUNING_MAX_SCRATCH), or 0 if the BROM's memory usage
+ * isn't known.
+ */
+uint32_t soc_scratch_limit(const soc_info_t *soc_info);
+/*
+ * USB bulk transfer chunk size and timeout (in ms) for payload data, as
+ * selected by the SoC's tuning (soc_info may be NULL for the defaults).
+ */
+void soc_tuning_transfer(const soc_info_t *soc_info, uint32_t *chunk,
+			 uint32_t *timeout);
+
 #endif /* _SUNXI_TOOLS_SOC_INFO_H */
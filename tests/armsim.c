@@ -0,0 +1,841 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal ARM (A32) interpreter for host-side execution of FEL thunks
+ *
+ * This covers the subset of the ARMv7-A instruction set that our thunk
+ * code uses: data processing, multiplies, single and multiple loads/stores,
+ * branches (incl. bx/blx), mrs/msr, clz, movw/movt and a few hints/barriers.
+ * Coprocessor access (mrc/mcr, mrrc/mcrr) is passed to optional callbacks.
+ */
+#include "armsim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PC	15
+#define LR	14
+#define SP	13
+
+#define FLAG_N	(1u << 31)
+#define FLAG_Z	(1u << 30)
+#define FLAG_C	(1u << 29)
+#define FLAG_V	(1u << 28)
+
+void armsim_init(armsim_t *sim)
+{
+	memset(sim, 0, sizeof(*sim));
+	sim->cpsr = 0x000001D3; /* SVC mode, IRQ/FIQ masked */
+}
+
+void armsim_free(armsim_t *sim)
+{
+	size_t i;
+	for (i = 0; i < sim->regions; i++)
+		free(sim->region[i].mem);
+	sim->regions = 0;
+}
+
+static armsim_region *add_region(armsim_t *sim, uint32_t base, uint32_t size)
+{
+	if (sim->regions >= ARMSIM_MAX_REGIONS)
+		return NULL;
+	armsim_region *rgn = &sim->region[sim->regions++];
+	memset(rgn, 0, sizeof(*rgn));
+	rgn->base = base;
+	rgn->size = size;
+	return rgn;
+}
+
+uint8_t *armsim_add_ram(armsim_t *sim, uint32_t base, uint32_t size)
+{
+	armsim_region *rgn = add_region(sim, base, size);
+	if (!rgn)
+		return NULL;
+	rgn->mem = calloc(1, size);
+	return rgn->mem;
+}
+
+void armsim_add_mmio(armsim_t *sim, uint32_t base, uint32_t size,
+		     armsim_read_cb read, armsim_write_cb write, void *ctx)
+{
+	armsim_region *rgn = add_region(sim, base, size);
+	if (rgn) {
+		rgn->read = read;
+		rgn->write = write;
+		rgn->ctx = ctx;
+	}
+}
+
+static armsim_region *find_region(armsim_t *sim, uint32_t addr, int size)
+{
+	size_t i;
+	for (i = 0; i < sim->regions; i++) {
+		armsim_region *rgn = &sim->region[i];
+		if (addr >= rgn->base && addr - rgn->base < rgn->size &&
+		    rgn->size - (addr - rgn->base) >= (uint32_t)size)
+			return rgn;
+	}
+	return NULL;
+}
+
+/* raw memory access, returns false on unmapped addresses */
+static bool mem_read(armsim_t *sim, uint32_t addr, int size, uint32_t *value)
+{
+	armsim_region *rgn = find_region(sim, addr, size);
+	if (!rgn) {
+		sim->fault_addr = addr;
+		return false;
+	}
+	if (rgn->mem) {
+		uint8_t *p = rgn->mem + (addr - rgn->base);
+		uint32_t v = 0;
+		int i;
+		for (i = size - 1; i >= 0; i--)
+			v = (v << 8) | p[i];
+		*value = v;
+	} else {
+		*value = rgn->read ? rgn->read(sim, rgn->ctx, addr, size) : 0;
+	}
+	return true;
+}
+
+static bool mem_write(armsim_t *sim, uint32_t addr, int size, uint32_t value)
+{
+	armsim_region *rgn = find_region(sim, addr, size);
+	if (!rgn) {
+		sim->fault_addr = addr;
+		return false;
+	}
+	if (rgn->mem) {
+		uint8_t *p = rgn->mem + (addr - rgn->base);
+		int i;
+		for (i = 0; i < size; i++, value >>= 8)
+			p[i] = value & 0xFF;
+	} else if (rgn->write) {
+		rgn->write(sim, rgn->ctx, addr, value, size);
+	}
+	return true;
+}
+
+bool armsim_write_mem(armsim_t *sim, uint32_t addr, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	while (len-- > 0)
+		if (!mem_write(sim, addr++, 1, *p++))
+			return false;
+	return true;
+}
+
+bool armsim_read_mem(armsim_t *sim, uint32_t addr, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	uint32_t v;
+	while (len-- > 0) {
+		if (!mem_read(sim, addr++, 1, &v))
+			return false;
+		*p++ = v;
+	}
+	return true;
+}
+
+uint32_t armsim_readl(armsim_t *sim, uint32_t addr)
+{
+	uint32_t v = 0;
+	mem_read(sim, addr, 4, &v);
+	return v;
+}
+
+void armsim_writel(armsim_t *sim, uint32_t addr, uint32_t value)
+{
+	mem_write(sim, addr, 4, value);
+}
+
+/* counted accesses, on behalf of the simulated code */
+static bool load(armsim_t *sim, uint32_t addr, int size, uint32_t *value)
+{
+	sim->loads++;
+	sim->load_bytes += size;
+	return mem_read(sim, addr, size, value);
+}
+
+static bool store(armsim_t *sim, uint32_t addr, int size, uint32_t value)
+{
+	sim->stores++;
+	sim->store_bytes += size;
+	return mem_write(sim, addr, size, value);
+}
+
+static bool condition_passed(uint32_t cpsr, uint32_t cond)
+{
+	bool n = cpsr & FLAG_N, z = cpsr & FLAG_Z;
+	bool c = cpsr & FLAG_C, v = cpsr & FLAG_V;
+
+	switch (cond) {
+	case 0x0: return z;
+	case 0x1: return !z;
+	case 0x2: return c;
+	case 0x3: return !c;
+	case 0x4: return n;
+	case 0x5: return !n;
+	case 0x6: return v;
+	case 0x7: return !v;
+	case 0x8: return c && !z;
+	case 0x9: return !c || z;
+	case 0xA: return n == v;
+	case 0xB: return n != v;
+	case 0xC: return !z && n == v;
+	case 0xD: return z || n != v;
+	default:  return true;
+	}
+}
+
+/* register read, with the PC reading as "current instruction + 8" */
+static uint32_t reg(armsim_t *sim, int n)
+{
+	return n == PC ? sim->r[PC] + 8 : sim->r[n];
+}
+
+static uint32_t shift(uint32_t value, int type, unsigned amount,
+		      bool carry_in, bool *carry_out)
+{
+	*carry_out = carry_in;
+	switch (type) {
+	case 0: /* LSL */
+		if (amount == 0)
+			return value;
+		if (amount < 32) {
+			*carry_out = (value >> (32 - amount)) & 1;
+			return value << amount;
+		}
+		*carry_out = amount == 32 ? value & 1 : 0;
+		return 0;
+	case 1: /* LSR */
+		if (amount == 0)
+			return value;
+		if (amount < 32) {
+			*carry_out = (value >> (amount - 1)) & 1;
+			return value >> amount;
+		}
+		*carry_out = amount == 32 ? value >> 31 : 0;
+		return 0;
+	case 2: /* ASR */
+		if (amount == 0)
+			return value;
+		if (amount < 32) {
+			*carry_out = (value >> (amount - 1)) & 1;
+			return (uint32_t)((int32_t)value >> amount);
+		}
+		*carry_out = value >> 31;
+		return value & 0x80000000 ? 0xFFFFFFFF : 0;
+	default: /* ROR */
+		if (amount == 0)
+			return value;
+		amount &= 31;
+		if (amount == 0) {
+			*carry_out = value >> 31;
+			return value;
+		}
+		*carry_out = (value >> (amount - 1)) & 1;
+		return (value >> amount) | (value << (32 - amount));
+	}
+}
+
+/* decode the "shifter operand" of data processing instructions */
+static uint32_t shifter_operand(armsim_t *sim, uint32_t insn, bool *carry)
+{
+	bool c = sim->cpsr & FLAG_C;
+
+	if (insn & (1 << 25)) { /* immediate */
+		uint32_t imm = insn & 0xFF;
+		unsigned rot = ((insn >> 8) & 0xF) * 2;
+		*carry = c;
+		if (rot == 0)
+			return imm;
+		imm = (imm >> rot) | (imm << (32 - rot));
+		*carry = imm >> 31;
+		return imm;
+	}
+
+	uint32_t rm = reg(sim, insn & 0xF);
+	int type = (insn >> 5) & 3;
+	if (insn & (1 << 4)) { /* register-specified shift amount */
+		if ((insn & 0xF) == PC)
+			rm += 4; /* PC reads as +12 here */
+		return shift(rm, type, reg(sim, (insn >> 8) & 0xF) & 0xFF,
+			     c, carry);
+	}
+	unsigned amount = (insn >> 7) & 0x1F;
+	if (amount == 0) {
+		switch (type) {
+		case 1: case 2: /* LSR #32, ASR #32 */
+			amount = 32;
+			break;
+		case 3: /* RRX */
+			*carry = rm & 1;
+			return (rm >> 1) | (c ? 0x80000000 : 0);
+		}
+	}
+	return shift(rm, type, amount, c, carry);
+}
+
+static void set_nz(armsim_t *sim, uint32_t result)
+{
+	sim->cpsr &= ~(FLAG_N | FLAG_Z);
+	if (result & 0x80000000)
+		sim->cpsr |= FLAG_N;
+	if (result == 0)
+		sim->cpsr |= FLAG_Z;
+}
+
+static void set_flag(armsim_t *sim, uint32_t flag, bool value)
+{
+	if (value)
+		sim->cpsr |= flag;
+	else
+		sim->cpsr &= ~flag;
+}
+
+/* a + b + carry, with flag calculation */
+static uint32_t add_with_carry(armsim_t *sim, uint32_t a, uint32_t b,
+			       bool carry, bool setflags)
+{
+	uint64_t usum = (uint64_t)a + b + carry;
+	uint32_t result = (uint32_t)usum;
+	if (setflags) {
+		set_nz(sim, result);
+		set_flag(sim, FLAG_C, usum >> 32);
+		set_flag(sim, FLAG_V, ((a ^ result) & (b ^ result)) >> 31);
+	}
+	return result;
+}
+
+/* write a branch target to the PC (bit 0 set would mean Thumb) */
+static bool branch_to(armsim_t *sim, uint32_t target)
+{
+	if (target & 1)
+		return false; /* Thumb is not supported */
+	sim->r[PC] = target & ~3u;
+	sim->branches++;
+	return true;
+}
+
+static armsim_status data_processing(armsim_t *sim, uint32_t insn)
+{
+	int opcode = (insn >> 21) & 0xF;
+	bool s = insn & (1 << 20);
+	int rd = (insn >> 12) & 0xF;
+	uint32_t rn = reg(sim, (insn >> 16) & 0xF);
+	bool carry;
+	uint32_t op2 = shifter_operand(sim, insn, &carry);
+	uint32_t result = 0;
+	bool c = sim->cpsr & FLAG_C;
+	bool write = true;
+
+	if (!(insn & (1 << 25)) && (insn & (1 << 4)) && ((insn >> 16) & 0xF) == PC)
+		rn += 4;
+
+	switch (opcode) {
+	case 0x0: result = rn & op2; break;			/* AND */
+	case 0x1: result = rn ^ op2; break;			/* EOR */
+	case 0x2: result = add_with_carry(sim, rn, ~op2, 1, s); break; /* SUB */
+	case 0x3: result = add_with_carry(sim, op2, ~rn, 1, s); break; /* RSB */
+	case 0x4: result = add_with_carry(sim, rn, op2, 0, s); break;  /* ADD */
+	case 0x5: result = add_with_carry(sim, rn, op2, c, s); break;  /* ADC */
+	case 0x6: result = add_with_carry(sim, rn, ~op2, c, s); break; /* SBC */
+	case 0x7: result = add_with_carry(sim, op2, ~rn, c, s); break; /* RSC */
+	case 0x8: result = rn & op2; write = false; break;	/* TST */
+	case 0x9: result = rn ^ op2; write = false; break;	/* TEQ */
+	case 0xA: add_with_carry(sim, rn, ~op2, 1, true); write = false; break; /* CMP */
+	case 0xB: add_with_carry(sim, rn, op2, 0, true); write = false; break;  /* CMN */
+	case 0xC: result = rn | op2; break;			/* ORR */
+	case 0xD: result = op2; break;				/* MOV */
+	case 0xE: result = rn & ~op2; break;			/* BIC */
+	case 0xF: result = ~op2; break;				/* MVN */
+	}
+
+	/* logical operations set N, Z and the shifter carry */
+	if (s && (opcode <= 1 || (opcode >= 8 && opcode <= 9) || opcode >= 0xC)) {
+		set_nz(sim, result);
+		set_flag(sim, FLAG_C, carry);
+	}
+
+	if (write) {
+		if (rd == PC) {
+			if (s)
+				return ARMSIM_UNDEFINED; /* exception return */
+			return branch_to(sim, result) ? ARMSIM_OK : ARMSIM_UNDEFINED;
+		}
+		sim->r[rd] = result;
+	}
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+static armsim_status multiply(armsim_t *sim, uint32_t insn)
+{
+	int op = (insn >> 21) & 0xF;
+	bool s = insn & (1 << 20);
+	int rd = (insn >> 16) & 0xF, rn = (insn >> 12) & 0xF;
+	uint32_t rs = sim->r[(insn >> 8) & 0xF], rm = sim->r[insn & 0xF];
+
+	switch (op) {
+	case 0x0: /* MUL */
+	case 0x1: /* MLA */
+		sim->r[rd] = rm * rs + (op == 1 ? sim->r[rn] : 0);
+		if (s)
+			set_nz(sim, sim->r[rd]);
+		break;
+	case 0x4: /* UMULL */
+	case 0x5: /* UMLAL */
+	case 0x6: /* SMULL */
+	case 0x7: { /* SMLAL */
+		uint64_t result;
+		if (op & 2)
+			result = (uint64_t)((int64_t)(int32_t)rm * (int32_t)rs);
+		else
+			result = (uint64_t)rm * rs;
+		if (op & 1)
+			result += ((uint64_t)sim->r[rd] << 32) | sim->r[rn];
+		sim->r[rn] = (uint32_t)result;
+		sim->r[rd] = result >> 32;
+		if (s) {
+			set_flag(sim, FLAG_N, result >> 63);
+			set_flag(sim, FLAG_Z, result == 0);
+		}
+		break;
+	}
+	default:
+		return ARMSIM_UNDEFINED;
+	}
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+/* ldrh/strh/ldrsb/ldrsh/ldrd/strd */
+static armsim_status extra_load_store(armsim_t *sim, uint32_t insn)
+{
+	bool p = insn & (1 << 24), u = insn & (1 << 23);
+	bool w = insn & (1 << 21), l = insn & (1 << 20);
+	int rn = (insn >> 16) & 0xF, rt = (insn >> 12) & 0xF;
+	int sh = (insn >> 5) & 3;
+	uint32_t offset, addr, base = reg(sim, rn), value;
+
+	if (insn & (1 << 22))
+		offset = ((insn >> 4) & 0xF0) | (insn & 0xF);
+	else
+		offset = sim->r[insn & 0xF];
+	addr = p ? (u ? base + offset : base - offset) : base;
+
+	if (l) {
+		switch (sh) {
+		case 1: /* LDRH */
+			if (!load(sim, addr, 2, &value))
+				return ARMSIM_ABORT;
+			break;
+		case 2: /* LDRSB */
+			if (!load(sim, addr, 1, &value))
+				return ARMSIM_ABORT;
+			value = (uint32_t)(int32_t)(int8_t)value;
+			break;
+		case 3: /* LDRSH */
+			if (!load(sim, addr, 2, &value))
+				return ARMSIM_ABORT;
+			value = (uint32_t)(int32_t)(int16_t)value;
+			break;
+		default:
+			return ARMSIM_UNDEFINED;
+		}
+		sim->r[rt] = value;
+	} else {
+		switch (sh) {
+		case 1: /* STRH */
+			if (!store(sim, addr, 2, reg(sim, rt)))
+				return ARMSIM_ABORT;
+			break;
+		case 2: /* LDRD */
+			if (rt & 1)
+				return ARMSIM_UNDEFINED;
+			if (!load(sim, addr, 4, &sim->r[rt])
+			    || !load(sim, addr + 4, 4, &sim->r[rt + 1]))
+				return ARMSIM_ABORT;
+			break;
+		case 3: /* STRD */
+			if (rt & 1)
+				return ARMSIM_UNDEFINED;
+			if (!store(sim, addr, 4, sim->r[rt])
+			    || !store(sim, addr + 4, 4, sim->r[rt + 1]))
+				return ARMSIM_ABORT;
+			break;
+		default:
+			return ARMSIM_UNDEFINED;
+		}
+	}
+	if (!p)
+		sim->r[rn] = u ? base + offset : base - offset;
+	else if (w)
+		sim->r[rn] = addr;
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+static armsim_status load_store(armsim_t *sim, uint32_t insn)
+{
+	bool p = insn & (1 << 24), u = insn & (1 << 23), b = insn & (1 << 22);
+	bool w = insn & (1 << 21), l = insn & (1 << 20);
+	int rn = (insn >> 16) & 0xF, rt = (insn >> 12) & 0xF;
+	uint32_t offset, base = reg(sim, rn), addr, value;
+
+	if (insn & (1 << 25)) {
+		bool carry;
+		unsigned amount = (insn >> 7) & 0x1F;
+		int type = (insn >> 5) & 3;
+		if (amount == 0 && (type == 1 || type == 2))
+			amount = 32;
+		offset = shift(sim->r[insn & 0xF], type, amount,
+			       sim->cpsr & FLAG_C, &carry);
+	} else {
+		offset = insn & 0xFFF;
+	}
+	if (rn == PC)
+		base &= ~3u;
+	addr = p ? (u ? base + offset : base - offset) : base;
+
+	if (l) {
+		if (!load(sim, addr, b ? 1 : 4, &value))
+			return ARMSIM_ABORT;
+	} else {
+		uint32_t data = reg(sim, rt);
+		if (rt == PC)
+			data += 4;
+		if (!store(sim, addr, b ? 1 : 4, b ? data & 0xFF : data))
+			return ARMSIM_ABORT;
+	}
+	/* base register writeback */
+	if (!p)
+		sim->r[rn] = u ? base + offset : base - offset;
+	else if (w)
+		sim->r[rn] = addr;
+
+	if (l) {
+		if (rt == PC)
+			return branch_to(sim, value) ? ARMSIM_OK : ARMSIM_UNDEFINED;
+		sim->r[rt] = value;
+	}
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+static armsim_status load_store_multiple(armsim_t *sim, uint32_t insn)
+{
+	bool p = insn & (1 << 24), u = insn & (1 << 23);
+	bool w = insn & (1 << 21), l = insn & (1 << 20);
+	int rn = (insn >> 16) & 0xF;
+	uint32_t list = insn & 0xFFFF;
+	uint32_t base = sim->r[rn], addr, new_pc = 0;
+	int count = 0, i;
+	bool load_pc = false;
+
+	if (insn & (1 << 22))
+		return ARMSIM_UNDEFINED; /* user bank / exception return */
+	for (i = 0; i < 16; i++)
+		if (list & (1 << i))
+			count++;
+
+	/* lowest register always goes to the lowest address */
+	addr = u ? base : base - 4 * count;
+	if (p == u)
+		addr += 4;
+
+	for (i = 0; i < 16; i++) {
+		if (!(list & (1 << i)))
+			continue;
+		if (l) {
+			uint32_t value;
+			if (!load(sim, addr, 4, &value))
+				return ARMSIM_ABORT;
+			if (i == PC) {
+				new_pc = value;
+				load_pc = true;
+			} else {
+				sim->r[i] = value;
+			}
+		} else {
+			if (!store(sim, addr, 4, reg(sim, i)))
+				return ARMSIM_ABORT;
+		}
+		addr += 4;
+	}
+	if (w && !(l && (list & (1 << rn))))
+		sim->r[rn] = u ? base + 4 * count : base - 4 * count;
+
+	if (load_pc)
+		return branch_to(sim, new_pc) ? ARMSIM_OK : ARMSIM_UNDEFINED;
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+static armsim_status coprocessor(armsim_t *sim, uint32_t insn)
+{
+	int cp = (insn >> 8) & 0xF, opc1 = (insn >> 21) & 7;
+	int crn = (insn >> 16) & 0xF, crm = insn & 0xF;
+	int opc2 = (insn >> 5) & 7, rt = (insn >> 12) & 0xF;
+
+	if (insn & (1 << 20)) { /* MRC */
+		uint32_t value = 0;
+		if (sim->cp_read)
+			value = sim->cp_read(sim, cp, opc1, crn, crm, opc2);
+		if (rt == PC)
+			sim->cpsr = (sim->cpsr & 0x0FFFFFFF) | (value & 0xF0000000);
+		else
+			sim->r[rt] = value;
+	} else { /* MCR */
+		if (sim->cp_write)
+			sim->cp_write(sim, cp, opc1, crn, crm, opc2, reg(sim, rt));
+	}
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+/* 64-bit transfers, MRRC and MCRR */
+static armsim_status coprocessor64(armsim_t *sim, uint32_t insn)
+{
+	int cp = (insn >> 8) & 0xF, opc1 = (insn >> 4) & 0xF;
+	int crm = insn & 0xF, rt = (insn >> 12) & 0xF, rt2 = (insn >> 16) & 0xF;
+
+	if (rt == PC || rt2 == PC)
+		return ARMSIM_UNDEFINED;
+	if (insn & (1 << 20)) { /* MRRC */
+		uint64_t value = 0;
+		if (sim->cp_read64)
+			value = sim->cp_read64(sim, cp, opc1, crm);
+		sim->r[rt] = value;
+		sim->r[rt2] = value >> 32;
+	} else { /* MCRR */
+		if (sim->cp_write64)
+			sim->cp_write64(sim, cp, opc1, crm, sim->r[rt]
+					| (uint64_t)sim->r[rt2] << 32);
+	}
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+/* miscellaneous instructions in the data processing space */
+static armsim_status misc(armsim_t *sim, uint32_t insn)
+{
+	int rd = (insn >> 12) & 0xF;
+
+	if ((insn & 0x0FFFFFF0) == 0x012FFF10) { /* BX */
+		uint32_t target = reg(sim, insn & 0xF);
+		if (target == ARMSIM_RETURN_ADDR) {
+			sim->r[PC] = target;
+			return ARMSIM_OK;
+		}
+		return branch_to(sim, target) ? ARMSIM_OK : ARMSIM_UNDEFINED;
+	}
+	if ((insn & 0x0FFFFFF0) == 0x012FFF30) { /* BLX register */
+		uint32_t target = reg(sim, insn & 0xF);
+		sim->r[LR] = sim->r[PC] + 4;
+		return branch_to(sim, target) ? ARMSIM_OK : ARMSIM_UNDEFINED;
+	}
+	if ((insn & 0x0FFF0FF0) == 0x016F0F10) { /* CLZ */
+		uint32_t value = reg(sim, insn & 0xF);
+		int n = 0;
+		while (n < 32 && !(value & (0x80000000u >> n)))
+			n++;
+		sim->r[rd] = n;
+		sim->r[PC] += 4;
+		return ARMSIM_OK;
+	}
+	if ((insn & 0x0FBF0FFF) == 0x010F0000) { /* MRS */
+		if (insn & (1 << 22))
+			return ARMSIM_UNDEFINED; /* SPSR */
+		sim->r[rd] = sim->cpsr;
+		sim->r[PC] += 4;
+		return ARMSIM_OK;
+	}
+	if ((insn & 0x0FB0FFF0) == 0x0120F000
+	    || (insn & 0x0FB0F000) == 0x0320F000) { /* MSR */
+		uint32_t value, mask = 0;
+		bool carry;
+		if (insn & (1 << 22))
+			return ARMSIM_UNDEFINED; /* SPSR */
+		value = (insn & (1 << 25)) ? shifter_operand(sim, insn, &carry)
+					   : reg(sim, insn & 0xF);
+		if (insn & (1 << 16)) mask |= 0x000000FF;
+		if (insn & (1 << 17)) mask |= 0x0000FF00;
+		if (insn & (1 << 18)) mask |= 0x00FF0000;
+		if (insn & (1 << 19)) mask |= 0xFF000000;
+		/*
+		 * Mode changes would require banked registers. We don't model
+		 * those, but accept them as long as the code restores the
+		 * original mode (e.g. temporarily switching to IRQ mode to
+		 * read SP_irq yields the current SP instead).
+		 */
+		sim->cpsr = (sim->cpsr & ~mask) | (value & mask);
+		sim->r[PC] += 4;
+		return ARMSIM_OK;
+	}
+	return ARMSIM_UNDEFINED;
+}
+
+/* media instructions we support: uxtb, uxth, rev */
+static armsim_status media(armsim_t *sim, uint32_t insn)
+{
+	int rd = (insn >> 12) & 0xF;
+	uint32_t rm = reg(sim, insn & 0xF);
+	unsigned rot = ((insn >> 10) & 3) * 8;
+
+	if (rot)
+		rm = (rm >> rot) | (rm << (32 - rot));
+	if ((insn & 0x0FFF03F0) == 0x06EF0070) /* UXTB */
+		sim->r[rd] = rm & 0xFF;
+	else if ((insn & 0x0FFF03F0) == 0x06FF0070) /* UXTH */
+		sim->r[rd] = rm & 0xFFFF;
+	else if ((insn & 0x0FFF0FF0) == 0x06BF0F30) /* REV */
+		sim->r[rd] = (rm >> 24) | ((rm >> 8) & 0xFF00)
+			   | ((rm << 8) & 0xFF0000) | (rm << 24);
+	else
+		return ARMSIM_UNDEFINED;
+	sim->r[PC] += 4;
+	return ARMSIM_OK;
+}
+
+static armsim_status step(armsim_t *sim)
+{
+	uint32_t insn, pc = sim->r[PC];
+	uint32_t cond;
+
+	if (!mem_read(sim, pc, 4, &insn))
+		return ARMSIM_ABORT;
+	sim->insns++;
+	cond = insn >> 28;
+
+	if (cond == 0xF) {
+		/* barriers (dsb, dmb, isb) and preload hints are no-ops */
+		if ((insn & 0xFFFFFF00) == 0xF57FF000
+		    || (insn & 0xFD70F000) == 0xF550F000) {
+			sim->r[PC] += 4;
+			return ARMSIM_OK;
+		}
+		sim->fault_addr = pc;
+		return ARMSIM_UNDEFINED;
+	}
+	if (!condition_passed(sim->cpsr, cond)) {
+		sim->skipped++;
+		sim->r[PC] += 4;
+		return ARMSIM_OK;
+	}
+
+	armsim_status rc = ARMSIM_UNDEFINED;
+	switch ((insn >> 25) & 7) {
+	case 0:
+		if ((insn & 0x0F0000F0) == 0x00000090
+		    || (insn & 0x0F8000F0) == 0x00800090)
+			rc = multiply(sim, insn);
+		else if ((insn & 0x01900000) == 0x01000000
+			 && (insn & 0x90) != 0x90)
+			rc = misc(sim, insn);
+		else if ((insn & 0x90) == 0x90)
+			rc = extra_load_store(sim, insn);
+		else
+			rc = data_processing(sim, insn);
+		break;
+	case 1:
+		if ((insn & 0x0FF00000) == 0x03000000) { /* MOVW */
+			sim->r[(insn >> 12) & 0xF] =
+				((insn >> 4) & 0xF000) | (insn & 0xFFF);
+			sim->r[PC] += 4;
+			rc = ARMSIM_OK;
+		} else if ((insn & 0x0FF00000) == 0x03400000) { /* MOVT */
+			int rd = (insn >> 12) & 0xF;
+			sim->r[rd] = (sim->r[rd] & 0xFFFF)
+				   | (((insn >> 4) & 0xF000) | (insn & 0xFFF)) << 16;
+			sim->r[PC] += 4;
+			rc = ARMSIM_OK;
+		} else if ((insn & 0x0FFFFF00) == 0x0320F000) { /* hints */
+			if ((insn & 0xFF) == 3) /* WFI */
+				return ARMSIM_WFI;
+			sim->r[PC] += 4;
+			rc = ARMSIM_OK;
+		} else if ((insn & 0x01900000) == 0x01000000) {
+			rc = misc(sim, insn);
+		} else {
+			rc = data_processing(sim, insn);
+		}
+		break;
+	case 2:
+		rc = load_store(sim, insn);
+		break;
+	case 3:
+		if (insn & (1 << 4))
+			rc = media(sim, insn);
+		else
+			rc = load_store(sim, insn);
+		break;
+	case 4:
+		rc = load_store_multiple(sim, insn);
+		break;
+	case 5: { /* B, BL */
+		int32_t offset = (int32_t)(insn << 8) >> 6;
+		if (insn & (1 << 24))
+			sim->r[LR] = pc + 4;
+		sim->r[PC] = pc + 8 + offset;
+		sim->branches++;
+		rc = ARMSIM_OK;
+		break;
+	}
+	case 6:
+		if ((insn & 0x0FE00000) == 0x0C400000)
+			rc = coprocessor64(sim, insn);
+		break;
+	case 7:
+		if ((insn & (1 << 24)) == 0 && (insn & (1 << 4)))
+			rc = coprocessor(sim, insn);
+		break;
+	}
+	if (rc != ARMSIM_OK && rc != ARMSIM_ABORT)
+		sim->fault_addr = pc;
+	return rc;
+}
+
+armsim_status armsim_call(armsim_t *sim, uint32_t entry, uint64_t max_insns)
+{
+	uint64_t limit = max_insns ? sim->insns + max_insns : 0;
+
+	sim->r[LR] = ARMSIM_RETURN_ADDR;
+	sim->r[PC] = entry;
+	while (sim->r[PC] != ARMSIM_RETURN_ADDR) {
+		armsim_status rc = step(sim);
+		if (rc != ARMSIM_OK)
+			return rc;
+		if (limit && sim->insns >= limit)
+			return ARMSIM_STEP_LIMIT;
+	}
+	return ARMSIM_OK;
+}
+
+const char *armsim_status_str(armsim_status status)
+{
+	switch (status) {
+	case ARMSIM_OK:		return "ok";
+	case ARMSIM_UNDEFINED:	return "undefined instruction";
+	case ARMSIM_ABORT:	return "data/prefetch abort";
+	case ARMSIM_STEP_LIMIT:	return "instruction limit exceeded";
+	case ARMSIM_WFI:	return "wait for interrupt";
+	}
+	return "unknown";
+}
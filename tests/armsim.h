@@ -0,0 +1,105 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal ARM (A32) interpreter for host-side execution of FEL thunks
+ */
+#ifndef _SUNXI_TOOLS_ARMSIM_H
+#define _SUNXI_TOOLS_ARMSIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* magic link register value, returning to it ends the simulation */
+#define ARMSIM_RETURN_ADDR	0xFFFFFFF0
+
+#define ARMSIM_MAX_REGIONS	16
+
+typedef struct armsim armsim_t;
+
+/* MMIO hooks: called for accesses to regions registered with callbacks */
+typedef uint32_t (*armsim_read_cb)(armsim_t *sim, void *ctx,
+				   uint32_t addr, int size);
+typedef void (*armsim_write_cb)(armsim_t *sim, void *ctx,
+				uint32_t addr, uint32_t value, int size);
+/* coprocessor hooks, for mrc (read) and mcr (write) instructions */
+typedef uint32_t (*armsim_cp_read_cb)(armsim_t *sim, int cp, int opc1,
+				      int crn, int crm, int opc2);
+typedef void (*armsim_cp_write_cb)(armsim_t *sim, int cp, int opc1,
+				   int crn, int crm, int opc2, uint32_t value);
+/* the same for the 64-bit mrrc and mcrr */
+typedef uint64_t (*armsim_cp_read64_cb)(armsim_t *sim, int cp, int opc1,
+					int crm);
+typedef void (*armsim_cp_write64_cb)(armsim_t *sim, int cp, int opc1,
+				     int crm, uint64_t value);
+
+typedef struct {
+	uint32_t base, size;
+	uint8_t *mem;		/* backing storage (NULL for MMIO callbacks) */
+	armsim_read_cb read;
+	armsim_write_cb write;
+	void *ctx;
+} armsim_region;
+
+typedef enum {
+	ARMSIM_OK = 0,		/* returned to ARMSIM_RETURN_ADDR */
+	ARMSIM_UNDEFINED,	/* unsupported / undefined instruction */
+	ARMSIM_ABORT,		/* access to unmapped memory */
+	ARMSIM_STEP_LIMIT,	/* instruction limit exceeded */
+	ARMSIM_WFI,		/* CPU halted by "wfi" */
+} armsim_status;
+
+struct armsim {
+	uint32_t r[16];
+	uint32_t cpsr;
+	armsim_region region[ARMSIM_MAX_REGIONS];
+	size_t regions;
+	armsim_cp_read_cb cp_read;
+	armsim_cp_write_cb cp_write;
+	armsim_cp_read64_cb cp_read64;
+	armsim_cp_write64_cb cp_write64;
+	/* statistics, a simple cost model */
+	uint64_t insns;		/* instructions executed */
+	uint64_t skipped;	/* instructions with failed condition */
+	uint64_t loads, stores;	/* memory accesses (per transferred word) */
+	uint64_t load_bytes, store_bytes;
+	uint64_t branches;	/* taken branches */
+	uint32_t fault_addr;	/* address of the failing access or insn */
+};
+
+void armsim_init(armsim_t *sim);
+void armsim_free(armsim_t *sim);
+/* add RAM at given address (zero-initialized), returns its backing store */
+uint8_t *armsim_add_ram(armsim_t *sim, uint32_t base, uint32_t size);
+void armsim_add_mmio(armsim_t *sim, uint32_t base, uint32_t size,
+		     armsim_read_cb read, armsim_write_cb write, void *ctx);
+
+/* host-side memory access helpers (not counted in the statistics) */
+bool armsim_write_mem(armsim_t *sim, uint32_t addr, const void *buf, size_t len);
+bool armsim_read_mem(armsim_t *sim, uint32_t addr, void *buf, size_t len);
+uint32_t armsim_readl(armsim_t *sim, uint32_t addr);
+void armsim_writel(armsim_t *sim, uint32_t addr, uint32_t value);
+
+/*
+ * Call code at "entry" (like the FEL "execute" request does): lr is set to
+ * ARMSIM_RETURN_ADDR and the simulation runs until the code returns there,
+ * or something goes wrong. "max_insns" limits the run time (0 = no limit).
+ */
+armsim_status armsim_call(armsim_t *sim, uint32_t entry, uint64_t max_insns);
+
+const char *armsim_status_str(armsim_status status);
+
+#endif /* _SUNXI_TOOLS_ARMSIM_H */
@@ -0,0 +1,552 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Simulated FEL device, see felsim.h
+ */
+#include "common.h"
+#include "portable_endian.h"
+#include "felsim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPI_FIFO_DEPTH		64
+#define SPI_REGS_SIZE		0x400
+
+/* SPI NOR flash commands, and the number of status polls they take */
+#define FLASH_PP		0x02
+#define FLASH_READ		0x03
+#define FLASH_RDSR		0x05
+#define FLASH_WREN		0x06
+#define FLASH_SE		0x20
+#define FLASH_BE		0xD8
+#define FLASH_RDID		0x9F
+#define FLASH_PAGE_SIZE		256
+#define FLASH_PP_POLLS		3
+#define FLASH_ERASE_POLLS	5
+
+typedef struct {
+	uint8_t *data;
+	bool selected;		/* chip select active, a command is running */
+	bool wel;		/* write enable latch */
+	int busy;		/* number of status polls until ready */
+	uint8_t cmd;
+	size_t count;		/* bytes since the command byte */
+	uint32_t addr;
+	uint8_t page[FLASH_PAGE_SIZE];
+} flash_model;
+
+typedef struct {
+	const soc_spi_info *info;
+	uint32_t regs[SPI_REGS_SIZE / 4];
+	uint8_t tx[SPI_FIFO_DEPTH], rx[SPI_FIFO_DEPTH];
+	size_t tx_count, rx_first, rx_count;
+	bool xch;		/* burst in progress */
+	uint32_t burst_left;
+} spi_model;
+
+struct _felusb_handle {
+	armsim_t cpu;
+	uint8_t *mmio;
+	uint32_t cp15[8][16][16][8];	/* opc1, crn, crm, opc2 */
+	uint64_t cycle_base;
+	size_t set_way_ops;
+	size_t executes;
+	bool generic_timer;
+	spi_model spi;
+	flash_model flash;
+	felsim_flash_stats flash_stats;
+};
+
+#define CP15(usb, opc1, crn, crm, opc2)	((usb)->cp15[opc1][crn][crm][opc2])
+
+/* register layout of the SPI controllers, see fel_spiflash.c */
+#define SUN4I_SPI_RXD		0x00
+#define SUN4I_SPI_TXD		0x04
+#define SUN4I_SPI_CTL		0x08
+#define SUN4I_SPI_BC		0x20
+#define SUN4I_SPI_FIFO_STA	0x28
+#define SUN4I_CTL_TF_RST	(1 << 8)
+#define SUN4I_CTL_RF_RST	(1 << 9)
+#define SUN4I_CTL_XCH		(1 << 10)
+
+#define SUN6I_SPI_GCR		0x04
+#define SUN6I_SPI_TCR		0x08
+#define SUN6I_SPI_FCR		0x18
+#define SUN6I_SPI_FIFO_STA	0x1C
+#define SUN6I_SPI_MBC		0x30
+#define SUN6I_SPI_TXD		0x200
+#define SUN6I_SPI_RXD		0x300
+#define SUN6I_GCR_SRST		(1u << 31)
+#define SUN6I_TCR_XCH		(1u << 31)
+#define SUN6I_FCR_RX_RST	(1 << 15)
+#define SUN6I_FCR_TX_RST	(1u << 31)
+
+static felusb_handle *sim_of(armsim_t *cpu)
+{
+	return container_of(cpu, felusb_handle, cpu);
+}
+
+/* SPI NOR flash */
+
+static void flash_error(felusb_handle *usb, const char *msg, uint8_t cmd)
+{
+	fprintf(stderr, "felsim: SPI flash: %s (command %02X)\n", msg, cmd);
+	usb->flash_stats.errors++;
+}
+
+static void flash_deselect(felusb_handle *usb)
+{
+	flash_model *flash = &usb->flash;
+	uint32_t base, size;
+	size_t i;
+
+	if (!flash->selected)
+		return;
+	flash->selected = false;
+	switch (flash->cmd) {
+	case FLASH_PP:
+		if (flash->count < 4)
+			return;
+		if (!flash->wel) {
+			flash_error(usb, "program without WREN", flash->cmd);
+			return;
+		}
+		base = flash->addr & ~(FLASH_PAGE_SIZE - 1) & (FELSIM_FLASH_SIZE - 1);
+		for (i = 0; i < FLASH_PAGE_SIZE; i++)
+			flash->data[base + i] &= flash->page[i];
+		usb->flash_stats.programs++;
+		flash->busy = FLASH_PP_POLLS;
+		flash->wel = false;
+		break;
+	case FLASH_SE:
+	case FLASH_BE:
+		if (flash->count != 3) {
+			flash_error(usb, "bad erase command length", flash->cmd);
+			return;
+		}
+		if (!flash->wel) {
+			flash_error(usb, "erase without WREN", flash->cmd);
+			return;
+		}
+		size = flash->cmd == FLASH_SE ? 0x1000 : 0x10000;
+		base = flash->addr & ~(size - 1) & (FELSIM_FLASH_SIZE - 1);
+		memset(flash->data + base, 0xFF, size);
+		usb->flash_stats.erases++;
+		flash->busy = FLASH_ERASE_POLLS;
+		flash->wel = false;
+		break;
+	}
+}
+
+static uint8_t flash_transfer(felusb_handle *usb, uint8_t byte)
+{
+	static const uint8_t id[3] = {
+		(FELSIM_FLASH_ID >> 16) & 0xFF, (FELSIM_FLASH_ID >> 8) & 0xFF,
+		FELSIM_FLASH_ID & 0xFF
+	};
+	flash_model *flash = &usb->flash;
+	size_t n;
+
+	usb->flash_stats.bytes++;
+	if (!flash->selected) {
+		flash->selected = true;
+		flash->cmd = byte;
+		flash->count = 0;
+		flash->addr = 0;
+		memset(flash->page, 0xFF, sizeof(flash->page));
+		if (flash->busy && byte != FLASH_RDSR)
+			flash_error(usb, "command while busy", byte);
+		if (byte == FLASH_WREN)
+			flash->wel = true;
+		return 0xFF;
+	}
+
+	n = ++flash->count;
+	switch (flash->cmd) {
+	case FLASH_RDID:
+		return n <= sizeof(id) ? id[n - 1] : 0xFF;
+	case FLASH_RDSR:
+		if (!flash->busy)
+			return flash->wel << 1;
+		flash->busy--;
+		return 1 | flash->wel << 1;
+	case FLASH_READ:
+	case FLASH_PP:
+	case FLASH_SE:
+	case FLASH_BE:
+		if (n <= 3) {
+			flash->addr = flash->addr << 8 | byte;
+			return 0xFF;
+		}
+		if (flash->cmd == FLASH_READ)
+			return flash->data[flash->addr++ & (FELSIM_FLASH_SIZE - 1)];
+		if (flash->cmd == FLASH_PP)
+			flash->page[(flash->addr + n - 4) % FLASH_PAGE_SIZE] = byte;
+		break;
+	}
+	return 0xFF;
+}
+
+/* SPI controller */
+
+static void spi_shift_byte(felusb_handle *usb, uint8_t byte)
+{
+	spi_model *spi = &usb->spi;
+
+	if (spi->rx_count >= SPI_FIFO_DEPTH) {
+		fprintf(stderr, "felsim: SPI RX FIFO overflow\n");
+		usb->flash_stats.errors++;
+	} else {
+		spi->rx[(spi->rx_first + spi->rx_count++) % SPI_FIFO_DEPTH] =
+			flash_transfer(usb, byte);
+	}
+	if (--spi->burst_left == 0) {
+		spi->xch = false;
+		flash_deselect(usb);
+	}
+}
+
+static void spi_start_burst(felusb_handle *usb)
+{
+	spi_model *spi = &usb->spi;
+	size_t i;
+
+	spi->burst_left = spi->regs[(spi->info->sun6i ? SUN6I_SPI_MBC
+						      : SUN4I_SPI_BC) / 4];
+	if (spi->burst_left == 0)
+		return;
+	spi->xch = true;
+	for (i = 0; i < spi->tx_count && spi->xch; i++)
+		spi_shift_byte(usb, spi->tx[i]);
+	spi->tx_count = 0;
+}
+
+static void spi_reset_fifos(spi_model *spi)
+{
+	spi->tx_count = spi->rx_first = spi->rx_count = 0;
+}
+
+static uint32_t spi_read(felusb_handle *usb, uint32_t offset)
+{
+	spi_model *spi = &usb->spi;
+	bool sun6i = spi->info->sun6i;
+	uint32_t value;
+
+	if (offset == (sun6i ? SUN6I_SPI_RXD : SUN4I_SPI_RXD)) {
+		if (spi->rx_count == 0) {
+			fprintf(stderr, "felsim: SPI RX FIFO underflow\n");
+			usb->flash_stats.errors++;
+			return 0;
+		}
+		value = spi->rx[spi->rx_first];
+		spi->rx_first = (spi->rx_first + 1) % SPI_FIFO_DEPTH;
+		spi->rx_count--;
+		return value;
+	}
+	if (offset == (sun6i ? SUN6I_SPI_FIFO_STA : SUN4I_SPI_FIFO_STA))
+		return spi->rx_count | spi->tx_count << 16;
+	value = spi->regs[offset / 4];
+	if (sun6i && offset == SUN6I_SPI_TCR)
+		return spi->xch ? value | SUN6I_TCR_XCH : value;
+	if (!sun6i && offset == SUN4I_SPI_CTL)
+		return spi->xch ? value | SUN4I_CTL_XCH : value;
+	return value;
+}
+
+static void spi_write(felusb_handle *usb, uint32_t offset, uint32_t value)
+{
+	spi_model *spi = &usb->spi;
+	bool sun6i = spi->info->sun6i;
+
+	if (offset == (sun6i ? SUN6I_SPI_TXD : SUN4I_SPI_TXD)) {
+		if (spi->xch) {
+			spi_shift_byte(usb, value);
+		} else if (spi->tx_count >= SPI_FIFO_DEPTH) {
+			fprintf(stderr, "felsim: SPI TX FIFO overflow\n");
+			usb->flash_stats.errors++;
+		} else {
+			spi->tx[spi->tx_count++] = value;
+		}
+		return;
+	}
+	if (sun6i) {
+		switch (offset) {
+		case SUN6I_SPI_GCR:
+			value &= ~SUN6I_GCR_SRST;
+			break;
+		case SUN6I_SPI_TCR:
+			spi->regs[offset / 4] = value & ~SUN6I_TCR_XCH;
+			if (value & SUN6I_TCR_XCH)
+				spi_start_burst(usb);
+			return;
+		case SUN6I_SPI_FCR:
+			if (value & (SUN6I_FCR_RX_RST | SUN6I_FCR_TX_RST))
+				spi_reset_fifos(spi);
+			value &= ~(SUN6I_FCR_RX_RST | SUN6I_FCR_TX_RST);
+			break;
+		}
+	} else if (offset == SUN4I_SPI_CTL) {
+		if (value & (SUN4I_CTL_TF_RST | SUN4I_CTL_RF_RST))
+			spi_reset_fifos(spi);
+		spi->regs[offset / 4] = value & ~(SUN4I_CTL_TF_RST |
+						  SUN4I_CTL_RF_RST |
+						  SUN4I_CTL_XCH);
+		if (value & SUN4I_CTL_XCH)
+			spi_start_burst(usb);
+		return;
+	}
+	spi->regs[offset / 4] = value;
+}
+
+/* MMIO: plain registers, except for the SPI controller */
+
+static bool is_spi(felusb_handle *usb, uint32_t addr)
+{
+	const soc_spi_info *info = usb->spi.info;
+	return info && addr >= info->base && addr - info->base < SPI_REGS_SIZE;
+}
+
+static uint32_t mmio_read(armsim_t *cpu, void *ctx, uint32_t addr, int size)
+{
+	felusb_handle *usb = ctx;
+	uint32_t value = 0;
+
+	(void)cpu;
+	if (is_spi(usb, addr))
+		return spi_read(usb, addr - usb->spi.info->base);
+	memcpy(&value, usb->mmio + (addr - FELSIM_MMIO_BASE), size);
+	return le32toh(value);
+}
+
+static void mmio_write(armsim_t *cpu, void *ctx, uint32_t addr,
+		       uint32_t value, int size)
+{
+	felusb_handle *usb = ctx;
+
+	(void)cpu;
+	if (is_spi(usb, addr)) {
+		spi_write(usb, addr - usb->spi.info->base, value);
+		return;
+	}
+	value = htole32(value);
+	memcpy(usb->mmio + (addr - FELSIM_MMIO_BASE), &value, size);
+}
+
+/* CP15 */
+
+#define PMCR_E			(1 << 0)
+#define PMCR_C			(1 << 2)
+#define PMU_CYCLE_COUNTER	(1u << 31)
+#define TIMER_FREQ		24000000
+#define TIMER_INSNS_PER_TICK	16
+
+/* a 32 KiB L1 (4-way) and a 256 KiB L2 (8-way) data cache, 64-byte lines */
+#define CLIDR_VALUE		(2 << 24 | 4 << 3 | 3)
+#define CCSIDR_L1D		(127 << 13 | 3 << 3 | 2)
+#define CCSIDR_L2		(511 << 13 | 7 << 3 | 2)
+
+static uint32_t cp_read(armsim_t *cpu, int cp, int opc1, int crn, int crm,
+			int opc2)
+{
+	felusb_handle *usb = sim_of(cpu);
+
+	if (cp != 15)
+		return 0;
+	if (opc1 == 1 && crn == 0 && crm == 0 && opc2 == 0) /* CCSIDR */
+		return CP15(usb, 2, 0, 0, 0) == 0 ? CCSIDR_L1D : CCSIDR_L2;
+	if (opc1 == 1 && crn == 0 && crm == 0 && opc2 == 1)
+		return CLIDR_VALUE;
+	if (opc1 == 0 && crn == 0 && crm == 1 && opc2 == 1) /* ID_PFR1 */
+		return 0x11 | (usb->generic_timer ? 1 << 16 : 0);
+	if (opc1 == 0 && crn == 9 && crm == 13 && opc2 == 0) { /* PMCCNTR */
+		if (!(CP15(usb, 0, 9, 12, 0) & PMCR_E)
+		    || !(CP15(usb, 0, 9, 12, 1) & PMU_CYCLE_COUNTER))
+			return 0;
+		return cpu->insns - usb->cycle_base;
+	}
+	if (opc1 == 0 && crn == 14 && crm == 0 && opc2 == 0) /* CNTFRQ */
+		return usb->generic_timer ? TIMER_FREQ : 0;
+	return CP15(usb, opc1, crn, crm, opc2);
+}
+
+static void cp_write(armsim_t *cpu, int cp, int opc1, int crn, int crm,
+		     int opc2, uint32_t value)
+{
+	felusb_handle *usb = sim_of(cpu);
+
+	if (cp != 15)
+		return;
+	if (opc1 == 0 && crn == 7 && (crm == 6 || crm == 14) && opc2 == 2) {
+		usb->set_way_ops++; /* DCISW, DCCISW */
+		return;
+	}
+	if (opc1 == 0 && crn == 9 && crm == 12) {
+		switch (opc2) {
+		case 0: /* PMCR */
+			if (value & PMCR_C)
+				usb->cycle_base = cpu->insns;
+			value &= ~(PMCR_C | 2);
+			break;
+		case 1: /* PMCNTENSET */
+			value |= CP15(usb, 0, 9, 12, 1);
+			break;
+		case 2: /* PMCNTENCLR */
+			CP15(usb, 0, 9, 12, 1) &= ~value;
+			return;
+		case 3: /* PMOVSR */
+			value = CP15(usb, 0, 9, 12, 3) & ~value;
+			break;
+		}
+	}
+	CP15(usb, opc1, crn, crm, opc2) = value;
+}
+
+static uint64_t cp_read64(armsim_t *cpu, int cp, int opc1, int crm)
+{
+	felusb_handle *usb = sim_of(cpu);
+
+	if (cp == 15 && opc1 == 0 && crm == 14 && usb->generic_timer)
+		return cpu->insns / TIMER_INSNS_PER_TICK; /* CNTPCT */
+	return 0;
+}
+
+/* device setup */
+
+feldev_handle *felsim_open(uint32_t soc_id)
+{
+	feldev_handle *dev = calloc(1, sizeof(feldev_handle));
+	felusb_handle *usb = calloc(1, sizeof(felusb_handle));
+
+	if (!dev || !usb)
+		pr_fatal("felsim: out of memory\n");
+	dev->usb = usb;
+	dev->soc_version.soc_id = soc_id;
+	get_soc_name_from_id(dev->soc_name, soc_id);
+	dev->soc_info = get_soc_info_from_id(soc_id);
+
+	armsim_init(&usb->cpu);
+	usb->cpu.cp_read = cp_read;
+	usb->cpu.cp_write = cp_write;
+	usb->cpu.cp_read64 = cp_read64;
+	usb->mmio = calloc(1, FELSIM_MMIO_SIZE);
+	usb->flash.data = malloc(FELSIM_FLASH_SIZE);
+	if (!usb->mmio || !usb->flash.data
+	    || !armsim_add_ram(&usb->cpu, 0, FELSIM_SRAM_SIZE)
+	    || !armsim_add_ram(&usb->cpu, FELSIM_DRAM_BASE, FELSIM_DRAM_SIZE))
+		pr_fatal("felsim: out of memory\n");
+	armsim_add_mmio(&usb->cpu, FELSIM_MMIO_BASE, FELSIM_MMIO_SIZE,
+			mmio_read, mmio_write, usb);
+	memset(usb->flash.data, 0xFF, FELSIM_FLASH_SIZE);
+	usb->spi.info = dev->soc_info->spi;
+
+	CP15(usb, 0, 1, 0, 0) = 0x00C50078; /* SCTLR, MMU and caches off */
+	return dev;
+}
+
+void felsim_close(feldev_handle *dev)
+{
+	armsim_free(&dev->usb->cpu);
+	free(dev->usb->flash.data);
+	free(dev->usb->mmio);
+	free(dev->usb);
+	free(dev);
+}
+
+armsim_t *felsim_cpu(feldev_handle *dev)
+{
+	return &dev->usb->cpu;
+}
+
+uint8_t *felsim_flash(feldev_handle *dev)
+{
+	return dev->usb->flash.data;
+}
+
+felsim_flash_stats felsim_get_flash_stats(feldev_handle *dev)
+{
+	return dev->usb->flash_stats;
+}
+
+uint32_t *felsim_cp15(feldev_handle *dev, int opc1, int crn, int crm, int opc2)
+{
+	return &CP15(dev->usb, opc1, crn, crm, opc2);
+}
+
+size_t felsim_set_way_ops(feldev_handle *dev)
+{
+	return dev->usb->set_way_ops;
+}
+
+size_t felsim_executes(feldev_handle *dev)
+{
+	return dev->usb->executes;
+}
+
+void felsim_set_generic_timer(feldev_handle *dev, bool present)
+{
+	dev->usb->generic_timer = present;
+}
+
+/* the fel_lib.h functions */
+
+int aw_fel_read(feldev_handle *dev, uint32_t offset, void *buf, size_t len)
+{
+	if (!armsim_read_mem(&dev->usb->cpu, offset, buf, len))
+		pr_fatal("felsim: read from unmapped memory (0x%08X)\n",
+			 dev->usb->cpu.fault_addr);
+	return 0;
+}
+
+int aw_fel_write(feldev_handle *dev, void *buf, uint32_t offset, size_t len)
+{
+	if (!armsim_write_mem(&dev->usb->cpu, offset, buf, len))
+		pr_fatal("felsim: write to unmapped memory (0x%08X)\n",
+			 dev->usb->cpu.fault_addr);
+	return 0;
+}
+
+int aw_fel_execute(feldev_handle *dev, uint32_t offset)
+{
+	armsim_t *cpu = &dev->usb->cpu;
+	armsim_status status;
+
+	dev->usb->executes++;
+	cpu->r[13] = 0x7000; /* the BROM's stack, somewhere in SRAM */
+	status = armsim_call(cpu, offset, FELSIM_MAX_INSNS);
+	if (status != ARMSIM_OK)
+		pr_fatal("felsim: executing 0x%08X failed: %s (at 0x%08X)\n",
+			 offset, armsim_status_str(status), cpu->fault_addr);
+	return 0;
+}
+
+progress_t *feldev_progress(feldev_handle *dev)
+{
+	return dev->progress ? dev->progress : progress_default();
+}
+
+int fel_run_thunk(feldev_handle *dev, void *code, size_t code_size,
+		  void *result, size_t result_size)
+{
+	uint32_t scratch = dev->soc_info->scratch_addr;
+
+	aw_fel_write(dev, code, scratch, code_size);
+	aw_fel_execute(dev, scratch);
+	if (result_size > 0)
+		aw_fel_read(dev, scratch + code_size, result, result_size);
+	return 0;
+}
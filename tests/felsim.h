@@ -0,0 +1,69 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_FELSIM_H
+#define _SUNXI_TOOLS_FELSIM_H
+
+#include "fel_lib.h"
+#include "armsim.h"
+
+/*
+ * Simulated FEL device, for testing thunk code without hardware
+ *
+ * This implements the basic fel_lib.h requests, on which host code like
+ * fel_memory.c and fel_spiflash.c builds, with code uploads running in the
+ * ARM interpreter from armsim.c. The memory map consists of SRAM (the first 1 MiB), DRAM and
+ * the MMIO area, where plain registers just store the values written to
+ * them, except for the SPI0 controller: that is modelled along with a SPI
+ * NOR flash attached to it.
+ *
+ * The CP15 registers are a plain store as well, with the exception of the
+ * cache ID registers (a 32 KiB L1 and a 256 KiB L2 data cache), the set/way
+ * cache maintenance operations (counted), the cycle counter (which counts
+ * instructions) and the generic timer (one tick per 16 instructions).
+ */
+
+#define FELSIM_SRAM_SIZE	(1 << 20)
+#define FELSIM_DRAM_BASE	0x40000000
+#define FELSIM_DRAM_SIZE	(16 << 20)
+#define FELSIM_MMIO_BASE	0x01C00000
+#define FELSIM_MMIO_SIZE	(1 << 20)
+
+#define FELSIM_FLASH_ID		0xEF4015	/* Winbond W25Q16 */
+#define FELSIM_FLASH_SIZE	(2 << 20)
+
+/* maximum number of instructions for a single "execute" */
+#define FELSIM_MAX_INSNS	100000000
+
+typedef struct {
+	size_t bytes;		/* transferred over SPI */
+	size_t erases, programs;
+	size_t errors;		/* protocol violations */
+} felsim_flash_stats;
+
+feldev_handle *felsim_open(uint32_t soc_id);
+void felsim_close(feldev_handle *dev);
+
+armsim_t *felsim_cpu(feldev_handle *dev);
+uint8_t *felsim_flash(feldev_handle *dev);
+felsim_flash_stats felsim_get_flash_stats(feldev_handle *dev);
+
+/* CP15 register access, and the number of set/way operations so far */
+uint32_t *felsim_cp15(feldev_handle *dev, int opc1, int crn, int crm, int opc2);
+size_t felsim_set_way_ops(feldev_handle *dev);
+/* number of "execute" requests so far */
+size_t felsim_executes(feldev_handle *dev);
+void felsim_set_generic_timer(feldev_handle *dev, bool present);
+
+#endif /* _SUNXI_TOOLS_FELSIM_H */
@@ -8,6 +8,6 @@ TESTFILE=sunxi-boards/sys_config/a10/a10-olinuxino-lime
 FEX2BIN="../sunxi-fexc -v -q -I fex -O bin"
 
 ${FEX2BIN} ${TESTFILE}.fex ${TESTFILE}.bin
-# have bin2fex explicitly read /dev/stdin, to force use of fexc.c's "read_all()"
+# have bin2fex explicitly read /dev/stdin, to force the non-mmap path of file_load()
 cat ${TESTFILE}.bin | ${BIN2FEX} /dev/stdin > /dev/null
 rm -f ${TESTFILE}.bin
@@ -0,0 +1,97 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests for crc32.c, against known values and a bit-wise reference
+ * implementation (for all buffer alignments and tail lengths).
+ */
+#include "crc32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define expect(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static uint32_t crc32_bitwise(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	int k;
+
+	while (len--) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+static void test_known_values(void)
+{
+	expect(crc32(0, "", 0) == 0);
+	expect(crc32(0, "123456789", 9) == 0xCBF43926);
+	expect(crc32(0, "The quick brown fox jumps over the lazy dog", 43)
+	       == 0x414FA339);
+}
+
+static void test_reference(void)
+{
+	uint8_t buf[1024 + 8];
+	size_t i, offset, len;
+
+	srand(1);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+	for (offset = 0; offset < 8; offset++)
+		for (len = 0; len <= 1024; len += len < 64 ? 1 : 61)
+			expect(crc32(0, buf + offset, len)
+			       == crc32_bitwise(buf + offset, len));
+}
+
+static void test_continuation(void)
+{
+	uint8_t buf[4096];
+	uint32_t whole, crc;
+	size_t i, split;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 7 + (i >> 5);
+	whole = crc32(0, buf, sizeof(buf));
+	for (split = 0; split <= sizeof(buf); split += 333) {
+		crc = crc32(0, buf, split);
+		crc = crc32(crc, buf + split, sizeof(buf) - split);
+		expect(crc == whole);
+	}
+}
+
+int main(void)
+{
+	test_known_values();
+	test_reference();
+	test_continuation();
+	if (failures) {
+		fprintf(stderr, "%d CRC-32 test(s) failed\n", failures);
+		return 1;
+	}
+	puts("All CRC-32 tests passed");
+	return 0;
+}
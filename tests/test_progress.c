@@ -0,0 +1,211 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests for progress.c: rate smoothing, stall detection and aggregation
+ * of several transfers, with a fake clock to make them deterministic.
+ */
+#include "progress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures;
+
+#define expect(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/* relative comparison, good enough for the values below */
+static int near(double value, double expected)
+{
+	double diff = value - expected;
+	double limit = 1e-9 * (expected < 0 ? -expected : expected) + 1e-9;
+
+	return diff <= limit && -diff <= limit;
+}
+
+static double now;
+
+static double fake_clock(void)
+{
+	return now;
+}
+
+/* the last status reported to a callback, and the number of callbacks */
+static progress_status_t last;
+static unsigned int reports;
+
+static void record(const progress_status_t *status)
+{
+	last = *status;
+	reports++;
+}
+
+static void test_ewma(void)
+{
+	progress_t *p = progress_new("ewma", NULL, NULL);
+	progress_status_t st;
+	double ewma;
+
+	progress_set_clock(p, fake_clock);
+	now = 100.;
+	progress_begin(p, 1000000);
+
+	/* no complete sample yet: overall average */
+	now = 100.02;
+	progress_add(p, 20000);
+	progress_get_status(p, &st);
+	expect(near(st.elapsed, 0.02));
+	expect(near(st.rate, 20000 / 0.02));
+
+	/* the first sample (over 0.1 s) sets the average */
+	now = 100.1;
+	progress_add(p, 80000);
+	progress_get_status(p, &st);
+	expect(near(st.rate, 1e6));
+	expect(near(st.eta, 900000 / 1e6));
+
+	/* then weighted by dt / (tau + dt) */
+	now = 100.2;
+	progress_add(p, 300000);
+	ewma = 1e6 + (3e6 - 1e6) * 0.1 / (PROGRESS_RATE_TAU + 0.1);
+	progress_get_status(p, &st);
+	expect(st.done == 400000);
+	expect(near(st.rate, ewma));
+	expect(near(st.eta, 600000 / ewma));
+	expect(!st.stalled);
+
+	/* decays while idle */
+	now = 101.2;
+	progress_get_status(p, &st);
+	expect(near(st.rate, ewma * PROGRESS_RATE_TAU
+			     / (PROGRESS_RATE_TAU + 1.)));
+
+	/* and finally gets flagged as stalled, with an unknown ETA */
+	now = 100.21 + PROGRESS_STALL_TIME;
+	progress_get_status(p, &st);
+	expect(st.stalled);
+	expect(st.eta < 0);
+
+	now += 0.5;
+	progress_add(p, 600000);
+	progress_get_status(p, &st);
+	expect(!st.stalled && st.done == st.total && st.eta == 0);
+	progress_free(p);
+}
+
+static void test_aggregate(void)
+{
+	progress_t *all = progress_new(NULL, record, NULL);
+	progress_t *a = progress_new("a", NULL, all);
+	progress_t *b = progress_new("b", NULL, all);
+	progress_status_t st;
+
+	progress_set_clock(all, fake_clock);
+	progress_set_clock(a, fake_clock);
+	progress_set_clock(b, fake_clock);
+	progress_set_interval(all, 0.5);
+	reports = 0;
+
+	now = 10.;
+	progress_begin(a, 1000);
+	progress_begin(b, 3000);
+	progress_get_status(all, &st);
+	expect(st.total == 4000 && st.done == 0);
+
+	/* progress of both devices adds up, with callbacks rate-limited */
+	now = 10.1;
+	progress_add(a, 500);
+	progress_add(b, 1500);
+	expect(reports == 1);
+	expect(last.done == 500 && last.total == 4000);
+	progress_get_status(all, &st);
+	expect(st.done == 2000);
+
+	/* one device completing doesn't complete the aggregate */
+	now = 10.2;
+	progress_add(a, 500);
+	expect(reports == 1);
+	progress_get_status(a, &st);
+	expect(st.done == st.total && st.eta == 0);
+	progress_get_status(all, &st);
+	expect(st.done == 2500 && st.eta > 0);
+
+	/* another transfer may join while running */
+	progress_begin(a, 1000);
+	progress_get_status(all, &st);
+	expect(st.total == 5000 && st.done == 2500);
+
+	/* completion always gets reported */
+	now = 10.3;
+	progress_add(a, 1000);
+	progress_add(b, 1500);
+	expect(reports == 2);
+	expect(last.done == 5000 && last.total == 5000);
+	expect(near(last.elapsed, 0.3));
+	expect(last.eta == 0 && !last.stalled);
+
+	progress_free(a);
+	progress_free(b);
+	progress_free(all);
+}
+
+static void test_stall_report(void)
+{
+	progress_t *p = progress_new(NULL, record, NULL);
+
+	progress_set_clock(p, fake_clock);
+	progress_set_interval(p, 10.);
+	reports = 0;
+
+	now = 100.;
+	progress_begin(p, 100);
+	now = 100.1;
+	progress_add(p, 10);
+	expect(reports == 1);
+
+	/* a change of the stall state bypasses the interval */
+	now = 100.11 + PROGRESS_STALL_TIME;
+	progress_poll(p);
+	expect(reports == 2 && last.stalled);
+	progress_poll(p);
+	expect(reports == 2);
+
+	/* and so does a retry */
+	progress_retry(p);
+	expect(reports == 3 && last.retries == 1);
+
+	now += 0.1;
+	progress_add(p, 10);
+	expect(reports == 4 && !last.stalled);
+	progress_free(p);
+}
+
+int main(void)
+{
+	test_ewma();
+	test_aggregate();
+	test_stall_report();
+	if (failures) {
+		fprintf(stderr, "%d progress test(s) failed\n", failures);
+		return 1;
+	}
+	puts("All progress tests passed");
+	return 0;
+}
@@ -0,0 +1,365 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests for fel_sparse.c: extents from scanning plain buffers, and from
+ * (well-formed and broken) Android sparse images.
+ */
+#include "fel_sparse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define expect(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define BLK	SPARSE_BLOCK_SIZE
+#define ADDR	0x42000000
+
+/* check one extent, fill extents are given with data == NULL */
+static int extent_is(const sparse_image *img, size_t i, uint32_t addr,
+		     uint32_t size, const uint8_t *data, uint32_t value)
+{
+	const sparse_extent *ext;
+
+	if (i >= img->count)
+		return 0;
+	ext = &img->extent[i];
+	if (ext->addr != addr || ext->size != size || ext->data != data)
+		return 0;
+	return data || ext->value == value;
+}
+
+static void fill_le32(uint8_t *p, size_t len, uint32_t value)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = value >> (8 * (i & 3));
+}
+
+static void fill_random(uint8_t *p, size_t len)
+{
+	while (len--)
+		*p++ = rand();
+}
+
+static void test_scan_short(void)
+{
+	static uint8_t buf[SPARSE_MIN_FILL - 1];
+	sparse_image img;
+
+	/* constant, but too short to be worth a fill */
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, sizeof(buf), ADDR) == NULL);
+	expect(img.count == 1);
+	expect(extent_is(&img, 0, ADDR, sizeof(buf), buf, 0));
+	expect(img.data_bytes == sizeof(buf) && img.fill_bytes == 0);
+	sparse_free(&img);
+
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, 0, ADDR) == NULL);
+	expect(img.count == 0 && sparse_size(&img) == 0);
+	sparse_free(&img);
+}
+
+static void test_scan_threshold(void)
+{
+	static uint8_t buf[BLK + SPARSE_MIN_FILL + BLK];
+	sparse_image img;
+	const size_t run = SPARSE_MIN_FILL;
+
+	/* a run of exactly SPARSE_MIN_FILL bytes between two data blocks */
+	fill_random(buf, BLK);
+	fill_le32(buf + BLK, run, 0x11223344);
+	fill_random(buf + BLK + run, BLK);
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, sizeof(buf), ADDR) == NULL);
+	expect(img.count == 3);
+	expect(extent_is(&img, 0, ADDR, BLK, buf, 0));
+	expect(extent_is(&img, 1, ADDR + BLK, run, NULL, 0x11223344));
+	expect(extent_is(&img, 2, ADDR + BLK + run, BLK, buf + BLK + run, 0));
+	expect(img.data_bytes == 2 * BLK && img.fill_bytes == run);
+	sparse_free(&img);
+
+	/* one block less stays data, merged into a single extent */
+	fill_random(buf + BLK, BLK);
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, sizeof(buf), ADDR) == NULL);
+	expect(img.count == 1);
+	expect(extent_is(&img, 0, ADDR, sizeof(buf), buf, 0));
+	sparse_free(&img);
+
+	/* different patterns don't join up to a run */
+	fill_le32(buf + BLK, run / 2, 0);
+	fill_le32(buf + BLK + run / 2, run / 2, 0xFFFFFFFF);
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, sizeof(buf), ADDR) == NULL);
+	expect(img.count == 1 && img.fill_bytes == 0);
+	sparse_free(&img);
+}
+
+static void test_scan_tail(void)
+{
+	static uint8_t buf[SPARSE_MIN_FILL + BLK - 4];
+	sparse_image img;
+
+	/* constant all the way, but the partial tail block remains data */
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, sizeof(buf), ADDR) == NULL);
+	expect(img.count == 2);
+	expect(extent_is(&img, 0, ADDR, SPARSE_MIN_FILL, NULL, 0));
+	expect(extent_is(&img, 1, ADDR + SPARSE_MIN_FILL, BLK - 4,
+			 buf + SPARSE_MIN_FILL, 0));
+	expect(sparse_size(&img) == sizeof(buf));
+	sparse_free(&img);
+
+	/* no fills for unaligned target addresses */
+	sparse_init(&img);
+	expect(sparse_scan(&img, buf, sizeof(buf), ADDR + 2) == NULL);
+	expect(img.count == 1);
+	expect(extent_is(&img, 0, ADDR + 2, sizeof(buf), buf, 0));
+	sparse_free(&img);
+}
+
+/* Android sparse image construction */
+typedef struct {
+	uint8_t buf[4 * SPARSE_MIN_FILL];
+	size_t len;
+	uint32_t chunks;	/* chunk count so far */
+	uint32_t blks;		/* output blocks so far */
+} simg;
+
+/* file header fields */
+#define SIMG_FILE_HDR_SZ	8
+#define SIMG_CHUNK_HDR_SZ	10
+#define SIMG_BLK_SZ		12
+#define SIMG_TOTAL_BLKS		16
+#define SIMG_TOTAL_CHUNKS	20
+
+static void put_le16(uint8_t *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+	put_le16(p, value);
+	put_le16(p + 2, value >> 16);
+}
+
+static void simg_init(simg *s)
+{
+	memset(s, 0, sizeof(*s));
+	put_le32(s->buf, 0xED26FF3A);	/* magic */
+	put_le16(s->buf + 4, 1);	/* major version */
+	put_le16(s->buf + SIMG_FILE_HDR_SZ, 28);
+	put_le16(s->buf + SIMG_CHUNK_HDR_SZ, 12);
+	put_le32(s->buf + SIMG_BLK_SZ, BLK);
+	s->len = 28;
+}
+
+/* append a chunk, returns a pointer to its payload */
+static uint8_t *simg_chunk(simg *s, uint16_t type, uint32_t blks,
+			   uint32_t payload)
+{
+	uint8_t *chunk = s->buf + s->len;
+
+	put_le16(chunk, type);
+	put_le32(chunk + 4, blks);
+	put_le32(chunk + 8, 12 + payload);
+	s->len += 12 + payload;
+	s->blks += blks;
+	put_le32(s->buf + SIMG_TOTAL_BLKS, s->blks);
+	put_le32(s->buf + SIMG_TOTAL_CHUNKS, ++s->chunks);
+	return chunk + 12;
+}
+
+static const char *simg_parse(simg *s, sparse_image *img)
+{
+	sparse_init(img);
+	return sparse_parse_android(img, s->buf, s->len, ADDR);
+}
+
+static void test_android_chunks(void)
+{
+	static simg s;
+	sparse_image img;
+	uint8_t *raw, *fill;
+
+	simg_init(&s);
+	raw = simg_chunk(&s, 0xCAC1, 1, BLK);		/* RAW */
+	fill_random(raw, BLK);
+	fill = simg_chunk(&s, 0xCAC2, 2, 4);		/* FILL */
+	put_le32(fill, 0xDEADBEEF);
+	simg_chunk(&s, 0xCAC3, 3, 0);			/* DONT_CARE */
+	put_le32(simg_chunk(&s, 0xCAC4, 0, 4), 0);	/* CRC32 */
+	raw = simg_chunk(&s, 0xCAC1, 16, 16 * BLK);	/* constant RAW */
+	fill_le32(raw, 16 * BLK, 0x5A5A5A5A);
+	expect(is_android_sparse(s.buf, s.len));
+
+	expect(simg_parse(&s, &img) == NULL);
+	expect(img.count == 3);
+	expect(extent_is(&img, 0, ADDR, BLK, s.buf + 28 + 12, 0));
+	expect(extent_is(&img, 1, ADDR + BLK, 2 * BLK, NULL, 0xDEADBEEF));
+	/* the "don't care" blocks are skipped, constant raw data is a fill */
+	expect(extent_is(&img, 2, ADDR + 6 * BLK, 16 * BLK, NULL, 0x5A5A5A5A));
+	expect(img.data_bytes == BLK && img.fill_bytes == 18 * BLK);
+	sparse_free(&img);
+
+	/* an image without any chunks is fine too */
+	simg_init(&s);
+	expect(simg_parse(&s, &img) == NULL);
+	expect(img.count == 0);
+	sparse_free(&img);
+}
+
+static void test_android_headers(void)
+{
+	static simg s;
+	sparse_image img;
+
+	simg_init(&s);
+	expect(!is_android_sparse(s.buf, 27));
+	s.len = 27;
+	expect(simg_parse(&s, &img) != NULL);
+
+	simg_init(&s);
+	put_le16(s.buf + 4, 2);
+	expect(simg_parse(&s, &img) != NULL);
+
+	simg_init(&s);
+	expect(sparse_parse_android(&img, s.buf, s.len, ADDR + 2) != NULL);
+
+	/* header sizes too small, or exceeding the image */
+	simg_init(&s);
+	put_le16(s.buf + SIMG_FILE_HDR_SZ, 24);
+	expect(simg_parse(&s, &img) != NULL);
+	simg_init(&s);
+	put_le16(s.buf + SIMG_CHUNK_HDR_SZ, 8);
+	expect(simg_parse(&s, &img) != NULL);
+	simg_init(&s);
+	put_le16(s.buf + SIMG_FILE_HDR_SZ, 64);
+	expect(simg_parse(&s, &img) != NULL);
+
+	simg_init(&s);
+	put_le32(s.buf + SIMG_BLK_SZ, BLK + 2);
+	expect(simg_parse(&s, &img) != NULL);
+
+	simg_init(&s);
+	put_le32(s.buf + SIMG_TOTAL_BLKS, 0x100000000ULL / BLK);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+}
+
+static void test_android_broken(void)
+{
+	static simg s;
+	sparse_image img;
+
+	/* chunk header cut short */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC3, 1, 0);
+	s.len -= 4;
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	/* more chunks announced than present */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC3, 1, 0);
+	put_le32(s.buf + SIMG_TOTAL_CHUNKS, 2);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	/* chunk size beyond the end of the image, or below its header */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC1, 1, BLK);
+	s.len -= 1;
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+	simg_init(&s);
+	put_le32(simg_chunk(&s, 0xCAC3, 1, 0) - 4, 8);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	/* raw payload that doesn't match the block count */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC1, 2, BLK);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	/* fill without a pattern */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC2, 1, 0);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	/* unknown chunk type */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC5, 1, 0);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+}
+
+static void test_android_total_blks(void)
+{
+	static simg s;
+	sparse_image img;
+
+	/* chunks exceeding total_blks */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC3, 4, 0);
+	put_le32(s.buf + SIMG_TOTAL_BLKS, 3);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	/* chunks falling short of total_blks */
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC3, 4, 0);
+	put_le32(s.buf + SIMG_TOTAL_BLKS, 5);
+	expect(simg_parse(&s, &img) != NULL);
+	sparse_free(&img);
+
+	simg_init(&s);
+	simg_chunk(&s, 0xCAC3, 4, 0);
+	expect(simg_parse(&s, &img) == NULL);
+	sparse_free(&img);
+}
+
+int main(void)
+{
+	srand(1);
+	test_scan_short();
+	test_scan_threshold();
+	test_scan_tail();
+	test_android_chunks();
+	test_android_headers();
+	test_android_broken();
+	test_android_total_blks();
+	if (failures) {
+		fprintf(stderr, "%d sparse test(s) failed\n", failures);
+		return 1;
+	}
+	puts("All sparse tests passed");
+	return 0;
+}
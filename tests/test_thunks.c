@@ -0,0 +1,624 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tests for the thunk code from thunks/ and fel_memory.c, run on a
+ * simulated FEL device
+ *
+ * Each test reports the number of instructions executed and memory words
+ * accessed by the ARM code, as a simple cost model for the thunks.
+ */
+#include "common.h"
+#include "portable_endian.h"
+#include "fel_dump.h"
+#include "fel_spiflash.h"
+#include "felsim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t fill_thunk[] = {
+	#include "thunks/fill.h"
+};
+static const uint32_t scatter_thunk[] = {
+	#include "thunks/scatter.h"
+};
+static const uint32_t memsearch_thunk[] = {
+	#include "thunks/memsearch.h"
+};
+static const uint32_t mmu_tt_thunk[] = {
+	#include "thunks/mmu_tt.h"
+};
+static const uint32_t timed_call_thunk[] = {
+	#include "thunks/timed_call.h"
+};
+static const uint32_t cache_clean_thunk[] = {
+	#include "thunks/cache_clean.h"
+};
+static const uint32_t dump_compress_thunk[] = {
+	#include "thunks/dump_compress.h"
+};
+
+#define DRAM		FELSIM_DRAM_BASE
+
+static int failures;
+
+#define expect(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/* statistics of the simulated CPU at the start of a test */
+static armsim_t start;
+
+static void test_start(feldev_handle *dev)
+{
+	start = *felsim_cpu(dev);
+}
+
+static void test_report(feldev_handle *dev, const char *name)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+
+	printf("%-24s %9llu insns %9llu loads %9llu stores\n", name,
+	       (unsigned long long)(cpu->insns - start.insns),
+	       (unsigned long long)(cpu->loads - start.loads),
+	       (unsigned long long)(cpu->stores - start.stores));
+}
+
+/*
+ * Upload the thunk code followed by "count" parameter words, run it and
+ * read back the parameter area (which holds the results for most thunks).
+ */
+static void run_thunk(feldev_handle *dev, const uint32_t *code, size_t size,
+		      uint32_t *params, size_t count)
+{
+	uint32_t addr = dev->soc_info->scratch_addr;
+	size_t words = size / sizeof(uint32_t), i;
+	uint32_t buf[words + count];
+
+	for (i = 0; i < words; i++)
+		buf[i] = htole32(code[i]);
+	for (i = 0; i < count; i++)
+		buf[words + i] = htole32(params[i]);
+	aw_fel_write(dev, buf, addr, sizeof(buf));
+	aw_fel_execute(dev, addr);
+	aw_fel_read(dev, addr + size, buf, count * sizeof(uint32_t));
+	for (i = 0; i < count; i++)
+		params[i] = le32toh(buf[i]);
+}
+
+static void fill_pattern(uint8_t *buf, size_t len, uint32_t seed)
+{
+	while (len-- > 0) {
+		seed = seed * 1103515245 + 12345;
+		*buf++ = seed >> 16;
+	}
+}
+
+static void test_fill(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	uint32_t params[] = {
+		DRAM, 4096 + 12, 0xDEADBEEF,
+		DRAM + 0x2000, 4, 0x12345678,
+		0, 0, 0
+	};
+
+	armsim_writel(cpu, DRAM + 4096 + 12, 0x55555555);
+	armsim_writel(cpu, DRAM + 0x2004, 0x55555555);
+	test_start(dev);
+	run_thunk(dev, fill_thunk, sizeof(fill_thunk), params, ARRAY_SIZE(params));
+	test_report(dev, "fill");
+
+	expect(armsim_readl(cpu, DRAM) == 0xDEADBEEF);
+	expect(armsim_readl(cpu, DRAM + 4096 + 8) == 0xDEADBEEF);
+	expect(armsim_readl(cpu, DRAM + 4096 + 12) == 0x55555555);
+	expect(armsim_readl(cpu, DRAM + 0x2000) == 0x12345678);
+	expect(armsim_readl(cpu, DRAM + 0x2004) == 0x55555555);
+}
+
+static void test_scatter(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	uint8_t data[256], buf[256];
+	uint32_t params[] = {
+		DRAM + 0x10000, DRAM + 0x20000, 128,		/* aligned */
+		DRAM + 0x10081, DRAM + 0x21003, 13,		/* unaligned */
+		0, 0, 0
+	};
+
+	fill_pattern(data, sizeof(data), 1);
+	armsim_write_mem(cpu, DRAM + 0x10000, data, sizeof(data));
+	test_start(dev);
+	run_thunk(dev, scatter_thunk, sizeof(scatter_thunk),
+		  params, ARRAY_SIZE(params));
+	test_report(dev, "scatter");
+
+	armsim_read_mem(cpu, DRAM + 0x20000, buf, 128);
+	expect(memcmp(buf, data, 128) == 0);
+	armsim_read_mem(cpu, DRAM + 0x21003, buf, 13);
+	expect(memcmp(buf, data + 0x81, 13) == 0);
+	expect((armsim_readl(cpu, DRAM + 0x21000) & 0xFFFFFF) == 0);
+	expect(armsim_readl(cpu, DRAM + 0x21010) == 0);
+}
+
+static void test_memsearch(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	uint32_t params[22 + 8];
+	uint8_t *pattern = (uint8_t *)(params + 4);
+	uint8_t *mask = (uint8_t *)(params + 12);
+	int masked;
+
+	armsim_write_mem(cpu, DRAM + 0x30000 + 100, "sunxi", 5);
+	armsim_write_mem(cpu, DRAM + 0x30000 + 3000, "SUNXI", 5);
+	armsim_write_mem(cpu, DRAM + 0x30000 + 8187, "sunxi", 5);
+
+	/* plain search, then ignoring the case (bit 5) */
+	for (masked = 0; masked <= 1; masked++) {
+		memset(params, 0, sizeof(params));
+		params[0] = DRAM + 0x30000;
+		params[1] = 8192;
+		params[2] = 5;
+		params[3] = 8;
+		memcpy(pattern, masked ? "SUNXI" : "sunxi", 5);
+		memset(mask, masked ? 0xDF : 0xFF, 32);
+
+		/* the parameter words get converted, the bytes shouldn't */
+		for (size_t i = 4; i < 20; i++)
+			params[i] = le32toh(params[i]);
+		test_start(dev);
+		run_thunk(dev, memsearch_thunk, sizeof(memsearch_thunk),
+			  params, ARRAY_SIZE(params));
+		test_report(dev, masked ? "memsearch (masked)" : "memsearch");
+
+		expect(params[20] == (masked ? 3u : 2u));
+		expect(params[21] == DRAM + 0x30000 + 8192 - 5 + 1);
+		expect(params[22] == DRAM + 0x30000 + 100);
+		expect(params[23] == DRAM + 0x30000 + (masked ? 3000 : 8187));
+		if (masked)
+			expect(params[24] == DRAM + 0x30000 + 8187);
+	}
+}
+
+static void test_mmu_tt(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	uint32_t table = DRAM + 0x100000;
+	uint32_t params[] = {
+		table, 3, 1,
+		0x400, 0x400, 0x0000700C, 0x00001000,
+	};
+
+	test_start(dev);
+	run_thunk(dev, mmu_tt_thunk, sizeof(mmu_tt_thunk),
+		  params, ARRAY_SIZE(params));
+	test_report(dev, "mmu_tt (generate)");
+	expect(params[0] == 0);
+	expect(armsim_readl(cpu, table) == 0x00000DE2);
+	expect(armsim_readl(cpu, table + 0x3FF * 4) == 0x3FF00DE2);
+	expect(armsim_readl(cpu, table + 0x400 * 4) == 0x40001DE2);
+	expect(armsim_readl(cpu, table + 0x7FF * 4) == 0x7FF01DE2);
+	expect(armsim_readl(cpu, table + 0x800 * 4) == 0x80000DE2);
+
+	/* checking only, the table is fine */
+	params[0] = table;
+	params[1] = 2;
+	params[2] = 0;
+	test_start(dev);
+	run_thunk(dev, mmu_tt_thunk, sizeof(mmu_tt_thunk), params, 3);
+	test_report(dev, "mmu_tt (check)");
+	expect(params[0] == 0);
+
+	/* a wrong mapping, then a page table entry */
+	armsim_writel(cpu, table + 5 * 4, 0x00600DE2);
+	params[0] = table;
+	params[1] = 2;
+	run_thunk(dev, mmu_tt_thunk, sizeof(mmu_tt_thunk), params, 3);
+	expect(params[0] == 2 && params[1] == 5);
+
+	armsim_writel(cpu, table + 5 * 4, 0x00500DE2);
+	armsim_writel(cpu, table + 7 * 4, 0x40000001);
+	params[0] = table;
+	params[1] = 2;
+	run_thunk(dev, mmu_tt_thunk, sizeof(mmu_tt_thunk), params, 3);
+	expect(params[0] == 1 && params[1] == 7);
+}
+
+static void test_timed_call(feldev_handle *dev)
+{
+	/* a function counting down from 1000, setting a flag when done */
+	static const uint32_t func[] = {
+		0xe3a00ffa, /* mov  r0, #1000      */
+		0xe2500001, /* subs r0, r0, #1     */
+		0x1afffffd, /* bne  <loop>         */
+		0xe3a01001, /* mov  r1, #1         */
+		0xe5821000, /* str  r1, [r2]       */
+		0xe12fff1e, /* bx   lr             */
+	};
+	armsim_t *cpu = felsim_cpu(dev);
+	uint32_t code = DRAM + 0x200000;
+	uint32_t params[7];
+	int timer;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(func); i++)
+		armsim_writel(cpu, code + i * 4, func[i]);
+
+	for (timer = 0; timer <= 1; timer++) {
+		felsim_set_generic_timer(dev, timer);
+		armsim_writel(cpu, DRAM, 0);
+		cpu->r[2] = DRAM; /* passed through by the thunk */
+		memset(params, 0, sizeof(params));
+		params[0] = code;
+		test_start(dev);
+		run_thunk(dev, timed_call_thunk, sizeof(timed_call_thunk),
+			  params, ARRAY_SIZE(params));
+		test_report(dev, timer ? "timed_call (timer)" : "timed_call");
+
+		/* the cycle counter counts instructions */
+		expect(params[1] >= 2 * 1000 + 4 && params[1] < 2 * 1000 + 32);
+		expect(params[2] == 0);
+		expect(!!params[6] == timer);
+		if (timer) {
+			expect(params[3] >= params[1] / 16 - 2);
+			expect(params[3] <= params[1] / 16 + 2);
+			expect(params[4] == 0);
+			expect(params[5] == 24000000);
+		}
+	}
+}
+
+static void test_cache_clean(feldev_handle *dev)
+{
+	uint32_t *sctlr = felsim_cp15(dev, 0, 1, 0, 0);
+	/* set/way operations for a 4-way 32 KiB L1 and 8-way 256 KiB L2 */
+	size_t expected = 128 * 4 + 512 * 8;
+	size_t ops = felsim_set_way_ops(dev);
+	uint32_t flags;
+
+	*sctlr |= 1 << 2;
+	flags = 1; /* CACHE_DISABLE */
+	test_start(dev);
+	run_thunk(dev, cache_clean_thunk, sizeof(cache_clean_thunk), &flags, 1);
+	test_report(dev, "cache_clean");
+	expect(felsim_set_way_ops(dev) - ops == expected);
+	expect(!(*sctlr & (1 << 2)));
+
+	*sctlr |= 1 << 2;
+	ops = felsim_set_way_ops(dev);
+	flags = 2; /* CACHE_INVALIDATE_ONLY */
+	run_thunk(dev, cache_clean_thunk, sizeof(cache_clean_thunk), &flags, 1);
+	expect(felsim_set_way_ops(dev) - ops == expected);
+	expect(*sctlr & (1 << 2));
+	*sctlr &= ~(1 << 2);
+}
+
+static void test_dump_compress(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	const size_t size = 64 * 1024;
+	const uint32_t input = DRAM + 0x300000, stage = DRAM + 0x400000;
+	const int hash_bits = 10;
+	uint8_t *data = malloc(size), *out = malloc(2 * size);
+	uint32_t *result = malloc(size);
+	uint32_t params[6];
+	size_t i, out_size;
+
+	if (!data || !out || !result)
+		pr_fatal("out of memory\n");
+	/* some random data, a zero run and a repeated pattern */
+	fill_pattern(data, size, 2);
+	memset(data + 0x1000, 0, 0x3000);
+	for (i = 0x8000; i < 0xC000; i++)
+		data[i] = data[i - 0x400];
+	armsim_write_mem(cpu, input, data, size);
+
+	params[0] = input;
+	params[1] = input + size;
+	params[2] = stage + (4 << hash_bits);
+	params[3] = params[2] + 2 * size;
+	params[4] = stage;
+	params[5] = 32 - hash_bits;
+	test_start(dev);
+	run_thunk(dev, dump_compress_thunk, sizeof(dump_compress_thunk),
+		  params, ARRAY_SIZE(params));
+	test_report(dev, "dump_compress");
+
+	expect(params[0] == input + size);
+	out_size = params[2] - (stage + (4 << hash_bits));
+	expect(out_size < size * 3 / 4);
+	armsim_read_mem(cpu, stage + (4 << hash_bits), out, out_size);
+	expect(dump_decompress((uint32_t *)out, out_size / 4, result, size / 4));
+	expect(memcmp(result, data, size) == 0);
+	/* truncated, or with the size of the result not matching */
+	expect(!dump_decompress((uint32_t *)out, out_size / 4 - 1,
+				result, size / 4));
+	expect(!dump_decompress((uint32_t *)out, out_size / 4,
+				result, size / 4 - 1));
+	expect(!dump_decompress((uint32_t *)out, out_size / 4,
+				result, size / 4 + 1));
+
+	free(result);
+	free(out);
+	free(data);
+}
+
+/* malformed dump_compress output gets rejected */
+static void test_dump_decompress(void)
+{
+	uint32_t out[8];
+	const uint32_t run[] = { htole32(DUMP_TOKEN_RUN << 30 | 8), 5 };
+	const uint32_t no_value[] = { htole32(DUMP_TOKEN_RUN << 30 | 8) };
+	const uint32_t too_far[] = {
+		htole32(DUMP_TOKEN_LITERAL << 30 | 1), 7,
+		htole32(DUMP_TOKEN_MATCH << 30 | 7), htole32(2) };
+	const uint32_t overlap[] = {
+		htole32(DUMP_TOKEN_LITERAL << 30 | 1), 7,
+		htole32(DUMP_TOKEN_MATCH << 30 | 7), htole32(1) };
+	const uint32_t bad_type[] = { htole32(3u << 30 | 8) };
+
+	expect(dump_decompress(run, 2, out, 8) && out[7] == 5);
+	expect(!dump_decompress(no_value, 1, out, 8));
+	expect(!dump_decompress(too_far, 4, out, 8));
+	expect(dump_decompress(overlap, 4, out, 8) && out[7] == 7);
+	expect(!dump_decompress(bad_type, 1, out, 8));
+}
+
+static void test_readl_writel(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	const uint32_t addr = DRAM + 0x500000;
+	const uint32_t guard = dev->soc_info->scratch_addr + FEL_SCRATCH_SIZE;
+	uint32_t data[600], buf[600];	/* more than a single thunk handles */
+	size_t i;
+
+	fill_pattern((uint8_t *)data, sizeof(data), 4);
+	armsim_writel(cpu, guard, 0xA5A5A5A5);
+	test_start(dev);
+	fel_writel_n(dev, addr, data, ARRAY_SIZE(data));
+	test_report(dev, "writel_n");
+	for (i = 0; i < ARRAY_SIZE(data); i++)
+		expect(armsim_readl(cpu, addr + i * 4) == data[i]);
+
+	test_start(dev);
+	fel_readl_n(dev, addr, buf, ARRAY_SIZE(buf));
+	test_report(dev, "readl_n");
+	expect(memcmp(buf, data, sizeof(data)) == 0);
+	expect(armsim_readl(cpu, guard) == 0xA5A5A5A5);
+
+	armsim_writel(cpu, addr, 0xF0F0F0F0);
+	fel_clrsetbits_le32(dev, addr, 0xFF, 0x03);
+	expect(armsim_readl(cpu, addr) == 0xF0F0F003);
+}
+
+static void test_memmove(feldev_handle *dev)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	const uint32_t addr = DRAM + 0x600000;
+	/* overlapping moves up and down, aligned and unaligned */
+	static const struct { uint32_t dst, src, size; } moves[] = {
+		{ 0x108, 0x100, 200 }, { 0x105, 0x100, 201 },
+		{ 0x0F8, 0x100, 200 }, { 0x0FD, 0x102, 199 },
+	};
+	uint8_t mem[0x300], buf[0x300];
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(moves); i++) {
+		fill_pattern(mem, sizeof(mem), 5 + i);
+		armsim_write_mem(cpu, addr, mem, sizeof(mem));
+		fel_memmove(dev, addr + moves[i].dst, addr + moves[i].src,
+			    moves[i].size);
+		memmove(mem + moves[i].dst, mem + moves[i].src, moves[i].size);
+		armsim_read_mem(cpu, addr, buf, sizeof(buf));
+		expect(memcmp(buf, mem, sizeof(mem)) == 0);
+	}
+}
+
+/* expected number of thunk runs for a fill / scatter list */
+static size_t batches(feldev_handle *dev, size_t thunk_size, size_t count)
+{
+	size_t max_words = fel_scratch_size(dev) / sizeof(uint32_t);
+	size_t per_batch = (max_words - thunk_size / sizeof(uint32_t)) / 3 - 1;
+
+	return (count + per_batch - 1) / per_batch;
+}
+
+/* fill and scatter lists, batched by the (default or tuned) scratch size */
+static void test_extent_batches(feldev_handle *dev, uint32_t scratch_size)
+{
+	armsim_t *cpu = felsim_cpu(dev);
+	const size_t count = 300;
+	const uint32_t fill = DRAM + 0x700000, src = DRAM + 0x800000;
+	const uint32_t dst = DRAM + 0x900000;
+	uint32_t guard;
+	fel_fill_extent *extents = calloc(count, sizeof(*extents));
+	fel_scatter_entry *entries = calloc(count, sizeof(*entries));
+	uint8_t data[16], buf[16];
+	size_t i, executes;
+
+	if (!extents || !entries)
+		pr_fatal("out of memory\n");
+	dev->soc_info->tuning.scratch_size = scratch_size;
+	guard = dev->soc_info->scratch_addr + fel_scratch_size(dev);
+	armsim_writel(cpu, guard, 0xA5A5A5A5);
+
+	for (i = 0; i < count; i++) {
+		extents[i].addr = fill + i * 16;
+		extents[i].size = 8;
+		extents[i].value = 0x01010101 * (i + 1);
+		armsim_writel(cpu, fill + i * 16 + 8, 0x55555555);
+	}
+	executes = felsim_executes(dev);
+	test_start(dev);
+	fel_fill_extents(dev, extents, count);
+	test_report(dev, scratch_size ? "fill_extents (tuned)"
+				      : "fill_extents");
+	expect(felsim_executes(dev) - executes
+	       == batches(dev, sizeof(fill_thunk), count));
+	for (i = 0; i < count; i++) {
+		expect(armsim_readl(cpu, fill + i * 16) == extents[i].value);
+		expect(armsim_readl(cpu, fill + i * 16 + 4)
+		       == extents[i].value);
+		expect(armsim_readl(cpu, fill + i * 16 + 8) == 0x55555555);
+	}
+
+	/* move 13 byte blocks to unaligned destinations */
+	for (i = 0; i < count; i++) {
+		fill_pattern(data, sizeof(data), 100 + i);
+		armsim_write_mem(cpu, src + i * 16, data, sizeof(data));
+		entries[i].src = src + i * 16;
+		entries[i].dst = dst + i * 16 + 1;
+		entries[i].size = 13;
+	}
+	executes = felsim_executes(dev);
+	test_start(dev);
+	fel_scatter(dev, entries, count);
+	test_report(dev, scratch_size ? "scatter list (tuned)"
+				      : "scatter list");
+	expect(felsim_executes(dev) - executes
+	       == batches(dev, sizeof(scatter_thunk), count));
+	for (i = 0; i < count; i++) {
+		fill_pattern(data, sizeof(data), 100 + i);
+		armsim_read_mem(cpu, dst + i * 16 + 1, buf, 13);
+		expect(memcmp(buf, data, 13) == 0);
+	}
+
+	expect(armsim_readl(cpu, guard) == 0xA5A5A5A5);
+	dev->soc_info->tuning.scratch_size = 0;
+	free(entries);
+	free(extents);
+}
+
+/* load a tuning file with the given contents, returns soc_tuning_load() */
+static int load_tuning(feldev_handle *dev, const char *contents)
+{
+	char name[] = "/tmp/test_thunks-XXXXXX";
+	int fd = mkstemp(name), rc;
+	FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+
+	if (!f)
+		pr_fatal("failed to create tuning file\n");
+	fprintf(f, "soc 0x%04X\n%s", dev->soc_info->soc_id, contents);
+	fclose(f);
+	rc = soc_tuning_load(name, dev->soc_info);
+	remove(name);
+	return rc;
+}
+
+static void test_tuning(feldev_handle *dev)
+{
+	soc_info_t *soc_info = dev->soc_info;
+	uint32_t limit = soc_scratch_limit(soc_info);
+	uint32_t chunk, timeout;
+
+	/* the defaults: 512 KiB chunks at 64 KiB/s, plus 2 seconds */
+	soc_tuning_transfer(NULL, &chunk, &timeout);
+	expect(chunk == 512 * 1024 && timeout == 10000);
+	soc_tuning_transfer(soc_info, &chunk, &timeout);
+	expect(chunk == 512 * 1024 && timeout == 10000);
+
+	expect(load_tuning(dev, "bulk_chunk 65536\nupload_rate 1048576\n") == 1);
+	soc_tuning_transfer(soc_info, &chunk, &timeout);
+	expect(chunk == 65536 && timeout == 62 + 2000);
+
+	/* values beyond the limits get rejected (with a message on stderr) */
+	expect(limit > FEL_SCRATCH_SIZE);
+	expect(load_tuning(dev, "bulk_chunk 0x100000\n") < 0);
+	expect(soc_info->tuning.bulk_chunk == 65536);
+	expect(load_tuning(dev, "scratch_size 0x10000\n") < 0);
+	expect(load_tuning(dev, "scratch_size 0x402\n") < 0);
+	expect(soc_info->tuning.scratch_size == 0);
+	expect(load_tuning(dev, "scratch_size 0x800\n") == 1);
+	expect(fel_scratch_size(dev) == 0x800);
+
+	soc_info->tuning = (soc_tuning){ 0 };
+}
+
+static void test_spiflash(feldev_handle *dev, const char *name)
+{
+	const size_t size = 100000;
+	const uint32_t offset = 0x1234;
+	uint8_t *flash = felsim_flash(dev);
+	uint8_t *data = malloc(size), *buf = malloc(size);
+	spiflash_t *spi;
+	spiflash_stats stats;
+
+	if (!data || !buf)
+		pr_fatal("out of memory\n");
+	fill_pattern(data, size, 3);
+	spi = spiflash_open(dev, DRAM + 0x800000, 0x100000);
+	expect(spiflash_id(spi) == FELSIM_FLASH_ID);
+	expect(spiflash_size(spi) == FELSIM_FLASH_SIZE);
+
+	test_start(dev);
+	stats = spiflash_write(spi, offset, data, size, NULL);
+	test_report(dev, name);
+	expect(memcmp(flash + offset, data, size) == 0);
+	expect(stats.erased == 0);
+	expect(flash[offset - 1] == 0xFF && flash[offset + size] == 0xFF);
+
+	spiflash_read(spi, offset, buf, size, NULL);
+	expect(memcmp(buf, data, size) == 0);
+
+	/* a blank range doesn't need erasing, the start of the flash does */
+	stats = spiflash_erase(spi, 0x20000, 0x10000, NULL);
+	expect(stats.units > 0 && stats.erased == 0);
+	stats = spiflash_erase(spi, 0, 0x4000, NULL);
+	expect(stats.erased > 0);
+	expect(flash[offset] == 0xFF && flash[0x3FFF] == 0xFF);
+	expect(memcmp(flash + 0x4000, data + 0x4000 - offset, 0x1000) == 0);
+
+	expect(felsim_get_flash_stats(dev).errors == 0);
+	spiflash_close(spi);
+	free(buf);
+	free(data);
+}
+
+int main(void)
+{
+	feldev_handle *dev = felsim_open(0x1651); /* A20 */
+
+	test_fill(dev);
+	test_scatter(dev);
+	test_memsearch(dev);
+	test_mmu_tt(dev);
+	test_timed_call(dev);
+	test_cache_clean(dev);
+	test_dump_compress(dev);
+	test_dump_decompress();
+	test_readl_writel(dev);
+	test_memmove(dev);
+	test_tuning(dev);
+	test_extent_batches(dev, 0);
+	test_extent_batches(dev, soc_scratch_limit(dev->soc_info));
+	test_spiflash(dev, "spiflash (sun4i)");
+	felsim_close(dev);
+
+	dev = felsim_open(0x1680); /* H3 */
+	test_spiflash(dev, "spiflash (sun6i)");
+	felsim_close(dev);
+
+	if (failures) {
+		printf("%d thunk test(s) FAILED\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("All thunk tests passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+	/* <fel_cache_clean>: */
+	0xe92d0ff0, /*        0:    push       {r4, r5, r6, r7, r8, r9, r10, r11} */
+	0xe59f80b8, /*        4:    ldr        r8, [pc, #184]               */
+	0xe3180001, /*        8:    tst        r8, #1                       */
+	0x1e110f10, /*        c:    mrcne      p15, #0, r0, c1, c0, #0      */
+	0x13c00004, /*       10:    bicne      r0, r0, #4                   */
+	0x1e010f10, /*       14:    mcrne      p15, #0, r0, c1, c0, #0      */
+	0xf57ff06f, /*       18:    isb        sy                           */
+	0xee300f30, /*       1c:    mrc        p15, #1, r0, c0, c0, #1      */
+	0xe2103407, /*       20:    ands       r3, r0, #117440512           */
+	0xe1a03ba3, /*       24:    lsr        r3, r3, #23                  */
+	0x0a00001c, /*       28:    beq        a0 <done>                    */
+	0xe3a0a000, /*       2c:    mov        r10, #0                      */
+	/* <level>: */
+	0xe08a20aa, /*       30:    add        r2, r10, r10, lsr #1         */
+	0xe1a01230, /*       34:    lsr        r1, r0, r2                   */
+	0xe2011007, /*       38:    and        r1, r1, #7                   */
+	0xe3510002, /*       3c:    cmp        r1, #2                       */
+	0xba000013, /*       40:    blt        94 <next_level>              */
+	0xee40af10, /*       44:    mcr        p15, #2, r10, c0, c0, #0     */
+	0xf57ff06f, /*       48:    isb        sy                           */
+	0xee301f10, /*       4c:    mrc        p15, #1, r1, c0, c0, #0      */
+	0xe2012007, /*       50:    and        r2, r1, #7                   */
+	0xe2822004, /*       54:    add        r2, r2, #4                   */
+	0xe30043ff, /*       58:    movw       r4, #1023                    */
+	0xe01441a1, /*       5c:    ands       r4, r4, r1, lsr #3           */
+	0xe16f5f14, /*       60:    clz        r5, r4                       */
+	0xe3077fff, /*       64:    movw       r7, #32767                   */
+	0xe01776a1, /*       68:    ands       r7, r7, r1, lsr #13          */
+	/* <set>: */
+	0xe1a09004, /*       6c:    mov        r9, r4                       */
+	/* <way>: */
+	0xe18ab519, /*       70:    orr        r11, r10, r9, lsl r5         */
+	0xe18bb217, /*       74:    orr        r11, r11, r7, lsl r2         */
+	0xe3180002, /*       78:    tst        r8, #2                       */
+	0x0e07bf5e, /*       7c:    mcreq      p15, #0, r11, c7, c14, #2    */
+	0x1e07bf56, /*       80:    mcrne      p15, #0, r11, c7, c6, #2     */
+	0xe2599001, /*       84:    subs       r9, r9, #1                   */
+	0xaafffff8, /*       88:    bge        70 <way>                     */
+	0xe2577001, /*       8c:    subs       r7, r7, #1                   */
+	0xaafffff5, /*       90:    bge        6c <set>                     */
+	/* <next_level>: */
+	0xe28aa002, /*       94:    add        r10, r10, #2                 */
+	0xe153000a, /*       98:    cmp        r3, r10                      */
+	0xcaffffe3, /*       9c:    bgt        30 <level>                   */
+	/* <done>: */
+	0xe3a00000, /*       a0:    mov        r0, #0                       */
+	0xee400f10, /*       a4:    mcr        p15, #2, r0, c0, c0, #0      */
+	0xf57ff04f, /*       a8:    dsb        sy                           */
+	0xee070f15, /*       ac:    mcr        p15, #0, r0, c7, c5, #0      */
+	0xee070fd5, /*       b0:    mcr        p15, #0, r0, c7, c5, #6      */
+	0xf57ff04f, /*       b4:    dsb        sy                           */
+	0xf57ff06f, /*       b8:    isb        sy                           */
+	0xe8bd0ff0, /*       bc:    pop        {r4, r5, r6, r7, r8, r9, r10, r11} */
+	0xe12fff1e, /*       c0:    bx         lr                           */
@@ -0,0 +1,123 @@
+	/* <fel_dump_compress>: */
+	0xe92d4ff0, /*        0:    push       {r4, r5, r6, r7, r8, r9, r10, r11, lr} */
+	0xe28fce1b, /*        4:    add        r12, pc, #432                */
+	0xe89c003f, /*        8:    ldm        r12, {r0, r1, r2, r3, r4, r5} */
+	0xe1a06000, /*        c:    mov        r6, r0                       */
+	0xe2659020, /*       10:    rsb        r9, r5, #32                  */
+	0xe3a0a001, /*       14:    mov        r10, #1                      */
+	0xe1a0a91a, /*       18:    lsl        r10, r10, r9                 */
+	0xe3a09000, /*       1c:    mov        r9, #0                       */
+	0xe1a0b004, /*       20:    mov        r11, r4                      */
+	/* <clear_hash>: */
+	0xe48b9004, /*       24:    str        r9, [r11], #4                */
+	0xe25aa001, /*       28:    subs       r10, r10, #1                 */
+	0x1afffffc, /*       2c:    bne        24 <clear_hash>              */
+	0xe3a0e49e, /*       30:    mov        lr, #-1644167168             */
+	0xe38ee837, /*       34:    orr        lr, lr, #3604480             */
+	0xe38eec77, /*       38:    orr        lr, lr, #30464               */
+	0xe38ee0b1, /*       3c:    orr        lr, lr, #177                 */
+	/* <chunk_next>: */
+	0xe1500001, /*       40:    cmp        r0, r1                       */
+	0x2a000058, /*       44:    bhs        1ac <compress_done>          */
+	0xe0439002, /*       48:    sub        r9, r3, r2                   */
+	0xe3a0cb05, /*       4c:    mov        r12, #5120                   */
+	0xe28cc010, /*       50:    add        r12, r12, #16                */
+	0xe159000c, /*       54:    cmp        r9, r12                      */
+	0x3a000053, /*       58:    blo        1ac <compress_done>          */
+	0xe2808a01, /*       5c:    add        r8, r0, #4096                */
+	0xe1580001, /*       60:    cmp        r8, r1                       */
+	0x81a08001, /*       64:    movhi      r8, r1                       */
+	0xe1a07000, /*       68:    mov        r7, r0                       */
+	/* <scan>: */
+	0xe1500008, /*       6c:    cmp        r0, r8                       */
+	0x2a000044, /*       70:    bhs        188 <chunk_done>             */
+	0xe5909000, /*       74:    ldr        r9, [r0]                     */
+	0xe1a0a000, /*       78:    mov        r10, r0                      */
+	/* <count_run>: */
+	0xe28aa004, /*       7c:    add        r10, r10, #4                 */
+	0xe15a0008, /*       80:    cmp        r10, r8                      */
+	0x2a000002, /*       84:    bhs        94 <count_run_done>          */
+	0xe59ab000, /*       88:    ldr        r11, [r10]                   */
+	0xe15b0009, /*       8c:    cmp        r11, r9                      */
+	0x0afffff9, /*       90:    beq        7c <count_run>               */
+	/* <count_run_done>: */
+	0xe04ab000, /*       94:    sub        r11, r10, r0                 */
+	0xe35b0010, /*       98:    cmp        r11, #16                     */
+	0x3a00000f, /*       9c:    blo        e0 <try_match>               */
+	0xe050b007, /*       a0:    subs       r11, r0, r7                  */
+	0x0a000005, /*       a4:    beq        c0 <count_run_done+0x2c>     */
+	0xe1a0c12b, /*       a8:    lsr        r12, r11, #2                 */
+	0xe482c004, /*       ac:    str        r12, [r2], #4                */
+	0xe497c004, /*       b0:    ldr        r12, [r7], #4                */
+	0xe482c004, /*       b4:    str        r12, [r2], #4                */
+	0xe1570000, /*       b8:    cmp        r7, r0                       */
+	0x3afffffb, /*       bc:    blo        b0 <count_run_done+0x1c>     */
+	0xe04ab000, /*       c0:    sub        r11, r10, r0                 */
+	0xe1a0b12b, /*       c4:    lsr        r11, r11, #2                 */
+	0xe38bb101, /*       c8:    orr        r11, r11, #1073741824        */
+	0xe482b004, /*       cc:    str        r11, [r2], #4                */
+	0xe4829004, /*       d0:    str        r9, [r2], #4                 */
+	0xe1a0000a, /*       d4:    mov        r0, r10                      */
+	0xe1a0700a, /*       d8:    mov        r7, r10                      */
+	0xeaffffe2, /*       dc:    b          6c <scan>                    */
+	/* <try_match>: */
+	0xe00a0e99, /*       e0:    mul        r10, r9, lr                  */
+	0xe1a0a53a, /*       e4:    lsr        r10, r10, r5                 */
+	0xe794b10a, /*       e8:    ldr        r11, [r4, r10, lsl #2]       */
+	0xe784010a, /*       ec:    str        r0, [r4, r10, lsl #2]        */
+	0xe15b0006, /*       f0:    cmp        r11, r6                      */
+	0x3a000021, /*       f4:    blo        180 <literal>                */
+	0xe15b0000, /*       f8:    cmp        r11, r0                      */
+	0x2a00001f, /*       fc:    bhs        180 <literal>                */
+	0xe31b0003, /*      100:    tst        r11, #3                      */
+	0x1a00001d, /*      104:    bne        180 <literal>                */
+	0xe1a0a000, /*      108:    mov        r10, r0                      */
+	/* <count_match>: */
+	0xe59ac000, /*      10c:    ldr        r12, [r10]                   */
+	0xe59b9000, /*      110:    ldr        r9, [r11]                    */
+	0xe15c0009, /*      114:    cmp        r12, r9                      */
+	0x1a000003, /*      118:    bne        12c <count_match_done>       */
+	0xe28aa004, /*      11c:    add        r10, r10, #4                 */
+	0xe28bb004, /*      120:    add        r11, r11, #4                 */
+	0xe15a0008, /*      124:    cmp        r10, r8                      */
+	0x3afffff7, /*      128:    blo        10c <count_match>            */
+	/* <count_match_done>: */
+	0xe04ac000, /*      12c:    sub        r12, r10, r0                 */
+	0xe35c0010, /*      130:    cmp        r12, #16                     */
+	0x3a000011, /*      134:    blo        180 <literal>                */
+	0xe04a900b, /*      138:    sub        r9, r10, r11                 */
+	0xe1a09129, /*      13c:    lsr        r9, r9, #2                   */
+	0xe050b007, /*      140:    subs       r11, r0, r7                  */
+	0x0a000005, /*      144:    beq        160 <count_match_done+0x34>  */
+	0xe1a0c12b, /*      148:    lsr        r12, r11, #2                 */
+	0xe482c004, /*      14c:    str        r12, [r2], #4                */
+	0xe497c004, /*      150:    ldr        r12, [r7], #4                */
+	0xe482c004, /*      154:    str        r12, [r2], #4                */
+	0xe1570000, /*      158:    cmp        r7, r0                       */
+	0x3afffffb, /*      15c:    blo        150 <count_match_done+0x24>  */
+	0xe04ac000, /*      160:    sub        r12, r10, r0                 */
+	0xe1a0c12c, /*      164:    lsr        r12, r12, #2                 */
+	0xe38cc102, /*      168:    orr        r12, r12, #-2147483648       */
+	0xe482c004, /*      16c:    str        r12, [r2], #4                */
+	0xe4829004, /*      170:    str        r9, [r2], #4                 */
+	0xe1a0000a, /*      174:    mov        r0, r10                      */
+	0xe1a0700a, /*      178:    mov        r7, r10                      */
+	0xeaffffba, /*      17c:    b          6c <scan>                    */
+	/* <literal>: */
+	0xe2800004, /*      180:    add        r0, r0, #4                   */
+	0xeaffffb8, /*      184:    b          6c <scan>                    */
+	/* <chunk_done>: */
+	0xe050b007, /*      188:    subs       r11, r0, r7                  */
+	0x0a000005, /*      18c:    beq        1a8 <chunk_done+0x20>        */
+	0xe1a0c12b, /*      190:    lsr        r12, r11, #2                 */
+	0xe482c004, /*      194:    str        r12, [r2], #4                */
+	0xe497c004, /*      198:    ldr        r12, [r7], #4                */
+	0xe482c004, /*      19c:    str        r12, [r2], #4                */
+	0xe1570000, /*      1a0:    cmp        r7, r0                       */
+	0x3afffffb, /*      1a4:    blo        198 <chunk_done+0x10>        */
+	0xeaffffa4, /*      1a8:    b          40 <chunk_next>              */
+	/* <compress_done>: */
+	0xe28fc008, /*      1ac:    add        r12, pc, #8                  */
+	0xe58c0000, /*      1b0:    str        r0, [r12]                    */
+	0xe58c2008, /*      1b4:    str        r2, [r12, #8]                */
+	0xe8bd8ff0, /*      1b8:    pop        {r4, r5, r6, r7, r8, r9, r10, r11, pc} */
@@ -0,0 +1,26 @@
+	/* <fel_fill_extents>: */
+	0xe92d0070, /*        0:    push       {r4, r5, r6}                 */
+	0xe28f0044, /*        4:    add        r0, pc, #68                  */
+	/* <fill_next>: */
+	0xe8b0000e, /*        8:    ldm        r0!, {r1, r2, r3}            */
+	0xe3520000, /*        c:    cmp        r2, #0                       */
+	0x0a00000c, /*       10:    beq        48 <fill_done>               */
+	0xe1a04003, /*       14:    mov        r4, r3                       */
+	0xe1a05003, /*       18:    mov        r5, r3                       */
+	0xe1a06003, /*       1c:    mov        r6, r3                       */
+	0xe2522010, /*       20:    subs       r2, r2, #16                  */
+	0x3a000002, /*       24:    blo        34 <fill_tail>               */
+	/* <fill_loop>: */
+	0xe8a10078, /*       28:    stm        r1!, {r3, r4, r5, r6}        */
+	0xe2522010, /*       2c:    subs       r2, r2, #16                  */
+	0x2afffffc, /*       30:    bhs        28 <fill_loop>               */
+	/* <fill_tail>: */
+	0xe2922010, /*       34:    adds       r2, r2, #16                  */
+	/* <fill_word>: */
+	0xe2522004, /*       38:    subs       r2, r2, #4                   */
+	0x24813004, /*       3c:    strhs      r3, [r1], #4                 */
+	0x8afffffc, /*       40:    bhi        38 <fill_word>               */
+	0xeaffffef, /*       44:    b          8 <fill_next>                */
+	/* <fill_done>: */
+	0xe8bd0070, /*       48:    pop        {r4, r5, r6}                 */
+	0xe12fff1e, /*       4c:    bx         lr                           */
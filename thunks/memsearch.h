@@ -0,0 +1,43 @@
+	/* <fel_memsearch>: */
+	0xe92d43f0, /*        0:    push       {r4, r5, r6, r7, r8, r9, lr} */
+	0xe28f008c, /*        4:    add        r0, pc, #140                 */
+	0xe5901000, /*        8:    ldr        r1, [r0]                     */
+	0xe5902004, /*        c:    ldr        r2, [r0, #4]                 */
+	0xe5908008, /*       10:    ldr        r8, [r0, #8]                 */
+	0xe0812002, /*       14:    add        r2, r1, r2                   */
+	0xe0422008, /*       18:    sub        r2, r2, r8                   */
+	0xe5d03030, /*       1c:    ldrb       r3, [r0, #48]                */
+	0xe5d0c010, /*       20:    ldrb       r12, [r0, #16]               */
+	0xe3a09000, /*       24:    mov        r9, #0                       */
+	/* <scan>: */
+	0xe1510002, /*       28:    cmp        r1, r2                       */
+	0x8a000016, /*       2c:    bhi        8c <done>                    */
+	0xe4d14001, /*       30:    ldrb       r4, [r1], #1                 */
+	0xe0044003, /*       34:    and        r4, r4, r3                   */
+	0xe154000c, /*       38:    cmp        r4, r12                      */
+	0x1afffff9, /*       3c:    bne        28 <scan>                    */
+	0xe2415001, /*       40:    sub        r5, r1, #1                   */
+	0xe3a06001, /*       44:    mov        r6, #1                       */
+	/* <compare>: */
+	0xe1560008, /*       48:    cmp        r6, r8                       */
+	0x2a000008, /*       4c:    bhs        74 <match>                   */
+	0xe7d54006, /*       50:    ldrb       r4, [r5, r6]                 */
+	0xe0807006, /*       54:    add        r7, r0, r6                   */
+	0xe5d7e030, /*       58:    ldrb       lr, [r7, #48]                */
+	0xe004400e, /*       5c:    and        r4, r4, lr                   */
+	0xe5d7e010, /*       60:    ldrb       lr, [r7, #16]                */
+	0xe154000e, /*       64:    cmp        r4, lr                       */
+	0x1affffee, /*       68:    bne        28 <scan>                    */
+	0xe2866001, /*       6c:    add        r6, r6, #1                   */
+	0xeafffff4, /*       70:    b          48 <compare>                 */
+	/* <match>: */
+	0xe2807058, /*       74:    add        r7, r0, #88                  */
+	0xe7875109, /*       78:    str        r5, [r7, r9, lsl #2]         */
+	0xe2899001, /*       7c:    add        r9, r9, #1                   */
+	0xe590700c, /*       80:    ldr        r7, [r0, #12]                */
+	0xe1590007, /*       84:    cmp        r9, r7                       */
+	0x3affffe6, /*       88:    blo        28 <scan>                    */
+	/* <done>: */
+	0xe5809050, /*       8c:    str        r9, [r0, #80]                */
+	0xe5801054, /*       90:    str        r1, [r0, #84]                */
+	0xe8bd83f0, /*       94:    pop        {r4, r5, r6, r7, r8, r9, pc} */
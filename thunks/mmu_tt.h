@@ -0,0 +1,56 @@
+	/* <fel_mmu_tt>: */
+	0xe92d00f0, /*        0:    push       {r4, r5, r6, r7}             */
+	0xe28f00b4, /*        4:    add        r0, pc, #180                 */
+	0xe8b0000e, /*        8:    ldm        r0!, {r1, r2, r3}            */
+	0xe3120001, /*        c:    tst        r2, #1                       */
+	0x0a000007, /*       10:    beq        34 <mmu_tt_check>            */
+	0xe3a04c0d, /*       14:    mov        r4, #3328                    */
+	0xe38440e2, /*       18:    orr        r4, r4, #226                 */
+	0xe3a05000, /*       1c:    mov        r5, #0                       */
+	/* <mmu_tt_generate>: */
+	0xe1846a05, /*       20:    orr        r6, r4, r5, lsl #20          */
+	0xe7816105, /*       24:    str        r6, [r1, r5, lsl #2]         */
+	0xe2855001, /*       28:    add        r5, r5, #1                   */
+	0xe3550a01, /*       2c:    cmp        r5, #4096                    */
+	0x1afffffa, /*       30:    bne        20 <mmu_tt_generate>         */
+	/* <mmu_tt_check>: */
+	0xe3120002, /*       34:    tst        r2, #2                       */
+	0x0a00000c, /*       38:    beq        70 <mmu_tt_patch>            */
+	0xe3a05000, /*       3c:    mov        r5, #0                       */
+	/* <mmu_tt_check_entry>: */
+	0xe7916105, /*       40:    ldr        r6, [r1, r5, lsl #2]         */
+	0xe3a02001, /*       44:    mov        r2, #1                       */
+	0xe3160002, /*       48:    tst        r6, #2                       */
+	0x0a000016, /*       4c:    beq        ac <mmu_tt_result>           */
+	0xe3160701, /*       50:    tst        r6, #262144                  */
+	0x1a000014, /*       54:    bne        ac <mmu_tt_result>           */
+	0xe3a02002, /*       58:    mov        r2, #2                       */
+	0xe1550a26, /*       5c:    cmp        r5, r6, lsr #20              */
+	0x1a000011, /*       60:    bne        ac <mmu_tt_result>           */
+	0xe2855001, /*       64:    add        r5, r5, #1                   */
+	0xe3550a01, /*       68:    cmp        r5, #4096                    */
+	0x1afffff3, /*       6c:    bne        40 <mmu_tt_check_entry>      */
+	/* <mmu_tt_patch>: */
+	0xe2533001, /*       70:    subs       r3, r3, #1                   */
+	0x4a00000a, /*       74:    bmi        a4 <mmu_tt_done>             */
+	0xe8b000f0, /*       78:    ldm        r0!, {r4, r5, r6, r7}        */
+	0xe3550000, /*       7c:    cmp        r5, #0                       */
+	0x0afffffa, /*       80:    beq        70 <mmu_tt_patch>            */
+	/* <mmu_tt_patch_entry>: */
+	0xe791c104, /*       84:    ldr        r12, [r1, r4, lsl #2]        */
+	0xe1ccc006, /*       88:    bic        r12, r12, r6                 */
+	0xe18cc007, /*       8c:    orr        r12, r12, r7                 */
+	0xe781c104, /*       90:    str        r12, [r1, r4, lsl #2]        */
+	0xe2844001, /*       94:    add        r4, r4, #1                   */
+	0xe2555001, /*       98:    subs       r5, r5, #1                   */
+	0x1afffff8, /*       9c:    bne        84 <mmu_tt_patch_entry>      */
+	0xeafffff2, /*       a0:    b          70 <mmu_tt_patch>            */
+	/* <mmu_tt_done>: */
+	0xe3a02000, /*       a4:    mov        r2, #0                       */
+	0xe3a05000, /*       a8:    mov        r5, #0                       */
+	/* <mmu_tt_result>: */
+	0xe28fc00c, /*       ac:    add        r12, pc, #12                 */
+	0xe58c2000, /*       b0:    str        r2, [r12]                    */
+	0xe58c5004, /*       b4:    str        r5, [r12, #4]                */
+	0xe8bd00f0, /*       b8:    pop        {r4, r5, r6, r7}             */
+	0xe12fff1e, /*       bc:    bx         lr                           */
@@ -0,0 +1,22 @@
+	/* <fel_scatter>: */
+	0xe28f0040, /*        0:    add        r0, pc, #64                  */
+	/* <scatter_next>: */
+	0xe8b0000e, /*        4:    ldm        r0!, {r1, r2, r3}            */
+	0xe3530000, /*        8:    cmp        r3, #0                       */
+	0x012fff1e, /*        c:    bxeq       lr                           */
+	0xe181c002, /*       10:    orr        r12, r1, r2                  */
+	0xe18cc003, /*       14:    orr        r12, r12, r3                 */
+	0xe31c0003, /*       18:    tst        r12, #3                      */
+	0x1a000004, /*       1c:    bne        34 <scatter_byte>            */
+	/* <scatter_word>: */
+	0xe491c004, /*       20:    ldr        r12, [r1], #4                */
+	0xe482c004, /*       24:    str        r12, [r2], #4                */
+	0xe2533004, /*       28:    subs       r3, r3, #4                   */
+	0x1afffffb, /*       2c:    bne        20 <scatter_word>            */
+	0xeafffff3, /*       30:    b          4 <scatter_next>             */
+	/* <scatter_byte>: */
+	0xe4d1c001, /*       34:    ldrb       r12, [r1], #1                */
+	0xe4c2c001, /*       38:    strb       r12, [r2], #1                */
+	0xe2533001, /*       3c:    subs       r3, r3, #1                   */
+	0x1afffffb, /*       40:    bne        34 <scatter_byte>            */
+	0xeaffffee, /*       44:    b          4 <scatter_next>             */
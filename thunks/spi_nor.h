@@ -0,0 +1,107 @@
+	/* <fel_spi_nor>: */
+	0xe92d4ff0, /*        0:    push       {r4, r5, r6, r7, r8, r9, r10, r11, lr} */
+	0xe28fae17, /*        4:    add        r10, pc, #368                */
+	0xe59a0020, /*        8:    ldr        r0, [r10, #32]               */
+	0xe3a0b001, /*        c:    mov        r11, #1                      */
+	0xe3a0c000, /*       10:    mov        r12, #0                      */
+	0xe58ac02c, /*       14:    str        r12, [r10, #44]              */
+	/* <spi_next_cmd>: */
+	0xe8b0000e, /*       18:    ldm        r0!, {r1, r2, r3}            */
+	0xe211c0ff, /*       1c:    ands       r12, r1, #255                */
+	0x0a000052, /*       20:    beq        170 <spi_done>               */
+	0xe3110c01, /*       24:    tst        r1, #256                     */
+	0x0a000001, /*       28:    beq        34 <spi_run>                 */
+	0xe35b0000, /*       2c:    cmp        r11, #0                      */
+	0x0a000047, /*       30:    beq        154 <spi_cmd_done>           */
+	/* <spi_run>: */
+	0xe1a04000, /*       34:    mov        r4, r0                       */
+	0xe0825003, /*       38:    add        r5, r2, r3                   */
+	0xe59a9024, /*       3c:    ldr        r9, [r10, #36]               */
+	/* <spi_xfer>: */
+	0xe59ac014, /*       40:    ldr        r12, [r10, #20]              */
+	0xe58c5000, /*       44:    str        r5, [r12]                    */
+	0xe59ac018, /*       48:    ldr        r12, [r10, #24]              */
+	0xe58c5000, /*       4c:    str        r5, [r12]                    */
+	0xe59ac01c, /*       50:    ldr        r12, [r10, #28]              */
+	0xe35c0000, /*       54:    cmp        r12, #0                      */
+	0x158c5000, /*       58:    strne      r5, [r12]                    */
+	0xe59ac00c, /*       5c:    ldr        r12, [r10, #12]              */
+	0xe59ce000, /*       60:    ldr        lr, [r12]                    */
+	0xe59a6010, /*       64:    ldr        r6, [r10, #16]               */
+	0xe18ee006, /*       68:    orr        lr, lr, r6                   */
+	0xe58ce000, /*       6c:    str        lr, [r12]                    */
+	0xe3a06000, /*       70:    mov        r6, #0                       */
+	0xe3a07000, /*       74:    mov        r7, #0                       */
+	0xe3a08000, /*       78:    mov        r8, #0                       */
+	/* <spi_loop>: */
+	0xe1560005, /*       7c:    cmp        r6, r5                       */
+	0x2a000008, /*       80:    bhs        a8 <spi_rx>                  */
+	0xe046c007, /*       84:    sub        r12, r6, r7                  */
+	0xe35c0040, /*       88:    cmp        r12, #64                     */
+	0x2a000005, /*       8c:    bhs        a8 <spi_rx>                  */
+	0xe1560002, /*       90:    cmp        r6, r2                       */
+	0x37d4c006, /*       94:    ldrblo     r12, [r4, r6]                */
+	0x23a0c0ff, /*       98:    movhs      r12, #255                    */
+	0xe59ae000, /*       9c:    ldr        lr, [r10]                    */
+	0xe5cec000, /*       a0:    strb       r12, [lr]                    */
+	0xe2866001, /*       a4:    add        r6, r6, #1                   */
+	/* <spi_rx>: */
+	0xe59ae008, /*       a8:    ldr        lr, [r10, #8]                */
+	0xe59ee000, /*       ac:    ldr        lr, [lr]                     */
+	0xe31e00ff, /*       b0:    tst        lr, #255                     */
+	0x0afffff0, /*       b4:    beq        7c <spi_loop>                */
+	0xe59ae004, /*       b8:    ldr        lr, [r10, #4]                */
+	0xe5dee000, /*       bc:    ldrb       lr, [lr]                     */
+	0xe1570002, /*       c0:    cmp        r7, r2                       */
+	0x3a000007, /*       c4:    blo        e8 <spi_rx_next>             */
+	0xe201c0ff, /*       c8:    and        r12, r1, #255                */
+	0xe35c0002, /*       cc:    cmp        r12, #2                      */
+	0x07c4e007, /*       d0:    strbeq     lr, [r4, r7]                 */
+	0xe35c0003, /*       d4:    cmp        r12, #3                      */
+	0x01a0800e, /*       d8:    moveq      r8, lr                       */
+	0xe35c0004, /*       dc:    cmp        r12, #4                      */
+	0x022ee0ff, /*       e0:    eoreq      lr, lr, #255                 */
+	0x0188800e, /*       e4:    orreq      r8, r8, lr                   */
+	/* <spi_rx_next>: */
+	0xe2877001, /*       e8:    add        r7, r7, #1                   */
+	0xe1570005, /*       ec:    cmp        r7, r5                       */
+	0x3affffe1, /*       f0:    blo        7c <spi_loop>                */
+	0xe59ac00c, /*       f4:    ldr        r12, [r10, #12]              */
+	0xe59a6010, /*       f8:    ldr        r6, [r10, #16]               */
+	/* <spi_wait>: */
+	0xe59ce000, /*       fc:    ldr        lr, [r12]                    */
+	0xe11e0006, /*      100:    tst        lr, r6                       */
+	0x1afffffc, /*      104:    bne        fc <spi_wait>                */
+	0xe201c0ff, /*      108:    and        r12, r1, #255                */
+	0xe35c0003, /*      10c:    cmp        r12, #3                      */
+	0x1a000006, /*      110:    bne        130 <spi_check_blank>        */
+	0xe008c821, /*      114:    and        r12, r8, r1, lsr #16         */
+	0xe31c00ff, /*      118:    tst        r12, #255                    */
+	0x0a00000c, /*      11c:    beq        154 <spi_cmd_done>           */
+	0xe2599001, /*      120:    subs       r9, r9, #1                   */
+	0x1affffc5, /*      124:    bne        40 <spi_xfer>                */
+	0xe3a0c001, /*      128:    mov        r12, #1                      */
+	0xea000010, /*      12c:    b          174 <spi_status>             */
+	/* <spi_check_blank>: */
+	0xe35c0004, /*      130:    cmp        r12, #4                      */
+	0x1a000006, /*      134:    bne        154 <spi_cmd_done>           */
+	0xe3580000, /*      138:    cmp        r8, #0                       */
+	0x13a0b001, /*      13c:    movne      r11, #1                      */
+	0x1a000003, /*      140:    bne        154 <spi_cmd_done>           */
+	0xe3a0b000, /*      144:    mov        r11, #0                      */
+	0xe59ac02c, /*      148:    ldr        r12, [r10, #44]              */
+	0xe28cc001, /*      14c:    add        r12, r12, #1                 */
+	0xe58ac02c, /*      150:    str        r12, [r10, #44]              */
+	/* <spi_cmd_done>: */
+	0xe0800002, /*      154:    add        r0, r0, r2                   */
+	0xe201c0ff, /*      158:    and        r12, r1, #255                */
+	0xe35c0002, /*      15c:    cmp        r12, #2                      */
+	0x00800003, /*      160:    addeq      r0, r0, r3                   */
+	0xe2800003, /*      164:    add        r0, r0, #3                   */
+	0xe3c00003, /*      168:    bic        r0, r0, #3                   */
+	0xeaffffa9, /*      16c:    b          18 <spi_next_cmd>            */
+	/* <spi_done>: */
+	0xe3a0c000, /*      170:    mov        r12, #0                      */
+	/* <spi_status>: */
+	0xe58ac028, /*      174:    str        r12, [r10, #40]              */
+	0xe8bd8ff0, /*      178:    pop        {r4, r5, r6, r7, r8, r9, r10, r11, pc} */
@@ -0,0 +1,37 @@
+	/* <fel_timed_call>: */
+	0xe92d41f0, /*        0:    push       {r4, r5, r6, r7, r8, lr}     */
+	0xe28f8084, /*        4:    add        r8, pc, #132                 */
+	0xee100f31, /*        8:    mrc        p15, #0, r0, c0, c1, #1      */
+	0xe210780f, /*        c:    ands       r7, r0, #983040              */
+	0xee190f1c, /*       10:    mrc        p15, #0, r0, c9, c12, #0     */
+	0xe3c00008, /*       14:    bic        r0, r0, #8                   */
+	0xe3800005, /*       18:    orr        r0, r0, #5                   */
+	0xee090f1c, /*       1c:    mcr        p15, #0, r0, c9, c12, #0     */
+	0xe3a00102, /*       20:    mov        r0, #-2147483648             */
+	0xee090f3c, /*       24:    mcr        p15, #0, r0, c9, c12, #1     */
+	0xee090f7c, /*       28:    mcr        p15, #0, r0, c9, c12, #3     */
+	0xf57ff06f, /*       2c:    isb        sy                           */
+	0xe1b07007, /*       30:    movs       r7, r7                       */
+	0x1c554f0e, /*       34:    mrrcne     p15, #0, r4, r5, c14         */
+	0xee196f1d, /*       38:    mrc        p15, #0, r6, c9, c13, #0     */
+	0xe5980000, /*       3c:    ldr        r0, [r8]                     */
+	0xe12fff30, /*       40:    blx        r0                           */
+	0xee190f1d, /*       44:    mrc        p15, #0, r0, c9, c13, #0     */
+	0xe1b07007, /*       48:    movs       r7, r7                       */
+	0x1c521f0e, /*       4c:    mrrcne     p15, #0, r1, r2, c14         */
+	0x1e1e3f10, /*       50:    mrcne      p15, #0, r3, c14, c0, #0     */
+	0x01a01004, /*       54:    moveq      r1, r4                       */
+	0x01a02005, /*       58:    moveq      r2, r5                       */
+	0x03a03000, /*       5c:    moveq      r3, #0                       */
+	0xe0400006, /*       60:    sub        r0, r0, r6                   */
+	0xe0511004, /*       64:    subs       r1, r1, r4                   */
+	0xe0c22005, /*       68:    sbc        r2, r2, r5                   */
+	0xe5880004, /*       6c:    str        r0, [r8, #4]                 */
+	0xe588100c, /*       70:    str        r1, [r8, #12]                */
+	0xe5882010, /*       74:    str        r2, [r8, #16]                */
+	0xe5883014, /*       78:    str        r3, [r8, #20]                */
+	0xe5887018, /*       7c:    str        r7, [r8, #24]                */
+	0xee190f7c, /*       80:    mrc        p15, #0, r0, c9, c12, #3     */
+	0xe2000102, /*       84:    and        r0, r0, #-2147483648         */
+	0xe5880008, /*       88:    str        r0, [r8, #8]                 */
+	0xe8bd81f0, /*       8c:    pop        {r4, r5, r6, r7, r8, pc}     */